@@ -0,0 +1,369 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <thread>
+#include <vector>
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "FramePipeline.h"
+#include "Frustum.h"
+#include "GLSLProgram.h"
+#include "LodSelector.h"
+#include "ObjectStore.h"
+#include "RenderQueue.h"
+#include "Scene.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+
+namespace {
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// Number of uniforms set per simulated frame in each variant below.
+const int UNIFORMS_PER_FRAME = 7;
+
+// The uniforms of the original single-light cube shader. Every one of them feeds the output so
+// that none is optimized away.
+const char* UNIFORM_BENCHMARK_VERTEX_SHADER =
+        "#version 330 core\n"
+        "layout (location = 0) in vec3 aPos;\n"
+        "uniform mat4 model;\n"
+        "uniform mat4 view;\n"
+        "uniform mat4 projection;\n"
+        "void main() { gl_Position = projection * view * model * vec4(aPos, 1.0); }\n";
+
+const char* UNIFORM_BENCHMARK_FRAGMENT_SHADER =
+        "#version 330 core\n"
+        "out vec4 FragColor;\n"
+        "uniform vec3 objectColor;\n"
+        "uniform vec3 lightColor;\n"
+        "uniform vec3 lightPos;\n"
+        "uniform vec3 viewPos;\n"
+        "void main() { FragColor = vec4(objectColor * lightColor + lightPos - viewPos, 1.0); }\n";
+
+// Passes over the objects in each culling benchmark variant; the fastest one is reported.
+const int CULLING_PASSES = 20;
+
+// Frames prepared before the pipeline benchmark starts timing, and frames timed.
+const int PIPELINE_WARMUP_FRAMES = 10;
+const int PIPELINE_FRAMES = 100;
+
+// An object as the scalar reference sees it: the glm inputs, one struct per object.
+struct ReferenceObject
+{
+    glm::vec3 position;
+    glm::vec3 axis;
+    float angle;
+    glm::vec3 scale;
+    float radius;   // world space
+};
+
+// Runs pass CULLING_PASSES times and returns the fastest, in milliseconds.
+template <typename F>
+double FastestPass(F pass)
+{
+    double fastest = 0.0;
+    for (int i = 0; i < CULLING_PASSES; ++i) {
+        Clock::time_point start = Clock::now();
+        pass();
+        double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        fastest = (i == 0 || milliseconds < fastest) ? milliseconds : fastest;
+    }
+    return fastest;
+}
+
+void ReportCullingTiming(const char* label, double milliseconds, size_t objects, double referenceMilliseconds)
+{
+    std::cout << std::left << std::setw(28) << label
+              << std::right << std::setw(10) << std::fixed << std::setprecision(3) << milliseconds << " ms  "
+              << std::setw(8) << std::setprecision(2) << objects / milliseconds / 1e6 << " M/ms  "
+              << std::setw(6) << std::setprecision(1) << referenceMilliseconds / milliseconds << "x" << std::endl;
+}
+
+void ReportUniformTiming(const char* label, Clock::duration elapsed, int frames)
+{
+    double nanoseconds = std::chrono::duration<double, std::nano>(elapsed).count();
+    std::cout << std::left << std::setw(24) << label
+              << std::right << std::setw(10) << std::fixed << std::setprecision(1)
+              << nanoseconds / (double(frames) * UNIFORMS_PER_FRAME) << " ns/uniform  "
+              << std::setw(10) << nanoseconds / double(frames) / 1000.0 << " us/frame" << std::endl;
+}
+
+}
+
+void RunUniformBenchmark(int frames)
+{
+    GLSLProgram program;
+    program.AddShader(GL_VERTEX_SHADER, UNIFORM_BENCHMARK_VERTEX_SHADER);
+    program.AddShader(GL_FRAGMENT_SHADER, UNIFORM_BENCHMARK_FRAGMENT_SHADER);
+    program.CreateAndLinkProgram();
+
+    const GLuint handle = program.GetProgramHandle();
+    const glm::vec3 objectColor(1.0f, 0.5f, 0.31f);
+    const glm::vec3 lightColor(1.0f, 1.0f, 1.0f);
+    const glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
+    const glm::vec3 viewPos(0.0f, 0.0f, 6.0f);
+    const glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+    const glm::mat4 view = glm::lookAt(viewPos, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    program.UseProgram();
+
+    std::cout << "Uniform upload benchmark, " << frames << " frames x " << UNIFORMS_PER_FRAME << " uniforms on "
+              << glGetString(GL_RENDERER) << std::endl;
+
+    // Driver lookup on every call.
+    glFinish();
+    Clock::time_point start = Clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        glm::mat4 model = glm::translate(glm::mat4(), glm::vec3(0.0f, 0.0f, frame * 1e-6f));
+        glUniform3fv(glGetUniformLocation(handle, "objectColor"), 1, &objectColor[0]);
+        glUniform3fv(glGetUniformLocation(handle, "lightColor"), 1, &lightColor[0]);
+        glUniform3fv(glGetUniformLocation(handle, "lightPos"), 1, &lightPos[0]);
+        glUniform3fv(glGetUniformLocation(handle, "viewPos"), 1, &viewPos[0]);
+        glUniformMatrix4fv(glGetUniformLocation(handle, "projection"), 1, GL_FALSE, &projection[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(handle, "view"), 1, GL_FALSE, &view[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(handle, "model"), 1, GL_FALSE, &model[0][0]);
+    }
+    glFinish();
+    ReportUniformTiming("glGetUniformLocation", Clock::now() - start, frames);
+
+    // Name lookup through the reflected table. Like the handle setters below, this skips uploads of
+    // values that haven't changed since the last frame, so only the model matrix reaches the driver.
+    start = Clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        glm::mat4 model = glm::translate(glm::mat4(), glm::vec3(0.0f, 0.0f, frame * 1e-6f));
+        program.setVec3("objectColor", objectColor);
+        program.setVec3("lightColor", lightColor);
+        program.setVec3("lightPos", lightPos);
+        program.setVec3("viewPos", viewPos);
+        program.setMat4("projection", projection);
+        program.setMat4("view", view);
+        program.setMat4("model", model);
+    }
+    glFinish();
+    ReportUniformTiming("string setters", Clock::now() - start, frames);
+
+    // Handles resolved once up front.
+    UniformHandle<glm::vec3> objectColorUniform = program.GetUniformHandle<glm::vec3>("objectColor");
+    UniformHandle<glm::vec3> lightColorUniform = program.GetUniformHandle<glm::vec3>("lightColor");
+    UniformHandle<glm::vec3> lightPosUniform = program.GetUniformHandle<glm::vec3>("lightPos");
+    UniformHandle<glm::vec3> viewPosUniform = program.GetUniformHandle<glm::vec3>("viewPos");
+    UniformHandle<glm::mat4> projectionUniform = program.GetUniformHandle<glm::mat4>("projection");
+    UniformHandle<glm::mat4> viewUniform = program.GetUniformHandle<glm::mat4>("view");
+    UniformHandle<glm::mat4> modelUniform = program.GetUniformHandle<glm::mat4>("model");
+
+    start = Clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        glm::mat4 model = glm::translate(glm::mat4(), glm::vec3(0.0f, 0.0f, frame * 1e-6f));
+        program.setVec3(objectColorUniform, objectColor);
+        program.setVec3(lightColorUniform, lightColor);
+        program.setVec3(lightPosUniform, lightPos);
+        program.setVec3(viewPosUniform, viewPos);
+        program.setMat4(projectionUniform, projection);
+        program.setMat4(viewUniform, view);
+        program.setMat4(modelUniform, model);
+    }
+    glFinish();
+    ReportUniformTiming("handle setters", Clock::now() - start, frames);
+}
+
+void RunCullingBenchmark(size_t objects)
+{
+    // Objects scattered through a 200-unit box around a camera looking down -z, so that roughly
+    // a tenth of them are visible.
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 6.28318531f);
+    std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+
+    std::vector<ReferenceObject> referenceObjects(objects);
+    ObjectStore store;
+    store.Resize(objects);
+    for (size_t i = 0; i < objects; ++i) {
+        ReferenceObject& object = referenceObjects[i];
+        object.position = glm::vec3(position(random), position(random), position(random));
+        object.axis = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+        object.angle = angle(random);
+        object.scale = glm::vec3(scale(random), scale(random), scale(random));
+        object.radius = 0.866025404f * std::max(std::max(object.scale.x, object.scale.y), object.scale.z);
+
+        glm::vec3 axis = object.axis * std::sin(0.5f * object.angle);
+        store.SetObject(i, object.position, glm::vec4(axis.x, axis.y, axis.z, std::cos(0.5f * object.angle)),
+                        object.scale, 0.866025404f);
+    }
+
+    const glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 6.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::vec4 planes[FRUSTUM_PLANE_COUNT];
+    ExtractFrustumPlanes(projection * view, planes);
+
+    ThreadPool threadPool;
+    std::vector<glm::mat4> referenceModels(objects), models(objects);
+    std::vector<uint32_t> referenceVisible(objects), visible(objects);
+    size_t referenceCount = 0, count = 0;
+
+#if SIMD_AVX
+    const char* width = "AVX, 8";
+#elif SIMD_SSE
+    const char* width = "SSE, 4";
+#elif SIMD_NEON
+    const char* width = "NEON, 4";
+#else
+    const char* width = "no SIMD, 4";
+#endif
+    std::cout << "Culling benchmark, " << objects << " objects, best of " << CULLING_PASSES << " passes, "
+              << width << " spheres per iteration, " << threadPool.ThreadCount() + 1 << " threads" << std::endl;
+
+    double referenceMilliseconds = FastestPass([&]() {
+        for (size_t i = 0; i < objects; ++i) {
+            const ReferenceObject& object = referenceObjects[i];
+            glm::mat4 model = glm::translate(glm::mat4(), object.position);
+            model = glm::rotate(model, object.angle, object.axis);
+            referenceModels[i] = glm::scale(model, object.scale);
+        }
+    });
+    ReportCullingTiming("models: glm reference", referenceMilliseconds, objects, referenceMilliseconds);
+    ReportCullingTiming("models: batch", FastestPass([&]() { store.BuildModelMatrices(&models[0], 0, objects); }),
+                        objects, referenceMilliseconds);
+    ReportCullingTiming("models: batch, threaded", FastestPass([&]() { store.BuildModelMatrices(threadPool, &models[0]); }),
+                        objects, referenceMilliseconds);
+
+    float maxError = 0.0f;
+    for (size_t i = 0; i < objects; ++i) {
+        for (int column = 0; column < 4; ++column) {
+            for (int row = 0; row < 4; ++row) {
+                maxError = std::max(maxError, std::abs(models[i][column][row] - referenceModels[i][column][row]));
+            }
+        }
+    }
+
+    referenceMilliseconds = FastestPass([&]() {
+        referenceCount = 0;
+        for (size_t i = 0; i < objects; ++i) {
+            if (IsSphereInFrustum(planes, referenceObjects[i].position, referenceObjects[i].radius)) {
+                referenceVisible[referenceCount++] = static_cast<uint32_t>(i);
+            }
+        }
+    });
+    ReportCullingTiming("spheres: glm reference", referenceMilliseconds, objects, referenceMilliseconds);
+    ReportCullingTiming("spheres: batch", FastestPass([&]() { count = store.CullSpheres(planes, &visible[0], 0, objects); }),
+                        objects, referenceMilliseconds);
+    bool matches = count == referenceCount && std::equal(visible.begin(), visible.begin() + count, referenceVisible.begin());
+    ReportCullingTiming("spheres: batch, threaded", FastestPass([&]() { count = store.CullSpheres(threadPool, planes, &visible[0]); }),
+                        objects, referenceMilliseconds);
+    matches = matches && count == referenceCount && std::equal(visible.begin(), visible.begin() + count, referenceVisible.begin());
+
+    std::cout << "Largest model matrix difference from glm: " << std::scientific << maxError << "; " << referenceCount << " visible, "
+              << (matches ? "same" : "DIFFERENT") << " visible list as the reference" << std::endl;
+}
+
+void RunFramePipelineBenchmark(size_t objects, unsigned int maxThreads)
+{
+    if (maxThreads == 0) {
+        maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<unsigned int> threadCounts;
+    for (unsigned int threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    // A chain like the simplifier's: half the triangles and twice the error at every level.
+    std::vector<MeshLod> lods;
+    for (uint32_t lod = 0, indexCount = 3 * 65536, firstIndex = 0; lod < MESH_MAX_LODS; ++lod, indexCount /= 2) {
+        lods.push_back({ firstIndex, indexCount, 0.002f * static_cast<float>(1 << lod) });
+        firstIndex += indexCount;
+    }
+
+    // The default camera looking into the grid, which is sunk behind the origin.
+    FramePipeline::Settings settings;
+    settings.deltaTime = 1.0f / 60.0f;
+    settings.cameraPosition = glm::vec3(0.0f, 0.0f, 6.0f);
+    settings.view = glm::lookAt(settings.cameraPosition, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    settings.projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+    settings.viewportHeight = 960;
+    settings.nearPlane = 0.1f;
+    settings.farPlane = 100.0f;
+    settings.cull = true;
+    settings.queue = true;
+
+    std::cout << "Frame pipeline benchmark, " << objects << " objects, " << lods.size() << " levels of detail, mean of "
+              << PIPELINE_FRAMES << " frames" << std::endl;
+    std::cout << "threads  frame ms  best ms  speedup  simulate  transforms    lod   cull  queue  steals" << std::endl;
+
+    double oneThreadMilliseconds = 0.0;
+    size_t firstVisible = 0, firstTriangles = 0, firstQueued = 0;
+    bool identical = true;
+    for (size_t i = 0; i < threadCounts.size(); ++i) {
+        // A fresh scene each time, so every thread count animates the same frames.
+        ThreadPool threadPool(threadCounts[i]);
+        Scene scene;
+        scene.CreateGrid(objects);
+        LodSelector lodSelector;
+        lodSelector.SetLods(lods);
+
+        GLSLProgram program;
+        RenderQueue queueA(objects), queueB(objects);
+        RenderQueue* queues[FramePipeline::FRAME_COUNT] = { &queueA, &queueB };
+        settings.meshes.clear();
+        for (RenderQueue* queue : queues) {
+            settings.program = queue->AddProgram(program, "objects");
+            settings.material = queue->AddMaterial(glm::vec4(1.0f));
+        }
+        for (const MeshLod& lod : lods) {
+            for (RenderQueue* queue : queues) {
+                queue->AddMesh({ 0, static_cast<GLsizei>(lod.indexCount), GL_UNSIGNED_INT, lod.firstIndex });
+            }
+            settings.meshes.push_back(static_cast<uint16_t>(settings.meshes.size()));
+        }
+
+        FramePipeline pipeline(threadPool, scene, lodSelector, queues);
+        for (int frame = 0; frame < PIPELINE_WARMUP_FRAMES; ++frame) {
+            pipeline.Prepare(settings);
+            pipeline.Wait();
+        }
+        pipeline.ResetStatistics();
+        const size_t stealsBefore = threadPool.Steals();
+        double bestMilliseconds = std::numeric_limits<double>::max();
+        const FramePipeline::Frame* frame = nullptr;
+        for (int j = 0; j < PIPELINE_FRAMES; ++j) {
+            pipeline.Prepare(settings);
+            frame = &pipeline.Wait();
+            bestMilliseconds = std::min(bestMilliseconds, pipeline.GetGraph().GetStatistics().milliseconds);
+        }
+
+        const FramePipeline::Statistics& statistics = pipeline.GetStatistics();
+        const double meanMilliseconds = statistics.prepareMilliseconds / statistics.frames;
+        if (i == 0) {
+            oneThreadMilliseconds = meanMilliseconds;
+            firstVisible = frame->visibleCount;
+            firstTriangles = frame->lodStatistics.triangles;
+            firstQueued = frame->queue->Size();
+        }
+        identical = identical && frame->visibleCount == firstVisible && frame->lodStatistics.triangles == firstTriangles &&
+                    frame->queue->Size() == firstQueued;
+
+        const std::vector<double>& tasks = statistics.taskMilliseconds;
+        std::printf("%7u  %8.2f  %7.2f  %6.2fx  %8.2f  %10.2f  %5.2f  %5.2f  %5.2f  %6.1f\n", threadCounts[i], meanMilliseconds,
+                    bestMilliseconds, oneThreadMilliseconds / meanMilliseconds, tasks[0] / statistics.frames,
+                    tasks[1] / statistics.frames, tasks[2] / statistics.frames, tasks[3] / statistics.frames,
+                    tasks[4] / statistics.frames, static_cast<double>(threadPool.Steals() - stealsBefore) / statistics.frames);
+    }
+    std::cout << firstVisible << " visible, " << firstQueued << " queued, " << firstTriangles << " triangles"
+              << (identical ? ", identical on every thread count" : ", DIFFERS between thread counts") << std::endl;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+
+// Micro-benchmarks that print their results to stdout. The GL ones run against the current GL
+// context; to measure on Mesa's software rasterizer, run with LIBGL_ALWAYS_SOFTWARE=1
+// GALLIUM_DRIVER=llvmpipe.
+
+// Compares three ways of uploading the uniforms the lighting shader used to set one at a time:
+// - name lookup through the driver with glGetUniformLocation (what the setters used to do),
+// - name lookup through the program's reflected uniform table,
+// - pre-resolved UniformHandles with no lookup at all.
+// Builds its own program with those uniforms, so it doesn't depend on the scene's shaders.
+void RunUniformBenchmark(int frames);
+
+// Compares the ObjectStore kernels with a scalar glm reference on objects with random transforms and
+// bounding spheres: building the model matrices (glm::translate/rotate/scale per object) and
+// testing the spheres against a camera's frustum. Each is run single-threaded and across a thread
+// pool, and the results are checked against the reference. Needs no GL context.
+void RunCullingBenchmark(size_t objects);
+
+// Prepares frames of a grid of objects (see Scene) through a FramePipeline on 1, 2, 4... worker
+// threads, up to maxThreads (0 for one per hardware thread), and prints the mean time to prepare a
+// frame and each of its tasks, and the speedup over one thread. The levels of detail are a made-up
+// chain, so the selector has work to do; the render queue's program and meshes are never drawn.
+// The results must be the same on every thread count. Needs no GL context.
+void RunFramePipelineBenchmark(size_t objects, unsigned int maxThreads);
@@ -142,6 +142,14 @@ public:
         UpdateCameraVectors();
     }
 
+    // Places the camera directly, for scripted camera paths.
+    void SetPose(glm::vec3 position, float yaw, float pitch) {
+        Position = position;
+        Yaw = yaw;
+        Pitch = pitch;
+        UpdateCameraVectors();
+    }
+
 private:
     // Calculates the front vector from the Camera's (updated) Euler angles.
     void UpdateCameraVectors() {
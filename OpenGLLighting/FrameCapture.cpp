@@ -0,0 +1,110 @@
+#include "FrameCapture.h"
+
+#include <chrono>
+#include <iostream>
+
+#include "GLStateCache.h"
+
+FrameCapture::FrameCapture(int width, int height) :
+    _width(width),
+    _height(height),
+    _frameBytes(static_cast<size_t>(width) * height * 4),
+    _oldest(0),
+    _inFlight(0)
+{
+    _statistics.captures = 0;
+    _statistics.stalls = 0;
+    _statistics.stallMilliseconds = 0.0;
+
+    for (unsigned int i = 0; i < BUFFER_COUNT; ++i) {
+        Slot& slot = _slots[i];
+        glGenBuffers(1, &slot.buffer);
+        GLStateCache::BindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(_frameBytes), nullptr, GL_STREAM_READ);
+        slot.fence = nullptr;
+        slot.id = -1;
+    }
+    GLStateCache::BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+FrameCapture::~FrameCapture()
+{
+    for (unsigned int i = 0; i < BUFFER_COUNT; ++i) {
+        glDeleteSync(_slots[i].fence);
+        GLStateCache::DeleteBuffer(_slots[i].buffer);
+    }
+}
+
+void FrameCapture::Capture(GLuint framebuffer, int id, const FrameCallback& onFrame)
+{
+    if (_inFlight == BUFFER_COUNT) {
+        Collect(true, onFrame);
+    }
+
+    Slot& slot = _slots[(_oldest + _inFlight) % BUFFER_COUNT];
+    slot.id = id;
+    ++_inFlight;
+    ++_statistics.captures;
+
+    // With a pack buffer bound, glReadPixels only queues the copy and returns.
+    GLint previousFramebuffer = 0;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glReadBuffer(framebuffer != 0 ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    GLStateCache::BindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    glReadPixels(0, 0, _width, _height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    GLStateCache::BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, static_cast<GLuint>(previousFramebuffer));
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void FrameCapture::Poll(const FrameCallback& onFrame)
+{
+    while (_inFlight > 0 && Collect(false, onFrame)) {
+    }
+}
+
+void FrameCapture::Flush(const FrameCallback& onFrame)
+{
+    while (_inFlight > 0) {
+        Collect(true, onFrame);
+    }
+}
+
+bool FrameCapture::Collect(bool wait, const FrameCallback& onFrame)
+{
+    Slot& slot = _slots[_oldest];
+
+    // As in StreamBuffer: the first check neither flushes nor blocks, and only a real wait counts
+    // as a stall.
+    if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        if (!wait) {
+            return false;
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        while (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+        }
+        ++_statistics.stalls;
+        _statistics.stallMilliseconds +=
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+
+    GLStateCache::BindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, static_cast<GLsizeiptr>(_frameBytes), GL_MAP_READ_BIT);
+    if (pixels != nullptr) {
+        onFrame(slot.id, static_cast<const uint8_t*>(pixels));
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    else {
+        std::cerr << "FrameCapture: unable to map the pixels of capture " << slot.id << std::endl;
+    }
+    GLStateCache::BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    _oldest = (_oldest + 1) % BUFFER_COUNT;
+    --_inFlight;
+    return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+// Reads frames back from the GL without waiting for them. Capture() queues a glReadPixels of the
+// framebuffer into one of a ring of pixel pack buffers and fences it, which returns as soon as the
+// copy is queued; Poll(), called once a frame, maps the buffers whose fences have signalled and
+// hands their pixels over. A frame is usually collected a frame or two after it was captured,
+// and the render loop never waits for the GPU on its behalf, unless every buffer is in flight
+// when another capture is asked for.
+//
+// Pixels are RGBA, 8 bits per channel, bottom row first, as glReadPixels returns them.
+class FrameCapture final
+{
+public:
+    static const unsigned int BUFFER_COUNT = 3;
+
+    // Counters since construction.
+    struct Statistics
+    {
+        unsigned int captures;
+        unsigned int stalls;        // captures or flushes that had to wait for the GPU
+        double stallMilliseconds;
+    };
+
+    // Called with the id given to Capture() and the frame's pixels, which are only valid during
+    // the call.
+    typedef std::function<void(int id, const uint8_t* pixels)> FrameCallback;
+
+    FrameCapture(int width, int height);
+
+    FrameCapture(const FrameCapture& rhs) = delete;
+    FrameCapture& operator=(const FrameCapture& rhs) = delete;
+
+    ~FrameCapture();
+
+    int GetWidth() const { return _width; }
+    int GetHeight() const { return _height; }
+
+    // Queues a copy of framebuffer's first color attachment (0 for the default framebuffer). If all
+    // the buffers are in flight, waits for the oldest and passes it to onFrame first.
+    void Capture(GLuint framebuffer, int id, const FrameCallback& onFrame);
+
+    // Passes every capture the GPU has finished to onFrame, oldest first, without waiting.
+    void Poll(const FrameCallback& onFrame);
+
+    // Waits for every capture in flight and passes them to onFrame.
+    void Flush(const FrameCallback& onFrame);
+
+    const Statistics& GetStatistics() const { return _statistics; }
+
+private:
+    struct Slot
+    {
+        GLuint buffer;
+        GLsync fence;       // null when the slot is free
+        int id;
+    };
+
+    // Maps the oldest slot in flight and hands it to onFrame; if wait, waits for its fence first,
+    // otherwise returns false if it hasn't signalled.
+    bool Collect(bool wait, const FrameCallback& onFrame);
+
+    int _width;
+    int _height;
+    size_t _frameBytes;
+    Slot _slots[BUFFER_COUNT];
+    unsigned int _oldest;       // next slot to collect
+    unsigned int _inFlight;
+
+    Statistics _statistics;
+};
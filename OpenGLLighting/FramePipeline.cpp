@@ -0,0 +1,129 @@
+#include "FramePipeline.h"
+
+#include <cstring>
+
+#include "Frustum.h"
+#include "ObjectStore.h"
+#include "RenderQueue.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+
+FramePipeline::FramePipeline(ThreadPool& threadPool, Scene& scene, LodSelector& lodSelector, RenderQueue* queues[FRAME_COUNT]) :
+        _threadPool(threadPool),
+        _scene(scene),
+        _lodSelector(lodSelector),
+        _preparing(FRAME_COUNT - 1)
+{
+    for (size_t i = 0; i < FRAME_COUNT; ++i) {
+        _frames[i].queue = queues[i];
+        _frames[i].lodsChanged = false;
+        std::memset(&_frames[i].lodStatistics, 0, sizeof(_frames[i].lodStatistics));
+        _frames[i].visibleCount = 0;
+    }
+
+    TaskGraph::TaskId simulate = _graph.Add("simulate", [this]() { Simulate(); });
+    TaskGraph::TaskId transforms = _graph.Add("transforms", [this]() { BuildTransforms(); }, { simulate });
+    TaskGraph::TaskId lod = _graph.Add("lod", [this]() { SelectLods(); });
+    TaskGraph::TaskId cull = _graph.Add("cull", [this]() { Cull(); });
+    _graph.Add("queue", [this]() { BuildQueue(); }, { transforms, lod, cull });
+
+    ResetStatistics();
+}
+
+void FramePipeline::Prepare(const Settings& settings)
+{
+    _preparing = (_preparing + 1) % FRAME_COUNT;
+    _frames[_preparing].settings = settings;
+    _graph.Run(_threadPool);
+}
+
+const FramePipeline::Frame& FramePipeline::Wait()
+{
+    if (_graph.IsRunning()) {
+        _graph.Wait();
+
+        const TaskGraph::Statistics& graphStatistics = _graph.GetStatistics();
+        ++_statistics.frames;
+        _statistics.prepareMilliseconds += graphStatistics.milliseconds;
+        for (size_t task = 0; task < _graph.Size(); ++task) {
+            _statistics.taskMilliseconds[task] += graphStatistics.taskMilliseconds[task];
+        }
+    }
+    return _frames[_preparing];
+}
+
+void FramePipeline::Finish()
+{
+    Wait();
+}
+
+void FramePipeline::ResetStatistics()
+{
+    _statistics.frames = 0;
+    _statistics.prepareMilliseconds = 0.0;
+    _statistics.taskMilliseconds.assign(_graph.Size(), 0.0);
+}
+
+void FramePipeline::Simulate()
+{
+    Frame& frame = _frames[_preparing];
+    _scene.Update(frame.settings.deltaTime, &_threadPool);
+    frame.lights = _scene.GetLights();
+}
+
+void FramePipeline::BuildTransforms()
+{
+    Frame& frame = _frames[_preparing];
+    frame.models.resize(_scene.Size());
+    frame.normalMatrices.resize(_scene.Size());
+    if (_scene.Size() > 0) {
+        _scene.GetTransforms(&frame.models[0], &frame.normalMatrices[0], &_threadPool);
+    }
+}
+
+void FramePipeline::SelectLods()
+{
+    Frame& frame = _frames[_preparing];
+    frame.lodsChanged = _lodSelector.Select(_scene.GetStore(), frame.settings.cameraPosition, frame.settings.projection,
+                                            frame.settings.viewportHeight, _threadPool);
+    frame.objectLods = _lodSelector.GetObjectLods();
+    frame.lodStatistics = _lodSelector.GetStatistics();
+}
+
+void FramePipeline::Cull()
+{
+    Frame& frame = _frames[_preparing];
+    if (!frame.settings.cull) {
+        frame.visibleCount = _scene.Size();
+        return;
+    }
+    glm::vec4 planes[FRUSTUM_PLANE_COUNT];
+    ExtractFrustumPlanes(frame.settings.projection * frame.settings.view, planes);
+    frame.visibleObjects.resize(_scene.Size());
+    frame.visibleCount = _scene.GetStore().CullSpheres(_threadPool, planes, frame.visibleObjects.data());
+}
+
+// Every object becomes a draw item; the queue orders them by state and depth and merges items that
+// share a program, mesh and material into instanced draws.
+void FramePipeline::BuildQueue()
+{
+    Frame& frame = _frames[_preparing];
+    const Settings& settings = frame.settings;
+    RenderQueue& queue = *frame.queue;
+
+    queue.Begin(settings.view, settings.nearPlane, settings.farPlane);
+    if (settings.queue && settings.cull) {
+        for (size_t i = 0; i < frame.visibleCount; ++i) {
+            uint32_t object = frame.visibleObjects[i];
+            queue.Submit(PASS_OPAQUE, settings.program, settings.meshes[frame.objectLods[object]], settings.material,
+                         &frame.models[object], &frame.normalMatrices[object]);
+        }
+    }
+    else if (settings.queue) {
+        for (size_t i = 0; i < frame.models.size(); ++i) {
+            queue.Submit(PASS_OPAQUE, settings.program, settings.meshes[frame.objectLods[i]], settings.material,
+                         &frame.models[i], &frame.normalMatrices[i]);
+        }
+    }
+    queue.Sort();
+}
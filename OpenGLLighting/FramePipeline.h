@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+
+#include "LightGrid.h"
+#include "LodSelector.h"
+#include "TaskGraph.h"
+
+class RenderQueue;
+class Scene;
+class ThreadPool;
+
+// Prepares the CPU side of a frame on the worker threads while the render thread is still
+// submitting the one before: the render thread starts preparing frame N + 1, draws frame N, and
+// then waits for frame N + 1, so the two overlap and the render thread only does GL work.
+//
+// Preparing a frame runs a TaskGraph of five tasks:
+//   simulate    advance the scene and copy its lights
+//   transforms  the model and normal matrices, after simulate
+//   lod         each object's level of detail (see LodSelector)
+//   cull        the objects whose bounding spheres touch the frustum
+//   queue       submit the objects to the frame's render queue and sort it, after all the others
+// lod and cull read the objects' positions, scales and bounds, which the simulation never writes
+// (it only turns the objects), so they run alongside simulate. Each task spreads its objects over
+// the pool with ParallelFor() except queue, which is the serial tail.
+//
+// Everything a frame draws with is in its Frame, and there are two: the one being drawn and the
+// one being prepared. A Frame returned by Wait() stays valid until the Prepare() after the next.
+// Nothing else may touch the scene or the level of detail selector while a frame is being
+// prepared, and the render queues' programs and meshes may only be registered in between.
+class FramePipeline final
+{
+public:
+    static const size_t FRAME_COUNT = 2;
+
+    // What a frame is prepared from, taken when it starts.
+    struct Settings
+    {
+        float deltaTime;                // seconds to advance the scene by
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::vec3 cameraPosition;
+        int viewportHeight;             // pixels, for the levels of detail
+        float nearPlane, farPlane;
+        bool cull;                      // only queue the objects in the frustum
+        bool queue;                     // false leaves the render queue empty, for the GPU culler
+        uint16_t program;               // the render queue ids every object is submitted with
+        uint16_t material;
+        std::vector<uint16_t> meshes;   // one per level of detail
+    };
+
+    struct Frame
+    {
+        Settings settings;
+        RenderQueue* queue;                         // sorted, ready for Upload()
+        std::vector<glm::mat4> models;              // one per object
+        std::vector<glm::mat3> normalMatrices;
+        std::vector<PointLight> lights;
+        std::vector<uint8_t> objectLods;            // one per object
+        bool lodsChanged;                           // since the frame before
+        LodSelector::Statistics lodStatistics;
+        std::vector<uint32_t> visibleObjects;       // with settings.cull, the first visibleCount
+        size_t visibleCount;
+    };
+
+    // Summed over the frames prepared since the last ResetStatistics().
+    struct Statistics
+    {
+        size_t frames;
+        double prepareMilliseconds;     // from Prepare() to the last task finishing
+        std::vector<double> taskMilliseconds;   // by task, in the order above
+    };
+
+    // queues are the two frames' render queues, registered with the same programs, meshes and
+    // materials so their ids agree.
+    FramePipeline(ThreadPool& threadPool, Scene& scene, LodSelector& lodSelector, RenderQueue* queues[FRAME_COUNT]);
+
+    FramePipeline(const FramePipeline& rhs) = delete;
+    FramePipeline& operator=(const FramePipeline& rhs) = delete;
+
+    // Starts preparing the next frame and returns at once. The last one must have been waited for.
+    void Prepare(const Settings& settings);
+
+    // Waits for the frame Prepare() started and returns it.
+    const Frame& Wait();
+
+    // True from Prepare() to Wait().
+    bool IsPreparing() const { return _graph.IsRunning(); }
+
+    // Waits for the frame being prepared, if any, and drops it.
+    void Finish();
+
+    const TaskGraph& GetGraph() const { return _graph; }
+    const Statistics& GetStatistics() const { return _statistics; }
+    void ResetStatistics();
+
+private:
+    void Simulate();
+    void BuildTransforms();
+    void SelectLods();
+    void Cull();
+    void BuildQueue();
+
+    ThreadPool& _threadPool;
+    Scene& _scene;
+    LodSelector& _lodSelector;
+
+    Frame _frames[FRAME_COUNT];
+    size_t _preparing;      // index of the frame Prepare() last started
+
+    TaskGraph _graph;
+    Statistics _statistics;
+};
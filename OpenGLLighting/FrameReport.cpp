@@ -0,0 +1,143 @@
+#include "FrameReport.h"
+
+#include <algorithm>
+
+namespace {
+
+// Nearest-rank percentile of sorted samples.
+double Percentile(const std::vector<double>& sorted, int percent)
+{
+    return sorted[(sorted.size() - 1) * percent / 100];
+}
+
+void WriteDistribution(std::ostream& out, std::vector<double> samples)
+{
+    if (samples.empty()) {
+        out << "{}";
+        return;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    size_t count = samples.size();
+    double sum = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        sum += samples[i];
+    }
+
+    out << "{\"min\": " << samples.front()
+        << ", \"p50\": " << Percentile(samples, 50)
+        << ", \"p99\": " << Percentile(samples, 99)
+        << ", \"max\": " << samples.back()
+        << ", \"mean\": " << sum / count << "}";
+}
+
+void WriteJsonString(std::ostream& out, const std::string& text)
+{
+    out << '"';
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            out << ' ';
+        }
+        else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+}
+
+FrameReport::FrameReport() :
+    _recording(false)
+{
+    std::fill(_currentStages, _currentStages + STAGE_COUNT, 0.0);
+}
+
+void FrameReport::Start(size_t expectedFrames)
+{
+    _frameMilliseconds.clear();
+    _frameMilliseconds.reserve(expectedFrames);
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        _stageMilliseconds[stage].clear();
+        _stageMilliseconds[stage].reserve(expectedFrames);
+    }
+    _recording = true;
+}
+
+void FrameReport::BeginFrame()
+{
+    if (!_recording) {
+        return;
+    }
+    std::fill(_currentStages, _currentStages + STAGE_COUNT, 0.0);
+    _frameStart = _lastMark = Clock::now();
+}
+
+void FrameReport::Mark(FrameStage stage)
+{
+    if (!_recording) {
+        return;
+    }
+    Clock::time_point now = Clock::now();
+    _currentStages[stage] += std::chrono::duration<double, std::milli>(now - _lastMark).count();
+    _lastMark = now;
+}
+
+void FrameReport::EndFrame()
+{
+    if (!_recording) {
+        return;
+    }
+    _frameMilliseconds.push_back(std::chrono::duration<double, std::milli>(Clock::now() - _frameStart).count());
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        _stageMilliseconds[stage].push_back(_currentStages[stage]);
+    }
+}
+
+double FrameReport::FramePercentile(int percent) const
+{
+    if (_frameMilliseconds.empty()) {
+        return 0.0;
+    }
+    std::vector<double> sorted(_frameMilliseconds);
+    std::sort(sorted.begin(), sorted.end());
+    return Percentile(sorted, percent);
+}
+
+void FrameReport::WriteJson(std::ostream& out, const std::vector<std::pair<std::string, std::string>>& properties) const
+{
+    out << "{\n";
+    for (size_t i = 0; i < properties.size(); ++i) {
+        out << "  ";
+        WriteJsonString(out, properties[i].first);
+        out << ": ";
+        WriteJsonString(out, properties[i].second);
+        out << ",\n";
+    }
+    out << "  \"frames\": " << _frameMilliseconds.size() << ",\n";
+    out << "  \"frame_ms\": ";
+    WriteDistribution(out, _frameMilliseconds);
+    out << ",\n  \"stages_ms\": {\n";
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        out << "    \"" << StageName(static_cast<FrameStage>(stage)) << "\": ";
+        WriteDistribution(out, _stageMilliseconds[stage]);
+        out << (stage + 1 < STAGE_COUNT ? ",\n" : "\n");
+    }
+    out << "  }\n}\n";
+}
+
+const char* FrameReport::StageName(FrameStage stage)
+{
+    switch (stage) {
+        case STAGE_WAIT: return "wait";
+        case STAGE_UPDATE: return "update";
+        case STAGE_UPLOAD: return "upload";
+        case STAGE_DRAW: return "draw";
+        case STAGE_FINISH: return "finish";
+        default: return "unknown";
+    }
+}
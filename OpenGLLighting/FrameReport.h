@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Parts of a frame timed separately by FrameReport.
+enum FrameStage
+{
+    STAGE_WAIT,         // waiting for the worker threads to prepare the frame (see FramePipeline)
+    STAGE_UPDATE,       // binning the lights and finding the stale shadow maps
+    STAGE_UPLOAD,       // writing uniform blocks and instance data into the stream buffer
+    STAGE_DRAW,         // issuing GL state changes and draw calls
+    STAGE_FINISH,       // waiting for the GL to finish the frame (glFinish, glFlush or the buffer swap)
+    STAGE_COUNT
+};
+
+// Records CPU time per frame and per FrameStage over a run, and writes the distribution as JSON.
+// Stages are timed by marks: Mark(stage) charges the time since the previous mark (or since
+// BeginFrame()) to stage, so a stage may be charged several times per frame. Outside Start()/Stop()
+// the calls do nothing, so Render() can always call Mark().
+class FrameReport final
+{
+public:
+    FrameReport();
+
+    void Start(size_t expectedFrames);
+    void Stop() { _recording = false; }
+    bool IsRecording() const { return _recording; }
+
+    void BeginFrame();
+    void Mark(FrameStage stage);
+    void EndFrame();
+
+    size_t FrameCount() const { return _frameMilliseconds.size(); }
+
+    // Nearest-rank percentile (0 to 100) of the recorded frame times, as written by WriteJson();
+    // 0 if no frame was recorded.
+    double FramePercentile(int percent) const;
+
+    // Writes {"frames": n, "frame_ms": {...}, "stages_ms": {"update": {...}, ...}} with min, p50,
+    // p99, max and mean milliseconds for each. properties are extra "key": "value" pairs written
+    // first, for the renderer, instance count and so on.
+    void WriteJson(std::ostream& out, const std::vector<std::pair<std::string, std::string>>& properties) const;
+
+    static const char* StageName(FrameStage stage);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    bool _recording;
+    Clock::time_point _frameStart;
+    Clock::time_point _lastMark;
+    double _currentStages[STAGE_COUNT];
+
+    std::vector<double> _frameMilliseconds;
+    std::vector<double> _stageMilliseconds[STAGE_COUNT];
+};
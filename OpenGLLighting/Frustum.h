@@ -0,0 +1,66 @@
+#pragma once
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+
+// The six planes of a view frustum, for culling bounding spheres.
+//
+// Each plane is (n, d) with n the unit normal pointing into the frustum, so a point p is inside
+// the plane when dot(n, p) + d >= 0 and a sphere (c, r) is at least partly inside when
+// dot(n, c) + d >= -r. A sphere is visible when it is partly inside all six planes; spheres near a
+// frustum corner can pass while being outside, which only costs a draw.
+
+enum FrustumPlane
+{
+    FRUSTUM_LEFT,
+    FRUSTUM_RIGHT,
+    FRUSTUM_BOTTOM,
+    FRUSTUM_TOP,
+    FRUSTUM_NEAR,
+    FRUSTUM_FAR,
+    FRUSTUM_PLANE_COUNT
+};
+
+// Extracts the world-space planes from projection * view (Gribb and Hartmann): each plane is the
+// fourth row of the matrix plus or minus one of the other rows, normalized.
+inline void ExtractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[FRUSTUM_PLANE_COUNT])
+{
+    // glm is column major: row i is (m[0][i], m[1][i], m[2][i], m[3][i]).
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; ++i) {
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    }
+
+    planes[FRUSTUM_LEFT] = rows[3] + rows[0];
+    planes[FRUSTUM_RIGHT] = rows[3] - rows[0];
+    planes[FRUSTUM_BOTTOM] = rows[3] + rows[1];
+    planes[FRUSTUM_TOP] = rows[3] - rows[1];
+    planes[FRUSTUM_NEAR] = rows[3] + rows[2];
+    planes[FRUSTUM_FAR] = rows[3] - rows[2];
+
+    for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i) {
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+}
+
+// The reference test; the batch kernels in ObjectStore and the GPU culling shader (cull.comp) do
+// the same for many objects at once.
+inline bool IsSphereInFrustum(const glm::vec4 planes[FRUSTUM_PLANE_COUNT], const glm::vec3& center, float radius)
+{
+    for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i) {
+        if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Radius of the sphere around an object's model-space bounding sphere once transformed by model:
+// the radius scaled by the longest basis vector, so it is conservative for non-uniform scales.
+inline float TransformedRadius(const glm::mat4& model, float radius)
+{
+    float scale = glm::max(glm::max(glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+                                    glm::dot(glm::vec3(model[1]), glm::vec3(model[1]))),
+                           glm::dot(glm::vec3(model[2]), glm::vec3(model[2])));
+    return radius * glm::sqrt(scale);
+}
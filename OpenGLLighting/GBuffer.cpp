@@ -0,0 +1,130 @@
+#include "GBuffer.h"
+
+#include <iostream>
+
+#include "GLStateCache.h"
+
+GBuffer::GBuffer() :
+    _width(0),
+    _height(0),
+    _framebuffer(0),
+    _targetFramebuffer(0),
+    _frameIndex(0),
+    _fragmentsWritten(0)
+{
+    _textures[0] = _textures[1] = _textures[2] = 0;
+    glGenQueries(FRAME_LATENCY, _queries);
+    for (unsigned int i = 0; i < FRAME_LATENCY; ++i) {
+        _queryPending[i] = false;
+    }
+}
+
+GBuffer::~GBuffer()
+{
+    DeleteTargets();
+    glDeleteQueries(FRAME_LATENCY, _queries);
+}
+
+void GBuffer::DeleteTargets()
+{
+    if (_framebuffer != 0) {
+        glDeleteFramebuffers(1, &_framebuffer);
+        glDeleteTextures(3, _textures);
+        _framebuffer = 0;
+        _textures[0] = _textures[1] = _textures[2] = 0;
+    }
+}
+
+bool GBuffer::Resize(int width, int height)
+{
+    if (width == _width && height == _height && _framebuffer != 0) {
+        return true;
+    }
+    DeleteTargets();
+    _width = width;
+    _height = height;
+
+    static const GLenum internalFormats[3] = { GL_RG16, GL_RGBA8, GL_DEPTH24_STENCIL8 };
+    static const GLenum formats[3] = { GL_RG, GL_RGBA, GL_DEPTH_STENCIL };
+    static const GLenum types[3] = { GL_UNSIGNED_SHORT, GL_UNSIGNED_BYTE, GL_UNSIGNED_INT_24_8 };
+    static const GLenum attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_DEPTH_STENCIL_ATTACHMENT };
+
+    GLint previousFramebuffer = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+
+    glGenFramebuffers(1, &_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+    glGenTextures(3, _textures);
+    for (int i = 0; i < 3; ++i) {
+        // Read with texelFetch only, so no filtering or mipmaps.
+        glBindTexture(GL_TEXTURE_2D, _textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[i], width, height, 0, formats[i], types[i], nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachments[i], GL_TEXTURE_2D, _textures[i], 0);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    static const GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(previousFramebuffer));
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "G-buffer incomplete: 0x" << std::hex << status << std::dec << std::endl;
+        DeleteTargets();
+        return false;
+    }
+    return true;
+}
+
+void GBuffer::BeginGeometryPass()
+{
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &_targetFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+
+    // Collect this slot's count from FRAME_LATENCY frames ago if the GPU is done with it.
+    unsigned int slot = ++_frameIndex % FRAME_LATENCY;
+    if (_queryPending[slot]) {
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 samples = 0;
+            glGetQueryObjectui64v(_queries[slot], GL_QUERY_RESULT, &samples);
+            _fragmentsWritten = static_cast<size_t>(samples);
+        }
+        _queryPending[slot] = false;
+    }
+
+    // Zero normals and albedo where nothing is drawn; the lighting pass skips those pixels by depth.
+    GLStateCache::ClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glBeginQuery(GL_SAMPLES_PASSED, _queries[slot]);
+    _queryPending[slot] = true;
+}
+
+void GBuffer::EndGeometryPass()
+{
+    glEndQuery(GL_SAMPLES_PASSED);
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(_targetFramebuffer));
+}
+
+void GBuffer::BindTextures() const
+{
+    static const GLenum units[3] = { NORMAL_UNIT, ALBEDO_UNIT, DEPTH_UNIT };
+
+    for (int i = 0; i < 3; ++i) {
+        glActiveTexture(GL_TEXTURE0 + units[i]);
+        glBindTexture(GL_TEXTURE_2D, _textures[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void GBuffer::BlitDepth() const
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, static_cast<GLuint>(_targetFramebuffer));
+    glBlitFramebuffer(0, 0, _width, _height, 0, 0, _width, _height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(_targetFramebuffer));
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+// The render targets of the deferred path: the geometry pass writes each visible surface's normal
+// and material here, and the lighting pass reads them back in one full-screen pass.
+//
+// The layout is kept to 12 bytes per pixel:
+//   normal        RG16, the unit normal in octahedral encoding (gbuffer.fs), mapped to [0, 1]
+//   albedo        RGBA8, the surface color, and the specular strength in alpha
+//   depth         DEPTH24_STENCIL8, from which deferred.fs reconstructs the position
+// A G-buffer storing the world position in RGB32F and the normal in RGB16F would take 28.
+//
+// The geometry pass is wrapped in a GL_SAMPLES_PASSED query to count the fragments that reach the
+// G-buffer, so the bytes it writes can be reported. Like the profiler's timestamps the result is
+// read FRAME_LATENCY frames later instead of being waited for.
+class GBuffer final
+{
+public:
+    static const unsigned int BYTES_PER_PIXEL = 12;
+    static const unsigned int FRAME_LATENCY = 4;
+
+    // Texture units the lighting pass reads the G-buffer from; after the light grid's.
+    enum TextureUnit
+    {
+        NORMAL_UNIT = 3,
+        ALBEDO_UNIT = 4,
+        DEPTH_UNIT = 5
+    };
+
+    GBuffer();
+
+    GBuffer(const GBuffer& rhs) = delete;
+    GBuffer& operator=(const GBuffer& rhs) = delete;
+
+    ~GBuffer();
+
+    // (Re)creates the targets if the size changed. Returns false if the framebuffer is incomplete.
+    bool Resize(int width, int height);
+
+    int GetWidth() const { return _width; }
+    int GetHeight() const { return _height; }
+
+    // Binds and clears the G-buffer, remembering the framebuffer that was bound to restore it in
+    // EndGeometryPass().
+    void BeginGeometryPass();
+    void EndGeometryPass();
+
+    // Binds the targets to their texture units. Leaves texture unit 0 active.
+    void BindTextures() const;
+
+    // Copies the depth into the framebuffer bound before the geometry pass, so forward passes
+    // after the lighting (the lamps) are hidden by the cubes. That framebuffer's depth format must
+    // be DEPTH24_STENCIL8 too, as the window's and the headless context's are.
+    void BlitDepth() const;
+
+    // Fragments written by the latest geometry pass whose count is known; 0 until then.
+    size_t GetFragmentsWritten() const { return _fragmentsWritten; }
+
+private:
+    void DeleteTargets();
+
+    int _width;
+    int _height;
+    GLuint _framebuffer;
+    GLuint _textures[3];        // normal, albedo, depth
+    GLint _targetFramebuffer;   // bound before BeginGeometryPass()
+
+    GLuint _queries[FRAME_LATENCY];
+    bool _queryPending[FRAME_LATENCY];
+    unsigned int _frameIndex;
+    size_t _fragmentsWritten;
+};
@@ -1,15 +1,20 @@
 #include "GLSLProgram.h"
 
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <utility>
+
+#include "GLStateCache.h"
+#include "ProgramBinaryCache.h"
 
 GLSLProgram::GLSLProgram() :
         _shaderProgramHandle(0),
         _didLink(GL_FALSE),
-        _vertexShader(0),
-        _fragmentShader(0),
-        _geometryShader(0)
+        _generation(0),
+        _linkPending(false),
+        _pendingCacheKey(0)
 { }
 
 GLSLProgram::~GLSLProgram()
@@ -17,53 +22,28 @@ GLSLProgram::~GLSLProgram()
     DeleteProgram();
 }
 
-// Build and compile a shader
-void GLSLProgram::AddShader(GLenum shaderType, const GLchar* const source)
-{
-    GLuint shader = glCreateShader(shaderType); // creates an empty shader object
-    glShaderSource(shader,      // shader to be compiled
-                   1,           // number of lines of shader code
-                   &source,     // reference to pointer(s) of strings (lines of source code)
-                   nullptr);    // array of string lengths
-
-    glCompileShader(shader);
-
-    GLint didCompile = 0;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &didCompile);
-    if (didCompile == GL_TRUE) {
-        switch (shaderType) {
-            case GL_VERTEX_SHADER :
-                _vertexShader = shader;
-                break;
-            case GL_FRAGMENT_SHADER :
-                _fragmentShader = shader;
-                break;
-            case GL_GEOMETRY_SHADER :
-                _geometryShader = shader;
-        }
-    }
-    else  {
-        GLint logLength = 0;    // this will include the NULL character
-        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+ProgramBinaryCache* GLSLProgram::_binaryCache = nullptr;
 
-        GLchar* logBuffer = new GLchar[logLength];
-        glGetShaderInfoLog(shader, logLength, nullptr, logBuffer);
-
-        std::cerr << "GLSLProgram::AddShader compile error: " << logBuffer << std::endl;
+void GLSLProgram::SetBinaryCache(ProgramBinaryCache* cache)
+{
+    _binaryCache = cache;
+}
 
-        delete[] logBuffer;     // don't leak the log buffer
-        glDeleteShader(shader); // don't leak the shader
-    }
+// Add a shader stage; it is compiled by CreateAndLinkProgram()
+void GLSLProgram::AddShader(GLenum shaderType, const GLchar* const source)
+{
+    ShaderStage stage = { shaderType, source };
+    _stages.push_back(stage);
 }
 
-// Build and compile a shader
+// Add a shader stage; it is compiled by CreateAndLinkProgram()
 void GLSLProgram::AddShader(GLenum shaderType, const std::string& source)
 {
     const char* sourceAsChar = source.c_str();
     AddShader(shaderType, sourceAsChar);
 }
 
-// Build and compile a shader
+// Add a shader stage; it is compiled by CreateAndLinkProgram()
 void GLSLProgram::AddShaderFromFile(GLenum shaderType, const std::string& filename)
 {
     std::ifstream inputStream;
@@ -85,23 +65,147 @@ void GLSLProgram::AddShaderFromFile(GLenum shaderType, const std::string& filena
     }
 }
 
+void GLSLProgram::AddDefine(const std::string& name, const std::string& value)
+{
+    _defines.push_back("#define " + name + " " + value + "\n");
+}
+
+// Inserts the program's #defines after the #version directive, which must stay the first line.
+std::string GLSLProgram::InsertAfterVersion(const std::string& source, const std::string& text)
+{
+    std::string::size_type insertAt = 0;
+    if (source.compare(0, 8, "#version") == 0) {
+        insertAt = source.find('\n');
+        insertAt = insertAt == std::string::npos ? source.size() : insertAt + 1;
+    }
+
+    std::string result = source;
+    result.insert(insertAt, text);
+    return result;
+}
+
+std::string GLSLProgram::PreprocessSource(const std::string& source) const
+{
+    if (_defines.empty()) {
+        return source;
+    }
+
+    std::string defines;
+    for (size_t i = 0; i < _defines.size(); ++i) {
+        defines += _defines[i];
+    }
+    return InsertAfterVersion(source, defines);
+}
+
+// Build and compile a shader. The compile status isn't queried here: that would wait for the
+// driver to finish, and with parallel compilation it may still be running.
+GLuint GLSLProgram::CompileShader(GLenum shaderType, const std::string& source)
+{
+    const GLchar* sourceAsChar = source.c_str();
+
+    GLuint shader = glCreateShader(shaderType); // creates an empty shader object
+    glShaderSource(shader,      // shader to be compiled
+                   1,           // number of lines of shader code
+                   &sourceAsChar, // reference to pointer(s) of strings (lines of source code)
+                   nullptr);    // array of string lengths
+
+    glCompileShader(shader);
+
+    return shader;
+}
+
+void GLSLProgram::ReportCompileErrors(GLuint shader)
+{
+    GLint didCompile = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &didCompile);
+    if (didCompile != GL_TRUE) {
+        GLint logLength = 0;    // this will include the NULL character
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+
+        GLchar* logBuffer = new GLchar[logLength];
+        glGetShaderInfoLog(shader, logLength, nullptr, logBuffer);
+
+        std::cerr << "GLSLProgram::AddShader compile error: " << logBuffer << std::endl;
+
+        delete[] logBuffer;     // don't leak the log buffer
+    }
+}
+
 GLuint GLSLProgram::CreateAndLinkProgram() {
+    BeginLink();
+    return FinishLink();
+}
+
+void GLSLProgram::BeginLink()
+{
     _shaderProgramHandle = glCreateProgram(); // create a shader program and return a reference to it
+    _linkPending = true;
+    _pendingCacheKey = 0;
 
-    if (_vertexShader != 0) {
-        glAttachShader(_shaderProgramHandle, _vertexShader);
+    std::vector<std::string> sources;
+    for (size_t i = 0; i < _stages.size(); ++i) {
+        sources.push_back(PreprocessSource(_stages[i].source));
     }
-    if (_fragmentShader != 0) {
-        glAttachShader(_shaderProgramHandle, _fragmentShader);
+
+    // Try the binary cache first; on a hit there is nothing to compile.
+    if (_binaryCache != nullptr && _binaryCache->IsSupported()) {
+        uint64_t cacheKey = _binaryCache->BeginKey();
+        for (size_t i = 0; i < _stages.size(); ++i) {
+            cacheKey = ProgramBinaryCache::AddStageToKey(cacheKey, _stages[i].type, sources[i]);
+        }
+
+        if (_binaryCache->Load(cacheKey, _shaderProgramHandle)) {
+            return;
+        }
+
+        // A rejected binary can leave the program in an unspecified state; start over.
+        GLStateCache::DeleteProgram(_shaderProgramHandle);
+        _shaderProgramHandle = glCreateProgram();
+        glProgramParameteri(_shaderProgramHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        _pendingCacheKey = cacheKey;
     }
-    if (_geometryShader != 0) {
-        glAttachShader(_shaderProgramHandle, _geometryShader);
+
+    for (size_t i = 0; i < _stages.size(); ++i) {
+        GLuint shader = CompileShader(_stages[i].type, sources[i]);
+        glAttachShader(_shaderProgramHandle, shader);
+        _pendingShaders.push_back(shader);
     }
 
     glLinkProgram(_shaderProgramHandle);
+}
+
+bool GLSLProgram::IsLinkComplete() const
+{
+    if (!_linkPending) {
+        return true;
+    }
+
+#ifdef GL_KHR_parallel_shader_compile
+    if (GLEW_KHR_parallel_shader_compile) {
+        GLint isComplete = GL_FALSE;
+        glGetProgramiv(_shaderProgramHandle, GL_COMPLETION_STATUS_KHR, &isComplete);
+        return isComplete == GL_TRUE;
+    }
+#endif
+    // Without the extension there is no way to ask without blocking, so report the link as done
+    // and let FinishLink() wait.
+    return true;
+}
+
+GLuint GLSLProgram::FinishLink()
+{
+    if (!_linkPending) {
+        return _shaderProgramHandle;
+    }
+    _linkPending = false;
 
     glGetProgramiv(_shaderProgramHandle, GL_LINK_STATUS, &_didLink);
     if (_didLink != GL_TRUE) {
+        // A failed compile shows up as a failed link; report the compile errors first.
+        for (size_t i = 0; i < _pendingShaders.size(); ++i) {
+            ReportCompileErrors(_pendingShaders[i]);
+        }
+
         GLint logLength = 0;    // this will include the NULL character
         glGetProgramiv(_shaderProgramHandle, GL_INFO_LOG_LENGTH, &logLength);
 
@@ -112,10 +216,20 @@ GLuint GLSLProgram::CreateAndLinkProgram() {
 
         delete[] logBuffer;
     }
+    else {
+        ReflectUniforms();
+        ApplyUniformBlockBindings();
+        ++_generation;
+
+        if (_pendingCacheKey != 0) {
+            _binaryCache->Store(_pendingCacheKey, _shaderProgramHandle);
+        }
+    }
 
-    glDeleteShader(_vertexShader);
-    glDeleteShader(_fragmentShader);
-    glDeleteShader(_geometryShader);
+    for (size_t i = 0; i < _pendingShaders.size(); ++i) {
+        glDeleteShader(_pendingShaders[i]);
+    }
+    _pendingShaders.clear();
 
     return _shaderProgramHandle;
 }
@@ -127,12 +241,62 @@ GLuint GLSLProgram::IsCreated() const
 
 void GLSLProgram::UseProgram()
 {
-    glUseProgram(_shaderProgramHandle);
+    GLStateCache::UseProgram(_shaderProgramHandle);
 }
 
 void GLSLProgram::DeleteProgram()
 {
-    glDeleteProgram(_shaderProgramHandle);
+    GLStateCache::DeleteProgram(_shaderProgramHandle);
+}
+
+void GLSLProgram::CopyBuildSettings(const GLSLProgram& other)
+{
+    _defines = other._defines;
+    _blockBindings = other._blockBindings;
+}
+
+bool GLSLProgram::AdoptProgram(GLSLProgram& rebuilt)
+{
+    if (rebuilt._linkPending || rebuilt._didLink != GL_TRUE) {
+        return false;
+    }
+
+    std::swap(_shaderProgramHandle, rebuilt._shaderProgramHandle);
+    _stages.swap(rebuilt._stages);
+    _uniforms.swap(rebuilt._uniforms);
+    _uniformList.swap(rebuilt._uniformList);
+    _uniformValues.swap(rebuilt._uniformValues);
+    _attributeList.clear();
+    _didLink = GL_TRUE;
+    ++_generation;
+
+    // rebuilt is left with the old program; let it go. If it is bound, the GL keeps it alive until
+    // the next UseProgram().
+    rebuilt.DeleteProgram();
+    rebuilt._shaderProgramHandle = 0;
+    rebuilt._didLink = GL_FALSE;
+    return true;
+}
+
+void GLSLProgram::SetUniformBlockBinding(const std::string& blockName, GLuint bindingPoint)
+{
+    _blockBindings[blockName] = bindingPoint;
+    if (_didLink) {
+        ApplyUniformBlockBindings();
+    }
+}
+
+// Block bindings are program state, not part of the source, so they have to be set again after
+// every link (including a link from a cached binary).
+void GLSLProgram::ApplyUniformBlockBindings() const
+{
+    std::map<std::string, GLuint>::const_iterator iterator;
+    for (iterator = _blockBindings.begin(); iterator != _blockBindings.end(); ++iterator) {
+        GLuint blockIndex = glGetUniformBlockIndex(_shaderProgramHandle, iterator->first.c_str());
+        if (blockIndex != GL_INVALID_INDEX) {
+            glUniformBlockBinding(_shaderProgramHandle, blockIndex, iterator->second);
+        }
+    }
 }
 
 // Maps an attribute name to its location.
@@ -153,6 +317,8 @@ GLint GLSLProgram::AddAttribute(const std::string& attribute)
 }
 
 // Maps a uniform name to its location.
+// All active uniforms are already mapped when the program is linked, so this is only needed for
+// names the driver doesn't report on its own, such as individual array elements ("lights[3]").
 // If successful:
 // Returns the location of the uniform.
 // If error:
@@ -162,7 +328,29 @@ GLint GLSLProgram::AddUniform(const std::string& uniform)
 {
     GLint returnCode = -1;
     if (_didLink) {
-        returnCode = _uniformList[uniform] = glGetUniformLocation(_shaderProgramHandle, uniform.c_str());
+        GLint index = FindUniform(uniform);
+        if (index >= 0) {
+            return _uniforms[index].location;
+        }
+
+        returnCode = glGetUniformLocation(_shaderProgramHandle, uniform.c_str());
+        if (returnCode >= 0) {
+            // Inherit the element type from the array the name belongs to.
+            GLenum type = GL_NONE;
+            std::string::size_type bracket = uniform.find('[');
+            if (bracket != std::string::npos) {
+                GLint arrayIndex = FindUniform(uniform.substr(0, bracket));
+                if (arrayIndex >= 0) {
+                    type = _uniforms[arrayIndex].type;
+                }
+            }
+
+            UniformInfo info = { uniform, returnCode, 1, type };
+            _uniformList[uniform] = static_cast<GLint>(_uniforms.size());
+            _uniforms.push_back(info);
+            _uniformValues.push_back(UniformValue());
+            _uniformValues.back().size = 0;
+        }
     }
     return returnCode;
 }
@@ -177,14 +365,127 @@ GLuint GLSLProgram::GetAttributeLocation(const std::string& attribute) const
     return location;
 }
 
-GLuint GLSLProgram::GetUniformLocation(const std::string& uniform) const
+// Returns the location of a uniform from the reflected table, falling back to the driver for names
+// that were never reflected or added.
+GLint GLSLProgram::GetUniformLocation(const std::string& uniform) const
 {
-    GLuint location = -1;
-    std::map<std::string, GLuint>::const_iterator iterator = _uniformList.find(uniform);
-    if (iterator != _uniformList.end()) {
-        location = iterator->second;
+    GLint index = FindUniform(uniform);
+    if (index >= 0) {
+        return _uniforms[index].location;
     }
-    return location;
+    return _didLink ? glGetUniformLocation(_shaderProgramHandle, uniform.c_str()) : -1;
+}
+
+// Builds the uniform table from the driver's list of active uniforms. Called once after linking
+// so that later lookups never reach the driver.
+void GLSLProgram::ReflectUniforms()
+{
+    _uniforms.clear();
+    _uniformList.clear();
+    _uniformValues.clear();     // a new link resets every uniform to its default
+
+    GLint nbrOfUniforms = 0, maxBufferSize = 0;
+    glGetProgramiv(_shaderProgramHandle, GL_ACTIVE_UNIFORMS, &nbrOfUniforms);
+    glGetProgramiv(_shaderProgramHandle, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxBufferSize);
+
+    std::vector<GLchar> name(maxBufferSize > 0 ? maxBufferSize : 1);
+    _uniforms.reserve(nbrOfUniforms);
+
+    for (GLint index = 0; index < nbrOfUniforms; ++index) {
+        GLsizei charsInBuffer = 0;
+        GLint size = 0;
+        GLenum type = GL_NONE;
+        glGetActiveUniform(_shaderProgramHandle, index, maxBufferSize, &charsInBuffer, &size, &type, &name[0]);
+
+        // Uniforms that live in a uniform block have no location of their own.
+        GLint location = glGetUniformLocation(_shaderProgramHandle, &name[0]);
+        if (location < 0) {
+            continue;
+        }
+
+        UniformInfo info = { std::string(&name[0], charsInBuffer), location, size, type };
+        GLint tableIndex = static_cast<GLint>(_uniforms.size());
+        _uniformList[info.name] = tableIndex;
+
+        // Arrays are reported as "name[0]"; make them reachable by their bare name as well.
+        std::string::size_type bracket = info.name.rfind("[0]");
+        if (bracket != std::string::npos && bracket + 3 == info.name.size()) {
+            _uniformList[info.name.substr(0, bracket)] = tableIndex;
+        }
+
+        _uniforms.push_back(info);
+    }
+
+    _uniformValues.resize(_uniforms.size());
+    for (size_t i = 0; i < _uniformValues.size(); ++i) {
+        _uniformValues[i].size = 0;
+    }
+}
+
+bool GLSLProgram::PrepareUniform(GLint index, const void* value, size_t size) const
+{
+    if (index < 0 || static_cast<size_t>(index) >= _uniformValues.size() || size > UniformValue::MAX_SIZE) {
+        return true;
+    }
+
+    UniformValue& cached = _uniformValues[index];
+    bool changed = cached.size != size || std::memcmp(cached.bytes, value, size) != 0;
+    GLStateCache::Count(GLStateCache::UNIFORM, !changed);
+    if (changed) {
+        std::memcpy(cached.bytes, value, size);
+        cached.size = size;
+    }
+    return changed;
+}
+
+bool GLSLProgram::PrepareUniform(const std::string& name, const void* value, size_t size, GLint& location) const
+{
+    GLint index = FindUniform(name);
+    if (index < 0) {
+        location = GetUniformLocation(name);
+        return true;
+    }
+    location = _uniforms[index].location;
+    return PrepareUniform(index, value, size);
+}
+
+GLint GLSLProgram::FindUniform(const std::string& uniform) const
+{
+    std::unordered_map<std::string, GLint>::const_iterator iterator = _uniformList.find(uniform);
+    return iterator != _uniformList.end() ? iterator->second : -1;
+}
+
+bool GLSLProgram::IsCompatibleUniformType(GLenum uniformType, GLenum requestedType)
+{
+    if (uniformType == requestedType || uniformType == GL_NONE) {
+        return true;
+    }
+
+    // Booleans and samplers are set through the integer entry points.
+    if (requestedType == GL_INT) {
+        switch (uniformType) {
+            case GL_BOOL :
+            case GL_SAMPLER_1D :
+            case GL_SAMPLER_2D :
+            case GL_SAMPLER_3D :
+            case GL_SAMPLER_CUBE :
+            case GL_SAMPLER_2D_SHADOW :
+            case GL_SAMPLER_2D_ARRAY :
+            case GL_SAMPLER_2D_ARRAY_SHADOW :
+            case GL_SAMPLER_CUBE_SHADOW :
+            case GL_SAMPLER_BUFFER :
+            case GL_INT_SAMPLER_BUFFER :
+            case GL_UNSIGNED_INT_SAMPLER_BUFFER :
+                return true;
+        }
+    }
+    return requestedType == GL_BOOL && uniformType == GL_INT;
+}
+
+void GLSLProgram::ReportUniformTypeMismatch(const std::string& uniform, GLenum uniformType, GLenum requestedType)
+{
+    std::cerr << "GLSLProgram::GetUniformHandle: " << uniform << " has GLSL type 0x" << std::hex << uniformType
+              << " but was requested as 0x" << requestedType << std::dec << std::endl;
 }
 
 std::string GLSLProgram::ToString() const
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstdint>
 #include <map>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 // GLEW: OpenGL Extension Wrangler
 #include <GL/glew.h>
@@ -9,6 +12,37 @@
 // GLM: OpenGL Math
 #include <glm/glm.hpp>
 
+#include "Transform.h"
+
+class ProgramBinaryCache;
+
+// A uniform location resolved once after linking. Pass it to the typed setters below to upload a
+// value without any name lookup. The template parameter records the GLSL type the handle was
+// resolved as, so a vec3 handle cannot be handed to setMat4 by accident.
+template <typename T>
+struct UniformHandle
+{
+    UniformHandle() : location(-1), index(-1) { }
+    UniformHandle(GLint location, GLint index) : location(location), index(index) { }
+
+    bool IsValid() const { return location >= 0; }
+
+    GLint location; // location in the program, -1 if the uniform is not active
+    GLint index;    // index into the program's reflected uniform table
+};
+
+// Maps a C++ type to the GLSL type it is uploaded as.
+template <typename T> struct UniformType;
+template <> struct UniformType<bool>      { static const GLenum value = GL_BOOL; };
+template <> struct UniformType<int>       { static const GLenum value = GL_INT; };
+template <> struct UniformType<float>     { static const GLenum value = GL_FLOAT; };
+template <> struct UniformType<glm::vec2> { static const GLenum value = GL_FLOAT_VEC2; };
+template <> struct UniformType<glm::vec3> { static const GLenum value = GL_FLOAT_VEC3; };
+template <> struct UniformType<glm::vec4> { static const GLenum value = GL_FLOAT_VEC4; };
+template <> struct UniformType<glm::mat2> { static const GLenum value = GL_FLOAT_MAT2; };
+template <> struct UniformType<glm::mat3> { static const GLenum value = GL_FLOAT_MAT3; };
+template <> struct UniformType<glm::mat4> { static const GLenum value = GL_FLOAT_MAT4; };
+
 class GLSLProgram final
 {
 public:
@@ -22,96 +56,310 @@ public:
 
     ~GLSLProgram();
 
+    // Shader stages are compiled when the program is linked, so that a cached binary can skip
+    // compilation entirely.
     void AddShader(GLenum shaderType, const GLchar* const source);
     void AddShader(GLenum shaderType, const std::string &source);
     void AddShaderFromFile(GLenum shaderType, const std::string &filename);
 
+    // Adds "#define name value" to every stage, directly after the #version line.
+    void AddDefine(const std::string& name, const std::string& value = "");
+
+    // Returns source with text inserted directly after its #version line, where the #defines go.
+    static std::string InsertAfterVersion(const std::string& source, const std::string& text);
+
     GLuint CreateAndLinkProgram();
 
+    // Two-phase version of CreateAndLinkProgram() used by ShaderCompiler. BeginLink() issues the
+    // compiles and the link without waiting on the driver; with GL_KHR_parallel_shader_compile the
+    // driver then builds on its own threads until IsLinkComplete() returns true. FinishLink()
+    // collects the results (blocking if the build is still running) and returns the program.
+    void BeginLink();
+    bool IsLinkComplete() const;
+    GLuint FinishLink();
+
+    // Gives this program the settings other was built with (its #defines and uniform block
+    // bindings) but not its stages, so a rebuild of other from new sources can be linked into this
+    // one and handed back with AdoptProgram().
+    void CopyBuildSettings(const GLSLProgram& other);
+
+    // Takes over rebuilt's linked program in place of this one's, which is deleted, so everything
+    // holding a reference to this GLSLProgram draws with the new code from then on. Fails, keeping
+    // the current program, if rebuilt didn't link. The uniform table is the new program's; every
+    // uniform is back at its default, and handles resolved before the swap are stale (see
+    // GetGeneration()).
+    bool AdoptProgram(GLSLProgram& rebuilt);
+
+    // Counts successful links and adoptions. A UniformHandle resolved under an earlier generation
+    // must be resolved again.
+    unsigned int GetGeneration() const { return _generation; }
+
+    // Programs created after this call are looked up in (and written to) cache. Pass nullptr to
+    // disable caching. The cache must outlive every program that uses it.
+    static void SetBinaryCache(ProgramBinaryCache* cache);
+
     GLuint IsCreated() const;
 
+    GLuint GetProgramHandle() const { return _shaderProgramHandle; }
+
     void UseProgram();
 
     void DeleteProgram();
 
+    // Connects the named uniform block to a binding point. May be called before the program is
+    // linked; the binding is (re)applied after every successful link.
+    void SetUniformBlockBinding(const std::string& blockName, GLuint bindingPoint);
+
     GLint AddAttribute(const std::string& attribute);
     GLint AddUniform(const std::string& uniform);
 
     GLuint GetAttributeLocation(const std::string& attribute) const;
-    GLuint GetUniformLocation(const std::string& uniform) const;
+    GLint GetUniformLocation(const std::string& uniform) const;
+
+    // Resolves a uniform to a typed handle. Returns an invalid handle (and logs) if the uniform is
+    // not active or its GLSL type does not match T.
+    template <typename T>
+    UniformHandle<T> GetUniformHandle(const std::string& uniform) const
+    {
+        GLint index = FindUniform(uniform);
+        if (index < 0) {
+            return UniformHandle<T>();
+        }
+        if (!IsCompatibleUniformType(_uniforms[index].type, UniformType<T>::value)) {
+            ReportUniformTypeMismatch(uniform, _uniforms[index].type, UniformType<T>::value);
+            return UniformHandle<T>();
+        }
+        return UniformHandle<T>(_uniforms[index].location, index);
+    }
 
     std::string ToString() const;
 
     // Uniform convenience functions =============================================================
+    // Each program remembers the last value set for every uniform in its table and skips uploads
+    // that wouldn't change anything (counted in GLStateCache's statistics).
 
     void setBool(const std::string& name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(_shaderProgramHandle, name.c_str()), (int)value);
+        setInt(name, (int)value);
     }
 
     void setInt(const std::string &name, int value) const
     {
-        glUniform1i(glGetUniformLocation(_shaderProgramHandle, name.c_str()), value);
+        GLint location;
+        if (PrepareUniform(name, &value, sizeof(value), location)) {
+            glUniform1i(location, value);
+        }
     }
 
     void setFloat(const std::string& name, float value) const
     {
-        glUniform1f(glGetUniformLocation(_shaderProgramHandle, name.c_str()), value);
+        GLint location;
+        if (PrepareUniform(name, &value, sizeof(value), location)) {
+            glUniform1f(location, value);
+        }
     }
 
     void setVec2(const std::string& name, const glm::vec2& value) const
     {
-        glUniform2fv(glGetUniformLocation(_shaderProgramHandle, name.c_str()), 1, &value[0]);
+        GLint location;
+        if (PrepareUniform(name, &value[0], sizeof(value), location)) {
+            glUniform2fv(location, 1, &value[0]);
+        }
     }
 
     void setVec2(const std::string& name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(_shaderProgramHandle, name.c_str()), x, y);
+        setVec2(name, glm::vec2(x, y));
     }
 
     void setVec3(const std::string& name, const glm::vec3& value) const
     {
-        glUniform3fv(glGetUniformLocation(_shaderProgramHandle, name.c_str()), 1, &value[0]);
+        GLint location;
+        if (PrepareUniform(name, &value[0], sizeof(value), location)) {
+            glUniform3fv(location, 1, &value[0]);
+        }
     }
 
     void setVec3(const std::string& name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(_shaderProgramHandle, name.c_str()), x, y, z);
+        setVec3(name, glm::vec3(x, y, z));
     }
 
     void setVec4(const std::string& name, const glm::vec4& value) const
     {
-        glUniform4fv(glGetUniformLocation(_shaderProgramHandle, name.c_str()), 1, &value[0]);
+        GLint location;
+        if (PrepareUniform(name, &value[0], sizeof(value), location)) {
+            glUniform4fv(location, 1, &value[0]);
+        }
     }
-    void setVec4(const std::string& name, float x, float y, float z, float w)
+    void setVec4(const std::string& name, float x, float y, float z, float w) const
     {
-        glUniform4f(glGetUniformLocation(_shaderProgramHandle, name.c_str()), x, y, z, w);
+        setVec4(name, glm::vec4(x, y, z, w));
     }
 
     void setMat2(const std::string& name, const glm::mat2& mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(_shaderProgramHandle, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        GLint location;
+        if (PrepareUniform(name, &mat[0][0], sizeof(mat), location)) {
+            glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]);
+        }
     }
 
     void setMat3(const std::string& name, const glm::mat3& mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(_shaderProgramHandle, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        GLint location;
+        if (PrepareUniform(name, &mat[0][0], sizeof(mat), location)) {
+            glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]);
+        }
     }
 
     void setMat4(const std::string& name, const glm::mat4& mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(_shaderProgramHandle, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        GLint location;
+        if (PrepareUniform(name, &mat[0][0], sizeof(mat), location)) {
+            glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
+        }
+    }
+
+    // Handle-based setters; no lookup at all. The program must be in use.
+
+    void setBool(UniformHandle<bool> handle, bool value) const
+    {
+        int intValue = (int)value;
+        if (PrepareUniform(handle.index, &intValue, sizeof(intValue))) {
+            glUniform1i(handle.location, intValue);
+        }
+    }
+
+    void setInt(UniformHandle<int> handle, int value) const
+    {
+        if (PrepareUniform(handle.index, &value, sizeof(value))) {
+            glUniform1i(handle.location, value);
+        }
+    }
+
+    void setFloat(UniformHandle<float> handle, float value) const
+    {
+        if (PrepareUniform(handle.index, &value, sizeof(value))) {
+            glUniform1f(handle.location, value);
+        }
+    }
+
+    void setVec2(UniformHandle<glm::vec2> handle, const glm::vec2& value) const
+    {
+        if (PrepareUniform(handle.index, &value[0], sizeof(value))) {
+            glUniform2fv(handle.location, 1, &value[0]);
+        }
+    }
+
+    void setVec3(UniformHandle<glm::vec3> handle, const glm::vec3& value) const
+    {
+        if (PrepareUniform(handle.index, &value[0], sizeof(value))) {
+            glUniform3fv(handle.location, 1, &value[0]);
+        }
+    }
+
+    void setVec3(UniformHandle<glm::vec3> handle, float x, float y, float z) const
+    {
+        setVec3(handle, glm::vec3(x, y, z));
+    }
+
+    void setVec4(UniformHandle<glm::vec4> handle, const glm::vec4& value) const
+    {
+        if (PrepareUniform(handle.index, &value[0], sizeof(value))) {
+            glUniform4fv(handle.location, 1, &value[0]);
+        }
+    }
+
+    void setMat2(UniformHandle<glm::mat2> handle, const glm::mat2& mat) const
+    {
+        if (PrepareUniform(handle.index, &mat[0][0], sizeof(mat))) {
+            glUniformMatrix2fv(handle.location, 1, GL_FALSE, &mat[0][0]);
+        }
+    }
+
+    void setMat3(UniformHandle<glm::mat3> handle, const glm::mat3& mat) const
+    {
+        if (PrepareUniform(handle.index, &mat[0][0], sizeof(mat))) {
+            glUniformMatrix3fv(handle.location, 1, GL_FALSE, &mat[0][0]);
+        }
+    }
+
+    // Uploads the normal matrix for model (see Transform.h); pass hasUniformScale when model is
+    // known to be a rotation, translation and uniform scale to skip the cofactor computation.
+    void setNormalMatrix(UniformHandle<glm::mat3> handle, const glm::mat4& model, bool hasUniformScale = false) const
+    {
+        setMat3(handle, NormalMatrix(model, hasUniformScale));
+    }
+
+    void setMat4(UniformHandle<glm::mat4> handle, const glm::mat4& mat) const
+    {
+        if (PrepareUniform(handle.index, &mat[0][0], sizeof(mat))) {
+            glUniformMatrix4fv(handle.location, 1, GL_FALSE, &mat[0][0]);
+        }
     }
 
 private:
+    // An active uniform as reported by the driver after linking.
+    struct UniformInfo
+    {
+        std::string name;
+        GLint location;
+        GLint size;     // array size, 1 for non-arrays
+        GLenum type;
+    };
+
+    // The last value uploaded to a uniform, compared against before the next upload.
+    struct UniformValue
+    {
+        static const size_t MAX_SIZE = sizeof(glm::mat4);
+
+        size_t size;    // 0 until a value has been set
+        unsigned char bytes[MAX_SIZE];
+    };
+
+    // A shader stage added but not yet compiled.
+    struct ShaderStage
+    {
+        GLenum type;
+        std::string source;
+    };
+
+    std::string PreprocessSource(const std::string& source) const;
+    static GLuint CompileShader(GLenum shaderType, const std::string& source);
+    static void ReportCompileErrors(GLuint shader);
+
+    void ReflectUniforms();
+
+    // Returns true if the value differs from the last one set for the uniform (or the uniform isn't
+    // in the table), recording it as the new value. The name overload also looks up the location.
+    bool PrepareUniform(GLint index, const void* value, size_t size) const;
+    bool PrepareUniform(const std::string& name, const void* value, size_t size, GLint& location) const;
+    void ApplyUniformBlockBindings() const;
+    GLint FindUniform(const std::string& uniform) const;
+
+    static bool IsCompatibleUniformType(GLenum uniformType, GLenum requestedType);
+    static void ReportUniformTypeMismatch(const std::string& uniform, GLenum uniformType, GLenum requestedType);
+
     GLuint _shaderProgramHandle;
 
     GLint _didLink; // GL_TRUE if the GLSL program was successfully created and linked
+    unsigned int _generation;
 
-    GLuint _vertexShader;
-    GLuint _fragmentShader;
-    GLuint _geometryShader;
+    std::vector<ShaderStage> _stages;
+    std::vector<std::string> _defines;  // "#define ..." lines injected into every stage
+
+    bool _linkPending;                  // BeginLink() was called but FinishLink() wasn't
+    std::vector<GLuint> _pendingShaders;
+    uint64_t _pendingCacheKey;          // key to store the binary under once linked, 0 if none
 
     std::map<std::string, GLuint> _attributeList;   // maps attribute names to locations
-    std::map<std::string, GLuint> _uniformList;     // maps uniform names to locations
+
+    std::vector<UniformInfo> _uniforms;                 // active uniforms, reflected once after linking
+    std::unordered_map<std::string, GLint> _uniformList; // maps uniform names to indices in _uniforms
+    mutable std::vector<UniformValue> _uniformValues;   // parallel to _uniforms
+
+    std::map<std::string, GLuint> _blockBindings;   // maps uniform block names to binding points
+
+    static ProgramBinaryCache* _binaryCache;
 };
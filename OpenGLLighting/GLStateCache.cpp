@@ -0,0 +1,245 @@
+#include "GLStateCache.h"
+
+#include <cstring>
+
+GLuint GLStateCache::_program = GLStateCache::UNKNOWN;
+GLuint GLStateCache::_vertexArray = GLStateCache::UNKNOWN;
+GLuint GLStateCache::_buffers[4] = { UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN };
+GLStateCache::BufferRange GLStateCache::_uniformBufferRanges[GLStateCache::MAX_INDEXED_BINDINGS];  // zeroed: not known
+int GLStateCache::_capabilities[3] = { -1, -1, -1 };
+GLenum GLStateCache::_depthFunc = GLStateCache::UNKNOWN;
+int GLStateCache::_depthMask = -1;
+GLenum GLStateCache::_blendSource = GLStateCache::UNKNOWN;
+GLenum GLStateCache::_blendDestination = GLStateCache::UNKNOWN;
+GLfloat GLStateCache::_clearColor[4];
+bool GLStateCache::_clearColorKnown = false;
+GLStateCache::Statistics GLStateCache::_statistics;
+
+void GLStateCache::UseProgram(GLuint program)
+{
+    if (program == _program) {
+        Count(PROGRAM, true);
+        return;
+    }
+    Count(PROGRAM, false);
+    glUseProgram(program);
+    _program = program;
+}
+
+void GLStateCache::BindVertexArray(GLuint vertexArray)
+{
+    if (vertexArray == _vertexArray) {
+        Count(VERTEX_ARRAY, true);
+        return;
+    }
+    Count(VERTEX_ARRAY, false);
+    glBindVertexArray(vertexArray);
+    _vertexArray = vertexArray;
+
+    // The element buffer binding belongs to the vertex array.
+    _buffers[BufferTargetSlot(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+}
+
+void GLStateCache::BindBuffer(GLenum target, GLuint buffer)
+{
+    int slot = BufferTargetSlot(target);
+    if (slot >= 0 && _buffers[slot] == buffer) {
+        Count(BUFFER, true);
+        return;
+    }
+    Count(BUFFER, false);
+    glBindBuffer(target, buffer);
+    if (slot >= 0) {
+        _buffers[slot] = buffer;
+    }
+}
+
+void GLStateCache::BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    if (target == GL_UNIFORM_BUFFER && index < MAX_INDEXED_BINDINGS) {
+        BufferRange& range = _uniformBufferRanges[index];
+        if (range.known && range.buffer == buffer && range.offset == offset && range.size == size) {
+            Count(BUFFER, true);
+            return;
+        }
+        range.known = true;
+        range.buffer = buffer;
+        range.offset = offset;
+        range.size = size;
+    }
+    Count(BUFFER, false);
+    glBindBufferRange(target, index, buffer, offset, size);
+
+    // Binding a range also binds the buffer to the generic target.
+    int slot = BufferTargetSlot(target);
+    if (slot >= 0) {
+        _buffers[slot] = buffer;
+    }
+}
+
+void GLStateCache::Enable(GLenum capability)
+{
+    int slot = CapabilitySlot(capability);
+    if (slot >= 0 && _capabilities[slot] == 1) {
+        Count(CAPABILITY, true);
+        return;
+    }
+    Count(CAPABILITY, false);
+    glEnable(capability);
+    if (slot >= 0) {
+        _capabilities[slot] = 1;
+    }
+}
+
+void GLStateCache::Disable(GLenum capability)
+{
+    int slot = CapabilitySlot(capability);
+    if (slot >= 0 && _capabilities[slot] == 0) {
+        Count(CAPABILITY, true);
+        return;
+    }
+    Count(CAPABILITY, false);
+    glDisable(capability);
+    if (slot >= 0) {
+        _capabilities[slot] = 0;
+    }
+}
+
+void GLStateCache::DepthFunc(GLenum function)
+{
+    if (function == _depthFunc) {
+        Count(DEPTH_BLEND, true);
+        return;
+    }
+    Count(DEPTH_BLEND, false);
+    glDepthFunc(function);
+    _depthFunc = function;
+}
+
+void GLStateCache::DepthMask(GLboolean flag)
+{
+    int mask = flag ? 1 : 0;
+    if (mask == _depthMask) {
+        Count(DEPTH_BLEND, true);
+        return;
+    }
+    Count(DEPTH_BLEND, false);
+    glDepthMask(flag);
+    _depthMask = mask;
+}
+
+void GLStateCache::BlendFunc(GLenum sourceFactor, GLenum destinationFactor)
+{
+    if (sourceFactor == _blendSource && destinationFactor == _blendDestination) {
+        Count(DEPTH_BLEND, true);
+        return;
+    }
+    Count(DEPTH_BLEND, false);
+    glBlendFunc(sourceFactor, destinationFactor);
+    _blendSource = sourceFactor;
+    _blendDestination = destinationFactor;
+}
+
+void GLStateCache::ClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+{
+    const GLfloat color[4] = { red, green, blue, alpha };
+    if (_clearColorKnown && std::memcmp(color, _clearColor, sizeof(color)) == 0) {
+        Count(CLEAR_COLOR, true);
+        return;
+    }
+    Count(CLEAR_COLOR, false);
+    glClearColor(red, green, blue, alpha);
+    std::memcpy(_clearColor, color, sizeof(color));
+    _clearColorKnown = true;
+}
+
+void GLStateCache::DeleteProgram(GLuint program)
+{
+    glDeleteProgram(program);
+    if (program == _program) {
+        _program = UNKNOWN;
+    }
+}
+
+void GLStateCache::DeleteVertexArray(GLuint vertexArray)
+{
+    glDeleteVertexArrays(1, &vertexArray);
+    if (vertexArray == _vertexArray) {
+        _vertexArray = UNKNOWN;
+        _buffers[BufferTargetSlot(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+    }
+}
+
+void GLStateCache::DeleteBuffer(GLuint buffer)
+{
+    glDeleteBuffers(1, &buffer);
+    for (unsigned int i = 0; i < sizeof(_buffers) / sizeof(_buffers[0]); ++i) {
+        if (_buffers[i] == buffer) {
+            _buffers[i] = UNKNOWN;
+        }
+    }
+    for (unsigned int i = 0; i < MAX_INDEXED_BINDINGS; ++i) {
+        if (_uniformBufferRanges[i].buffer == buffer) {
+            _uniformBufferRanges[i].known = false;
+        }
+    }
+}
+
+void GLStateCache::Invalidate()
+{
+    _program = UNKNOWN;
+    _vertexArray = UNKNOWN;
+    for (unsigned int i = 0; i < sizeof(_buffers) / sizeof(_buffers[0]); ++i) {
+        _buffers[i] = UNKNOWN;
+    }
+    for (unsigned int i = 0; i < MAX_INDEXED_BINDINGS; ++i) {
+        _uniformBufferRanges[i].known = false;
+    }
+    for (unsigned int i = 0; i < sizeof(_capabilities) / sizeof(_capabilities[0]); ++i) {
+        _capabilities[i] = -1;
+    }
+    _depthFunc = UNKNOWN;
+    _depthMask = -1;
+    _blendSource = _blendDestination = UNKNOWN;
+    _clearColorKnown = false;
+}
+
+void GLStateCache::ResetStatistics()
+{
+    std::memset(&_statistics, 0, sizeof(_statistics));
+}
+
+const char* GLStateCache::StateKindName(StateKind kind)
+{
+    switch (kind) {
+        case PROGRAM: return "program";
+        case VERTEX_ARRAY: return "vertex array";
+        case BUFFER: return "buffer";
+        case CAPABILITY: return "enable/disable";
+        case DEPTH_BLEND: return "depth/blend";
+        case CLEAR_COLOR: return "clear color";
+        case UNIFORM: return "uniform";
+        default: return "unknown";
+    }
+}
+
+int GLStateCache::BufferTargetSlot(GLenum target)
+{
+    switch (target) {
+        case GL_ARRAY_BUFFER: return 0;
+        case GL_ELEMENT_ARRAY_BUFFER: return 1;
+        case GL_UNIFORM_BUFFER: return 2;
+        case GL_COPY_WRITE_BUFFER: return 3;
+        default: return -1;
+    }
+}
+
+int GLStateCache::CapabilitySlot(GLenum capability)
+{
+    switch (capability) {
+        case GL_DEPTH_TEST: return 0;
+        case GL_BLEND: return 1;
+        case GL_CULL_FACE: return 2;
+        default: return -1;
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+// Shadows the GL state the renderer changes every frame and drops calls that would set it to
+// what it already is: the current program, the vertex array, buffer bindings (including indexed
+// uniform buffer ranges), depth and blend state and the clear color. GLSLProgram keeps a similar
+// cache of each program's uniform values and reports into the same counters.
+//
+// The cache only works if everything goes through it. Code that changes this state with direct GL
+// calls must call Invalidate() afterwards. Objects must be deleted through the Delete*() functions
+// so a recycled name isn't mistaken for the one still cached. There is one GL context, so the
+// cache is global.
+class GLStateCache final
+{
+public:
+    // Kinds of state, for the statistics.
+    enum StateKind
+    {
+        PROGRAM,
+        VERTEX_ARRAY,
+        BUFFER,
+        CAPABILITY,     // glEnable/glDisable
+        DEPTH_BLEND,    // glDepthFunc, glDepthMask, glBlendFunc
+        CLEAR_COLOR,
+        UNIFORM,
+        STATE_KIND_COUNT
+    };
+
+    struct Statistics
+    {
+        unsigned int issued[STATE_KIND_COUNT];
+        unsigned int skipped[STATE_KIND_COUNT];
+    };
+
+    GLStateCache() = delete;
+
+    static void UseProgram(GLuint program);
+    static void BindVertexArray(GLuint vertexArray);
+    static void BindBuffer(GLenum target, GLuint buffer);
+    static void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+    static void Enable(GLenum capability);
+    static void Disable(GLenum capability);
+    static void DepthFunc(GLenum function);
+    static void DepthMask(GLboolean flag);
+    static void BlendFunc(GLenum sourceFactor, GLenum destinationFactor);
+    static void ClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+
+    static void DeleteProgram(GLuint program);
+    static void DeleteVertexArray(GLuint vertexArray);
+    static void DeleteBuffer(GLuint buffer);
+
+    // Forgets everything, so the next call of each kind reaches the driver.
+    static void Invalidate();
+
+    // For cached state kept elsewhere (GLSLProgram's uniform values).
+    static void Count(StateKind kind, bool skipped)
+    {
+        ++(skipped ? _statistics.skipped : _statistics.issued)[kind];
+    }
+
+    static const Statistics& GetStatistics() { return _statistics; }
+    static void ResetStatistics();
+    static const char* StateKindName(StateKind kind);
+
+private:
+    static const unsigned int MAX_INDEXED_BINDINGS = 16;
+
+    // GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_COPY_WRITE_BUFFER, and
+    // everything else uncached.
+    static int BufferTargetSlot(GLenum target);
+    static int CapabilitySlot(GLenum capability);
+
+    struct BufferRange
+    {
+        bool known;             // false until bound through the cache
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    static const GLuint UNKNOWN = 0xffffffffu;
+
+    static GLuint _program;
+    static GLuint _vertexArray;
+    static GLuint _buffers[4];
+    static BufferRange _uniformBufferRanges[MAX_INDEXED_BINDINGS];
+    static int _capabilities[3];        // -1 unknown, 0 disabled, 1 enabled
+    static GLenum _depthFunc;
+    static int _depthMask;              // -1 unknown
+    static GLenum _blendSource;
+    static GLenum _blendDestination;
+    static GLfloat _clearColor[4];
+    static bool _clearColorKnown;
+
+    static Statistics _statistics;
+};
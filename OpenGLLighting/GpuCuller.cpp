@@ -0,0 +1,197 @@
+#include "GpuCuller.h"
+
+#include <cstring>
+
+#include "Frustum.h"
+#include "GLSLProgram.h"
+#include "GLStateCache.h"
+#include "RenderQueue.h"
+#include "StreamBuffer.h"
+#include "UniformBlocks.h"
+
+namespace {
+
+// Must match local_size_x in cull.comp.
+const GLuint CULL_GROUP_SIZE = 64;
+
+size_t AlignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+}
+
+bool GpuCuller::IsSupported()
+{
+    return GLEW_VERSION_4_3;
+}
+
+GpuCuller::GpuCuller(GLSLProgram& cullProgram, size_t capacity) :
+    _program(cullProgram),
+    _capacity(capacity),
+    _objectCount(0),
+    _storageAlignment(16),
+    _commandBuffer(0),
+    _objectMeshBuffer(0),
+    _meshRadiusBuffer(0),
+    _visibleBuffer(0),
+    _visibleNormalMatrixOffset(0),
+    _modelOffset(-1),
+    _normalMatrixOffset(-1),
+    _hasCulled(false),
+    _drawCalls(0)
+{
+    GLint alignment = 0;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if (alignment > 0) {
+        _storageAlignment = static_cast<size_t>(alignment);
+    }
+
+    glGenBuffers(1, &_commandBuffer);
+    glGenBuffers(1, &_objectMeshBuffer);
+    glGenBuffers(1, &_meshRadiusBuffer);
+
+    // Written by the shader, read by the draws; never touched by the CPU.
+    _visibleNormalMatrixOffset = static_cast<GLintptr>(AlignUp(capacity * sizeof(glm::mat4), _storageAlignment));
+    glGenBuffers(1, &_visibleBuffer);
+    GLStateCache::BindBuffer(GL_COPY_WRITE_BUFFER, _visibleBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, _visibleNormalMatrixOffset + capacity * sizeof(glm::mat3), nullptr, GL_DYNAMIC_COPY);
+}
+
+GpuCuller::~GpuCuller()
+{
+    GLStateCache::DeleteBuffer(_commandBuffer);
+    GLStateCache::DeleteBuffer(_objectMeshBuffer);
+    GLStateCache::DeleteBuffer(_meshRadiusBuffer);
+    GLStateCache::DeleteBuffer(_visibleBuffer);
+}
+
+uint32_t GpuCuller::AddMesh(GLsizei indexCount, GLuint firstIndex, GLint baseVertex, float radius)
+{
+    DrawElementsIndirectCommand command = { static_cast<GLuint>(indexCount), 0, firstIndex, baseVertex, 0 };
+    _commands.push_back(command);
+    _meshRadii.push_back(radius);
+    return static_cast<uint32_t>(_commands.size() - 1);
+}
+
+void GpuCuller::SetObjects(const uint32_t* objectMeshes, size_t count)
+{
+    _objectCount = count < _capacity ? count : _capacity;
+
+    // Each mesh's instances go in their own range of the visible buffer, sized for the case where
+    // all of its objects are visible; baseInstance points the draw at it.
+    std::vector<GLuint> meshObjects(_commands.size(), 0);
+    for (size_t i = 0; i < _objectCount; ++i) {
+        ++meshObjects[objectMeshes[i]];
+    }
+    GLuint baseInstance = 0;
+    for (size_t mesh = 0; mesh < _commands.size(); ++mesh) {
+        _commands[mesh].baseInstance = baseInstance;
+        baseInstance += meshObjects[mesh];
+    }
+
+    GLStateCache::BindBuffer(GL_COPY_WRITE_BUFFER, _objectMeshBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, _objectCount * sizeof(uint32_t), objectMeshes, GL_STATIC_DRAW);
+
+    GLStateCache::BindBuffer(GL_COPY_WRITE_BUFFER, _meshRadiusBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, _meshRadii.size() * sizeof(float), _meshRadii.data(), GL_STATIC_DRAW);
+
+    GLStateCache::BindBuffer(GL_COPY_WRITE_BUFFER, _commandBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, _commands.size() * sizeof(DrawElementsIndirectCommand), _commands.data(), GL_DYNAMIC_DRAW);
+}
+
+void GpuCuller::Upload(StreamBuffer& streamBuffer, const glm::mat4* models, const glm::mat3* normalMatrices,
+                       const glm::mat4& viewProjection)
+{
+    _modelOffset = _normalMatrixOffset = -1;
+    if (_objectCount == 0 || _commands.empty()) {
+        return;
+    }
+
+    StreamBuffer::Allocation modelAllocation = streamBuffer.Allocate(_objectCount * sizeof(glm::mat4), _storageAlignment);
+    StreamBuffer::Allocation normalMatrixAllocation =
+            streamBuffer.Allocate(_objectCount * sizeof(glm::mat3), _storageAlignment);
+    if (modelAllocation.data == nullptr || normalMatrixAllocation.data == nullptr) {
+        return;
+    }
+    std::memcpy(modelAllocation.data, models, _objectCount * sizeof(glm::mat4));
+    std::memcpy(normalMatrixAllocation.data, normalMatrices, _objectCount * sizeof(glm::mat3));
+
+    CullBlock cullBlock;
+    ExtractFrustumPlanes(viewProjection, cullBlock.planes);
+    cullBlock.objectCount = glm::uvec4(static_cast<GLuint>(_objectCount), 0, 0, 0);
+    streamBuffer.BindUniformBlock(CULL_BLOCK_BINDING, cullBlock);   // flushes the matrices too
+
+    _modelOffset = modelAllocation.offset;
+    _normalMatrixOffset = normalMatrixAllocation.offset;
+}
+
+void GpuCuller::Cull(StreamBuffer& streamBuffer)
+{
+    _hasCulled = false;
+    if (_modelOffset < 0) {
+        return;
+    }
+
+    // Reset the instance counts; the shader counts the survivors up from zero.
+    GLStateCache::BindBuffer(GL_COPY_WRITE_BUFFER, _commandBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, _commands.size() * sizeof(DrawElementsIndirectCommand), _commands.data());
+
+    const GLuint stream = streamBuffer.GetBufferHandle();
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, MODELS_BINDING, stream, _modelOffset, _objectCount * sizeof(glm::mat4));
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, NORMAL_MATRICES_BINDING, stream, _normalMatrixOffset,
+                      _objectCount * sizeof(glm::mat3));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OBJECT_MESHES_BINDING, _objectMeshBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_RADII_BINDING, _meshRadiusBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMANDS_BINDING, _commandBuffer);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, VISIBLE_MODELS_BINDING, _visibleBuffer, 0,
+                      _capacity * sizeof(glm::mat4));
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, VISIBLE_NORMAL_MATRICES_BINDING, _visibleBuffer,
+                      _visibleNormalMatrixOffset, _capacity * sizeof(glm::mat3));
+
+    _program.UseProgram();
+    glDispatchCompute(static_cast<GLuint>((_objectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE), 1, 1);
+
+    // The draw reads the commands and the instance attributes the shader wrote.
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    _hasCulled = true;
+}
+
+void GpuCuller::Draw(GLuint vertexArray, GLenum indexType)
+{
+    _drawCalls = 0;
+    if (!_hasCulled) {
+        return;
+    }
+
+    GLStateCache::BindVertexArray(vertexArray);
+    GLStateCache::BindBuffer(GL_ARRAY_BUFFER, _visibleBuffer);
+    for (GLuint column = 0; column < 4; ++column) {
+        glVertexAttribPointer(RenderQueue::INSTANCE_MODEL_LOCATION + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                              (void*)(column * sizeof(glm::vec4)));
+    }
+    for (GLuint column = 0; column < 3; ++column) {
+        glVertexAttribPointer(RenderQueue::INSTANCE_NORMAL_MATRIX_LOCATION + column, 3, GL_FLOAT, GL_FALSE,
+                              sizeof(glm::mat3), (void*)(_visibleNormalMatrixOffset + column * sizeof(glm::vec3)));
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _commandBuffer);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, nullptr, static_cast<GLsizei>(_commands.size()), 0);
+    _drawCalls = 1;
+}
+
+size_t GpuCuller::ReadVisibleCount() const
+{
+    std::vector<DrawElementsIndirectCommand> commands(_commands.size());
+    if (commands.empty()) {
+        return 0;
+    }
+    GLStateCache::BindBuffer(GL_COPY_WRITE_BUFFER, _commandBuffer);
+    glGetBufferSubData(GL_COPY_WRITE_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+
+    size_t visible = 0;
+    for (const DrawElementsIndirectCommand& command : commands) {
+        visible += command.instanceCount;
+    }
+    return visible;
+}
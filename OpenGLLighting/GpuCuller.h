@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+
+class GLSLProgram;
+class StreamBuffer;
+
+// GPU-driven frustum culling and drawing for large numbers of instanced objects.
+//
+// Every frame the objects' model and normal matrices are streamed, and a compute shader (cull.comp)
+// tests each object's bounding sphere against the frustum. Survivors are appended to their mesh's
+// range of a visible instance buffer, and counted in that mesh's DrawElementsIndirectCommand. One
+// glMultiDrawElementsIndirect then draws every mesh, so the CPU issues the same two calls (a
+// dispatch and a draw) whatever the number of objects, and never learns how many were visible.
+//
+// Meshes drawn together share one vertex array and index buffer; each is a range of the indices.
+// Needs compute shaders, shader storage buffers and multi-draw indirect, i.e. GL 4.3; check
+// IsSupported() first (macOS stops at 4.1, where the render queue draws everything instead).
+class GpuCuller final
+{
+public:
+    // GL_SHADER_STORAGE_BUFFER binding points used by cull.comp.
+    enum StorageBinding
+    {
+        MODELS_BINDING = 0,
+        NORMAL_MATRICES_BINDING = 1,
+        OBJECT_MESHES_BINDING = 2,
+        MESH_RADII_BINDING = 3,
+        COMMANDS_BINDING = 4,
+        VISIBLE_MODELS_BINDING = 5,
+        VISIBLE_NORMAL_MATRICES_BINDING = 6
+    };
+
+    // The layout glMultiDrawElementsIndirect reads.
+    struct DrawElementsIndirectCommand
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    static bool IsSupported();
+
+    // cullProgram is the linked cull.comp program; capacity is the largest number of objects.
+    GpuCuller(GLSLProgram& cullProgram, size_t capacity);
+
+    GpuCuller(const GpuCuller& rhs) = delete;
+    GpuCuller& operator=(const GpuCuller& rhs) = delete;
+
+    ~GpuCuller();
+
+    // Registers a range of the shared index buffer. radius is the mesh's model-space bounding
+    // sphere radius, centred on the origin. Returns the mesh id for SetObjects().
+    uint32_t AddMesh(GLsizei indexCount, GLuint firstIndex, GLint baseVertex, float radius);
+
+    // Assigns a mesh to each object, count <= capacity. Call once the meshes are added and again
+    // whenever the scene changes, not every frame: it sizes each mesh's instance range.
+    void SetObjects(const uint32_t* objectMeshes, size_t count);
+
+    // Streams the transforms (count as given to SetObjects()) and the frustum. Must come between
+    // the stream buffer's BeginFrame() and EndFrame().
+    void Upload(StreamBuffer& streamBuffer, const glm::mat4* models, const glm::mat3* normalMatrices,
+                const glm::mat4& viewProjection);
+
+    // Dispatches the culling shader over what Upload() streamed.
+    void Cull(StreamBuffer& streamBuffer);
+
+    // Draws the visible instances of every mesh with one call. The caller binds the program and
+    // its uniform blocks; vertexArray must have the instance attributes enabled at RenderQueue's
+    // locations.
+    void Draw(GLuint vertexArray, GLenum indexType);
+
+    // Draw calls issued by the last Draw() (0 or 1).
+    unsigned int GetDrawCalls() const { return _drawCalls; }
+
+    // Reads back how many objects survived the last Cull(). Waits for the GPU; for reports only.
+    size_t ReadVisibleCount() const;
+
+private:
+    GLSLProgram& _program;
+    size_t _capacity;
+    size_t _objectCount;
+    size_t _storageAlignment;   // GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT
+
+    std::vector<DrawElementsIndirectCommand> _commands;     // instanceCount zero: the per-frame reset
+    std::vector<float> _meshRadii;
+
+    GLuint _commandBuffer;
+    GLuint _objectMeshBuffer;
+    GLuint _meshRadiusBuffer;
+    GLuint _visibleBuffer;          // visible models, then visible normal matrices
+    GLintptr _visibleNormalMatrixOffset;
+
+    GLintptr _modelOffset;          // where Upload() streamed the transforms, -1 if it failed
+    GLintptr _normalMatrixOffset;
+    bool _hasCulled;
+    unsigned int _drawCalls;
+};
@@ -0,0 +1,229 @@
+#include "HeadlessContext.h"
+
+#include <cstring>
+
+#if defined(__linux__)
+#define HEADLESS_CONTEXT_EGL 1
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+HeadlessContext::HeadlessContext(int width, int height) :
+    _width(width),
+    _height(height),
+    _display(nullptr),
+    _config(nullptr),
+    _context(nullptr),
+    _sharedContext(nullptr),
+    _framebuffer(0),
+    _colorBuffer(0),
+    _depthBuffer(0)
+{
+    if (CreateContext()) {
+        if (!CreateFramebuffer()) {
+            DestroyContext();
+        }
+    }
+}
+
+HeadlessContext::~HeadlessContext()
+{
+    if (_framebuffer != 0) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &_framebuffer);
+        glDeleteRenderbuffers(1, &_colorBuffer);
+        glDeleteRenderbuffers(1, &_depthBuffer);
+    }
+    DestroyContext();
+}
+
+#if defined(HEADLESS_CONTEXT_EGL)
+
+namespace {
+
+// The same version the window asks for in InitGlfw().
+const EGLint CONTEXT_ATTRIBUTES[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 4,
+    EGL_CONTEXT_MINOR_VERSION, 1,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+};
+
+bool HasExtension(const char* extensions, const char* name)
+{
+    if (extensions == nullptr) {
+        return false;
+    }
+    size_t length = std::strlen(name);
+    for (const char* found = std::strstr(extensions, name); found != nullptr; found = std::strstr(found + length, name)) {
+        if ((found == extensions || found[-1] == ' ') && (found[length] == ' ' || found[length] == '\0')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
+bool HeadlessContext::CreateContext()
+{
+    // Prefer Mesa's surfaceless platform, which needs neither X nor a DRM device; fall back to the
+    // default display.
+    EGLDisplay display = EGL_NO_DISPLAY;
+    const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (HasExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+                reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (getPlatformDisplay != nullptr) {
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        }
+    }
+    if (display == EGL_NO_DISPLAY) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    EGLint major = 0, minor = 0;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        _error = "no EGL display";
+        return false;
+    }
+    _display = display;
+
+    if (!HasExtension(eglQueryString(display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+        _error = "EGL_KHR_surfaceless_context is not supported";
+        DestroyContext();
+        return false;
+    }
+
+    const EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0) {
+        _error = "no EGL config for desktop OpenGL";
+        DestroyContext();
+        return false;
+    }
+    _config = config;
+
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, CONTEXT_ATTRIBUTES);
+    if (context == EGL_NO_CONTEXT) {
+        _error = "eglCreateContext failed for an OpenGL 4.1 core context";
+        DestroyContext();
+        return false;
+    }
+    _context = context;
+
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        _error = "eglMakeCurrent failed";
+        DestroyContext();
+        return false;
+    }
+
+    // glewInit() would also look for a GLX display, which doesn't exist here; only the GL entry
+    // points are needed.
+    glewExperimental = GL_TRUE;
+    GLenum err = glewContextInit();
+    if (err != GLEW_OK) {
+        _error = std::string("GLEW initialization error: ") + reinterpret_cast<const char*>(glewGetErrorString(err));
+        DestroyContext();
+        return false;
+    }
+
+    return true;
+}
+
+bool HeadlessContext::CreateSharedContext()
+{
+    if (_context == nullptr || _sharedContext != nullptr) {
+        return _sharedContext != nullptr;
+    }
+    EGLContext context = eglCreateContext(_display, _config, _context, CONTEXT_ATTRIBUTES);
+    if (context == EGL_NO_CONTEXT) {
+        return false;
+    }
+    _sharedContext = context;
+    return true;
+}
+
+bool HeadlessContext::MakeSharedContextCurrent(bool current)
+{
+    if (_sharedContext == nullptr) {
+        return false;
+    }
+    return eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, current ? _sharedContext : EGL_NO_CONTEXT) == EGL_TRUE;
+}
+
+void HeadlessContext::DestroyContext()
+{
+    if (_display == nullptr) {
+        return;
+    }
+    eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (_sharedContext != nullptr) {
+        eglDestroyContext(_display, _sharedContext);
+        _sharedContext = nullptr;
+    }
+    if (_context != nullptr) {
+        eglDestroyContext(_display, _context);
+        _context = nullptr;
+    }
+    eglTerminate(_display);
+    _display = nullptr;
+}
+
+#else
+
+bool HeadlessContext::CreateContext()
+{
+    _error = "headless rendering needs EGL, which is only set up on Linux";
+    return false;
+}
+
+bool HeadlessContext::CreateSharedContext()
+{
+    return false;
+}
+
+bool HeadlessContext::MakeSharedContextCurrent(bool current)
+{
+    return false;
+}
+
+void HeadlessContext::DestroyContext()
+{
+}
+
+#endif
+
+bool HeadlessContext::CreateFramebuffer()
+{
+    glGenRenderbuffers(1, &_colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, _colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, _width, _height);
+
+    glGenRenderbuffers(1, &_depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, _depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, _width, _height);
+
+    glGenFramebuffers(1, &_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, _colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, _depthBuffer);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        _error = "offscreen framebuffer is incomplete";
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &_framebuffer);
+        glDeleteRenderbuffers(1, &_colorBuffer);
+        glDeleteRenderbuffers(1, &_depthBuffer);
+        _framebuffer = _colorBuffer = _depthBuffer = 0;
+        return false;
+    }
+
+    glViewport(0, 0, _width, _height);
+    return true;
+}
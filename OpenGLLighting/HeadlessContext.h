@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+// An OpenGL context with no window, for benchmarks and CI machines without a display or a GPU.
+// On Linux this is a surfaceless EGL context (EGL_MESA_platform_surfaceless, which Mesa's llvmpipe
+// supports; set LIBGL_ALWAYS_SOFTWARE=1 to force it) made current without a surface, rendering into
+// an FBO with color and depth renderbuffers. There is no default framebuffer and no swap, so
+// nothing waits for vsync.
+//
+// Other platforms have no implementation yet; IsValid() is false and GetError() says why.
+class HeadlessContext final
+{
+public:
+    HeadlessContext(int width, int height);
+    ~HeadlessContext();
+
+    HeadlessContext(const HeadlessContext& rhs) = delete;
+    HeadlessContext& operator=(const HeadlessContext& rhs) = delete;
+
+    // True if the context is current, GLEW is initialized and the framebuffer is bound.
+    bool IsValid() const { return _framebuffer != 0; }
+    const std::string& GetError() const { return _error; }
+
+    // The FBO standing in for the window; bound to GL_FRAMEBUFFER on creation.
+    GLuint GetFramebuffer() const { return _framebuffer; }
+    int GetWidth() const { return _width; }
+    int GetHeight() const { return _height; }
+
+    // Creates a second context that shares this one's objects, for a loader thread to upload from
+    // (see ResourceStreamer.h). False if it can't be created.
+    bool CreateSharedContext();
+
+    // Makes the shared context current on the calling thread, or with false releases it.
+    bool MakeSharedContextCurrent(bool current);
+
+private:
+    bool CreateContext();
+    void DestroyContext();
+    bool CreateFramebuffer();
+
+    int _width;
+    int _height;
+    std::string _error;
+
+    void* _display;     // EGLDisplay
+    void* _config;      // EGLConfig
+    void* _context;     // EGLContext
+    void* _sharedContext;
+
+    GLuint _framebuffer;
+    GLuint _colorBuffer;
+    GLuint _depthBuffer;
+};
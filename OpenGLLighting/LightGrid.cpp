@@ -0,0 +1,330 @@
+#include "LightGrid.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "GLStateCache.h"
+#include "ThreadPool.h"
+
+namespace {
+
+const unsigned int MAX_TILE_COUNT = LightGrid::MAX_CLUSTERS_X * LightGrid::MAX_CLUSTERS_Y;
+
+// The tile range [first, last] an NDC interval [low, high] covers, clamped to the screen.
+void TileRange(float low, float high, unsigned int tiles, uint8_t& first, uint8_t& last)
+{
+    float firstTile = std::floor((0.5f * low + 0.5f) * tiles);
+    float lastTile = std::floor((0.5f * high + 0.5f) * tiles);
+    first = static_cast<uint8_t>(std::min(std::max(firstTile, 0.0f), static_cast<float>(tiles - 1)));
+    last = static_cast<uint8_t>(std::min(std::max(lastTile, 0.0f), static_cast<float>(tiles - 1)));
+}
+
+// span / size rounded up, clamped to [low, high].
+unsigned int ClusterCount(float span, float size, unsigned int low, unsigned int high)
+{
+    float count = std::ceil(span / size);
+    return count >= high ? high : std::max(low, static_cast<unsigned int>(count));
+}
+
+}
+
+const float LightGrid::CLUSTER_SIZE_PER_RADIUS = 0.35f;
+
+LightGrid::LightGrid() :
+    _clustersX(MIN_CLUSTERS_X),
+    _clustersY(MIN_CLUSTERS_Y),
+    _clustersZ(MIN_CLUSTERS_Z),
+    _sliceScale(0.0f),
+    _sliceBias(0.0f),
+    _projectionScale(1.0f),
+    _sliceIndices(MAX_CLUSTERS_Z),
+    _sliceOverflows(MAX_CLUSTERS_Z, 0),
+    _clusters(2 * MIN_CLUSTERS_X * MIN_CLUSTERS_Y * MIN_CLUSTERS_Z, 0)
+{
+    _statistics.clustersX = _clustersX;
+    _statistics.clustersY = _clustersY;
+    _statistics.clustersZ = _clustersZ;
+    _statistics.lights = 0;
+    _statistics.indices = 0;
+    _statistics.maxLightsPerCluster = 0;
+    _statistics.overflowingClusters = 0;
+
+    static const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+
+    glGenBuffers(3, _buffers);
+    glGenTextures(3, _textures);
+    for (int i = 0; i < 3; ++i) {
+        // A buffer texture needs storage before it can be attached; the first Upload() sizes it.
+        GLStateCache::BindBuffer(GL_COPY_WRITE_BUFFER, _buffers[i]);
+        glBufferData(GL_COPY_WRITE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+
+        glBindTexture(GL_TEXTURE_BUFFER, _textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], _buffers[i]);
+    }
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+LightGrid::~LightGrid()
+{
+    glDeleteTextures(3, _textures);
+    for (int i = 0; i < 3; ++i) {
+        GLStateCache::DeleteBuffer(_buffers[i]);
+    }
+}
+
+void LightGrid::Build(const PointLight* lights, size_t count, const glm::mat4& view, const glm::mat4& projection,
+                      float nearPlane, float farPlane, ThreadPool& threadPool)
+{
+    count = std::min<size_t>(count, MAX_LIGHTS);
+
+    _lightData.resize(2 * count);
+    _bounds.clear();
+
+    const float scaleX = projection[0][0];
+    const float scaleY = projection[1][1];
+    _projectionScale = glm::vec2(scaleX, scaleY);
+
+    // First the lights in the depth range, which size the clusters...
+    for (size_t i = 0; i < count; ++i) {
+        const PointLight& light = lights[i];
+        _lightData[2 * i] = glm::vec4(light.position, light.radius);
+        _lightData[2 * i + 1] = glm::vec4(light.color, light.intensity);
+
+        // The camera looks down -z in view space.
+        glm::vec4 center = view * glm::vec4(light.position, 1.0f);
+        float radius = light.radius;
+        if (-center.z + radius < nearPlane || -center.z - radius > farPlane) {
+            continue;
+        }
+
+        LightBounds bounds;
+        bounds.light = static_cast<uint16_t>(i);
+        bounds.x = center.x;
+        bounds.y = center.y;
+        bounds.depth = -center.z;
+        bounds.radius = radius;
+        _bounds.push_back(bounds);
+    }
+
+    // Slices are spaced so that the far edge of each is a constant factor further than its near
+    // edge: slice = _clustersZ * log(depth / near) / log(far / near).
+    float logRatio = std::log(farPlane / nearPlane);
+    SizeClusters(logRatio);
+    _sliceScale = _clustersZ / logRatio;
+    _sliceBias = -std::log(nearPlane) * _sliceScale;
+
+    // ... then the clusters each one may cover, dropping the ones off screen.
+    size_t kept = 0;
+    for (size_t i = 0; i < _bounds.size(); ++i) {
+        LightBounds bounds = _bounds[i];
+        float radius = bounds.radius;
+        float nearDepth = bounds.depth - radius;
+        float farDepth = bounds.depth + radius;
+
+        float firstSlice = std::floor(std::log(std::max(nearDepth, nearPlane)) * _sliceScale + _sliceBias);
+        float lastSlice = std::floor(std::log(std::min(farDepth, farPlane)) * _sliceScale + _sliceBias);
+        bounds.minZ = static_cast<uint8_t>(std::min(std::max(firstSlice, 0.0f), static_cast<float>(_clustersZ - 1)));
+        bounds.maxZ = static_cast<uint8_t>(std::min(std::max(lastSlice, 0.0f), static_cast<float>(_clustersZ - 1)));
+
+        if (nearDepth <= nearPlane) {
+            // The sphere reaches behind the near plane, where the projection of its box is unbounded.
+            bounds.minX = 0;
+            bounds.maxX = static_cast<uint8_t>(_clustersX - 1);
+            bounds.minY = 0;
+            bounds.maxY = static_cast<uint8_t>(_clustersY - 1);
+        }
+        else {
+            // Each edge of the box projects furthest out at whichever of its near and far depths
+            // makes it so; divide by both and keep the extremes.
+            float minX = scaleX * std::min((bounds.x - radius) / nearDepth, (bounds.x - radius) / farDepth);
+            float maxX = scaleX * std::max((bounds.x + radius) / nearDepth, (bounds.x + radius) / farDepth);
+            float minY = scaleY * std::min((bounds.y - radius) / nearDepth, (bounds.y - radius) / farDepth);
+            float maxY = scaleY * std::max((bounds.y + radius) / nearDepth, (bounds.y + radius) / farDepth);
+            if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f) {
+                continue;
+            }
+            TileRange(minX, maxX, _clustersX, bounds.minX, bounds.maxX);
+            TileRange(minY, maxY, _clustersY, bounds.minY, bounds.maxY);
+        }
+        _bounds[kept++] = bounds;
+    }
+    _bounds.resize(kept);
+
+    const unsigned int tileCount = _clustersX * _clustersY;
+    _clusters.resize(2 * tileCount * _clustersZ);
+    threadPool.ParallelFor(_clustersZ, [this](size_t begin, size_t end) {
+        for (size_t slice = begin; slice < end; ++slice) {
+            FillSlice(static_cast<unsigned int>(slice));
+        }
+    });
+
+    // Append the slices' lists one after the other and rebase their offsets.
+    _indices.clear();
+    _statistics.maxLightsPerCluster = 0;
+    _statistics.overflowingClusters = 0;
+    for (unsigned int slice = 0; slice < _clustersZ; ++slice) {
+        uint32_t base = static_cast<uint32_t>(_indices.size());
+        uint32_t* clusters = &_clusters[2 * slice * tileCount];
+        for (unsigned int tile = 0; tile < tileCount; ++tile) {
+            clusters[2 * tile] += base;
+            _statistics.maxLightsPerCluster = std::max(_statistics.maxLightsPerCluster, clusters[2 * tile + 1]);
+        }
+        _indices.insert(_indices.end(), _sliceIndices[slice].begin(), _sliceIndices[slice].end());
+        _statistics.overflowingClusters += _sliceOverflows[slice];
+    }
+
+    _statistics.clustersX = _clustersX;
+    _statistics.clustersY = _clustersY;
+    _statistics.clustersZ = _clustersZ;
+    _statistics.lights = count;
+    _statistics.indices = _indices.size();
+}
+
+// A light of radius r at depth d spans an angle of about r / d. A tile spans 2 / (projection scale
+// * tiles) of that per unit of depth, and a slice about log(far / near) / slices, so the clusters
+// are made CLUSTER_SIZE_PER_RADIUS times the median light's angle. Lights reaching the near plane
+// don't count: their angle says nothing about the lights around them.
+void LightGrid::SizeClusters(float logRatio)
+{
+    _angularRadii.clear();
+    for (const LightBounds& bounds : _bounds) {
+        if (bounds.depth > bounds.radius) {
+            _angularRadii.push_back(bounds.radius / bounds.depth);
+        }
+    }
+    if (_angularRadii.empty()) {
+        _clustersX = MIN_CLUSTERS_X;
+        _clustersY = MIN_CLUSTERS_Y;
+        _clustersZ = MIN_CLUSTERS_Z;
+        return;
+    }
+
+    std::vector<float>::iterator median = _angularRadii.begin() + _angularRadii.size() / 2;
+    std::nth_element(_angularRadii.begin(), median, _angularRadii.end());
+    const float size = CLUSTER_SIZE_PER_RADIUS * *median;
+    _clustersX = ClusterCount(2.0f / _projectionScale.x, size, MIN_CLUSTERS_X, MAX_CLUSTERS_X);
+    _clustersY = ClusterCount(2.0f / _projectionScale.y, size, MIN_CLUSTERS_Y, MAX_CLUSTERS_Y);
+    _clustersZ = ClusterCount(logRatio, size, MIN_CLUSTERS_Z, MAX_CLUSTERS_Z);
+}
+
+// Two passes over the lights that touch the slice: count per cluster, then fill each cluster's
+// range, so the slice's list is written once without per-cluster allocations. Within a light's
+// rectangle of tiles, only the clusters whose view-space box the sphere actually reaches get it;
+// that drops the corners the rectangle adds, which are most of it for small lights.
+void LightGrid::FillSlice(unsigned int slice)
+{
+    const unsigned int tileCount = _clustersX * _clustersY;
+    uint32_t counts[MAX_TILE_COUNT] = { };
+    uint32_t* clusters = &_clusters[2 * slice * tileCount];
+    std::vector<uint16_t>& indices = _sliceIndices[slice];
+
+    // The slice's depth range, and the view-space x and y ranges of its columns and rows of tiles:
+    // a tile's edge at NDC x lies at x * depth / projection[0][0], largest at one of the depths.
+    const float nearDepth = std::exp((slice - _sliceBias) / _sliceScale);
+    const float farDepth = std::exp((slice + 1 - _sliceBias) / _sliceScale);
+    float tileMinX[MAX_CLUSTERS_X], tileMaxX[MAX_CLUSTERS_X], tileMinY[MAX_CLUSTERS_Y], tileMaxY[MAX_CLUSTERS_Y];
+    for (unsigned int x = 0; x < _clustersX; ++x) {
+        float low = (2.0f * x / _clustersX - 1.0f) / _projectionScale.x;
+        float high = (2.0f * (x + 1) / _clustersX - 1.0f) / _projectionScale.x;
+        tileMinX[x] = std::min(low * nearDepth, low * farDepth);
+        tileMaxX[x] = std::max(high * nearDepth, high * farDepth);
+    }
+    for (unsigned int y = 0; y < _clustersY; ++y) {
+        float low = (2.0f * y / _clustersY - 1.0f) / _projectionScale.y;
+        float high = (2.0f * (y + 1) / _clustersY - 1.0f) / _projectionScale.y;
+        tileMinY[y] = std::min(low * nearDepth, low * farDepth);
+        tileMaxY[y] = std::max(high * nearDepth, high * farDepth);
+    }
+
+    // Squared distance from the centre to the box, accumulated per axis.
+    auto squaredDistance = [](float value, float low, float high) {
+        float d = std::max(std::max(low - value, value - high), 0.0f);
+        return d * d;
+    };
+
+    for (int pass = 0; pass < 2; ++pass) {
+        for (const LightBounds& bounds : _bounds) {
+            if (slice < bounds.minZ || slice > bounds.maxZ) {
+                continue;
+            }
+            const float radiusSquared = bounds.radius * bounds.radius;
+            const float dz = squaredDistance(bounds.depth, nearDepth, farDepth);
+            for (unsigned int y = bounds.minY; y <= bounds.maxY; ++y) {
+                const float dyz = dz + squaredDistance(bounds.y, tileMinY[y], tileMaxY[y]);
+                if (dyz > radiusSquared) {
+                    continue;
+                }
+                for (unsigned int x = bounds.minX; x <= bounds.maxX; ++x) {
+                    if (dyz + squaredDistance(bounds.x, tileMinX[x], tileMaxX[x]) > radiusSquared) {
+                        continue;
+                    }
+                    unsigned int tile = y * _clustersX + x;
+                    if (pass == 0) {
+                        ++counts[tile];
+                    }
+                    else if (counts[tile] < clusters[2 * tile + 1]) {
+                        indices[clusters[2 * tile] + counts[tile]++] = bounds.light;
+                    }
+                }
+            }
+        }
+
+        if (pass == 0) {
+            uint32_t offset = 0;
+            unsigned int overflows = 0;
+            for (unsigned int tile = 0; tile < tileCount; ++tile) {
+                uint32_t count = counts[tile];
+                if (count > MAX_LIGHTS_PER_CLUSTER) {
+                    count = MAX_LIGHTS_PER_CLUSTER;
+                    ++overflows;
+                }
+                clusters[2 * tile] = offset;
+                clusters[2 * tile + 1] = count;
+                counts[tile] = 0;
+                offset += count;
+            }
+            _sliceOverflows[slice] = overflows;
+            indices.resize(offset);
+        }
+    }
+}
+
+void LightGrid::Upload()
+{
+    // Orphan each buffer so the driver can hand out fresh storage instead of waiting for the
+    // frames still reading the old contents. Buffer textures cannot be empty, hence the padding.
+    const void* data[3] = { _lightData.empty() ? nullptr : &_lightData[0], &_clusters[0],
+                            _indices.empty() ? nullptr : &_indices[0] };
+    const size_t sizes[3] = { _lightData.size() * sizeof(glm::vec4), _clusters.size() * sizeof(uint32_t),
+                              _indices.size() * sizeof(uint16_t) };
+
+    for (int i = 0; i < 3; ++i) {
+        GLStateCache::BindBuffer(GL_COPY_WRITE_BUFFER, _buffers[i]);
+        glBufferData(GL_COPY_WRITE_BUFFER, std::max<size_t>(sizes[i], 16), nullptr, GL_STREAM_DRAW);
+        if (sizes[i] > 0) {
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizes[i], data[i]);
+        }
+    }
+}
+
+void LightGrid::Bind() const
+{
+    static const GLenum units[3] = { LIGHT_DATA_UNIT, CLUSTER_UNIT, LIGHT_INDEX_UNIT };
+
+    for (int i = 0; i < 3; ++i) {
+        glActiveTexture(GL_TEXTURE0 + units[i]);
+        glBindTexture(GL_TEXTURE_BUFFER, _textures[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+LightBlock LightGrid::GetLightBlock(int viewportWidth, int viewportHeight, const glm::vec3& ambientColor) const
+{
+    LightBlock block;
+    block.ambientColor = glm::vec4(ambientColor, 0.0f);
+    block.clusterCounts = glm::uvec4(_clustersX, _clustersY, _clustersZ, static_cast<unsigned int>(_statistics.lights));
+    block.clusterScale = glm::vec4(static_cast<float>(_clustersX) / std::max(viewportWidth, 1),
+                                   static_cast<float>(_clustersY) / std::max(viewportHeight, 1),
+                                   _sliceScale, _sliceBias);
+    return block;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+
+#include "UniformBlocks.h"
+
+class ThreadPool;
+
+// A point light. Its contribution fades smoothly to nothing at radius.
+struct PointLight
+{
+    glm::vec3 position;     // world space
+    float radius;
+    glm::vec3 color;
+    float intensity;
+};
+
+// Clustered forward lighting: the view frustum is split into screen tiles and depth slices
+// (exponentially spaced, so clusters stay roughly cubic), every frame each light is binned into the
+// clusters its bounding sphere can touch, and cube.fs only loops over the lights of the fragment's
+// cluster. The cost per fragment then depends on how many lights overlap it rather than on how
+// many there are.
+//
+// A cluster much larger than the lights holds every light of its volume, so the grid is sized to
+// the lights every frame: clusters are about CLUSTER_SIZE_PER_RADIUS of a typical light's radius
+// across (the median over the lights in view, at the light's depth), between the minimum and
+// maximum counts below. Smaller, denser lights get finer clusters, and a cluster holds about as
+// many lights whatever their number.
+//
+// The data reaches the shaders through buffer textures, which GL 3.3 and 4.1 have (shader storage
+// buffers need 4.3):
+//   lightData     RGBA32F, two texels per light: position and radius, color and intensity
+//   clusters      RG32UI, per cluster: offset into lightIndices, count
+//   lightIndices  R16UI, the lights of each cluster, one list after the other
+// Binning runs on the CPU, one depth slice per task on the thread pool. A light's candidate
+// clusters are those in the screen rectangle and slice range covered by the box around its
+// sphere; of those it is added to the ones whose view-space bounding box the sphere touches.
+class LightGrid final
+{
+public:
+    static const unsigned int MIN_CLUSTERS_X = 16;
+    static const unsigned int MIN_CLUSTERS_Y = 12;
+    static const unsigned int MIN_CLUSTERS_Z = 24;
+    static const unsigned int MAX_CLUSTERS_X = 64;
+    static const unsigned int MAX_CLUSTERS_Y = 48;
+    static const unsigned int MAX_CLUSTERS_Z = 256;                 // slice indices are 8 bits
+    static const float CLUSTER_SIZE_PER_RADIUS;
+
+    static const unsigned int MAX_LIGHTS = 4096;                // indices are 16 bits
+    static const unsigned int MAX_LIGHTS_PER_CLUSTER = 256;     // further lights are dropped
+
+    // Texture units of the buffer textures; the samplers in cube.fs and lamp.vs are set to these.
+    enum TextureUnit
+    {
+        LIGHT_DATA_UNIT = 0,
+        CLUSTER_UNIT = 1,
+        LIGHT_INDEX_UNIT = 2
+    };
+
+    // For the last Build().
+    struct Statistics
+    {
+        unsigned int clustersX, clustersY, clustersZ;
+        size_t lights;
+        size_t indices;                     // light references over all clusters
+        unsigned int maxLightsPerCluster;
+        unsigned int overflowingClusters;   // clusters that hit MAX_LIGHTS_PER_CLUSTER
+    };
+
+    LightGrid();
+
+    LightGrid(const LightGrid& rhs) = delete;
+    LightGrid& operator=(const LightGrid& rhs) = delete;
+
+    ~LightGrid();
+
+    // Bins the lights (at most MAX_LIGHTS) into the clusters of the frustum of view and
+    // projection, a symmetric perspective projection with the given planes.
+    void Build(const PointLight* lights, size_t count, const glm::mat4& view, const glm::mat4& projection,
+               float nearPlane, float farPlane, ThreadPool& threadPool);
+
+    // Copies the lights and the clusters into the buffer textures.
+    void Upload();
+
+    // Binds the buffer textures to their units. Leaves texture unit 0 active.
+    void Bind() const;
+
+    // The LightBlock cube.fs needs to find a fragment's cluster, for a viewport of the given size.
+    LightBlock GetLightBlock(int viewportWidth, int viewportHeight, const glm::vec3& ambientColor) const;
+
+    size_t LightCount() const { return _statistics.lights; }
+    const Statistics& GetStatistics() const { return _statistics; }
+
+private:
+    // A light in view space and the clusters it may cover, found once per light and per frame
+    // before the slices are filled.
+    struct LightBounds
+    {
+        float x, y, depth, radius;
+        uint16_t light;
+        uint8_t minX, maxX, minY, maxY, minZ, maxZ;
+    };
+
+    // Picks the cluster counts for the lights in _bounds.
+    void SizeClusters(float logRatio);
+
+    void FillSlice(unsigned int slice);
+
+    unsigned int _clustersX, _clustersY, _clustersZ;
+    float _sliceScale;      // slice = log(depth) * _sliceScale + _sliceBias
+    float _sliceBias;
+    glm::vec2 _projectionScale;     // projection[0][0] and projection[1][1]
+
+    std::vector<glm::vec4> _lightData;          // two texels per light
+    std::vector<LightBounds> _bounds;
+    std::vector<float> _angularRadii;           // scratch for SizeClusters()
+    std::vector<std::vector<uint16_t>> _sliceIndices;   // per slice, merged into _indices
+    std::vector<unsigned int> _sliceOverflows;
+    std::vector<uint32_t> _clusters;            // offset and count per cluster
+    std::vector<uint16_t> _indices;
+
+    GLuint _buffers[3];
+    GLuint _textures[3];
+
+    Statistics _statistics;
+};
@@ -0,0 +1,121 @@
+#include "LodSelector.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "ObjectStore.h"
+#include "ThreadPool.h"
+
+const float LodSelector::DEFAULT_PIXEL_ERROR = 1.0f;
+const float LodSelector::HYSTERESIS = 0.75f;
+
+namespace {
+
+// Objects are picked for in runs of this many per task.
+const size_t PARALLEL_CHUNK_SIZE = 16384;
+
+}   // namespace
+
+LodSelector::LodSelector() :
+        _pixelError(DEFAULT_PIXEL_ERROR)
+{
+    std::memset(&_statistics, 0, sizeof(_statistics));
+}
+
+void LodSelector::SetLods(const std::vector<MeshLod>& lods)
+{
+    _lods.assign(lods.begin(), lods.begin() + std::min<size_t>(lods.size(), MESH_MAX_LODS));
+    std::fill(_objectLods.begin(), _objectLods.end(), 0);
+}
+
+bool LodSelector::Select(const ObjectStore& store, const glm::vec3& cameraPosition, const glm::mat4& projection,
+                         int viewportHeight, ThreadPool& threadPool)
+{
+    const size_t size = store.Size();
+    _objectLods.resize(size, 0);
+
+    // A distance of one unit at the centre of the view spans this many pixels.
+    const float pixelsPerUnit = projection[1][1] * 0.5f * static_cast<float>(viewportHeight);
+
+    const size_t chunkCount = (size + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+    _chunkSwitches.assign(chunkCount, 0);
+    if (_lods.size() > 1) {
+        threadPool.ParallelFor(chunkCount, [this, &store, cameraPosition, pixelsPerUnit, size](size_t firstChunk, size_t lastChunk) {
+            for (size_t chunk = firstChunk; chunk < lastChunk; ++chunk) {
+                size_t begin = chunk * PARALLEL_CHUNK_SIZE;
+                size_t end = std::min(begin + PARALLEL_CHUNK_SIZE, size);
+                _chunkSwitches[chunk] = Select(store, cameraPosition, pixelsPerUnit, begin, end);
+            }
+        });
+    }
+
+    std::memset(&_statistics, 0, sizeof(_statistics));
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+        _statistics.switches += _chunkSwitches[chunk];
+    }
+    if (!_lods.empty()) {
+        for (uint8_t lod : _objectLods) {
+            ++_statistics.objects[lod];
+        }
+        for (size_t lod = 0; lod < _lods.size(); ++lod) {
+            _statistics.triangles += _statistics.objects[lod] * (_lods[lod].indexCount / 3);
+        }
+    }
+    return _statistics.switches > 0;
+}
+
+size_t LodSelector::Select(const ObjectStore& store, const glm::vec3& cameraPosition, float pixelsPerUnit,
+                           size_t begin, size_t end)
+{
+    size_t switches = 0;
+    for (size_t i = begin; i < end; ++i) {
+        // Nearer than the sphere's surface, every level shows its full error on screen.
+        float distance = glm::length(store.GetPosition(i) - cameraPosition) - store.GetRadius(i);
+        glm::vec3 scale = store.GetScale(i);
+        float pixelsPerError = _pixelError > 0.0f && distance > 0.0f
+                ? pixelsPerUnit * std::max(scale.x, std::max(scale.y, scale.z)) / distance
+                : 0.0f;
+
+        int lod = PickLod(_objectLods[i], pixelsPerError);
+        if (lod != _objectLods[i]) {
+            _objectLods[i] = static_cast<uint8_t>(lod);
+            ++switches;
+        }
+    }
+    return switches;
+}
+
+void LodSelector::SelectSpheres(const std::vector<glm::vec3>& centers, float radius, float scale,
+                                const glm::vec3& cameraPosition, const glm::mat4& projection, int viewportHeight,
+                                std::vector<uint8_t>& lods) const
+{
+    lods.resize(centers.size(), 0);
+    if (_lods.size() <= 1) {
+        std::fill(lods.begin(), lods.end(), 0);
+        return;
+    }
+
+    const float pixelsPerUnit = projection[1][1] * 0.5f * static_cast<float>(viewportHeight);
+    const int coarsest = static_cast<int>(_lods.size()) - 1;
+    for (size_t i = 0; i < centers.size(); ++i) {
+        float distance = glm::length(centers[i] - cameraPosition) - radius;
+        float pixelsPerError = _pixelError > 0.0f && distance > 0.0f ? pixelsPerUnit * scale / distance : 0.0f;
+        lods[i] = static_cast<uint8_t>(PickLod(std::min<int>(lods[i], coarsest), pixelsPerError));
+    }
+}
+
+int LodSelector::PickLod(int lod, float pixelsPerError) const
+{
+    if (pixelsPerError == 0.0f) {
+        return 0;
+    }
+
+    const int coarsest = static_cast<int>(_lods.size()) - 1;
+    while (lod > 0 && _lods[lod].error * pixelsPerError > _pixelError) {
+        --lod;
+    }
+    while (lod < coarsest && _lods[lod + 1].error * pixelsPerError < _pixelError * HYSTERESIS) {
+        ++lod;
+    }
+    return lod;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+
+#include "MeshBuilder.h"
+
+class ObjectStore;
+class ThreadPool;
+
+// Picks the level of detail of every object each frame, so the triangles drawn depend on how much
+// of the screen the objects cover rather than on how many there are.
+//
+// A level's error (see MeshSimplifier.h) is a distance on the mesh; scaled by the object's largest
+// scale and projected at the nearest point of its bounding sphere, it becomes a number of pixels.
+// Each object gets the coarsest level whose projected error is under the pixel threshold. To keep
+// an object at the edge of two levels from switching every frame as the camera moves, an object
+// only goes coarser once the coarser level's error is under HYSTERESIS of the threshold; it goes
+// finer as soon as its level's error is over it.
+class LodSelector final
+{
+public:
+    static const float DEFAULT_PIXEL_ERROR;
+    static const float HYSTERESIS;
+
+    // For the last Select().
+    struct Statistics
+    {
+        size_t objects[MESH_MAX_LODS];  // per level
+        size_t triangles;               // drawn if every object is
+        size_t switches;                // objects whose level changed
+    };
+
+    LodSelector();
+
+    LodSelector(const LodSelector& rhs) = delete;
+    LodSelector& operator=(const LodSelector& rhs) = delete;
+
+    // The levels of the mesh every object draws; puts every object back at level 0.
+    void SetLods(const std::vector<MeshLod>& lods);
+    size_t LodCount() const { return _lods.size(); }
+
+    // The largest error, in pixels, an object may show; 0 keeps every object at level 0.
+    void SetPixelError(float pixels) { _pixelError = pixels; }
+    float GetPixelError() const { return _pixelError; }
+
+    // Picks a level for each object of store as seen from cameraPosition through projection (the
+    // frame's, whose [1][1] element scales the view's height) on a viewport viewportHeight pixels
+    // high. Returns true if any object's level changed.
+    bool Select(const ObjectStore& store, const glm::vec3& cameraPosition, const glm::mat4& projection,
+                int viewportHeight, ThreadPool& threadPool);
+
+    // The levels picked by the last Select(), one per object.
+    const std::vector<uint8_t>& GetObjectLods() const { return _objectLods; }
+
+    // Picks levels the same way for instances drawn outside the store, such as the lamps: spheres
+    // of one radius around centers, their mesh scaled by scale. lods holds each sphere's level from
+    // the last call, new spheres at level 0, and gets the new ones.
+    void SelectSpheres(const std::vector<glm::vec3>& centers, float radius, float scale,
+                       const glm::vec3& cameraPosition, const glm::mat4& projection, int viewportHeight,
+                       std::vector<uint8_t>& lods) const;
+
+    const Statistics& GetStatistics() const { return _statistics; }
+
+private:
+    // Picks levels for objects [begin, end); returns how many changed.
+    size_t Select(const ObjectStore& store, const glm::vec3& cameraPosition, float pixelsPerUnit,
+                  size_t begin, size_t end);
+
+    // The level to move to from lod, for an object on which one unit of error spans pixelsPerError
+    // pixels.
+    int PickLod(int lod, float pixelsPerError) const;
+
+    std::vector<MeshLod> _lods;
+    std::vector<uint8_t> _objectLods;
+    float _pixelError;
+
+    std::vector<size_t> _chunkSwitches;     // per chunk, for the parallel pick
+    Statistics _statistics;
+};
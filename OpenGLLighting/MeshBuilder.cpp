@@ -0,0 +1,489 @@
+#include "MeshBuilder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace {
+
+// Hashes and compares vertices by their exact bit patterns; welding only merges true duplicates.
+struct VertexBits
+{
+    uint32_t bits[6];
+
+    bool operator==(const VertexBits& rhs) const
+    {
+        return std::memcmp(bits, rhs.bits, sizeof(bits)) == 0;
+    }
+};
+
+struct VertexBitsHash
+{
+    size_t operator()(const VertexBits& vertex) const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (int i = 0; i < 6; ++i) {
+            hash = (hash ^ vertex.bits[i]) * 1099511628211ull;
+        }
+        return static_cast<size_t>(hash ^ (hash >> 32));
+    }
+};
+
+// Tuning constants from Tom Forsyth, "Linear-Speed Vertex Cache Optimisation" (2006).
+const int FORSYTH_CACHE_SIZE = 32;
+const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+const float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+const float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+float ForsythVertexScore(int cachePosition, unsigned int remainingTriangles)
+{
+    if (remainingTriangles == 0) {
+        return -1.0f;   // no triangles left to use this vertex
+    }
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            // The vertex was used by the last triangle. It gets a fixed score so that the next
+            // triangle doesn't simply reuse the same three vertices in a strip-like way.
+            score = FORSYTH_LAST_TRIANGLE_SCORE;
+        }
+        else {
+            const float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+            score = std::pow(1.0f - (cachePosition - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+        }
+    }
+
+    // Boost vertices with few triangles left so that lone triangles get finished off.
+    score += FORSYTH_VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remainingTriangles), -FORSYTH_VALENCE_BOOST_POWER);
+    return score;
+}
+
+}
+
+Mesh WeldVertices(const MeshVertex* vertices, size_t vertexCount)
+{
+    Mesh mesh;
+    mesh.indices.reserve(vertexCount);
+
+    std::unordered_map<VertexBits, uint32_t, VertexBitsHash> uniqueVertices;
+    uniqueVertices.reserve(vertexCount);
+
+    for (size_t i = 0; i < vertexCount; ++i) {
+        VertexBits key;
+        std::memcpy(key.bits, &vertices[i], sizeof(key.bits));
+
+        std::pair<std::unordered_map<VertexBits, uint32_t, VertexBitsHash>::iterator, bool> result =
+                uniqueVertices.insert(std::make_pair(key, static_cast<uint32_t>(mesh.vertices.size())));
+        if (result.second) {
+            mesh.vertices.push_back(vertices[i]);
+        }
+        mesh.indices.push_back(result.first->second);
+    }
+
+    return mesh;
+}
+
+void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // Triangles using each vertex: adjacency[adjacencyOffset[v] .. + remaining[v]) lists the ones
+    // not yet emitted.
+    std::vector<unsigned int> remaining(vertexCount, 0);
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+        ++remaining[indices[i]];
+    }
+
+    std::vector<unsigned int> adjacencyOffset(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        adjacencyOffset[v + 1] = adjacencyOffset[v] + remaining[v];
+    }
+
+    std::vector<uint32_t> adjacency(triangleCount * 3);
+    std::vector<unsigned int> filled(vertexCount, 0);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        for (int corner = 0; corner < 3; ++corner) {
+            uint32_t v = indices[t * 3 + corner];
+            adjacency[adjacencyOffset[v] + filled[v]++] = static_cast<uint32_t>(t);
+        }
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        vertexScore[v] = ForsythVertexScore(-1, remaining[v]);
+    }
+
+    std::vector<float> triangleScore(triangleCount);
+    std::vector<unsigned char> isEmitted(triangleCount, 0);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+    }
+
+    std::vector<uint32_t> output;
+    output.reserve(triangleCount * 3);
+
+    // The cache holds up to FORSYTH_CACHE_SIZE vertices, plus room for the three pushed in front.
+    std::vector<uint32_t> cache, newCache;
+    cache.reserve(FORSYTH_CACHE_SIZE + 3);
+    newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+    size_t scanCursor = 0;  // triangles before this are all emitted
+    long bestTriangle = -1;
+
+    for (size_t emitted = 0; emitted < triangleCount; ++emitted) {
+        // No candidate from the cache: fall back to the best triangle overall. This only happens at
+        // the start and when the mesh has disconnected pieces.
+        if (bestTriangle < 0) {
+            float bestScore = -1.0f;
+            while (scanCursor < triangleCount && isEmitted[scanCursor]) {
+                ++scanCursor;
+            }
+            for (size_t t = scanCursor; t < triangleCount; ++t) {
+                if (!isEmitted[t] && triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    bestTriangle = static_cast<long>(t);
+                }
+            }
+        }
+
+        const uint32_t* triangle = &indices[bestTriangle * 3];
+        output.insert(output.end(), triangle, triangle + 3);
+        isEmitted[bestTriangle] = 1;
+
+        // Remove the triangle from its vertices' adjacency lists.
+        for (int corner = 0; corner < 3; ++corner) {
+            uint32_t v = triangle[corner];
+            uint32_t* begin = &adjacency[adjacencyOffset[v]];
+            uint32_t* end = begin + remaining[v];
+            uint32_t* found = std::find(begin, end, static_cast<uint32_t>(bestTriangle));
+            if (found != end) {
+                *found = *(end - 1);
+                --remaining[v];
+            }
+        }
+
+        // Move the triangle's vertices to the front of the cache.
+        newCache.assign(triangle, triangle + 3);
+        for (size_t i = 0; i < cache.size(); ++i) {
+            uint32_t v = cache[i];
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+                newCache.push_back(v);
+            }
+        }
+        for (size_t i = 0; i < newCache.size(); ++i) {
+            uint32_t v = newCache[i];
+            cachePosition[v] = i < static_cast<size_t>(FORSYTH_CACHE_SIZE) ? static_cast<int>(i) : -1;
+            vertexScore[v] = ForsythVertexScore(cachePosition[v], remaining[v]);
+        }
+        if (newCache.size() > static_cast<size_t>(FORSYTH_CACHE_SIZE)) {
+            newCache.resize(FORSYTH_CACHE_SIZE);
+        }
+        cache.swap(newCache);
+
+        // Rescore the triangles around the cached vertices and pick the best of them next.
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < cache.size(); ++i) {
+            uint32_t v = cache[i];
+            for (unsigned int a = 0; a < remaining[v]; ++a) {
+                uint32_t t = adjacency[adjacencyOffset[v] + a];
+                float score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                triangleScore[t] = score;
+                if (score > bestScore) {
+                    bestScore = score;
+                    bestTriangle = static_cast<long>(t);
+                }
+            }
+        }
+    }
+
+    indices.swap(output);
+}
+
+void OptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<MeshVertex>& vertices, unsigned int cacheSize)
+{
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // Split the cache-optimized order into clusters wherever a triangle misses the cache on all three
+    // vertices; reordering whole clusters keeps most of the cache efficiency.
+    std::vector<size_t> clusterStart;
+    std::vector<uint32_t> fifo(cacheSize, 0xffffffffu);
+    size_t fifoHead = 0;
+    for (size_t t = 0; t < triangleCount; ++t) {
+        int misses = 0;
+        for (int corner = 0; corner < 3; ++corner) {
+            uint32_t v = indices[t * 3 + corner];
+            if (std::find(fifo.begin(), fifo.end(), v) == fifo.end()) {
+                fifo[fifoHead] = v;
+                fifoHead = (fifoHead + 1) % cacheSize;
+                ++misses;
+            }
+        }
+        if (t == 0 || misses == 3) {
+            clusterStart.push_back(t);
+        }
+    }
+    clusterStart.push_back(triangleCount);
+
+    glm::vec3 meshCentroid(0.0f);
+    for (size_t v = 0; v < vertices.size(); ++v) {
+        meshCentroid += vertices[v].position;
+    }
+    meshCentroid /= static_cast<float>(std::max<size_t>(vertices.size(), 1));
+
+    // Clusters that face away from the mesh's centre are likely to occlude the rest; draw them first.
+    const size_t clusterCount = clusterStart.size() - 1;
+    std::vector<std::pair<float, size_t>> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; ++c) {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; ++t) {
+            const glm::vec3& p0 = vertices[indices[t * 3]].position;
+            const glm::vec3& p1 = vertices[indices[t * 3 + 1]].position;
+            const glm::vec3& p2 = vertices[indices[t * 3 + 2]].position;
+            glm::vec3 faceNormal = glm::cross(p1 - p0, p2 - p0);    // length is twice the area
+            float faceArea = glm::length(faceNormal);
+            centroid += (p0 + p1 + p2) * (faceArea / 3.0f);
+            normal += faceNormal;
+            area += faceArea;
+        }
+
+        float normalLength = glm::length(normal);
+        float key = 0.0f;
+        if (area > 0.0f && normalLength > 0.0f) {
+            key = glm::dot(centroid / area - meshCentroid, normal / normalLength);
+        }
+        order[c] = std::make_pair(-key, c);
+    }
+    std::stable_sort(order.begin(), order.end());
+
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    for (size_t i = 0; i < clusterCount; ++i) {
+        size_t c = order[i].second;
+        output.insert(output.end(), indices.begin() + clusterStart[c] * 3, indices.begin() + clusterStart[c + 1] * 3);
+    }
+    indices.swap(output);
+}
+
+void OptimizeVertexFetch(Mesh& mesh)
+{
+    std::vector<uint32_t> remap(mesh.vertices.size(), 0xffffffffu);
+    std::vector<MeshVertex> vertices;
+    vertices.reserve(mesh.vertices.size());
+
+    for (size_t i = 0; i < mesh.indices.size(); ++i) {
+        uint32_t& index = mesh.indices[i];
+        if (remap[index] == 0xffffffffu) {
+            remap[index] = static_cast<uint32_t>(vertices.size());
+            vertices.push_back(mesh.vertices[index]);
+        }
+        index = remap[index];
+    }
+
+    mesh.vertices.swap(vertices);
+}
+
+PackedMesh PackVertices(const Mesh& mesh, const MeshBuildOptions& options)
+{
+    PackedMesh packed;
+
+    VertexFormat& format = packed.format;
+    format.positionType = options.packPositions ? GL_HALF_FLOAT : GL_FLOAT;
+    format.positionOffset = 0;
+    GLuint positionBytes = options.packPositions ? 4 * sizeof(uint16_t) : 3 * sizeof(float);  // halves padded to 8 bytes
+    format.normalType = options.packNormals ? GL_INT_2_10_10_10_REV : GL_FLOAT;
+    format.normalSize = options.packNormals ? 4 : 3;
+    format.normalOffset = positionBytes;
+    GLuint normalBytes = options.packNormals ? sizeof(uint32_t) : 3 * sizeof(float);
+    format.stride = static_cast<GLsizei>(positionBytes + normalBytes);
+
+    packed.vertexData.resize(mesh.vertices.size() * format.stride);
+    for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+        unsigned char* vertex = &packed.vertexData[i * format.stride];
+        const MeshVertex& source = mesh.vertices[i];
+
+        if (options.packPositions) {
+            uint16_t position[4] = {
+                FloatToHalf(source.position.x), FloatToHalf(source.position.y), FloatToHalf(source.position.z), FloatToHalf(1.0f)
+            };
+            std::memcpy(vertex + format.positionOffset, position, sizeof(position));
+        }
+        else {
+            std::memcpy(vertex + format.positionOffset, &source.position[0], 3 * sizeof(float));
+        }
+
+        if (options.packNormals) {
+            uint32_t normal = PackNormal2_10_10_10(source.normal);
+            std::memcpy(vertex + format.normalOffset, &normal, sizeof(normal));
+        }
+        else {
+            std::memcpy(vertex + format.normalOffset, &source.normal[0], 3 * sizeof(float));
+        }
+    }
+
+    packed.indexCount = static_cast<GLsizei>(mesh.indices.size());
+    packed.lods = mesh.lods;
+    if (packed.lods.empty()) {
+        packed.lods.push_back({ 0, static_cast<uint32_t>(mesh.indices.size()), 0.0f });
+    }
+    if (mesh.vertices.size() <= 0xffff) {
+        packed.indexType = GL_UNSIGNED_SHORT;
+        packed.indexData.resize(mesh.indices.size() * sizeof(uint16_t));
+        uint16_t* indices = reinterpret_cast<uint16_t*>(&packed.indexData[0]);
+        for (size_t i = 0; i < mesh.indices.size(); ++i) {
+            indices[i] = static_cast<uint16_t>(mesh.indices[i]);
+        }
+    }
+    else {
+        packed.indexType = GL_UNSIGNED_INT;
+        packed.indexData.resize(mesh.indices.size() * sizeof(uint32_t));
+        std::memcpy(&packed.indexData[0], &mesh.indices[0], packed.indexData.size());
+    }
+
+    return packed;
+}
+
+float SimulateAcmr(const uint32_t* indices, size_t indexCount, unsigned int cacheSize)
+{
+    if (indexCount < 3) {
+        return 0.0f;
+    }
+
+    std::vector<uint32_t> fifo(cacheSize, 0xffffffffu);
+    size_t fifoHead = 0;
+    size_t misses = 0;
+    for (size_t i = 0; i < indexCount; ++i) {
+        if (std::find(fifo.begin(), fifo.end(), indices[i]) == fifo.end()) {
+            fifo[fifoHead] = indices[i];
+            fifoHead = (fifoHead + 1) % cacheSize;
+            ++misses;
+        }
+    }
+    return static_cast<float>(misses) / static_cast<float>(indexCount / 3);
+}
+
+PackedMesh BuildMesh(const MeshVertex* vertices, size_t vertexCount, const MeshBuildOptions& options,
+                     MeshBuildStatistics* statistics)
+{
+    PackedMesh packed = BuildMesh(WeldVertices(vertices, vertexCount), options, statistics);
+
+    if (statistics != nullptr) {
+        // Unindexed, every vertex is transformed: the ACMR is exactly 3.
+        statistics->verticesBefore = vertexCount;
+        statistics->vertexBytesBefore = vertexCount * sizeof(MeshVertex);
+        statistics->acmrBefore = vertexCount >= 3 ? 3.0f : 0.0f;
+    }
+
+    return packed;
+}
+
+PackedMesh BuildMesh(Mesh mesh, const MeshBuildOptions& options, MeshBuildStatistics* statistics)
+{
+    if (mesh.lods.empty()) {
+        mesh.lods.push_back({ 0, static_cast<uint32_t>(mesh.indices.size()), 0.0f });
+    }
+
+    // The statistics are of the full mesh, level 0.
+    const size_t fullIndexCount = mesh.lods[0].indexCount;
+    if (statistics != nullptr) {
+        statistics->verticesBefore = mesh.vertices.size();
+        statistics->vertexBytesBefore = mesh.vertices.size() * sizeof(MeshVertex);
+        statistics->acmrBefore = fullIndexCount == 0 ? 0.0f : SimulateAcmr(&mesh.indices[0], fullIndexCount, options.cacheSize);
+    }
+
+    // Each level is drawn on its own, so each is ordered on its own. The vertices are then
+    // renumbered in the order level 0 uses them, which every coarser level shares.
+    std::vector<uint32_t> levelIndices;
+    for (const MeshLod& lod : mesh.lods) {
+        levelIndices.assign(mesh.indices.begin() + lod.firstIndex, mesh.indices.begin() + lod.firstIndex + lod.indexCount);
+        OptimizeVertexCache(levelIndices, mesh.vertices.size());
+        OptimizeOverdraw(levelIndices, mesh.vertices, options.cacheSize);
+        std::copy(levelIndices.begin(), levelIndices.end(), mesh.indices.begin() + lod.firstIndex);
+    }
+    OptimizeVertexFetch(mesh);
+
+    PackedMesh packed = PackVertices(mesh, options);
+
+    if (statistics != nullptr) {
+        statistics->verticesAfter = mesh.vertices.size();
+        statistics->vertexBytesAfter = packed.vertexData.size();
+        statistics->indexBytesAfter = packed.indexData.size();
+        statistics->acmrAfter = fullIndexCount == 0 ? 0.0f : SimulateAcmr(&mesh.indices[0], fullIndexCount, options.cacheSize);
+    }
+
+    return packed;
+}
+
+uint16_t FloatToHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t biasedExponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (biasedExponent == 0xff) {
+        return static_cast<uint16_t>(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));     // infinity or NaN
+    }
+
+    int exponent = static_cast<int>(biasedExponent) - 127 + 15;
+    if (exponent >= 31) {
+        return static_cast<uint16_t>(sign | 0x7c00);    // overflow to infinity
+    }
+
+    if (exponent <= 0) {
+        if (exponent < -10) {
+            return static_cast<uint16_t>(sign);         // underflow to zero
+        }
+        // Denormal: shift the mantissa, with its implicit leading one, into place and round.
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1) {
+            ++half;
+        }
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    // Round to nearest; a carry out of the mantissa correctly bumps the exponent.
+    uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000) {
+        ++half;
+    }
+    return static_cast<uint16_t>(half);
+}
+
+uint32_t PackNormal2_10_10_10(const glm::vec3& normal)
+{
+    uint32_t packed = 0;
+    for (int i = 0; i < 3; ++i) {
+        float component = std::min(std::max(normal[i], -1.0f), 1.0f);
+        int32_t value = static_cast<int32_t>(std::floor(component * 511.0f + 0.5f));
+        packed |= (static_cast<uint32_t>(value) & 0x3ff) << (10 * i);
+    }
+    return packed;      // w (bits 30-31) is left at 0
+}
+
+void VertexFormat::Apply(bool includeNormals) const
+{
+    glVertexAttribPointer(0, 3, positionType, GL_FALSE, stride, (void*)(uintptr_t)positionOffset);
+    glEnableVertexAttribArray(0);
+
+    if (includeNormals) {
+        GLboolean normalize = normalType == GL_FLOAT ? GL_FALSE : GL_TRUE;
+        glVertexAttribPointer(1, normalSize, normalType, normalize, stride, (void*)(uintptr_t)normalOffset);
+        glEnableVertexAttribArray(1);
+    }
+}
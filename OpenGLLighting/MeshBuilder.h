@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+
+// Turns triangle soup (like the vertices[] array in main.cpp) into an indexed mesh ready for
+// upload:
+// 1. WeldVertices() merges bit-identical vertices and builds an index buffer.
+// 2. OptimizeVertexCache() reorders triangles for the post-transform vertex cache (Tom Forsyth's
+//    linear-speed algorithm).
+// 3. OptimizeOverdraw() reorders clusters of those triangles so outward-facing ones come first,
+//    which lets early depth testing reject more of what's behind them.
+// 4. OptimizeVertexFetch() renumbers vertices in the order they're first used.
+// 5. PackVertices() optionally stores positions as half floats and normals as
+//    GL_INT_2_10_10_10_REV.
+// BuildMesh() runs all of them, the first two on each level of detail (see MeshSimplifier.h) on
+// its own.
+
+struct MeshVertex
+{
+    glm::vec3 position;
+    glm::vec3 normal;
+};
+
+static const unsigned int MESH_MAX_LODS = 8;
+
+// A level of detail: a run of a mesh's indices drawing its vertices with fewer triangles, and how
+// far, in the mesh's units, its surface may be from the full mesh's.
+struct MeshLod
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;
+};
+
+struct Mesh
+{
+    std::vector<MeshVertex> vertices;
+    std::vector<uint32_t> indices;      // three per triangle
+    std::vector<MeshLod> lods;          // finest first; empty for a single level of all the indices
+};
+
+// How packed vertices are laid out; Apply() points vertex attributes 0 (position) and 1 (normal)
+// at a buffer in this layout.
+struct VertexFormat
+{
+    GLsizei stride;
+    GLenum positionType;        // GL_FLOAT or GL_HALF_FLOAT
+    GLuint positionOffset;
+    GLenum normalType;          // GL_FLOAT or GL_INT_2_10_10_10_REV
+    GLint normalSize;           // components: 3 for GL_FLOAT, 4 for GL_INT_2_10_10_10_REV
+    GLuint normalOffset;
+
+    // Sets the attribute pointers on the bound VAO, reading from the bound GL_ARRAY_BUFFER.
+    // Pass includeNormals false for programs (like the lamp) that only read positions.
+    void Apply(bool includeNormals = true) const;
+};
+
+struct MeshBuildOptions
+{
+    MeshBuildOptions() : packPositions(true), packNormals(true), cacheSize(16) { }
+
+    bool packPositions;     // half-float positions; fine for small objects, lossy for large ones
+    bool packNormals;       // 10:10:10:2 normals
+    unsigned int cacheSize; // FIFO size used to report ACMR
+};
+
+// Sizes and average cache miss ratio (transformed vertices per triangle) before and after.
+struct MeshBuildStatistics
+{
+    size_t vertexBytesBefore;
+    size_t vertexBytesAfter;
+    size_t indexBytesAfter;
+    size_t verticesBefore;
+    size_t verticesAfter;
+    float acmrBefore;
+    float acmrAfter;
+};
+
+// A mesh in its final form: packed vertices plus 16- or 32-bit indices.
+struct PackedMesh
+{
+    std::vector<unsigned char> vertexData;
+    std::vector<unsigned char> indexData;
+    GLenum indexType;           // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    GLsizei indexCount;         // of every level
+    VertexFormat format;
+    std::vector<MeshLod> lods;  // at least one
+};
+
+Mesh WeldVertices(const MeshVertex* vertices, size_t vertexCount);
+void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount);
+void OptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<MeshVertex>& vertices, unsigned int cacheSize = 16);
+void OptimizeVertexFetch(Mesh& mesh);
+PackedMesh PackVertices(const Mesh& mesh, const MeshBuildOptions& options);
+
+// Average number of vertices transformed per triangle with a FIFO cache of cacheSize entries.
+float SimulateAcmr(const uint32_t* indices, size_t indexCount, unsigned int cacheSize);
+
+// Builds a packed mesh from triangle soup, filling statistics if it isn't null.
+PackedMesh BuildMesh(const MeshVertex* vertices, size_t vertexCount, const MeshBuildOptions& options,
+                     MeshBuildStatistics* statistics = nullptr);
+
+// The same for a mesh that is already indexed (like one read from a file); skips the welding.
+PackedMesh BuildMesh(Mesh mesh, const MeshBuildOptions& options, MeshBuildStatistics* statistics = nullptr);
+
+uint16_t FloatToHalf(float value);
+uint32_t PackNormal2_10_10_10(const glm::vec3& normal);
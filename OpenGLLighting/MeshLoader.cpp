@@ -0,0 +1,1281 @@
+#include "MeshLoader.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "GLStateCache.h"
+#include "MeshSimplifier.h"
+#include "ProgramBinaryCache.h"
+#include "ThreadPool.h"
+
+namespace {
+
+const uint32_t MESH_CACHE_MAGIC = 0x4853454d;   // "MESH"
+const uint32_t MESH_CACHE_VERSION = 2;  // 2: levels of detail
+
+// An OBJ file is split into runs of lines of at least this many bytes, one per task.
+const size_t OBJ_MIN_CHUNK_BYTES = 256 * 1024;
+
+double MillisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+size_t AlignUp(size_t value)
+{
+    return (value + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+}
+
+// True if [offset, offset + bytes) lies within a file of size bytes, without overflowing.
+bool IsWithin(uint64_t offset, uint64_t bytes, uint64_t size)
+{
+    return offset <= size && bytes <= size - offset;
+}
+
+// The header of a mapped cache file, or null if it is truncated, from another version, isn't the
+// file for key, or describes blobs the draw would read past: the draw trusts the index type, the
+// counts and the stride as they are.
+const MeshCacheHeader* GetHeader(const MappedFile& file, uint64_t key)
+{
+    if (file.GetSize() < sizeof(MeshCacheHeader)) {
+        return nullptr;
+    }
+    const MeshCacheHeader* header = reinterpret_cast<const MeshCacheHeader*>(file.GetData());
+    if (header->magic != MESH_CACHE_MAGIC || header->version != MESH_CACHE_VERSION || header->key != key ||
+        header->indexCount == 0 || header->vertexCount == 0 || header->lodCount == 0 || header->lodCount > MESH_MAX_LODS ||
+        !IsWithin(header->vertexOffset, header->vertexBytes, file.GetSize()) ||
+        !IsWithin(header->indexOffset, header->indexBytes, file.GetSize())) {
+        return nullptr;
+    }
+
+    uint64_t indexSize = header->indexType == GL_UNSIGNED_SHORT ? 2 : header->indexType == GL_UNSIGNED_INT ? 4 : 0;
+    if (indexSize == 0 || header->indexBytes != header->indexCount * indexSize ||
+        header->stride <= 0 || header->vertexBytes != static_cast<uint64_t>(header->vertexCount) * header->stride ||
+        header->positionOffset >= static_cast<uint32_t>(header->stride) ||
+        header->normalOffset >= static_cast<uint32_t>(header->stride)) {
+        return nullptr;
+    }
+    for (uint32_t lod = 0; lod < header->lodCount; ++lod) {
+        if (static_cast<uint64_t>(header->lods[lod].firstIndex) + header->lods[lod].indexCount > header->indexCount) {
+            return nullptr;
+        }
+    }
+    return header;
+}
+
+// Gives every vertex whose hasNormal is 0 the area-weighted average normal of its triangles.
+void AddMissingNormals(Mesh& mesh, const std::vector<uint8_t>& hasNormal)
+{
+    if (std::find(hasNormal.begin(), hasNormal.end(), 0) == hasNormal.end()) {
+        return;
+    }
+
+    for (size_t v = 0; v < mesh.vertices.size(); ++v) {
+        if (!hasNormal[v]) {
+            mesh.vertices[v].normal = glm::vec3(0.0f);
+        }
+    }
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+        const uint32_t* triangle = &mesh.indices[i];
+        const glm::vec3& p0 = mesh.vertices[triangle[0]].position;
+        // The cross product's length is twice the area, which weights it.
+        glm::vec3 faceNormal = glm::cross(mesh.vertices[triangle[1]].position - p0, mesh.vertices[triangle[2]].position - p0);
+        for (int corner = 0; corner < 3; ++corner) {
+            if (!hasNormal[triangle[corner]]) {
+                mesh.vertices[triangle[corner]].normal += faceNormal;
+            }
+        }
+    }
+    for (size_t v = 0; v < mesh.vertices.size(); ++v) {
+        if (!hasNormal[v]) {
+            float length = glm::length(mesh.vertices[v].normal);
+            mesh.vertices[v].normal = length > 0.0f ? mesh.vertices[v].normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+        }
+    }
+}
+
+// ---- OBJ ----
+
+bool IsBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+void SkipBlanks(const char*& p, const char* end)
+{
+    while (p < end && IsBlank(*p)) {
+        ++p;
+    }
+}
+
+// strtod() needs a terminated string and the locale's decimal point; a mapped file has neither.
+bool ParseFloat(const char*& p, const char* end, float& value)
+{
+    static const double POWERS_OF_TEN[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    SkipBlanks(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    bool hasDigits = false;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, hasDigits = true) {
+        if (digits < 18) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+        }
+        else {
+            ++exponent;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, hasDigits = true) {
+            if (digits < 18) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                --exponent;
+            }
+        }
+    }
+    if (!hasDigits) {
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negativeExponent = *p++ == '-';
+        }
+        int written = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+            written = std::min(written * 10 + (*p - '0'), 10000);
+        }
+        exponent += negativeExponent ? -written : written;
+    }
+
+    double result = static_cast<double>(mantissa);
+    if (exponent < -22 || exponent > 22) {
+        result *= std::pow(10.0, exponent);
+    }
+    else if (exponent < 0) {
+        result /= POWERS_OF_TEN[-exponent];
+    }
+    else {
+        result *= POWERS_OF_TEN[exponent];
+    }
+    value = static_cast<float>(negative ? -result : result);
+    return true;
+}
+
+bool ParseInteger(const char*& p, const char* end, int64_t& value)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        return false;
+    }
+    value = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+        value = value * 10 + (*p - '0');
+    }
+    if (negative) {
+        value = -value;
+    }
+    return true;
+}
+
+// A corner of a face. Indices are zero-based; a relative one (negative in the file) counts from
+// the start of its chunk and is made absolute once the chunks before it are counted.
+struct ObjCorner
+{
+    enum Flags
+    {
+        RELATIVE_POSITION = 1 << 0,
+        RELATIVE_NORMAL = 1 << 1,
+        HAS_NORMAL = 1 << 2
+    };
+
+    int64_t position;
+    int64_t normal;
+    uint32_t flags;
+};
+
+// What one run of lines defines.
+struct ObjChunk
+{
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<ObjCorner> corners;     // three per triangle
+    size_t badLine;                     // 1-based within the chunk, 0 if every line parsed
+};
+
+// Reads a face's corner ("p", "p/t", "p//n" or "p/t/n").
+bool ParseObjCorner(const char*& p, const char* end, const ObjChunk& chunk, ObjCorner& corner)
+{
+    corner.flags = 0;
+    corner.normal = 0;
+    if (!ParseInteger(p, end, corner.position) || corner.position == 0) {
+        return false;
+    }
+    if (corner.position < 0) {
+        corner.position += static_cast<int64_t>(chunk.positions.size());
+        corner.flags |= ObjCorner::RELATIVE_POSITION;
+    }
+    else {
+        --corner.position;
+    }
+
+    if (p < end && *p == '/') {
+        ++p;
+        int64_t texcoord;
+        if (p < end && *p != '/') {
+            if (!ParseInteger(p, end, texcoord)) {
+                return false;
+            }
+        }
+        if (p < end && *p == '/') {
+            ++p;
+            if (!ParseInteger(p, end, corner.normal) || corner.normal == 0) {
+                return false;
+            }
+            if (corner.normal < 0) {
+                corner.normal += static_cast<int64_t>(chunk.normals.size());
+                corner.flags |= ObjCorner::RELATIVE_NORMAL;
+            }
+            else {
+                --corner.normal;
+            }
+            corner.flags |= ObjCorner::HAS_NORMAL;
+        }
+    }
+    return true;
+}
+
+// Parses the lines in [p, end), which starts at the start of a line.
+void ParseObjChunk(const char* p, const char* end, ObjChunk& chunk)
+{
+    chunk.badLine = 0;
+    std::vector<ObjCorner> face;
+    for (size_t line = 1; p < end; ++line) {
+        const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (lineEnd == nullptr) {
+            lineEnd = end;
+        }
+
+        SkipBlanks(p, lineEnd);
+        bool parsed = true;
+        if (lineEnd - p >= 2 && p[0] == 'v' && IsBlank(p[1])) {
+            glm::vec3 position;
+            p += 2;
+            parsed = ParseFloat(p, lineEnd, position.x) && ParseFloat(p, lineEnd, position.y) &&
+                     ParseFloat(p, lineEnd, position.z);
+            chunk.positions.push_back(position);
+        }
+        else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && IsBlank(p[2])) {
+            glm::vec3 normal;
+            p += 3;
+            parsed = ParseFloat(p, lineEnd, normal.x) && ParseFloat(p, lineEnd, normal.y) &&
+                     ParseFloat(p, lineEnd, normal.z);
+            chunk.normals.push_back(normal);
+        }
+        else if (lineEnd - p >= 2 && p[0] == 'f' && IsBlank(p[1])) {
+            // Polygons become fans around their first corner.
+            face.clear();
+            p += 2;
+            for (SkipBlanks(p, lineEnd); parsed && p < lineEnd; SkipBlanks(p, lineEnd)) {
+                ObjCorner corner;
+                parsed = ParseObjCorner(p, lineEnd, chunk, corner);
+                face.push_back(corner);
+            }
+            parsed = parsed && face.size() >= 3;
+            for (size_t i = 2; parsed && i < face.size(); ++i) {
+                chunk.corners.push_back(face[0]);
+                chunk.corners.push_back(face[i - 1]);
+                chunk.corners.push_back(face[i]);
+            }
+        }
+        // Anything else (comments, texture coordinates, groups, materials) is skipped.
+
+        if (!parsed && chunk.badLine == 0) {
+            chunk.badLine = line;
+        }
+        p = lineEnd + 1;
+    }
+}
+
+bool ReadObj(const std::string& path, ThreadPool& threadPool, Mesh& mesh)
+{
+    MappedFile file;
+    if (!file.Open(path)) {
+        std::cerr << "MeshLoader: can't read " << path << std::endl;
+        return false;
+    }
+    const char* text = reinterpret_cast<const char*>(file.GetData());
+    const size_t size = file.GetSize();
+
+    // Split the file into a run of whole lines per thread.
+    size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threadPool.ThreadCount() + 1, size / OBJ_MIN_CHUNK_BYTES));
+    std::vector<size_t> chunkStart(chunkCount + 1, size);
+    chunkStart[0] = 0;
+    for (size_t c = 1; c < chunkCount; ++c) {
+        const char* newline = static_cast<const char*>(std::memchr(text + size * c / chunkCount, '\n', size - size * c / chunkCount));
+        chunkStart[c] = std::max(chunkStart[c - 1], newline != nullptr ? static_cast<size_t>(newline - text) + 1 : size);
+    }
+
+    std::vector<ObjChunk> chunks(chunkCount);
+    threadPool.ParallelFor(chunkCount, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c) {
+            ParseObjChunk(text + chunkStart[c], text + chunkStart[c + 1], chunks[c]);
+        }
+    });
+
+    std::vector<glm::vec3> positions, normals;
+    std::vector<size_t> positionBase(chunkCount), normalBase(chunkCount);
+    size_t cornerCount = 0;
+    for (size_t c = 0; c < chunkCount; ++c) {
+        if (chunks[c].badLine != 0) {
+            size_t line = chunks[c].badLine + std::count(text, text + chunkStart[c], '\n');
+            std::cerr << "MeshLoader: can't parse line " << line << " of " << path << std::endl;
+            return false;
+        }
+        positionBase[c] = positions.size();
+        normalBase[c] = normals.size();
+        positions.insert(positions.end(), chunks[c].positions.begin(), chunks[c].positions.end());
+        normals.insert(normals.end(), chunks[c].normals.begin(), chunks[c].normals.end());
+        cornerCount += chunks[c].corners.size();
+    }
+
+    // Every distinct pair of position and normal is a vertex.
+    std::unordered_map<uint64_t, uint32_t> vertexIds;
+    vertexIds.reserve(positions.size() * 2);
+    std::vector<uint8_t> hasNormal;
+    mesh.vertices.clear();
+    mesh.indices.clear();
+    mesh.indices.reserve(cornerCount);
+    for (size_t c = 0; c < chunkCount; ++c) {
+        for (const ObjCorner& corner : chunks[c].corners) {
+            int64_t position = corner.position + ((corner.flags & ObjCorner::RELATIVE_POSITION) ? positionBase[c] : 0);
+            int64_t normal = corner.normal + ((corner.flags & ObjCorner::RELATIVE_NORMAL) ? normalBase[c] : 0);
+            bool withNormal = (corner.flags & ObjCorner::HAS_NORMAL) != 0;
+            if (position < 0 || position >= static_cast<int64_t>(positions.size()) ||
+                (withNormal && (normal < 0 || normal >= static_cast<int64_t>(normals.size())))) {
+                std::cerr << "MeshLoader: face index out of range in " << path << std::endl;
+                return false;
+            }
+
+            uint64_t key = (static_cast<uint64_t>(position) << 32) | (withNormal ? static_cast<uint64_t>(normal) : 0xffffffffu);
+            std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> result =
+                    vertexIds.insert(std::make_pair(key, static_cast<uint32_t>(mesh.vertices.size())));
+            if (result.second) {
+                MeshVertex vertex = { positions[position], withNormal ? glm::normalize(normals[normal]) : glm::vec3(0.0f) };
+                mesh.vertices.push_back(vertex);
+                hasNormal.push_back(withNormal ? 1 : 0);
+            }
+            mesh.indices.push_back(result.first->second);
+        }
+    }
+
+    AddMissingNormals(mesh, hasNormal);
+    return true;
+}
+
+// ---- glTF ----
+
+// Just enough JSON for glTF: numbers are doubles and objects keep their members in file order.
+struct JsonValue
+{
+    enum Type { NULL_VALUE, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+    JsonValue() : type(NULL_VALUE), boolean(false), number(0.0) { }
+
+    // The member called key of an object, or null.
+    const JsonValue* Find(const char* key) const
+    {
+        for (size_t i = 0; i < members.size(); ++i) {
+            if (members[i].first == key) {
+                return &members[i].second;
+            }
+        }
+        return nullptr;
+    }
+
+    double GetNumber(const char* key, double fallback) const
+    {
+        const JsonValue* value = Find(key);
+        return value != nullptr && value->type == NUMBER ? value->number : fallback;
+    }
+
+    std::string GetString(const char* key) const
+    {
+        const JsonValue* value = Find(key);
+        return value != nullptr && value->type == STRING ? value->string : std::string();
+    }
+
+    // The element at index of the array called key, or null.
+    const JsonValue* GetElement(const char* key, double index) const
+    {
+        const JsonValue* array = Find(key);
+        if (array == nullptr || array->type != ARRAY || index < 0.0 || index >= array->elements.size()) {
+            return nullptr;
+        }
+        return &array->elements[static_cast<size_t>(index)];
+    }
+
+    Type type;
+    bool boolean;
+    double number;
+    std::string string;
+    std::vector<JsonValue> elements;
+    std::vector<std::pair<std::string, JsonValue>> members;
+};
+
+class JsonParser final
+{
+public:
+    JsonParser(const char* text, size_t length) : _p(text), _end(text + length) { }
+
+    JsonParser(const JsonParser& rhs) = delete;
+    JsonParser& operator=(const JsonParser& rhs) = delete;
+
+    // Parses the one value in the text.
+    bool Parse(JsonValue& value)
+    {
+        if (!ParseValue(value, 0)) {
+            return false;
+        }
+        SkipWhitespace();
+        return _p == _end;
+    }
+
+private:
+    static const int MAX_DEPTH = 64;
+
+    void SkipWhitespace()
+    {
+        while (_p < _end && (*_p == ' ' || *_p == '\t' || *_p == '\n' || *_p == '\r')) {
+            ++_p;
+        }
+    }
+
+    bool Match(const char* literal)
+    {
+        size_t length = std::strlen(literal);
+        if (static_cast<size_t>(_end - _p) < length || std::memcmp(_p, literal, length) != 0) {
+            return false;
+        }
+        _p += length;
+        return true;
+    }
+
+    bool ParseValue(JsonValue& value, int depth)
+    {
+        SkipWhitespace();
+        if (_p == _end || depth > MAX_DEPTH) {
+            return false;
+        }
+        switch (*_p) {
+            case '{': return ParseObject(value, depth);
+            case '[': return ParseArray(value, depth);
+            case '"': value.type = JsonValue::STRING; return ParseString(value.string);
+            case 't': value.type = JsonValue::BOOLEAN; value.boolean = true; return Match("true");
+            case 'f': value.type = JsonValue::BOOLEAN; value.boolean = false; return Match("false");
+            case 'n': value.type = JsonValue::NULL_VALUE; return Match("null");
+            default: value.type = JsonValue::NUMBER; return ParseNumber(value.number);
+        }
+    }
+
+    bool ParseObject(JsonValue& value, int depth)
+    {
+        value.type = JsonValue::OBJECT;
+        ++_p;
+        SkipWhitespace();
+        if (_p < _end && *_p == '}') {
+            ++_p;
+            return true;
+        }
+        while (true) {
+            value.members.push_back(std::make_pair(std::string(), JsonValue()));
+            SkipWhitespace();
+            if (!ParseString(value.members.back().first)) {
+                return false;
+            }
+            SkipWhitespace();
+            if (_p == _end || *_p++ != ':' || !ParseValue(value.members.back().second, depth + 1)) {
+                return false;
+            }
+            SkipWhitespace();
+            if (_p == _end) {
+                return false;
+            }
+            char c = *_p++;
+            if (c == '}') {
+                return true;
+            }
+            if (c != ',') {
+                return false;
+            }
+        }
+    }
+
+    bool ParseArray(JsonValue& value, int depth)
+    {
+        value.type = JsonValue::ARRAY;
+        ++_p;
+        SkipWhitespace();
+        if (_p < _end && *_p == ']') {
+            ++_p;
+            return true;
+        }
+        while (true) {
+            value.elements.push_back(JsonValue());
+            if (!ParseValue(value.elements.back(), depth + 1)) {
+                return false;
+            }
+            SkipWhitespace();
+            if (_p == _end) {
+                return false;
+            }
+            char c = *_p++;
+            if (c == ']') {
+                return true;
+            }
+            if (c != ',') {
+                return false;
+            }
+        }
+    }
+
+    bool ParseString(std::string& string)
+    {
+        if (_p == _end || *_p != '"') {
+            return false;
+        }
+        ++_p;
+        string.clear();
+        while (_p < _end && *_p != '"') {
+            char c = *_p++;
+            if (c != '\\') {
+                string += c;
+                continue;
+            }
+            if (_p == _end) {
+                return false;
+            }
+            c = *_p++;
+            switch (c) {
+                case 'b': string += '\b'; break;
+                case 'f': string += '\f'; break;
+                case 'n': string += '\n'; break;
+                case 'r': string += '\r'; break;
+                case 't': string += '\t'; break;
+                case 'u': {
+                    // Code points outside the basic plane come as surrogate pairs, which are kept as
+                    // two three-byte sequences; glTF only needs them in names and URIs.
+                    if (_end - _p < 4) {
+                        return false;
+                    }
+                    char digits[5] = { _p[0], _p[1], _p[2], _p[3], 0 };
+                    char* digitsEnd = nullptr;
+                    unsigned long codePoint = std::strtoul(digits, &digitsEnd, 16);
+                    if (digitsEnd != digits + 4) {
+                        return false;
+                    }
+                    _p += 4;
+                    if (codePoint < 0x80) {
+                        string += static_cast<char>(codePoint);
+                    }
+                    else if (codePoint < 0x800) {
+                        string += static_cast<char>(0xc0 | (codePoint >> 6));
+                        string += static_cast<char>(0x80 | (codePoint & 0x3f));
+                    }
+                    else {
+                        string += static_cast<char>(0xe0 | (codePoint >> 12));
+                        string += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+                        string += static_cast<char>(0x80 | (codePoint & 0x3f));
+                    }
+                    break;
+                }
+                default: string += c; break;     // \" \\ and \/
+            }
+        }
+        if (_p == _end) {
+            return false;
+        }
+        ++_p;
+        return true;
+    }
+
+    bool ParseNumber(double& number)
+    {
+        char digits[64];
+        size_t length = 0;
+        while (_p + length < _end && length + 1 < sizeof(digits) && std::strchr("+-0123456789.eE", _p[length]) != nullptr) {
+            digits[length] = _p[length];
+            ++length;
+        }
+        digits[length] = 0;
+        char* digitsEnd = nullptr;
+        number = std::strtod(digits, &digitsEnd);
+        if (length == 0 || digitsEnd != digits + length) {
+            return false;
+        }
+        _p += length;
+        return true;
+    }
+
+    const char* _p;
+    const char* _end;
+};
+
+// glTF's componentType values.
+const int GLTF_UNSIGNED_BYTE = 5121;
+const int GLTF_UNSIGNED_SHORT = 5123;
+const int GLTF_UNSIGNED_INT = 5125;
+const int GLTF_FLOAT = 5126;
+const int GLTF_TRIANGLES = 4;
+
+const uint32_t GLB_MAGIC = 0x46546c67;          // "glTF"
+const uint32_t GLB_CHUNK_JSON = 0x4e4f534a;     // "JSON"
+const uint32_t GLB_CHUNK_BIN = 0x004e4942;      // "BIN\0"
+
+bool DecodeBase64(const std::string& text, size_t start, std::vector<unsigned char>& bytes)
+{
+    bytes.clear();
+    uint32_t bits = 0;
+    int bitCount = 0;
+    for (size_t i = start; i < text.size() && text[i] != '='; ++i) {
+        const char c = text[i];
+        int value;
+        if (c >= 'A' && c <= 'Z') value = c - 'A';
+        else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') value = c - '0' + 52;
+        else if (c == '+') value = 62;
+        else if (c == '/') value = 63;
+        else return false;
+        bits = (bits << 6) | value;
+        bitCount += 6;
+        if (bitCount >= 8) {
+            bitCount -= 8;
+            bytes.push_back(static_cast<unsigned char>(bits >> bitCount));
+        }
+    }
+    return true;
+}
+
+// A glTF buffer: mapped from its own file, decoded from a data URI, or the .glb's binary chunk.
+struct GltfBuffer
+{
+    const unsigned char* data;
+    size_t size;
+    std::unique_ptr<MappedFile> file;
+    std::vector<unsigned char> decoded;
+};
+
+class GltfReader final
+{
+public:
+    explicit GltfReader(const std::string& path) : _path(path) { }
+
+    GltfReader(const GltfReader& rhs) = delete;
+    GltfReader& operator=(const GltfReader& rhs) = delete;
+
+    bool Read(Mesh& mesh)
+    {
+        MappedFile file;
+        if (!file.Open(_path)) {
+            return Fail("can't read");
+        }
+
+        // A .glb is a header and chunks: JSON, then optionally the binary buffer.
+        const unsigned char* json = file.GetData();
+        size_t jsonLength = file.GetSize();
+        const unsigned char* binary = nullptr;
+        size_t binaryLength = 0;
+        uint32_t magic = 0;
+        std::memcpy(&magic, file.GetData(), std::min<size_t>(sizeof(magic), file.GetSize()));
+        if (magic == GLB_MAGIC) {
+            size_t offset = 12;
+            json = nullptr;
+            while (offset + 8 <= file.GetSize()) {
+                uint32_t chunk[2];      // length and type
+                std::memcpy(chunk, file.GetData() + offset, sizeof(chunk));
+                offset += 8;
+                if (offset + chunk[0] > file.GetSize()) {
+                    return Fail("truncated");
+                }
+                if (chunk[1] == GLB_CHUNK_JSON && json == nullptr) {
+                    json = file.GetData() + offset;
+                    jsonLength = chunk[0];
+                }
+                else if (chunk[1] == GLB_CHUNK_BIN && binary == nullptr) {
+                    binary = file.GetData() + offset;
+                    binaryLength = chunk[0];
+                }
+                offset += (chunk[0] + 3) & ~3u;
+            }
+            if (json == nullptr) {
+                return Fail("has no JSON chunk");
+            }
+        }
+
+        JsonParser parser(reinterpret_cast<const char*>(json), jsonLength);
+        if (!parser.Parse(_root) || _root.type != JsonValue::OBJECT) {
+            return Fail("isn't valid JSON");
+        }
+
+        const JsonValue* buffers = _root.Find("buffers");
+        for (size_t i = 0; buffers != nullptr && i < buffers->elements.size(); ++i) {
+            if (!LoadBuffer(buffers->elements[i], binary, binaryLength)) {
+                return false;
+            }
+        }
+
+        mesh.vertices.clear();
+        mesh.indices.clear();
+        std::vector<uint8_t> hasNormal;
+        const JsonValue* meshes = _root.Find("meshes");
+        for (size_t m = 0; meshes != nullptr && m < meshes->elements.size(); ++m) {
+            const JsonValue* primitives = meshes->elements[m].Find("primitives");
+            for (size_t p = 0; primitives != nullptr && p < primitives->elements.size(); ++p) {
+                if (!ReadPrimitive(primitives->elements[p], mesh, hasNormal)) {
+                    return false;
+                }
+            }
+        }
+        if (mesh.indices.empty()) {
+            return Fail("has no triangles");
+        }
+
+        AddMissingNormals(mesh, hasNormal);
+        return true;
+    }
+
+private:
+    bool Fail(const char* reason)
+    {
+        std::cerr << "MeshLoader: " << _path << " " << reason << std::endl;
+        return false;
+    }
+
+    bool LoadBuffer(const JsonValue& description, const unsigned char* binary, size_t binaryLength)
+    {
+        _buffers.push_back(std::unique_ptr<GltfBuffer>(new GltfBuffer()));
+        GltfBuffer& buffer = *_buffers.back();
+        std::string uri = description.GetString("uri");
+        if (uri.empty()) {
+            buffer.data = binary;
+            buffer.size = binaryLength;
+        }
+        else if (uri.compare(0, 5, "data:") == 0) {
+            size_t comma = uri.find(";base64,");
+            if (comma == std::string::npos || !DecodeBase64(uri, comma + 8, buffer.decoded)) {
+                return Fail("has a data URI that isn't base64");
+            }
+            buffer.data = buffer.decoded.data();
+            buffer.size = buffer.decoded.size();
+        }
+        else {
+            // Relative to the .gltf; percent-encoded URIs aren't decoded.
+            size_t slash = _path.find_last_of('/');
+            std::string bufferPath = (slash == std::string::npos ? std::string() : _path.substr(0, slash + 1)) + uri;
+            buffer.file.reset(new MappedFile());
+            if (!buffer.file->Open(bufferPath)) {
+                std::cerr << "MeshLoader: can't read " << bufferPath << std::endl;
+                return false;
+            }
+            buffer.data = buffer.file->GetData();
+            buffer.size = buffer.file->GetSize();
+        }
+        if (buffer.data == nullptr || buffer.size < description.GetNumber("byteLength", 0.0)) {
+            return Fail("has a buffer shorter than its byteLength");
+        }
+        return true;
+    }
+
+    // Finds the first element of accessor index, which must have components components and fit in
+    // its buffer view, and sets count, componentType and stride (the distance between elements).
+    const unsigned char* GetAccessorData(double index, int components, size_t& count, int& componentType, size_t& stride)
+    {
+        const JsonValue* accessor = _root.GetElement("accessors", index);
+        if (accessor == nullptr) {
+            return nullptr;
+        }
+        static const char* TYPES[] = { nullptr, "SCALAR", "VEC2", "VEC3", "VEC4" };
+        if (accessor->GetString("type") != TYPES[components] || accessor->Find("sparse") != nullptr) {
+            return nullptr;
+        }
+        count = static_cast<size_t>(accessor->GetNumber("count", 0.0));
+        componentType = static_cast<int>(accessor->GetNumber("componentType", 0.0));
+        size_t componentSize = componentType == GLTF_UNSIGNED_BYTE ? 1 : componentType == GLTF_UNSIGNED_SHORT ? 2 : 4;
+
+        const JsonValue* view = _root.GetElement("bufferViews", accessor->GetNumber("bufferView", -1.0));
+        if (view == nullptr) {
+            return nullptr;
+        }
+        double bufferIndex = view->GetNumber("buffer", -1.0);
+        if (bufferIndex < 0.0 || bufferIndex >= _buffers.size()) {
+            return nullptr;
+        }
+        const GltfBuffer& buffer = *_buffers[static_cast<size_t>(bufferIndex)];
+
+        size_t elementSize = componentSize * components;
+        stride = static_cast<size_t>(view->GetNumber("byteStride", 0.0));
+        if (stride == 0) {
+            stride = elementSize;
+        }
+        size_t offset = static_cast<size_t>(view->GetNumber("byteOffset", 0.0) + accessor->GetNumber("byteOffset", 0.0));
+        size_t viewEnd = static_cast<size_t>(view->GetNumber("byteOffset", 0.0) + view->GetNumber("byteLength", 0.0));
+        if (count == 0 || stride < elementSize || viewEnd > buffer.size || offset + (count - 1) * stride + elementSize > viewEnd) {
+            return nullptr;
+        }
+        return buffer.data + offset;
+    }
+
+    bool ReadVectors(double index, std::vector<glm::vec3>& vectors)
+    {
+        size_t count = 0, stride = 0;
+        int componentType = 0;
+        const unsigned char* data = GetAccessorData(index, 3, count, componentType, stride);
+        if (data == nullptr || componentType != GLTF_FLOAT) {
+            return false;
+        }
+        vectors.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            std::memcpy(&vectors[i], data + i * stride, sizeof(glm::vec3));
+        }
+        return true;
+    }
+
+    bool ReadPrimitive(const JsonValue& primitive, Mesh& mesh, std::vector<uint8_t>& hasNormal)
+    {
+        if (primitive.GetNumber("mode", GLTF_TRIANGLES) != GLTF_TRIANGLES) {
+            return true;    // points and lines have nothing to draw here
+        }
+        const JsonValue* attributes = primitive.Find("attributes");
+        if (attributes == nullptr || attributes->Find("POSITION") == nullptr) {
+            return Fail("has a primitive without positions");
+        }
+
+        std::vector<glm::vec3> positions, normals;
+        if (!ReadVectors(attributes->GetNumber("POSITION", -1.0), positions)) {
+            return Fail("has positions that aren't float VEC3s");
+        }
+        if (attributes->Find("NORMAL") != nullptr &&
+            (!ReadVectors(attributes->GetNumber("NORMAL", -1.0), normals) || normals.size() != positions.size())) {
+            return Fail("has normals that aren't float VEC3s, one per position");
+        }
+
+        const size_t base = mesh.vertices.size();
+        for (size_t i = 0; i < positions.size(); ++i) {
+            MeshVertex vertex = { positions[i], normals.empty() ? glm::vec3(0.0f) : glm::normalize(normals[i]) };
+            mesh.vertices.push_back(vertex);
+            hasNormal.push_back(normals.empty() ? 0 : 1);
+        }
+
+        if (primitive.Find("indices") == nullptr) {
+            for (size_t i = 0; i + 2 < positions.size(); i += 3) {
+                for (size_t corner = 0; corner < 3; ++corner) {
+                    mesh.indices.push_back(static_cast<uint32_t>(base + i + corner));
+                }
+            }
+            return true;
+        }
+
+        size_t count = 0, stride = 0;
+        int componentType = 0;
+        const unsigned char* data = GetAccessorData(primitive.GetNumber("indices", -1.0), 1, count, componentType, stride);
+        if (data == nullptr || (componentType != GLTF_UNSIGNED_BYTE && componentType != GLTF_UNSIGNED_SHORT &&
+                                componentType != GLTF_UNSIGNED_INT)) {
+            return Fail("has indices that aren't unsigned integers");
+        }
+        for (size_t i = 0; i + 2 < count; i += 3) {
+            for (size_t corner = 0; corner < 3; ++corner) {
+                const unsigned char* element = data + (i + corner) * stride;
+                uint32_t index = 0;
+                if (componentType == GLTF_UNSIGNED_BYTE) {
+                    index = *element;
+                }
+                else if (componentType == GLTF_UNSIGNED_SHORT) {
+                    uint16_t value;
+                    std::memcpy(&value, element, sizeof(value));
+                    index = value;
+                }
+                else {
+                    std::memcpy(&index, element, sizeof(index));
+                }
+                if (index >= positions.size()) {
+                    return Fail("has an index out of range");
+                }
+                mesh.indices.push_back(static_cast<uint32_t>(base + index));
+            }
+        }
+        return true;
+    }
+
+    std::string _path;
+    JsonValue _root;
+    std::vector<std::unique_ptr<GltfBuffer>> _buffers;
+};
+
+bool HasExtension(const std::string& path, const char* extension)
+{
+    size_t length = std::strlen(extension);
+    if (path.size() < length) {
+        return false;
+    }
+    for (size_t i = 0; i < length; ++i) {
+        if (std::tolower(static_cast<unsigned char>(path[path.size() - length + i])) != extension[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+MappedFile::MappedFile() :
+        _data(nullptr),
+        _size(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+        void* data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (data != MAP_FAILED) {
+            // Every byte is read once, front to back.
+            posix_madvise(data, static_cast<size_t>(status.st_size), POSIX_MADV_SEQUENTIAL);
+            _data = static_cast<const unsigned char*>(data);
+            _size = static_cast<size_t>(status.st_size);
+        }
+    }
+    close(descriptor);
+    return _data != nullptr;
+}
+
+void MappedFile::Close()
+{
+    if (_data != nullptr) {
+        munmap(const_cast<unsigned char*>(_data), _size);
+        _data = nullptr;
+        _size = 0;
+    }
+}
+
+MeshLoader::MeshLoader(ThreadPool& threadPool, const std::string& cacheDirectory) :
+        _threadPool(threadPool),
+        _directory(cacheDirectory),
+        _stagingBuffer(0)
+{
+    std::memset(&_statistics, 0, sizeof(_statistics));
+
+    if (mkdir(_directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "MeshLoader: can't create " << _directory << std::endl;
+    }
+}
+
+MeshLoader::~MeshLoader()
+{
+    if (_stagingBuffer != 0) {
+        GLStateCache::DeleteBuffer(_stagingBuffer);
+    }
+}
+
+bool MeshLoader::Map(const std::string& path, const MeshLoadOptions& options, MappedFile& file)
+{
+    uint64_t key = KeyFor(path, options);
+    if (key == 0) {
+        std::cerr << "MeshLoader: can't find " << path << std::endl;
+        return false;
+    }
+
+    std::string cachePath = PathForKey(key);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool isMapped = file.Open(cachePath);
+    if (isMapped && GetHeader(file, key) != nullptr) {
+        std::lock_guard<std::mutex> lock(_statisticsMutex);
+        ++_statistics.hits;
+        _statistics.mapMilliseconds += MillisecondsSince(start);
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_statisticsMutex);
+        _statistics.rejects += isMapped ? 1 : 0;
+        ++_statistics.misses;
+    }
+    file.Close();
+
+    if (!Build(path, options, key, cachePath)) {
+        return false;
+    }
+
+    start = std::chrono::steady_clock::now();
+    if (!file.Open(cachePath) || GetHeader(file, key) == nullptr) {
+        std::cerr << "MeshLoader: can't read back " << cachePath << std::endl;
+        file.Close();
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(_statisticsMutex);
+    _statistics.mapMilliseconds += MillisecondsSince(start);
+    return true;
+}
+
+bool MeshLoader::Upload(const MappedFile& file, GpuMesh& mesh)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const MeshCacheHeader& header = *reinterpret_cast<const MeshCacheHeader*>(file.GetData());
+
+    mesh.vertexBuffer = UploadBuffer(file.GetData() + header.vertexOffset, header.vertexBytes);
+    mesh.indexBuffer = UploadBuffer(file.GetData() + header.indexOffset, header.indexBytes);
+    if (mesh.vertexBuffer == 0 || mesh.indexBuffer == 0) {
+        glDeleteBuffers(1, &mesh.vertexBuffer);     // 0 is ignored
+        glDeleteBuffers(1, &mesh.indexBuffer);
+        mesh.vertexBuffer = 0;
+        mesh.indexBuffer = 0;
+        return false;
+    }
+    mesh.indexCount = static_cast<GLsizei>(header.lods[0].indexCount);
+    mesh.lods.clear();
+    for (uint32_t lod = 0; lod < header.lodCount; ++lod) {
+        mesh.lods.push_back({ header.lods[lod].firstIndex, header.lods[lod].indexCount, header.lods[lod].error });
+    }
+    mesh.indexType = header.indexType;
+    mesh.format.stride = header.stride;
+    mesh.format.positionType = header.positionType;
+    mesh.format.positionOffset = header.positionOffset;
+    mesh.format.normalType = header.normalType;
+    mesh.format.normalSize = header.normalSize;
+    mesh.format.normalOffset = header.normalOffset;
+    mesh.boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+    mesh.boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+    mesh.radius = header.radius;
+
+    std::lock_guard<std::mutex> lock(_statisticsMutex);
+    _statistics.bytesUploaded += header.vertexBytes + header.indexBytes;
+    _statistics.uploadMilliseconds += MillisecondsSince(start);
+    return true;
+}
+
+MeshLoader::Statistics MeshLoader::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lock(_statisticsMutex);
+    return _statistics;
+}
+
+uint64_t MeshLoader::KeyFor(const std::string& path, const MeshLoadOptions& options) const
+{
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0) {
+        return 0;
+    }
+
+    uint64_t key = HashFnv1a64(&MESH_CACHE_VERSION, sizeof(MESH_CACHE_VERSION));
+    key = HashFnv1a64(path, key);
+    int64_t size = status.st_size;
+    int64_t modified = status.st_mtime;
+    key = HashFnv1a64(&size, sizeof(size), key);
+    key = HashFnv1a64(&modified, sizeof(modified), key);
+    uint32_t flags[5] = {
+        options.build.packPositions, options.build.packNormals, options.build.cacheSize, options.fitToUnitCube, options.maxLods
+    };
+    key = HashFnv1a64(flags, sizeof(flags), key);
+    return key != 0 ? key : 1;
+}
+
+std::string MeshLoader::PathForKey(uint64_t key) const
+{
+    std::ostringstream path;
+    path << _directory << "/" << std::hex << key << ".mesh";
+    return path.str();
+}
+
+bool MeshLoader::Build(const std::string& path, const MeshLoadOptions& options, uint64_t key, const std::string& cachePath)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Mesh mesh;
+    bool isRead = false;
+    if (HasExtension(path, ".obj")) {
+        isRead = ReadObj(path, _threadPool, mesh);
+    }
+    else if (HasExtension(path, ".gltf") || HasExtension(path, ".glb")) {
+        GltfReader reader(path);
+        isRead = reader.Read(mesh);
+    }
+    else {
+        std::cerr << "MeshLoader: " << path << " isn't an .obj, .gltf or .glb file" << std::endl;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_statisticsMutex);
+        _statistics.parseMilliseconds += MillisecondsSince(start);
+    }
+    if (!isRead) {
+        return false;
+    }
+    if (mesh.indices.empty()) {
+        std::cerr << "MeshLoader: " << path << " has no triangles" << std::endl;
+        return false;
+    }
+
+    start = std::chrono::steady_clock::now();
+    glm::vec3 boundsMin(std::numeric_limits<float>::max()), boundsMax(-std::numeric_limits<float>::max());
+    for (const MeshVertex& vertex : mesh.vertices) {
+        boundsMin = glm::min(boundsMin, vertex.position);
+        boundsMax = glm::max(boundsMax, vertex.position);
+    }
+    if (options.fitToUnitCube) {
+        glm::vec3 extent = boundsMax - boundsMin;
+        float largest = std::max(extent.x, std::max(extent.y, extent.z));
+        float scale = largest > 0.0f ? 1.0f / largest : 1.0f;
+        glm::vec3 centre = (boundsMin + boundsMax) * 0.5f;
+        for (MeshVertex& vertex : mesh.vertices) {
+            vertex.position = (vertex.position - centre) * scale;
+        }
+        boundsMin = (boundsMin - centre) * scale;
+        boundsMax = (boundsMax - centre) * scale;
+    }
+    float radius = 0.0f;
+    for (const MeshVertex& vertex : mesh.vertices) {
+        radius = std::max(radius, glm::length(vertex.position));
+    }
+
+    BuildLodChain(mesh, options.maxLods, &_threadPool);
+    const size_t vertexCount = mesh.vertices.size();
+    PackedMesh packed = BuildMesh(std::move(mesh), options.build);
+
+    MeshCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.key = key;
+    header.vertexOffset = sizeof(MeshCacheHeader);
+    header.vertexBytes = packed.vertexData.size();
+    header.indexOffset = AlignUp(header.vertexOffset + header.vertexBytes);
+    header.indexBytes = packed.indexData.size();
+    header.vertexCount = static_cast<uint32_t>(vertexCount);
+    header.indexCount = static_cast<uint32_t>(packed.indexCount);
+    header.indexType = packed.indexType;
+    header.stride = packed.format.stride;
+    header.positionType = packed.format.positionType;
+    header.positionOffset = packed.format.positionOffset;
+    header.normalType = packed.format.normalType;
+    header.normalSize = packed.format.normalSize;
+    header.normalOffset = packed.format.normalOffset;
+    for (int axis = 0; axis < 3; ++axis) {
+        header.boundsMin[axis] = boundsMin[axis];
+        header.boundsMax[axis] = boundsMax[axis];
+    }
+    header.radius = radius;
+    header.lodCount = static_cast<uint32_t>(packed.lods.size());
+    for (size_t lod = 0; lod < packed.lods.size(); ++lod) {
+        header.lods[lod].firstIndex = packed.lods[lod].firstIndex;
+        header.lods[lod].indexCount = packed.lods[lod].indexCount;
+        header.lods[lod].error = packed.lods[lod].error;
+    }
+
+    // Write to a temporary file and rename it into place, like ProgramBinaryCache, so a concurrent
+    // reader never maps a partly written file.
+    static const char PADDING[MESH_CACHE_ALIGNMENT] = { 0 };
+    std::string temporaryPath = cachePath + ".tmp";
+    std::ofstream outputStream(temporaryPath.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    outputStream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outputStream.write(reinterpret_cast<const char*>(packed.vertexData.data()), packed.vertexData.size());
+    outputStream.write(PADDING, header.indexOffset - header.vertexOffset - header.vertexBytes);
+    outputStream.write(reinterpret_cast<const char*>(packed.indexData.data()), packed.indexData.size());
+    outputStream.close();
+
+    {
+        std::lock_guard<std::mutex> lock(_statisticsMutex);
+        _statistics.buildMilliseconds += MillisecondsSince(start);
+    }
+
+    if (!outputStream || std::rename(temporaryPath.c_str(), cachePath.c_str()) != 0) {
+        std::cerr << "MeshLoader: can't write " << cachePath << std::endl;
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+GLuint MeshLoader::UploadBuffer(const unsigned char* data, size_t size)
+{
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if (GLEW_ARB_buffer_storage) {
+        // Immutable and never mapped: the driver can keep it in video memory.
+        glBufferStorage(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(size), nullptr, 0);
+    }
+    else {
+        glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(size), nullptr, GL_STATIC_DRAW);
+    }
+
+    if (_stagingBuffer == 0) {
+        glGenBuffers(1, &_stagingBuffer);
+        glBindBuffer(GL_COPY_READ_BUFFER, _stagingBuffer);
+        glBufferData(GL_COPY_READ_BUFFER, STAGING_BUFFER_SIZE, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, _stagingBuffer);
+
+    for (size_t offset = 0; offset < size; offset += STAGING_BUFFER_SIZE) {
+        size_t pieceSize = std::min(STAGING_BUFFER_SIZE, size - offset);
+
+        // Invalidating the whole staging buffer lets the driver hand out fresh memory while the GPU
+        // is still copying the previous piece, rather than wait for it.
+        void* staging = glMapBufferRange(GL_COPY_READ_BUFFER, 0, static_cast<GLsizeiptr>(pieceSize),
+                                         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (staging == nullptr) {
+            std::cerr << "MeshLoader: can't map the staging buffer" << std::endl;
+            glDeleteBuffers(1, &buffer);
+            buffer = 0;
+            break;
+        }
+        std::memcpy(staging, data + offset, pieceSize);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, static_cast<GLintptr>(offset),
+                            static_cast<GLsizeiptr>(pieceSize));
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return buffer;
+}
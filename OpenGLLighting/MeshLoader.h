@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+
+#include "MeshBuilder.h"
+
+class ThreadPool;
+
+// Loads meshes from OBJ files and glTF 2.0 files (.gltf with its buffers, or .glb). The first load
+// of a file parses it (an OBJ in parallel on the thread pool, one run of lines per task), runs it
+// through MeshBuilder and writes the result to a cache file; every later load maps the cache file
+// and copies its blobs into GL buffers through a staging buffer. Nothing is parsed or converted
+// and the bytes are touched once, on their way from the page cache into the staging buffer, so
+// a cached load costs about as much as reading the file.
+//
+// A cache file is a MeshCacheHeader followed by the vertex blob and the index blob, each starting on
+// a MESH_CACHE_ALIGNMENT boundary and laid out exactly as the GL reads them. The header's key is a
+// hash of the source's path, size and modification time and of the load options, so an edited
+// source or different options miss the cache. Files are in the byte order of the machine that
+// wrote them.
+//
+// Building a cache file also simplifies the mesh into a chain of levels of detail (see
+// MeshSimplifier.h), on the thread pool. The levels share the vertex blob; their indices follow each
+// other in the index blob, and the header lists them.
+//
+// glTF files are read in their meshes' own space: every triangle primitive of every mesh is merged
+// into one, and node transforms, materials and texture coordinates are ignored, as they are for OBJ.
+// Vertices without normals get the area-weighted average of their triangles' normals.
+
+static const uint32_t MESH_CACHE_ALIGNMENT = 64;
+
+// A level of detail in a cache file: a run of the index blob, in indices.
+struct MeshCacheLod
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;                // in the mesh's units, after MeshLoadOptions::fitToUnitCube
+    uint32_t reserved;
+};
+
+struct MeshCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t vertexOffset;      // from the start of the file
+    uint64_t vertexBytes;
+    uint64_t indexOffset;
+    uint64_t indexBytes;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t indexType;         // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    int32_t stride;             // the VertexFormat's fields
+    uint32_t positionType;
+    uint32_t positionOffset;
+    uint32_t normalType;
+    int32_t normalSize;
+    uint32_t normalOffset;
+    float boundsMin[3];
+    float boundsMax[3];
+    float radius;               // of the bounding sphere around the origin
+    uint32_t lodCount;
+    uint32_t reserved[3];
+    MeshCacheLod lods[MESH_MAX_LODS];   // finest first
+};
+
+static_assert(sizeof(MeshCacheHeader) % MESH_CACHE_ALIGNMENT == 0, "the vertex blob follows the header");
+
+// A read-only mapping of a whole file.
+class MappedFile final
+{
+public:
+    MappedFile();
+
+    MappedFile(const MappedFile& rhs) = delete;
+    MappedFile& operator=(const MappedFile& rhs) = delete;
+
+    ~MappedFile();
+
+    // Maps path, unmapping whatever was mapped before. False if it can't be opened or is empty.
+    bool Open(const std::string& path);
+    void Close();
+
+    const unsigned char* GetData() const { return _data; }
+    size_t GetSize() const { return _size; }
+
+private:
+    const unsigned char* _data;
+    size_t _size;
+};
+
+struct MeshLoadOptions
+{
+    MeshLoadOptions() : fitToUnitCube(false), maxLods(MESH_MAX_LODS) { }
+
+    MeshBuildOptions build;
+    bool fitToUnitCube;         // centre the mesh and scale it into the cube from -0.5 to 0.5
+    unsigned int maxLods;       // levels of detail to build, counting the full mesh; 1 for none
+};
+
+// A mesh in GL buffers, with its bounds after MeshLoadOptions::fitToUnitCube.
+struct GpuMesh
+{
+    GLuint vertexBuffer;
+    GLuint indexBuffer;
+    GLsizei indexCount;         // of level 0, the full mesh
+    std::vector<MeshLod> lods;
+    GLenum indexType;
+    VertexFormat format;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    float radius;
+};
+
+class MeshLoader final
+{
+public:
+    // The staging buffer; larger blobs are uploaded a piece at a time.
+    static const size_t STAGING_BUFFER_SIZE = 4 * 1024 * 1024;
+
+    // Counters since construction.
+    struct Statistics
+    {
+        unsigned int hits;
+        unsigned int misses;
+        unsigned int rejects;       // cache files that were truncated, inconsistent or didn't match their key
+        double parseMilliseconds;   // reading sources, on misses
+        double buildMilliseconds;   // simplifying, MeshBuilder and writing cache files, on misses
+        double mapMilliseconds;
+        double uploadMilliseconds;
+        uint64_t bytesUploaded;
+    };
+
+    // Cache files are written to cacheDirectory, which is created if it doesn't exist. OBJ files are
+    // parsed on threadPool.
+    MeshLoader(ThreadPool& threadPool, const std::string& cacheDirectory);
+
+    MeshLoader(const MeshLoader& rhs) = delete;
+    MeshLoader& operator=(const MeshLoader& rhs) = delete;
+
+    ~MeshLoader();
+
+    // Maps the cache file of the mesh at path, building it first if it is missing or stale. Makes no
+    // GL calls, so it can run on any thread, several at once. Returns false, printing why, if the
+    // mesh can't be read or the cache can't be written.
+    bool Map(const std::string& path, const MeshLoadOptions& options, MappedFile& file);
+
+    // Copies a cache file mapped by Map() into new buffers, from one thread at a time. It binds
+    // buffers directly rather than through GLStateCache, so that it can run on a loader thread's
+    // context; on the render thread, call GLStateCache::Invalidate() afterwards. Returns false,
+    // printing why and leaving no buffers behind, if the copy fails.
+    bool Upload(const MappedFile& file, GpuMesh& mesh);
+
+    Statistics GetStatistics() const;
+
+private:
+    // 0 if the source can't be found.
+    uint64_t KeyFor(const std::string& path, const MeshLoadOptions& options) const;
+    std::string PathForKey(uint64_t key) const;
+
+    // Reads the source, simplifies it and writes its cache file.
+    bool Build(const std::string& path, const MeshLoadOptions& options, uint64_t key, const std::string& cachePath);
+
+    // A new immutable buffer holding size bytes of data, or 0 if the copy fails.
+    GLuint UploadBuffer(const unsigned char* data, size_t size);
+
+    ThreadPool& _threadPool;
+    std::string _directory;
+    GLuint _stagingBuffer;      // created by the first upload
+
+    mutable std::mutex _statisticsMutex;
+    Statistics _statistics;
+};
@@ -0,0 +1,361 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+#include "ThreadPool.h"
+
+namespace {
+
+// Edges are costed in runs of this many per task.
+const size_t SIMPLIFY_CHUNK_SIZE = 16384;
+
+// A collapse is refused if it turns one of the moving vertex's triangles by more than about 75
+// degrees: the cosine between its normals before and after must be above this.
+const float SIMPLIFY_MAX_NORMAL_COSINE = 0.25f;
+
+// The symmetric 4x4 matrix of a sum of plane quadrics, and the area of the planes summed in.
+struct Quadric
+{
+    double a00, a01, a02, a03;
+    double a11, a12, a13;
+    double a22, a23;
+    double a33;
+    double weight;
+};
+
+// Adds the plane through p with unit normal n, weighted by area.
+void AddPlane(Quadric& quadric, const glm::vec3& n, const glm::vec3& p, double area)
+{
+    double x = n.x, y = n.y, z = n.z;
+    double d = -(x * p.x + y * p.y + z * p.z);
+    quadric.a00 += area * x * x;
+    quadric.a01 += area * x * y;
+    quadric.a02 += area * x * z;
+    quadric.a03 += area * x * d;
+    quadric.a11 += area * y * y;
+    quadric.a12 += area * y * z;
+    quadric.a13 += area * y * d;
+    quadric.a22 += area * z * z;
+    quadric.a23 += area * z * d;
+    quadric.a33 += area * d * d;
+    quadric.weight += area;
+}
+
+void AddQuadric(Quadric& quadric, const Quadric& other)
+{
+    quadric.a00 += other.a00;
+    quadric.a01 += other.a01;
+    quadric.a02 += other.a02;
+    quadric.a03 += other.a03;
+    quadric.a11 += other.a11;
+    quadric.a12 += other.a12;
+    quadric.a13 += other.a13;
+    quadric.a22 += other.a22;
+    quadric.a23 += other.a23;
+    quadric.a33 += other.a33;
+    quadric.weight += other.weight;
+}
+
+// The area-weighted sum of squared distances from point to the quadric's planes.
+double Evaluate(const Quadric& quadric, const glm::vec3& point)
+{
+    double x = point.x, y = point.y, z = point.z;
+    return quadric.a00 * x * x + quadric.a11 * y * y + quadric.a22 * z * z + quadric.a33 +
+           2.0 * (quadric.a01 * x * y + quadric.a02 * x * z + quadric.a12 * y * z +
+                  quadric.a03 * x + quadric.a13 * y + quadric.a23 * z);
+}
+
+struct Collapse
+{
+    uint32_t from;
+    uint32_t to;
+    float cost;     // mean squared distance
+};
+
+// Hashes and compares positions by their exact bit patterns.
+struct PositionBits
+{
+    uint32_t bits[3];
+
+    bool operator==(const PositionBits& rhs) const
+    {
+        return std::memcmp(bits, rhs.bits, sizeof(bits)) == 0;
+    }
+};
+
+struct PositionBitsHash
+{
+    size_t operator()(const PositionBits& position) const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (int i = 0; i < 3; ++i) {
+            hash = (hash ^ position.bits[i]) * 1099511628211ull;
+        }
+        return static_cast<size_t>(hash ^ (hash >> 32));
+    }
+};
+
+// For every vertex, the first vertex at the same position; seams are where they differ.
+std::vector<uint32_t> FindPositionGroups(const std::vector<MeshVertex>& vertices, std::vector<uint8_t>& onSeam)
+{
+    std::vector<uint32_t> groups(vertices.size());
+    onSeam.assign(vertices.size(), 0);
+    std::unordered_map<PositionBits, uint32_t, PositionBitsHash> firstAt;
+    firstAt.reserve(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        PositionBits bits;
+        std::memcpy(bits.bits, &vertices[i].position[0], sizeof(bits.bits));
+        auto inserted = firstAt.insert(std::make_pair(bits, static_cast<uint32_t>(i)));
+        groups[i] = inserted.first->second;
+        if (!inserted.second) {
+            onSeam[groups[i]] = 1;
+        }
+    }
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        onSeam[i] = onSeam[groups[i]];
+    }
+    return groups;
+}
+
+// Marks the vertices on edges used by only one triangle, comparing positions rather than indices
+// so that seams aren't taken for borders.
+void LockBorders(const std::vector<uint32_t>& indices, const std::vector<uint32_t>& groups, std::vector<uint8_t>& locked)
+{
+    std::vector<uint64_t> edges;
+    edges.reserve(indices.size());
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        for (int corner = 0; corner < 3; ++corner) {
+            uint64_t a = groups[indices[i + corner]];
+            uint64_t b = groups[indices[i + (corner + 1) % 3]];
+            edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<uint8_t> lockedGroups(groups.size(), 0);
+    for (size_t i = 0; i < edges.size();) {
+        size_t end = i + 1;
+        while (end < edges.size() && edges[end] == edges[i]) {
+            ++end;
+        }
+        if (end - i == 1) {
+            lockedGroups[edges[i] >> 32] = 1;
+            lockedGroups[edges[i] & 0xffffffffu] = 1;
+        }
+        i = end;
+    }
+    for (size_t i = 0; i < groups.size(); ++i) {
+        locked[i] |= lockedGroups[groups[i]];
+    }
+}
+
+// Whether moving from onto to turns any of from's remaining triangles too far. remap holds the
+// collapses made earlier in the pass.
+bool FlipsTriangle(const std::vector<MeshVertex>& vertices, const std::vector<uint32_t>& groups,
+                   const std::vector<uint32_t>& indices, const std::vector<uint32_t>& remap,
+                   const uint32_t* triangles, size_t triangleCount, uint32_t from, uint32_t to)
+{
+    const glm::vec3& target = vertices[to].position;
+    for (size_t i = 0; i < triangleCount; ++i) {
+        const uint32_t* triangle = &indices[triangles[i] * 3];
+        uint32_t corners[3] = { remap[triangle[0]], remap[triangle[1]], remap[triangle[2]] };
+        if (groups[corners[0]] == groups[to] || groups[corners[1]] == groups[to] || groups[corners[2]] == groups[to]) {
+            continue;   // collapses to nothing
+        }
+
+        glm::vec3 before[3], after[3];
+        for (int corner = 0; corner < 3; ++corner) {
+            before[corner] = vertices[corners[corner]].position;
+            after[corner] = corners[corner] == from ? target : before[corner];
+        }
+        glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+        glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+        if (glm::dot(normalBefore, normalAfter) <
+            SIMPLIFY_MAX_NORMAL_COSINE * glm::length(normalBefore) * glm::length(normalAfter)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+float SimplifyLevel(const std::vector<MeshVertex>& vertices, const std::vector<uint32_t>& groups,
+                    const std::vector<uint8_t>& onSeam, std::vector<uint32_t>& indices, size_t targetIndexCount,
+                    ThreadPool* threadPool)
+{
+    const size_t vertexCount = vertices.size();
+    std::vector<uint8_t> locked(onSeam);
+    LockBorders(indices, groups, locked);
+
+    // Quadrics are kept per position, so a seam's vertices share one.
+    std::vector<Quadric> quadrics(vertexCount);
+    std::memset(quadrics.data(), 0, quadrics.size() * sizeof(Quadric));
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        const glm::vec3& p0 = vertices[indices[i]].position;
+        glm::vec3 normal = glm::cross(vertices[indices[i + 1]].position - p0, vertices[indices[i + 2]].position - p0);
+        float length = glm::length(normal);
+        if (length == 0.0f) {
+            continue;
+        }
+        for (int corner = 0; corner < 3; ++corner) {
+            AddPlane(quadrics[groups[indices[i + corner]]], normal / length, p0, 0.5 * length);
+        }
+    }
+
+    std::vector<uint32_t> remap(vertexCount);
+    for (size_t i = 0; i < vertexCount; ++i) {
+        remap[i] = static_cast<uint32_t>(i);
+    }
+    std::vector<uint8_t> touched(vertexCount);
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+    std::vector<uint32_t> adjacency;
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> output;
+    double maxCost = 0.0;
+
+    while (indices.size() > targetIndexCount) {
+        // Every edge once: a closed surface has each edge in two triangles, ascending in one of them.
+        // An edge of an open surface may be missed, but its vertices are locked anyway.
+        collapses.clear();
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            for (int corner = 0; corner < 3; ++corner) {
+                uint32_t a = indices[i + corner], b = indices[i + (corner + 1) % 3];
+                if (a < b && !(locked[a] && locked[b])) {
+                    collapses.push_back({ a, b, 0.0f });
+                }
+            }
+        }
+
+        // Cost each edge's cheaper direction; a locked vertex can only be collapsed onto.
+        const size_t edgeCount = collapses.size();
+        auto costEdges = [&](size_t firstChunk, size_t lastChunk) {
+            for (size_t i = firstChunk * SIMPLIFY_CHUNK_SIZE; i < std::min(lastChunk * SIMPLIFY_CHUNK_SIZE, edgeCount); ++i) {
+                Collapse& collapse = collapses[i];
+                Quadric merged = quadrics[groups[collapse.from]];
+                AddQuadric(merged, quadrics[groups[collapse.to]]);
+                double scale = merged.weight > 0.0 ? 1.0 / merged.weight : 0.0;
+                double costToB = locked[collapse.from] ? std::numeric_limits<double>::max()
+                                                       : Evaluate(merged, vertices[collapse.to].position) * scale;
+                double costToA = locked[collapse.to] ? std::numeric_limits<double>::max()
+                                                     : Evaluate(merged, vertices[collapse.from].position) * scale;
+                if (costToA < costToB) {
+                    std::swap(collapse.from, collapse.to);
+                }
+                collapse.cost = static_cast<float>(std::max(std::min(costToA, costToB), 0.0));
+            }
+        };
+        const size_t chunkCount = (edgeCount + SIMPLIFY_CHUNK_SIZE - 1) / SIMPLIFY_CHUNK_SIZE;
+        if (threadPool != nullptr) {
+            threadPool->ParallelFor(chunkCount, costEdges);
+        }
+        else {
+            costEdges(0, chunkCount);
+        }
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+        // The triangles around each vertex.
+        std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+        for (uint32_t index : indices) {
+            ++adjacencyOffsets[index + 1];
+        }
+        for (size_t i = 0; i < vertexCount; ++i) {
+            adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+        }
+        adjacency.resize(indices.size());
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i) {
+            adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+
+        // Collapse cheapest first, each vertex at most once a pass, until enough triangles go.
+        std::fill(touched.begin(), touched.end(), 0);
+        const size_t trianglesToRemove = (indices.size() - targetIndexCount + 2) / 3;
+        size_t trianglesRemoved = 0;
+        size_t collapsed = 0;
+        for (const Collapse& collapse : collapses) {
+            if (trianglesRemoved >= trianglesToRemove) {
+                break;
+            }
+            if (touched[collapse.from] || touched[collapse.to]) {
+                continue;
+            }
+            const uint32_t* triangles = &adjacency[adjacencyOffsets[collapse.from]];
+            const size_t triangleCount = adjacencyOffsets[collapse.from + 1] - adjacencyOffsets[collapse.from];
+            if (FlipsTriangle(vertices, groups, indices, remap, triangles, triangleCount, collapse.from, collapse.to)) {
+                continue;
+            }
+
+            for (size_t i = 0; i < triangleCount; ++i) {
+                const uint32_t* triangle = &indices[triangles[i] * 3];
+                if (groups[remap[triangle[0]]] == groups[collapse.to] || groups[remap[triangle[1]]] == groups[collapse.to] ||
+                    groups[remap[triangle[2]]] == groups[collapse.to]) {
+                    ++trianglesRemoved;
+                }
+            }
+            remap[collapse.from] = collapse.to;
+            touched[collapse.from] = touched[collapse.to] = 1;
+            AddQuadric(quadrics[groups[collapse.to]], quadrics[groups[collapse.from]]);
+            maxCost = std::max(maxCost, static_cast<double>(collapse.cost));
+            ++collapsed;
+        }
+        if (collapsed == 0) {
+            break;
+        }
+
+        // Drop the triangles that collapsed; ones reduced to a line between seam vertices too.
+        output.clear();
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            uint32_t a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+            if (groups[a] != groups[b] && groups[b] != groups[c] && groups[a] != groups[c]) {
+                output.push_back(a);
+                output.push_back(b);
+                output.push_back(c);
+            }
+        }
+        indices.swap(output);
+    }
+
+    return static_cast<float>(std::sqrt(maxCost));
+}
+
+}   // namespace
+
+float SimplifyMesh(const std::vector<MeshVertex>& vertices, std::vector<uint32_t>& indices, size_t targetIndexCount,
+                   ThreadPool* threadPool)
+{
+    std::vector<uint8_t> onSeam;
+    std::vector<uint32_t> groups = FindPositionGroups(vertices, onSeam);
+    return SimplifyLevel(vertices, groups, onSeam, indices, targetIndexCount, threadPool);
+}
+
+void BuildLodChain(Mesh& mesh, unsigned int maxLods, ThreadPool* threadPool)
+{
+    mesh.lods.assign(1, { 0, static_cast<uint32_t>(mesh.indices.size()), 0.0f });
+    maxLods = std::min(maxLods, MESH_MAX_LODS);
+    if (maxLods <= 1) {
+        return;
+    }
+
+    std::vector<uint8_t> onSeam;
+    std::vector<uint32_t> groups = FindPositionGroups(mesh.vertices, onSeam);
+    std::vector<uint32_t> level(mesh.indices);
+    float error = 0.0f;
+    while (mesh.lods.size() < maxLods) {
+        const size_t triangleCount = level.size() / 3;
+        const size_t targetTriangles = static_cast<size_t>(triangleCount * MESH_LOD_REDUCTION);
+        if (targetTriangles < MESH_LOD_MIN_TRIANGLES) {
+            break;
+        }
+
+        error += SimplifyLevel(mesh.vertices, groups, onSeam, level, targetTriangles * 3, threadPool);
+        if (level.size() / 3 > triangleCount * MESH_LOD_MIN_PROGRESS) {
+            break;
+        }
+        mesh.lods.push_back({ static_cast<uint32_t>(mesh.indices.size()), static_cast<uint32_t>(level.size()), error });
+        mesh.indices.insert(mesh.indices.end(), level.begin(), level.end());
+    }
+}
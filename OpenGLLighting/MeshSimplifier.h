@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "MeshBuilder.h"
+
+class ThreadPool;
+
+// Quadric error mesh simplification (Garland and Heckbert, "Surface Simplification Using Quadric
+// Error Metrics", 1997), for building a mesh's levels of detail offline.
+//
+// Every vertex starts with the quadric of the planes of its triangles, weighted by their areas,
+// which measures the squared distance of a point from those planes. Simplification collapses
+// edges, moving one vertex onto the other, so no vertex is ever made and every level draws from
+// the full mesh's vertex buffer. A collapse costs the merged quadric's mean squared distance at
+// the kept vertex's position, and the merged quadric goes with the kept vertex. It runs in passes:
+// each pass costs every edge (in parallel on the thread pool), sorts the edges and collapses them
+// cheapest first, skipping vertices already moved or kept in the pass and collapses that would
+// flip a triangle, until the level has its target triangle count or nothing can collapse.
+//
+// Vertices on open borders and on attribute seams (vertices sharing a position, like the corners
+// of a hard-edged cube) never move, so outlines and creases stay where they were. A level's error
+// is how far, in the mesh's units, its surface may be from the full mesh's: the square root of its
+// largest collapse cost, added up down the chain.
+
+// Each level aims for this fraction of the triangles of the level before it...
+static const float MESH_LOD_REDUCTION = 0.5f;
+
+// ...and the chain stops when that would go under MESH_LOD_MIN_TRIANGLES, or when a level can't get
+// below MESH_LOD_MIN_PROGRESS of them.
+static const size_t MESH_LOD_MIN_TRIANGLES = 32;
+static const float MESH_LOD_MIN_PROGRESS = 0.75f;
+
+// Simplifies the triangles in indices, which index vertices, to at most targetIndexCount indices if
+// it can. Returns the error of the result. threadPool may be null.
+float SimplifyMesh(const std::vector<MeshVertex>& vertices, std::vector<uint32_t>& indices, size_t targetIndexCount,
+                   ThreadPool* threadPool = nullptr);
+
+// Builds up to maxLods levels of detail (at most MESH_MAX_LODS), each simplified from the one
+// before: mesh.lods[0] is the full mesh, and the indices of each coarser level are appended to
+// mesh.indices. threadPool may be null.
+void BuildLodChain(Mesh& mesh, unsigned int maxLods, ThreadPool* threadPool = nullptr);
@@ -0,0 +1,201 @@
+#include "ObjectStore.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Frustum.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+
+namespace {
+
+// The widest vector the culling kernel can use in this build.
+#if SIMD_AVX
+typedef Float8 CullVector;
+#else
+typedef Float4 CullVector;
+#endif
+
+// Objects per task in the parallel variants: large enough to amortize the scheduling, small
+// enough to balance the load.
+const size_t PARALLEL_CHUNK_SIZE = 16384;
+
+// Model matrix of one object, the scalar path for the tail of a batch.
+glm::mat4 ModelMatrix(float px, float py, float pz, float qx, float qy, float qz, float qw,
+                      float sx, float sy, float sz)
+{
+    glm::mat4 model;
+    model[0] = glm::vec4((1.0f - 2.0f * (qy * qy + qz * qz)) * sx, 2.0f * (qx * qy + qw * qz) * sx,
+                         2.0f * (qx * qz - qw * qy) * sx, 0.0f);
+    model[1] = glm::vec4(2.0f * (qx * qy - qw * qz) * sy, (1.0f - 2.0f * (qx * qx + qz * qz)) * sy,
+                         2.0f * (qy * qz + qw * qx) * sy, 0.0f);
+    model[2] = glm::vec4(2.0f * (qx * qz + qw * qy) * sz, 2.0f * (qy * qz - qw * qx) * sz,
+                         (1.0f - 2.0f * (qx * qx + qy * qy)) * sz, 0.0f);
+    model[3] = glm::vec4(px, py, pz, 1.0f);
+    return model;
+}
+
+// Culls objects [begin, end) Vector::WIDTH at a time and returns where it stopped; the caller
+// finishes the remainder. For each plane the signed distance of every centre plus its radius is
+// folded into a running minimum, so one compare at the end decides all six planes.
+template <typename Vector>
+size_t CullSpheresWide(const float* x, const float* y, const float* z, const float* radius,
+                       const glm::vec4* planes, uint32_t* visible, size_t begin, size_t end, size_t& count)
+{
+    Vector planeX[FRUSTUM_PLANE_COUNT], planeY[FRUSTUM_PLANE_COUNT], planeZ[FRUSTUM_PLANE_COUNT],
+           planeW[FRUSTUM_PLANE_COUNT];
+    for (int plane = 0; plane < FRUSTUM_PLANE_COUNT; ++plane) {
+        planeX[plane] = Vector::Set1(planes[plane].x);
+        planeY[plane] = Vector::Set1(planes[plane].y);
+        planeZ[plane] = Vector::Set1(planes[plane].z);
+        planeW[plane] = Vector::Set1(planes[plane].w);
+    }
+    const Vector zero = Vector::Zero();
+
+    size_t i = begin;
+    for (; i + Vector::WIDTH <= end; i += Vector::WIDTH) {
+        Vector cx = Vector::Load(x + i);
+        Vector cy = Vector::Load(y + i);
+        Vector cz = Vector::Load(z + i);
+        Vector r = Vector::Load(radius + i);
+
+        Vector distance = planeX[0] * cx + planeY[0] * cy + planeZ[0] * cz + planeW[0];
+        for (int plane = 1; plane < FRUSTUM_PLANE_COUNT; ++plane) {
+            distance = Min(distance, planeX[plane] * cx + planeY[plane] * cy + planeZ[plane] * cz + planeW[plane]);
+        }
+        int mask = GreaterEqualMask(distance + r, zero);
+
+        // Branch-free compaction: every lane writes its index, and only the visible ones advance
+        // the output.
+        for (int lane = 0; lane < Vector::WIDTH; ++lane) {
+            visible[count] = static_cast<uint32_t>(i + lane);
+            count += (mask >> lane) & 1;
+        }
+    }
+    return i;
+}
+
+}
+
+void ObjectStore::Resize(size_t count)
+{
+    _positionX.assign(count, 0.0f);
+    _positionY.assign(count, 0.0f);
+    _positionZ.assign(count, 0.0f);
+    _orientationX.assign(count, 0.0f);
+    _orientationY.assign(count, 0.0f);
+    _orientationZ.assign(count, 0.0f);
+    _orientationW.assign(count, 1.0f);
+    _scaleX.assign(count, 1.0f);
+    _scaleY.assign(count, 1.0f);
+    _scaleZ.assign(count, 1.0f);
+    _radius.assign(count, 0.0f);
+}
+
+void ObjectStore::SetObject(size_t index, const glm::vec3& position, const glm::vec4& orientation,
+                            const glm::vec3& scale, float radius)
+{
+    _positionX[index] = position.x;
+    _positionY[index] = position.y;
+    _positionZ[index] = position.z;
+    SetOrientation(index, orientation);
+    _scaleX[index] = scale.x;
+    _scaleY[index] = scale.y;
+    _scaleZ[index] = scale.z;
+    _radius[index] = radius * std::max(std::max(std::abs(scale.x), std::abs(scale.y)), std::abs(scale.z));
+}
+
+// Four objects per iteration: the twelve matrix elements are computed for all four at once, then
+// each column is transposed back into the four matrices.
+void ObjectStore::BuildModelMatrices(glm::mat4* models, size_t begin, size_t end) const
+{
+    const Float4 one = Float4::Set1(1.0f);
+    const Float4 two = Float4::Set1(2.0f);
+    const Float4 zero = Float4::Zero();
+
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        Float4 qx = Float4::Load(&_orientationX[i]);
+        Float4 qy = Float4::Load(&_orientationY[i]);
+        Float4 qz = Float4::Load(&_orientationZ[i]);
+        Float4 qw = Float4::Load(&_orientationW[i]);
+        Float4 sx = Float4::Load(&_scaleX[i]);
+        Float4 sy = Float4::Load(&_scaleY[i]);
+        Float4 sz = Float4::Load(&_scaleZ[i]);
+
+        Float4 xx = qx * qx, yy = qy * qy, zz = qz * qz;
+        Float4 xy = qx * qy, xz = qx * qz, yz = qy * qz;
+        Float4 wx = qw * qx, wy = qw * qy, wz = qw * qz;
+
+        Float4 columns[4][4] = {
+            { (one - two * (yy + zz)) * sx, two * (xy + wz) * sx, two * (xz - wy) * sx, zero },
+            { two * (xy - wz) * sy, (one - two * (xx + zz)) * sy, two * (yz + wx) * sy, zero },
+            { two * (xz + wy) * sz, two * (yz - wx) * sz, (one - two * (xx + yy)) * sz, zero },
+            { Float4::Load(&_positionX[i]), Float4::Load(&_positionY[i]), Float4::Load(&_positionZ[i]), one }
+        };
+
+        for (int column = 0; column < 4; ++column) {
+            Float4* c = columns[column];
+            Transpose(c[0], c[1], c[2], c[3]);
+            for (int object = 0; object < 4; ++object) {
+                c[object].Store(&models[i + object][column][0]);
+            }
+        }
+    }
+
+    for (; i < end; ++i) {
+        models[i] = ModelMatrix(_positionX[i], _positionY[i], _positionZ[i],
+                                _orientationX[i], _orientationY[i], _orientationZ[i], _orientationW[i],
+                                _scaleX[i], _scaleY[i], _scaleZ[i]);
+    }
+}
+
+void ObjectStore::BuildModelMatrices(ThreadPool& threadPool, glm::mat4* models) const
+{
+    threadPool.ParallelFor(Size(), [this, models](size_t begin, size_t end) {
+        BuildModelMatrices(models, begin, end);
+    });
+}
+
+size_t ObjectStore::CullSpheres(const glm::vec4* planes, uint32_t* visible, size_t begin, size_t end) const
+{
+    if (begin >= end) {
+        return 0;
+    }
+
+    size_t count = 0;
+    size_t i = CullSpheresWide<CullVector>(&_positionX[0], &_positionY[0], &_positionZ[0], &_radius[0],
+                                           planes, visible, begin, end, count);
+    for (; i < end; ++i) {
+        if (IsSphereInFrustum(planes, glm::vec3(_positionX[i], _positionY[i], _positionZ[i]), _radius[i])) {
+            visible[count++] = static_cast<uint32_t>(i);
+        }
+    }
+    return count;
+}
+
+// Each chunk is culled into its own slice of visible, then the slices are moved down to close the
+// gaps, which keeps the result in object order.
+size_t ObjectStore::CullSpheres(ThreadPool& threadPool, const glm::vec4* planes, uint32_t* visible) const
+{
+    const size_t size = Size();
+    const size_t chunkCount = (size + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+    _chunkCounts.resize(chunkCount);
+
+    threadPool.ParallelFor(chunkCount, [this, planes, visible, size](size_t firstChunk, size_t lastChunk) {
+        for (size_t chunk = firstChunk; chunk < lastChunk; ++chunk) {
+            size_t begin = chunk * PARALLEL_CHUNK_SIZE;
+            size_t end = std::min(begin + PARALLEL_CHUNK_SIZE, size);
+            _chunkCounts[chunk] = CullSpheres(planes, visible + begin, begin, end);
+        }
+    });
+
+    size_t count = 0;
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+        if (count != chunk * PARALLEL_CHUNK_SIZE) {
+            std::memmove(visible + count, visible + chunk * PARALLEL_CHUNK_SIZE, _chunkCounts[chunk] * sizeof(uint32_t));
+        }
+        count += _chunkCounts[chunk];
+    }
+    return count;
+}
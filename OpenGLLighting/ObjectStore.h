@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+
+class ThreadPool;
+
+// The transforms and bounds of the scene's objects, stored as a structure of arrays so the batch
+// kernels below can load one component of several objects per SIMD instruction.
+//
+// Each object has a position, a unit quaternion orientation, a per-axis scale and a bounding
+// sphere centred on its position. The kernels build model matrices in bulk (translate * rotate *
+// scale, the same as glm::translate/rotate/scale) and test the spheres against the frustum,
+// writing out the indices of the visible objects. They are the CPU fallback for drivers without
+// compute shaders (see GpuCuller), and run four objects per iteration with SSE or NEON, or eight
+// with AVX when the compiler targets it. Each kernel also has a variant that splits the objects
+// across a thread pool.
+class ObjectStore final
+{
+public:
+    ObjectStore() { }
+
+    ObjectStore(const ObjectStore& rhs) = delete;
+    ObjectStore& operator=(const ObjectStore& rhs) = delete;
+
+    void Resize(size_t count);
+    size_t Size() const { return _positionX.size(); }
+
+    // radius is the model-space bounding radius; the stored one is scaled by the largest scale.
+    void SetObject(size_t index, const glm::vec3& position, const glm::vec4& orientation, const glm::vec3& scale,
+                   float radius);
+
+    // orientation is a unit quaternion (x, y, z, w).
+    void SetOrientation(size_t index, const glm::vec4& orientation)
+    {
+        _orientationX[index] = orientation.x;
+        _orientationY[index] = orientation.y;
+        _orientationZ[index] = orientation.z;
+        _orientationW[index] = orientation.w;
+    }
+
+    glm::vec3 GetPosition(size_t index) const
+    {
+        return glm::vec3(_positionX[index], _positionY[index], _positionZ[index]);
+    }
+    glm::vec4 GetOrientation(size_t index) const
+    {
+        return glm::vec4(_orientationX[index], _orientationY[index], _orientationZ[index], _orientationW[index]);
+    }
+    glm::vec3 GetScale(size_t index) const { return glm::vec3(_scaleX[index], _scaleY[index], _scaleZ[index]); }
+    float GetRadius(size_t index) const { return _radius[index]; }
+
+    // Writes the model matrices of objects [begin, end) to models[begin, end).
+    void BuildModelMatrices(glm::mat4* models, size_t begin, size_t end) const;
+    void BuildModelMatrices(ThreadPool& threadPool, glm::mat4* models) const;
+
+    // Tests the bounding spheres of objects [begin, end) against planes (see Frustum.h) and writes
+    // the indices of the visible ones, in order, to visible. Returns how many there are. visible
+    // must have room for end - begin indices.
+    size_t CullSpheres(const glm::vec4* planes, uint32_t* visible, size_t begin, size_t end) const;
+
+    // The same for every object, in parallel. visible must have room for Size() indices.
+    size_t CullSpheres(ThreadPool& threadPool, const glm::vec4* planes, uint32_t* visible) const;
+
+private:
+    std::vector<float> _positionX, _positionY, _positionZ;
+    std::vector<float> _orientationX, _orientationY, _orientationZ, _orientationW;
+    std::vector<float> _scaleX, _scaleY, _scaleZ;
+    std::vector<float> _radius;     // world space
+
+    mutable std::vector<size_t> _chunkCounts;   // visible objects per chunk, for the parallel cull
+};
@@ -0,0 +1,300 @@
+#include "Profiler.h"
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+Profiler::Profiler() :
+    _epoch(Clock::now()),
+    _gpuEpoch(0),
+    _queries(FRAME_LATENCY * MAX_ZONES_PER_FRAME * 2),
+    _frameIndex(0),
+    _summaryInterval(0.0),
+    _summaryStart(_epoch),
+    _summaryFrames(0),
+    _summaryFrameMilliseconds(0.0),
+    _traceFramesLeft(0),
+    _droppedGpuFrames(0)
+{
+    glGetInteger64v(GL_TIMESTAMP, &_gpuEpoch);
+    glGenQueries(static_cast<GLsizei>(_queries.size()), &_queries[0]);
+
+    for (unsigned int i = 0; i < FRAME_LATENCY; ++i) {
+        _frames[i].zones.reserve(MAX_ZONES_PER_FRAME);
+        _frames[i].counters.reserve(MAX_COUNTERS_PER_FRAME);
+        _frames[i].queryCount = 0;
+        _frames[i].cpuBegin = _frames[i].cpuEnd = 0;
+        _frames[i].pending = false;
+    }
+    _openZones.reserve(MAX_ZONES_PER_FRAME);
+}
+
+Profiler::~Profiler()
+{
+    glDeleteQueries(static_cast<GLsizei>(_queries.size()), &_queries[0]);
+}
+
+void Profiler::BeginFrame()
+{
+    ++_frameIndex;
+    Frame& frame = _frames[_frameIndex % FRAME_LATENCY];
+
+    // This slot was last used FRAME_LATENCY frames ago; collect it before reusing its queries.
+    if (frame.pending) {
+        ReadBack(frame, false);
+        Complete(frame);
+    }
+
+    frame.zones.clear();
+    frame.counters.clear();
+    frame.queryCount = 0;
+    frame.cpuBegin = CpuNow();
+    frame.cpuEnd = frame.cpuBegin;
+    frame.pending = true;
+    _openZones.clear();
+}
+
+void Profiler::EndFrame()
+{
+    Frame& frame = _frames[_frameIndex % FRAME_LATENCY];
+    while (!_openZones.empty()) {
+        EndZone(_openZones.back());
+    }
+    frame.cpuEnd = CpuNow();
+}
+
+unsigned int Profiler::BeginZone(const char* name)
+{
+    Frame& frame = _frames[_frameIndex % FRAME_LATENCY];
+
+    Zone zone;
+    zone.name = name;
+    zone.depth = static_cast<unsigned int>(_openZones.size());
+    zone.query = -1;
+    zone.gpuBegin = zone.gpuEnd = -1;
+
+    // Zones past the query budget are still timed on the CPU.
+    if (frame.queryCount + 2 <= MAX_ZONES_PER_FRAME * 2) {
+        GLuint* queries = &_queries[(_frameIndex % FRAME_LATENCY) * MAX_ZONES_PER_FRAME * 2];
+        glQueryCounter(queries[frame.queryCount], GL_TIMESTAMP);
+        zone.query = static_cast<int>(frame.queryCount);
+        frame.queryCount += 2;
+    }
+
+    zone.cpuBegin = CpuNow();
+    zone.cpuEnd = zone.cpuBegin;
+    frame.zones.push_back(zone);
+
+    unsigned int index = static_cast<unsigned int>(frame.zones.size() - 1);
+    _openZones.push_back(index);
+    return index;
+}
+
+void Profiler::EndZone(unsigned int index)
+{
+    Frame& frame = _frames[_frameIndex % FRAME_LATENCY];
+    if (_openZones.empty() || _openZones.back() != index) {
+        return;     // already closed by EndFrame(), or ended out of order
+    }
+    _openZones.pop_back();
+
+    Zone& zone = frame.zones[index];
+    zone.cpuEnd = CpuNow();
+    if (zone.query >= 0) {
+        GLuint* queries = &_queries[(_frameIndex % FRAME_LATENCY) * MAX_ZONES_PER_FRAME * 2];
+        glQueryCounter(queries[zone.query + 1], GL_TIMESTAMP);
+    }
+}
+
+void Profiler::SetCounter(const char* name, double value)
+{
+    Frame& frame = _frames[_frameIndex % FRAME_LATENCY];
+    for (size_t i = 0; i < frame.counters.size(); ++i) {
+        if (frame.counters[i].name == name || std::strcmp(frame.counters[i].name, name) == 0) {
+            frame.counters[i].value = value;
+            return;
+        }
+    }
+    if (frame.counters.size() < MAX_COUNTERS_PER_FRAME) {
+        Counter counter = { name, value };
+        frame.counters.push_back(counter);
+    }
+}
+
+void Profiler::StartTrace(size_t maxFrames)
+{
+    _trace.clear();
+    _trace.reserve(maxFrames * 8);
+    _traceFramesLeft = maxFrames;
+}
+
+bool Profiler::WriteTrace(const std::string& path) const
+{
+    std::ofstream out(path.c_str());
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"CPU\"}},\n";
+    out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"GPU\"}}";
+    for (size_t i = 0; i < _trace.size(); ++i) {
+        const TraceEvent& event = _trace[i];
+        if (event.track < 0) {
+            out << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"C\", \"pid\": 1, \"ts\": "
+                << event.beginMicroseconds << ", \"args\": {\"value\": " << event.durationMicroseconds << "}}";
+            continue;
+        }
+        out << ",\n{\"name\": \"" << event.name << "\", \"cat\": \"" << (event.track == 0 ? "cpu" : "gpu")
+            << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.track + 1
+            << ", \"ts\": " << event.beginMicroseconds << ", \"dur\": " << event.durationMicroseconds << "}";
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+void Profiler::Flush()
+{
+    for (unsigned int i = 1; i <= FRAME_LATENCY; ++i) {
+        Frame& frame = _frames[(_frameIndex + i) % FRAME_LATENCY];  // oldest first
+        if (frame.pending) {
+            ReadBack(frame, true);
+            Complete(frame);
+        }
+    }
+}
+
+int64_t Profiler::CpuNow() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - _epoch).count();
+}
+
+void Profiler::ReadBack(Frame& frame, bool wait)
+{
+    frame.pending = false;
+    if (frame.queryCount == 0) {
+        return;
+    }
+
+    size_t slot = &frame - _frames;
+    GLuint* queries = &_queries[slot * MAX_ZONES_PER_FRAME * 2];
+
+    // Queries complete in order, so the last one being available means they all are.
+    GLint available = GL_FALSE;
+    if (!wait) {
+        glGetQueryObjectiv(queries[frame.queryCount - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    }
+
+    for (size_t i = 0; i < frame.zones.size(); ++i) {
+        Zone& zone = frame.zones[i];
+        if (zone.query < 0 || (!wait && !available)) {
+            continue;
+        }
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(queries[zone.query], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(queries[zone.query + 1], GL_QUERY_RESULT, &end);
+        zone.gpuBegin = static_cast<GLint64>(begin);
+        zone.gpuEnd = static_cast<GLint64>(end);
+    }
+
+    if (!wait && !available) {
+        ++_droppedGpuFrames;
+    }
+}
+
+void Profiler::Complete(const Frame& frame)
+{
+    // Rolling summary. The first interval starts with the first completed frame rather than at
+    // startup, which includes building the shaders.
+    if (_summaryFrames == 0 && _summary.empty()) {
+        _summaryStart = Clock::now();
+    }
+    ++_summaryFrames;
+    _summaryFrameMilliseconds += (frame.cpuEnd - frame.cpuBegin) * 1e-6;
+    for (size_t i = 0; i < frame.zones.size(); ++i) {
+        const Zone& zone = frame.zones[i];
+
+        ZoneSummary* summary = nullptr;
+        for (size_t j = 0; j < _summary.size() && summary == nullptr; ++j) {
+            if (_summary[j].name == zone.name || std::strcmp(_summary[j].name, zone.name) == 0) {
+                summary = &_summary[j];
+            }
+        }
+        if (summary == nullptr) {
+            ZoneSummary added = { zone.name, 0.0, 0.0, 0 };
+            _summary.push_back(added);
+            summary = &_summary.back();
+        }
+
+        summary->cpuMilliseconds += (zone.cpuEnd - zone.cpuBegin) * 1e-6;
+        if (zone.gpuBegin >= 0) {
+            summary->gpuMilliseconds += (zone.gpuEnd - zone.gpuBegin) * 1e-6;
+            ++summary->gpuSamples;
+        }
+    }
+    for (size_t i = 0; i < frame.counters.size(); ++i) {
+        const Counter& counter = frame.counters[i];
+
+        CounterSummary* summary = nullptr;
+        for (size_t j = 0; j < _counterSummary.size() && summary == nullptr; ++j) {
+            if (_counterSummary[j].name == counter.name || std::strcmp(_counterSummary[j].name, counter.name) == 0) {
+                summary = &_counterSummary[j];
+            }
+        }
+        if (summary == nullptr) {
+            CounterSummary added = { counter.name, 0.0 };
+            _counterSummary.push_back(added);
+            summary = &_counterSummary.back();
+        }
+        summary->total += counter.value;
+    }
+    if (_summaryInterval > 0.0 &&
+            std::chrono::duration<double>(Clock::now() - _summaryStart).count() >= _summaryInterval) {
+        PrintSummary();
+    }
+
+    // Trace.
+    if (_traceFramesLeft > 0) {
+        --_traceFramesLeft;
+        for (size_t i = 0; i < frame.zones.size(); ++i) {
+            const Zone& zone = frame.zones[i];
+            TraceEvent cpu = { zone.name, 0, zone.cpuBegin * 1e-3, (zone.cpuEnd - zone.cpuBegin) * 1e-3 };
+            _trace.push_back(cpu);
+            if (zone.gpuBegin >= 0) {
+                TraceEvent gpu = { zone.name, 1, (zone.gpuBegin - _gpuEpoch) * 1e-3, (zone.gpuEnd - zone.gpuBegin) * 1e-3 };
+                _trace.push_back(gpu);
+            }
+        }
+        for (size_t i = 0; i < frame.counters.size(); ++i) {
+            TraceEvent counter = { frame.counters[i].name, -1, frame.cpuBegin * 1e-3, frame.counters[i].value };
+            _trace.push_back(counter);
+        }
+    }
+}
+
+void Profiler::PrintSummary()
+{
+    std::cout << "Profile (" << _summaryFrames << " frames, ms per frame CPU/GPU): frame "
+              << _summaryFrameMilliseconds / _summaryFrames;
+    for (size_t i = 0; i < _summary.size(); ++i) {
+        const ZoneSummary& summary = _summary[i];
+        std::cout << " | " << summary.name << " " << summary.cpuMilliseconds / _summaryFrames << "/";
+        if (summary.gpuSamples > 0) {
+            std::cout << summary.gpuMilliseconds / summary.gpuSamples;
+        }
+        else {
+            std::cout << "-";
+        }
+    }
+    for (size_t i = 0; i < _counterSummary.size(); ++i) {
+        std::cout << " | " << _counterSummary[i].name << " " << _counterSummary[i].total / _summaryFrames;
+    }
+    if (_droppedGpuFrames > 0) {
+        std::cout << " (" << _droppedGpuFrames << " frames without GPU times)";
+    }
+    std::cout << std::endl;
+
+    _summary.clear();
+    _counterSummary.clear();
+    _summaryFrames = 0;
+    _summaryFrameMilliseconds = 0.0;
+    _summaryStart = Clock::now();
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+// A frame profiler with named, nestable zones timed on both the CPU (std::chrono) and the GPU
+// (glQueryCounter with GL_TIMESTAMP).
+//
+// GPU timestamps are only known once the GPU gets there, so each frame's queries come from a
+// pool with one slot per frame in flight. A slot is read back FRAME_LATENCY frames later, when it
+// is about to be reused; by then the results are normally available, and if they aren't the
+// frame's GPU times are dropped rather than waited for. Completed frames feed a rolling console
+// summary and, while tracing, a Chrome trace (chrome://tracing or ui.perfetto.dev) with one track
+// for the CPU and one for the GPU.
+//
+// Besides zones, a frame can record counters: named values such as bytes moved by a pass, which
+// the summary averages per frame and the trace plots as counter tracks.
+class Profiler final
+{
+public:
+    static const unsigned int FRAME_LATENCY = 4;
+    static const unsigned int MAX_ZONES_PER_FRAME = 64;
+    static const unsigned int MAX_COUNTERS_PER_FRAME = 16;
+
+    Profiler();
+    ~Profiler();
+
+    Profiler(const Profiler& rhs) = delete;
+    Profiler& operator=(const Profiler& rhs) = delete;
+
+    void BeginFrame();
+    void EndFrame();
+
+    // Zones must be ended in reverse order of beginning. name must outlive the profiler; use
+    // string literals.
+    unsigned int BeginZone(const char* name);
+    void EndZone(unsigned int zone);
+
+    // Records a value for the current frame; setting a counter twice in a frame keeps the last
+    // value. name must outlive the profiler, as for zones.
+    void SetCounter(const char* name, double value);
+
+    // Prints the average CPU and GPU milliseconds per frame of each zone every interval; 0 (the
+    // default) turns the summary off.
+    void SetSummaryInterval(double seconds) { _summaryInterval = seconds; }
+
+    // Keeps every zone of the next maxFrames completed frames for WriteTrace().
+    void StartTrace(size_t maxFrames);
+    bool WriteTrace(const std::string& path) const;
+
+    // Waits for the GPU results of the frames still in flight, e.g. before writing the trace.
+    void Flush();
+
+    unsigned int DroppedGpuFrames() const { return _droppedGpuFrames; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Zone
+    {
+        const char* name;
+        unsigned int depth;
+        int64_t cpuBegin;       // nanoseconds since the profiler was created
+        int64_t cpuEnd;
+        int query;              // first of the zone's two queries in the frame's slot; -1 if none
+        GLint64 gpuBegin;       // GL_TIMESTAMP nanoseconds; -1 if not measured
+        GLint64 gpuEnd;
+    };
+
+    struct Counter
+    {
+        const char* name;
+        double value;
+    };
+
+    struct Frame
+    {
+        std::vector<Zone> zones;
+        std::vector<Counter> counters;
+        unsigned int queryCount;
+        int64_t cpuBegin;
+        int64_t cpuEnd;
+        bool pending;           // recorded, but not yet read back
+    };
+
+    struct ZoneSummary
+    {
+        const char* name;
+        double cpuMilliseconds;
+        double gpuMilliseconds;
+        unsigned int gpuSamples;
+    };
+
+    struct CounterSummary
+    {
+        const char* name;
+        double total;
+    };
+
+    struct TraceEvent
+    {
+        const char* name;
+        int track;              // 0 is the CPU, 1 is the GPU, -1 a counter
+        double beginMicroseconds;
+        double durationMicroseconds;    // the value, for a counter
+    };
+
+    int64_t CpuNow() const;
+    void ReadBack(Frame& frame, bool wait);
+    void Complete(const Frame& frame);
+    void PrintSummary();
+
+    Clock::time_point _epoch;
+    GLint64 _gpuEpoch;          // GL_TIMESTAMP at _epoch, to put both clocks on one timeline
+
+    std::vector<GLuint> _queries;   // FRAME_LATENCY * MAX_ZONES_PER_FRAME * 2
+    Frame _frames[FRAME_LATENCY];
+    unsigned int _frameIndex;
+    std::vector<unsigned int> _openZones;
+
+    double _summaryInterval;
+    Clock::time_point _summaryStart;
+    unsigned int _summaryFrames;
+    double _summaryFrameMilliseconds;
+    std::vector<ZoneSummary> _summary;
+    std::vector<CounterSummary> _counterSummary;
+
+    std::vector<TraceEvent> _trace;
+    size_t _traceFramesLeft;
+
+    unsigned int _droppedGpuFrames;
+};
+
+// Times a block of code as a zone of profiler, which may be null. The zone ends when the object
+// goes out of scope, or earlier with End().
+class ProfileZone final
+{
+public:
+    ProfileZone(Profiler* profiler, const char* name) :
+        _profiler(profiler),
+        _zone(profiler != nullptr ? profiler->BeginZone(name) : 0)
+    {
+    }
+
+    ~ProfileZone() { End(); }
+
+    ProfileZone(const ProfileZone& rhs) = delete;
+    ProfileZone& operator=(const ProfileZone& rhs) = delete;
+
+    void End()
+    {
+        if (_profiler != nullptr) {
+            _profiler->EndZone(_zone);
+            _profiler = nullptr;
+        }
+    }
+
+private:
+    Profiler* _profiler;
+    unsigned int _zone;
+};
@@ -0,0 +1,156 @@
+#include "ProgramBinaryCache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <sys/stat.h>
+
+namespace {
+
+const uint32_t CACHE_MAGIC = 0x4e494250;    // "PBIN"
+const uint32_t CACHE_VERSION = 1;
+
+// File layout: this header followed by `length` bytes of driver binary.
+struct CacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+};
+
+std::string GetGLString(GLenum name)
+{
+    const GLubyte* value = glGetString(name);
+    return value != nullptr ? reinterpret_cast<const char*>(value) : "";
+}
+
+}
+
+ProgramBinaryCache::ProgramBinaryCache(const std::string& directory) :
+        _directory(directory),
+        _driverHash(0),
+        _isSupported(false),
+        _hits(0),
+        _misses(0),
+        _rejects(0)
+{
+    GLint nbrOfFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nbrOfFormats);
+
+    if (mkdir(_directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "ProgramBinaryCache: can't create " << _directory << std::endl;
+    }
+    else if (nbrOfFormats > 0) {
+        _isSupported = true;
+    }
+
+    _driverHash = HashFnv1a64(GetGLString(GL_VENDOR));
+    _driverHash = HashFnv1a64(GetGLString(GL_RENDERER), _driverHash);
+    _driverHash = HashFnv1a64(GetGLString(GL_VERSION), _driverHash);
+    _driverHash = HashFnv1a64(GetGLString(GL_SHADING_LANGUAGE_VERSION), _driverHash);
+}
+
+bool ProgramBinaryCache::IsSupported() const
+{
+    return _isSupported;
+}
+
+uint64_t ProgramBinaryCache::BeginKey() const
+{
+    return _driverHash;
+}
+
+uint64_t ProgramBinaryCache::AddStageToKey(uint64_t key, GLenum shaderType, const std::string& source)
+{
+    key = HashFnv1a64(&shaderType, sizeof(shaderType), key);
+    return HashFnv1a64(source, key);
+}
+
+bool ProgramBinaryCache::Load(uint64_t key, GLuint program)
+{
+    if (!_isSupported) {
+        return false;
+    }
+
+    std::string path = PathForKey(key);
+    std::ifstream inputStream(path.c_str(), std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+    std::streamoff fileSize = inputStream.tellg();
+    inputStream.seekg(0);
+
+    CacheHeader header;
+    if (!inputStream.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        ++_misses;
+        return false;
+    }
+
+    // A hash collision, a file from another cache version, or a length that isn't what follows the
+    // header (a truncated or corrupt file) is treated like a rejected binary.
+    std::vector<char> binary;
+    if (header.magic == CACHE_MAGIC && header.version == CACHE_VERSION && header.key == key &&
+        header.length > 0 && static_cast<std::streamoff>(header.length) == fileSize - static_cast<std::streamoff>(sizeof(header))) {
+        binary.resize(header.length);
+        inputStream.read(&binary[0], header.length);
+    }
+    inputStream.close();
+
+    GLint didLink = GL_FALSE;
+    if (!binary.empty() && inputStream) {
+        glProgramBinary(program, header.format, &binary[0], static_cast<GLsizei>(binary.size()));
+        glGetProgramiv(program, GL_LINK_STATUS, &didLink);
+    }
+
+    if (didLink != GL_TRUE) {
+        ++_rejects;
+        std::remove(path.c_str());
+        return false;
+    }
+
+    ++_hits;
+    return true;
+}
+
+void ProgramBinaryCache::Store(uint64_t key, GLuint program)
+{
+    if (!_isSupported) {
+        return;
+    }
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, nullptr, &format, &binary[0]);
+
+    CacheHeader header = { CACHE_MAGIC, CACHE_VERSION, key, format, static_cast<uint32_t>(length) };
+
+    // Write to a temporary file and rename it into place so that a concurrent reader never sees a
+    // partially written binary.
+    std::string path = PathForKey(key);
+    std::string temporaryPath = path + ".tmp";
+    std::ofstream outputStream(temporaryPath.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    outputStream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outputStream.write(&binary[0], length);
+    outputStream.close();
+
+    if (!outputStream || std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        std::cerr << "ProgramBinaryCache: can't write " << path << std::endl;
+        std::remove(temporaryPath.c_str());
+    }
+}
+
+std::string ProgramBinaryCache::PathForKey(uint64_t key) const
+{
+    std::ostringstream path;
+    path << _directory << "/" << std::hex << key << ".bin";
+    return path.str();
+}
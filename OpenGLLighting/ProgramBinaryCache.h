@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+// 64-bit FNV-1a hash. Chain calls by passing the previous result as the seed.
+inline uint64_t HashFnv1a64(const void* data, size_t length, uint64_t seed = 14695981039346656037ull)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t HashFnv1a64(const std::string& text, uint64_t seed = 14695981039346656037ull)
+{
+    return HashFnv1a64(text.data(), text.size(), seed);
+}
+
+// An on-disk cache of linked program binaries (glGetProgramBinary/glProgramBinary).
+// Entries are keyed on a hash of the driver's vendor, renderer and version strings plus the full
+// source of every stage (including injected #defines), so a driver update or a shader edit simply
+// misses the cache. A binary the driver refuses to load is deleted and the program is rebuilt from
+// source; callers never see the difference other than in the statistics.
+class ProgramBinaryCache final
+{
+public:
+    explicit ProgramBinaryCache(const std::string& directory);
+
+    ProgramBinaryCache(const ProgramBinaryCache& rhs) = delete;
+    ProgramBinaryCache& operator=(const ProgramBinaryCache& rhs) = delete;
+
+    // False if the driver exposes no binary formats (or the directory can't be created), in
+    // which case Load() always misses and Store() does nothing.
+    bool IsSupported() const;
+
+    // Starts a key for a program. Add each stage with AddStageToKey().
+    uint64_t BeginKey() const;
+    static uint64_t AddStageToKey(uint64_t key, GLenum shaderType, const std::string& source);
+
+    // Loads the binary for key into program. Returns true if program is now linked.
+    bool Load(uint64_t key, GLuint program);
+
+    // Writes the binary of a linked program. The program should have been linked with
+    // GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+    void Store(uint64_t key, GLuint program);
+
+    unsigned int Hits() const { return _hits; }
+    unsigned int Misses() const { return _misses; }
+    unsigned int Rejects() const { return _rejects; }
+
+private:
+    std::string PathForKey(uint64_t key) const;
+
+    std::string _directory;
+    uint64_t _driverHash;   // hash of GL_VENDOR, GL_RENDERER, GL_VERSION and GL_SHADING_LANGUAGE_VERSION
+    bool _isSupported;
+
+    unsigned int _hits;
+    unsigned int _misses;
+    unsigned int _rejects;  // binaries found on disk that the driver refused
+};
@@ -0,0 +1,245 @@
+#include "Regression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+std::vector<RegressionScenario> CreateScenarios()
+{
+    std::vector<RegressionScenario> scenarios;
+
+    // Circles the default cube and light, close up.
+    RegressionScenario singleCube = { "single-cube", 0, 1, false, false, false, 40, {}, { 19, 39 } };
+    singleCube.path = {
+        { glm::vec3(0.0f, 0.0f, 6.0f), -90.0f, 0.0f },
+        { glm::vec3(3.0f, 1.5f, 5.2f), -120.0f, -14.0f },
+        { glm::vec3(5.0f, 2.0f, 1.0f), -169.0f, -21.0f }
+    };
+    scenarios.push_back(singleCube);
+
+    // Flies from outside a grid of spinning cubes into the corridor along its axis.
+    RegressionScenario grid = { "grid-flythrough", 1000, 1, false, false, false, 40, {}, { 19, 39 } };
+    grid.path = {
+        { glm::vec3(0.0f, 2.0f, 30.0f), -90.0f, -4.0f },
+        { glm::vec3(0.0f, 0.0f, 6.0f), -90.0f, 0.0f },
+        { glm::vec3(0.0f, 0.0f, -8.0f), -80.0f, 0.0f }
+    };
+    scenarios.push_back(grid);
+
+    // Pans across the grid lit by many small lights, which loads the clustered lighting.
+    RegressionScenario manyLights = { "many-lights", 1000, 256, false, false, false, 40, {}, { 19, 39 } };
+    manyLights.path = {
+        { glm::vec3(-6.0f, 2.0f, 10.0f), -75.0f, -8.0f },
+        { glm::vec3(6.0f, 2.0f, 10.0f), -105.0f, -8.0f }
+    };
+    scenarios.push_back(manyLights);
+
+    // Deferred shading with shadow maps and the sun, from above, moving so the cascades refit.
+    RegressionScenario deferred = { "deferred-shadows", 1000, 64, true, true, true, 40, {}, { 19, 39 } };
+    deferred.path = {
+        { glm::vec3(0.0f, 6.0f, 14.0f), -90.0f, -25.0f },
+        { glm::vec3(8.0f, 4.0f, 8.0f), -135.0f, -15.0f }
+    };
+    scenarios.push_back(deferred);
+
+    return scenarios;
+}
+
+// sRGB to linear, for 8-bit channels.
+double ToLinear(uint8_t value)
+{
+    double c = value / 255.0;
+    return c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+}
+
+double LabCurve(double t)
+{
+    return t > 216.0 / 24389.0 ? std::cbrt(t) : (24389.0 / 27.0 * t + 16.0) / 116.0;
+}
+
+// CIELAB under D65 of an sRGB pixel.
+void ToLab(const uint8_t* rgb, const double* linear, double lab[3])
+{
+    double r = linear[rgb[0]], g = linear[rgb[1]], b = linear[rgb[2]];
+    double x = (0.4124 * r + 0.3576 * g + 0.1805 * b) / 0.95047;
+    double y = 0.2126 * r + 0.7152 * g + 0.0722 * b;
+    double z = (0.0193 * r + 0.1192 * g + 0.9505 * b) / 1.08883;
+    double fx = LabCurve(x), fy = LabCurve(y), fz = LabCurve(z);
+    lab[0] = 116.0 * fy - 16.0;
+    lab[1] = 500.0 * (fx - fy);
+    lab[2] = 200.0 * (fy - fz);
+}
+
+}
+
+const std::vector<RegressionScenario>& GetRegressionScenarios()
+{
+    static const std::vector<RegressionScenario> scenarios = CreateScenarios();
+    return scenarios;
+}
+
+const RegressionScenario* FindRegressionScenario(const std::string& name)
+{
+    const std::vector<RegressionScenario>& scenarios = GetRegressionScenarios();
+    for (size_t i = 0; i < scenarios.size(); ++i) {
+        if (name == scenarios[i].name) {
+            return &scenarios[i];
+        }
+    }
+    return nullptr;
+}
+
+CameraKey SampleCameraPath(const RegressionScenario& scenario, int frame)
+{
+    const std::vector<CameraKey>& path = scenario.path;
+    if (path.size() < 2 || scenario.frames < 2) {
+        return path.front();
+    }
+
+    float position = static_cast<float>(std::min(std::max(frame, 0), scenario.frames - 1)) /
+                     (scenario.frames - 1) * (path.size() - 1);
+    size_t key = std::min(static_cast<size_t>(position), path.size() - 2);
+    float t = position - key;
+
+    const CameraKey& a = path[key];
+    const CameraKey& b = path[key + 1];
+    CameraKey pose = { a.position + (b.position - a.position) * t, a.yaw + (b.yaw - a.yaw) * t,
+                       a.pitch + (b.pitch - a.pitch) * t };
+    return pose;
+}
+
+std::string GoldenImagePath(const std::string& directory, const RegressionScenario& scenario, int frame)
+{
+    return directory + "/" + scenario.name + "." + std::to_string(frame) + ".ppm";
+}
+
+std::string BaselinePath(const std::string& directory, const RegressionScenario& scenario)
+{
+    return directory + "/" + scenario.name + ".baseline";
+}
+
+RgbImage DownsampleFrame(const uint8_t* rgba, int width, int height, int factor)
+{
+    RgbImage image;
+    image.width = width / factor;
+    image.height = height / factor;
+    image.pixels.resize(static_cast<size_t>(image.width) * image.height * 3);
+
+    const int blockPixels = factor * factor;
+    for (int y = 0; y < image.height; ++y) {
+        // The frame is bottom row first, the image top row first.
+        int sourceY = height - (y + 1) * factor;
+        for (int x = 0; x < image.width; ++x) {
+            int sums[3] = { 0, 0, 0 };
+            for (int blockY = 0; blockY < factor; ++blockY) {
+                const uint8_t* source = rgba + ((static_cast<size_t>(sourceY + blockY) * width) + x * factor) * 4;
+                for (int blockX = 0; blockX < factor; ++blockX, source += 4) {
+                    sums[0] += source[0];
+                    sums[1] += source[1];
+                    sums[2] += source[2];
+                }
+            }
+            uint8_t* target = &image.pixels[(static_cast<size_t>(y) * image.width + x) * 3];
+            for (int channel = 0; channel < 3; ++channel) {
+                target[channel] = static_cast<uint8_t>((sums[channel] + blockPixels / 2) / blockPixels);
+            }
+        }
+    }
+    return image;
+}
+
+bool ReadPpm(const std::string& path, RgbImage& image)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    std::string magic;
+    int maxValue = 0;
+    file >> magic >> image.width >> image.height >> maxValue;
+    if (!file || magic != "P6" || maxValue != 255 || image.width <= 0 || image.height <= 0) {
+        return false;
+    }
+    file.get();     // the single whitespace before the pixels
+    image.pixels.resize(static_cast<size_t>(image.width) * image.height * 3);
+    file.read(reinterpret_cast<char*>(&image.pixels[0]), image.pixels.size());
+    return static_cast<bool>(file);
+}
+
+bool WritePpm(const std::string& path, const RgbImage& image)
+{
+    std::ofstream file(path.c_str(), std::ios::binary);
+    file << "P6\n" << image.width << " " << image.height << "\n255\n";
+    file.write(reinterpret_cast<const char*>(image.pixels.data()), image.pixels.size());
+    return static_cast<bool>(file);
+}
+
+ImageDifference CompareImages(const RgbImage& image, const RgbImage& golden, double tolerance)
+{
+    ImageDifference difference = { 0.0, 0.0, 1.0 };
+    if (image.width != golden.width || image.height != golden.height || image.pixels.empty()) {
+        return difference;
+    }
+
+    double linear[256];
+    for (int i = 0; i < 256; ++i) {
+        linear[i] = ToLinear(static_cast<uint8_t>(i));
+    }
+
+    size_t pixelCount = image.pixels.size() / 3;
+    size_t differing = 0;
+    double sum = 0.0;
+    for (size_t i = 0; i < pixelCount; ++i) {
+        const uint8_t* a = &image.pixels[i * 3];
+        const uint8_t* b = &golden.pixels[i * 3];
+        if (a[0] == b[0] && a[1] == b[1] && a[2] == b[2]) {
+            continue;
+        }
+        double labA[3], labB[3];
+        ToLab(a, linear, labA);
+        ToLab(b, linear, labB);
+        double deltaE = std::sqrt((labA[0] - labB[0]) * (labA[0] - labB[0]) + (labA[1] - labB[1]) * (labA[1] - labB[1]) +
+                                  (labA[2] - labB[2]) * (labA[2] - labB[2]));
+        sum += deltaE;
+        difference.maxDeltaE = std::max(difference.maxDeltaE, deltaE);
+        if (deltaE > tolerance) {
+            ++differing;
+        }
+    }
+    difference.meanDeltaE = sum / pixelCount;
+    difference.differing = static_cast<double>(differing) / pixelCount;
+    return difference;
+}
+
+bool ReadBaseline(const std::string& path, FrameTimeBaseline& baseline)
+{
+    // "key value" lines.
+    std::ifstream file(path.c_str());
+    bool hasP50 = false;
+    baseline.p99 = 0.0;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        double value = 0.0;
+        if (!(fields >> key >> value)) {
+            continue;
+        }
+        if (key == "frame_ms_p50") {
+            baseline.p50 = value;
+            hasP50 = true;
+        }
+        else if (key == "frame_ms_p99") {
+            baseline.p99 = value;
+        }
+    }
+    return hasP50;
+}
+
+bool WriteBaseline(const std::string& path, const FrameTimeBaseline& baseline)
+{
+    std::ofstream file(path.c_str());
+    file << "frame_ms_p50 " << baseline.p50 << "\n";
+    file << "frame_ms_p99 " << baseline.p99 << "\n";
+    return static_cast<bool>(file);
+}
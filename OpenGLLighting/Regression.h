@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+
+// The pieces of the regression run (--regress): canned scenarios that fly the camera along a
+// fixed path through a fixed scene, golden images to compare their frames with, and frame-time
+// baselines to compare their timings with. main.cpp renders the scenarios through Render() in a
+// HeadlessContext; everything here is plain CPU code.
+//
+// Golden images are stored as binary PPMs box-filtered down by REGRESSION_DOWNSAMPLE, which keeps
+// them small and, like viewing the frame from a distance, lets single-pixel differences on edges
+// average out. Frames are compared in CIELAB: a pixel differs if the CIE76 color difference (about
+// 2.3 is just noticeable) exceeds REGRESSION_DELTA_E, and a frame fails if more than
+// REGRESSION_MAX_DIFFERING of its pixels differ.
+
+static const int REGRESSION_DOWNSAMPLE = 4;
+static const double REGRESSION_DELTA_E = 3.0;
+static const double REGRESSION_MAX_DIFFERING = 0.001;
+
+// Slowest p50 frame time accepted, as a fraction over the baseline's; --regress-threshold changes it.
+// The path is replayed REGRESSION_TIMING_RUNS times and the median of the runs' p50s is compared.
+static const double REGRESSION_DEFAULT_THRESHOLD = 0.25;
+static const int REGRESSION_TIMING_RUNS = 3;
+
+// A camera pose: where it is and the Euler angles Camera takes, in degrees.
+struct CameraKey
+{
+    glm::vec3 position;
+    float yaw;
+    float pitch;
+};
+
+struct RegressionScenario
+{
+    const char* name;
+    size_t instances;           // cubes, 0 for the single default cube
+    size_t lights;
+    bool deferred;
+    bool shadows;
+    bool sun;
+    int frames;                 // recorded, after the headless warm-up
+    std::vector<CameraKey> path;        // spread evenly over the frames, interpolated linearly
+    std::vector<int> checkpoints;       // frames compared with golden images
+};
+
+const std::vector<RegressionScenario>& GetRegressionScenarios();
+
+// The scenario called name, or null.
+const RegressionScenario* FindRegressionScenario(const std::string& name);
+
+// The camera pose at frame (0 to frames - 1) of the scenario's path.
+CameraKey SampleCameraPath(const RegressionScenario& scenario, int frame);
+
+// "DIR/name.frame.ppm" and "DIR/name.baseline".
+std::string GoldenImagePath(const std::string& directory, const RegressionScenario& scenario, int frame);
+std::string BaselinePath(const std::string& directory, const RegressionScenario& scenario);
+
+// 8-bit RGB, top row first.
+struct RgbImage
+{
+    int width;
+    int height;
+    std::vector<uint8_t> pixels;
+};
+
+// Averages factor x factor blocks of a frame read back as RGBA, bottom row first.
+RgbImage DownsampleFrame(const uint8_t* rgba, int width, int height, int factor);
+
+bool ReadPpm(const std::string& path, RgbImage& image);
+bool WritePpm(const std::string& path, const RgbImage& image);
+
+struct ImageDifference
+{
+    double meanDeltaE;
+    double maxDeltaE;
+    double differing;           // fraction of pixels over the tolerance; 1 if the sizes differ
+};
+
+ImageDifference CompareImages(const RgbImage& image, const RgbImage& golden, double tolerance);
+
+// Frame times to compare a run with, written by --regress-update on the machine that gates.
+struct FrameTimeBaseline
+{
+    double p50;
+    double p99;
+};
+
+bool ReadBaseline(const std::string& path, FrameTimeBaseline& baseline);
+bool WriteBaseline(const std::string& path, const FrameTimeBaseline& baseline);
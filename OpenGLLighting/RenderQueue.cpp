@@ -0,0 +1,261 @@
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "GLSLProgram.h"
+#include "GLStateCache.h"
+#include "Profiler.h"
+#include "StreamBuffer.h"
+#include "UniformBlocks.h"
+
+namespace {
+
+const uint32_t DEPTH_MAX = (1u << 24) - 1;
+
+}
+
+RenderQueue::RenderQueue(size_t capacity) :
+    _viewDepthRow(0.0f, 0.0f, 1.0f, 0.0f),
+    _nearPlane(0.0f),
+    _depthScale(1.0f),
+    _modelOffset(-1),
+    _normalMatrixOffset(-1)
+{
+    _items.reserve(capacity);
+    _keys.reserve(capacity);
+    _order.reserve(capacity);
+    _scratchKeys.reserve(capacity);
+    _scratchOrder.reserve(capacity);
+    std::memset(&_statistics, 0, sizeof(_statistics));
+}
+
+uint16_t RenderQueue::AddProgram(GLSLProgram& program, const char* name)
+{
+    ProgramEntry entry = { &program, name };
+    _programs.push_back(entry);
+    return static_cast<uint16_t>(_programs.size() - 1);
+}
+
+uint16_t RenderQueue::AddMesh(const RenderMesh& mesh)
+{
+    _meshes.push_back(mesh);
+    return static_cast<uint16_t>(_meshes.size() - 1);
+}
+
+uint16_t RenderQueue::AddMaterial(const glm::vec4& color)
+{
+    _materials.push_back(color);
+    return static_cast<uint16_t>(_materials.size() - 1);
+}
+
+void RenderQueue::Begin(const glm::mat4& view, float nearPlane, float farPlane)
+{
+    _items.clear();
+    _keys.clear();
+    _modelOffset = _normalMatrixOffset = -1;
+
+    // View-space z of a world position p is dot(row 2 of view, (p, 1)); depth is its negation.
+    _viewDepthRow = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+    _nearPlane = nearPlane;
+    _depthScale = farPlane > nearPlane ? DEPTH_MAX / (farPlane - nearPlane) : 0.0f;
+}
+
+void RenderQueue::Submit(RenderPass pass, uint16_t program, uint16_t mesh, uint16_t material,
+                         const glm::mat4* model, const glm::mat3* normalMatrix)
+{
+    const glm::vec4& position = (*model)[3];
+    float depth = glm::dot(_viewDepthRow, position);
+    float scaled = (depth - _nearPlane) * _depthScale;
+    uint32_t quantized = scaled <= 0.0f ? 0 : (scaled >= DEPTH_MAX ? DEPTH_MAX : static_cast<uint32_t>(scaled));
+
+    Item item = { model, normalMatrix, program, mesh, material };
+    _items.push_back(item);
+    _keys.push_back(MakeKey(pass, program, mesh, material, quantized));
+}
+
+uint64_t RenderQueue::MakeKey(RenderPass pass, uint16_t program, uint16_t mesh, uint16_t material, uint32_t depth)
+{
+    uint64_t key = static_cast<uint64_t>(pass & 0xf) << 60;
+    if (pass == PASS_TRANSPARENT) {
+        key |= static_cast<uint64_t>(DEPTH_MAX - (depth & DEPTH_MAX)) << 36;
+        key |= static_cast<uint64_t>(program & 0xff) << 28;
+        key |= static_cast<uint64_t>(mesh & 0xfff) << 16;
+        key |= static_cast<uint64_t>(material);
+    }
+    else {
+        key |= static_cast<uint64_t>(program & 0xff) << 52;
+        key |= static_cast<uint64_t>(mesh & 0xfff) << 40;
+        key |= static_cast<uint64_t>(material) << 24;
+        key |= static_cast<uint64_t>(depth & DEPTH_MAX);
+    }
+    return key;
+}
+
+void RenderQueue::Sort()
+{
+    size_t count = _keys.size();
+    _order.resize(count);
+    _scratchKeys.resize(count);
+    _scratchOrder.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        _order[i] = static_cast<uint32_t>(i);
+    }
+    if (count > 1) {
+        RadixSort(&_keys[0], &_order[0], &_scratchKeys[0], &_scratchOrder[0], count);
+    }
+}
+
+// Least significant digit first, 8 bits per pass. All eight histograms are built in one read of
+// the keys, and passes where every key has the same digit (most of them: the pass, program and
+// mesh bits rarely vary) are skipped.
+void RenderQueue::RadixSort(uint64_t* keys, uint32_t* values, uint64_t* scratchKeys, uint32_t* scratchValues, size_t count)
+{
+    size_t histograms[8][256];
+    std::memset(histograms, 0, sizeof(histograms));
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t key = keys[i];
+        for (int digit = 0; digit < 8; ++digit) {
+            ++histograms[digit][(key >> (digit * 8)) & 0xff];
+        }
+    }
+
+    uint64_t* sourceKeys = keys;
+    uint32_t* sourceValues = values;
+    uint64_t* destinationKeys = scratchKeys;
+    uint32_t* destinationValues = scratchValues;
+
+    for (int digit = 0; digit < 8; ++digit) {
+        size_t* histogram = histograms[digit];
+        if (histogram[(sourceKeys[0] >> (digit * 8)) & 0xff] == count) {
+            continue;
+        }
+
+        // Exclusive prefix sum: where each bucket starts.
+        size_t offset = 0;
+        for (int bucket = 0; bucket < 256; ++bucket) {
+            size_t bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            size_t destination = histogram[(sourceKeys[i] >> (digit * 8)) & 0xff]++;
+            destinationKeys[destination] = sourceKeys[i];
+            destinationValues[destination] = sourceValues[i];
+        }
+
+        std::swap(sourceKeys, destinationKeys);
+        std::swap(sourceValues, destinationValues);
+    }
+
+    if (sourceKeys != keys) {
+        std::memcpy(keys, sourceKeys, count * sizeof(uint64_t));
+        std::memcpy(values, sourceValues, count * sizeof(uint32_t));
+    }
+}
+
+void RenderQueue::Upload(StreamBuffer& streamBuffer)
+{
+    size_t count = _order.size();
+    if (count == 0) {
+        return;
+    }
+
+    StreamBuffer::Allocation models = streamBuffer.Allocate(count * sizeof(glm::mat4));
+    StreamBuffer::Allocation normalMatrices = streamBuffer.Allocate(count * sizeof(glm::mat3));
+    if (models.data == nullptr || normalMatrices.data == nullptr) {
+        return;
+    }
+
+    glm::mat4* modelData = static_cast<glm::mat4*>(models.data);
+    glm::mat3* normalMatrixData = static_cast<glm::mat3*>(normalMatrices.data);
+    const glm::mat3 identity;
+    for (size_t i = 0; i < count; ++i) {
+        const Item& item = _items[_order[i]];
+        modelData[i] = *item.model;
+        normalMatrixData[i] = item.normalMatrix != nullptr ? *item.normalMatrix : identity;
+    }
+    streamBuffer.Flush();
+
+    _modelOffset = models.offset;
+    _normalMatrixOffset = normalMatrices.offset;
+}
+
+void RenderQueue::Execute(StreamBuffer& streamBuffer, Profiler* profiler)
+{
+    std::memset(&_statistics, 0, sizeof(_statistics));
+    _statistics.items = _order.size();
+    if (_order.empty() || _modelOffset < 0) {
+        return;
+    }
+
+    GLStateCache::BindBuffer(GL_ARRAY_BUFFER, streamBuffer.GetBufferHandle());
+
+    const size_t count = _order.size();
+    int currentProgram = -1, currentMesh = -1, currentMaterial = -1;
+    unsigned int programZone = 0;
+
+    for (size_t begin = 0; begin < count; ) {
+        const Item& first = _items[_order[begin]];
+
+        // The batch: every following item with the same program, mesh and material.
+        size_t end = begin + 1;
+        while (end < count) {
+            const Item& item = _items[_order[end]];
+            if (item.program != first.program || item.mesh != first.mesh || item.material != first.material) {
+                break;
+            }
+            ++end;
+        }
+
+        if (first.program != currentProgram) {
+            if (profiler != nullptr) {
+                if (currentProgram >= 0) {
+                    profiler->EndZone(programZone);
+                }
+                programZone = profiler->BeginZone(_programs[first.program].name);
+            }
+            _programs[first.program].program->UseProgram();
+            currentProgram = first.program;
+            ++_statistics.programChanges;
+        }
+
+        const RenderMesh& mesh = _meshes[first.mesh];
+        if (first.mesh != currentMesh) {
+            GLStateCache::BindVertexArray(mesh.vertexArray);
+            currentMesh = first.mesh;
+            ++_statistics.meshChanges;
+        }
+
+        if (first.material != currentMaterial) {
+            ObjectBlock objectBlock;
+            objectBlock.objectColor = _materials[first.material];
+            streamBuffer.BindUniformBlock(OBJECT_BLOCK_BINDING, objectBlock);
+            currentMaterial = first.material;
+            ++_statistics.materialChanges;
+        }
+
+        // Point the instance attributes at this batch's slice of the streamed matrices.
+        GLintptr models = _modelOffset + static_cast<GLintptr>(begin * sizeof(glm::mat4));
+        GLintptr normalMatrices = _normalMatrixOffset + static_cast<GLintptr>(begin * sizeof(glm::mat3));
+        for (GLuint column = 0; column < 4; ++column) {
+            glVertexAttribPointer(INSTANCE_MODEL_LOCATION + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                                  (void*)(models + column * sizeof(glm::vec4)));
+        }
+        for (GLuint column = 0; column < 3; ++column) {
+            glVertexAttribPointer(INSTANCE_NORMAL_MATRIX_LOCATION + column, 3, GL_FLOAT, GL_FALSE, sizeof(glm::mat3),
+                                  (void*)(normalMatrices + column * sizeof(glm::vec3)));
+        }
+
+        GLintptr indexOffset = mesh.firstIndex * (mesh.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t));
+        glDrawElementsInstanced(GL_TRIANGLES, mesh.indexCount, mesh.indexType, (void*)indexOffset, static_cast<GLsizei>(end - begin));
+        ++_statistics.drawCalls;
+
+        begin = end;
+    }
+
+    if (profiler != nullptr && currentProgram >= 0) {
+        profiler->EndZone(programZone);
+    }
+}
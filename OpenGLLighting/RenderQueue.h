@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+
+class GLSLProgram;
+class Profiler;
+class StreamBuffer;
+
+// Passes, in the order they are drawn.
+enum RenderPass
+{
+    PASS_OPAQUE = 0,        // front to back, grouped by state
+    PASS_TRANSPARENT = 1    // back to front
+};
+
+// Geometry a draw item refers to: a vertex array whose instance attributes follow the layout
+// below, and a run of its index buffer. A mesh's levels of detail are meshes of their own that
+// share the vertex array.
+struct RenderMesh
+{
+    GLuint vertexArray;
+    GLsizei indexCount;
+    GLenum indexType;
+    GLuint firstIndex;
+};
+
+// Collects the draw items of a frame, sorts them by a 64-bit key and draws them.
+//
+// Each item is one object: a program, a mesh, a material (the ObjectBlock color) and pointers to
+// its model and normal matrices. Its key packs, from the most significant bits down:
+//   opaque:      pass (4) | program (8) | mesh (12) | material (16) | depth (24)
+//   transparent: pass (4) | inverted depth (24) | program (8) | mesh (12) | material (16)
+// so opaque items are grouped by program, then mesh, then material and drawn front to back within
+// a group, while transparent items are drawn back to front. Keys are radix sorted. Consecutive
+// items that share program, mesh and material become one instanced draw, their matrices streamed
+// in sorted order; a group of 100,000 cubes is one draw call.
+//
+// Nothing is allocated per frame once the arrays have grown to the largest frame seen.
+class RenderQueue final
+{
+public:
+    // Instance attribute locations expected in every vertex shader drawn through the queue.
+    // Matrix attributes take one location per column.
+    static const GLuint INSTANCE_MODEL_LOCATION = 2;
+    static const GLuint INSTANCE_NORMAL_MATRIX_LOCATION = 6;
+
+    // Counters for the last Execute().
+    struct Statistics
+    {
+        size_t items;
+        unsigned int drawCalls;
+        unsigned int programChanges;
+        unsigned int meshChanges;
+        unsigned int materialChanges;
+    };
+
+    explicit RenderQueue(size_t capacity);
+
+    RenderQueue(const RenderQueue& rhs) = delete;
+    RenderQueue& operator=(const RenderQueue& rhs) = delete;
+
+    // Registration, once at startup. The returned ids go into the keys. name labels the program's
+    // profiler zone and must outlive the queue.
+    uint16_t AddProgram(GLSLProgram& program, const char* name);
+    uint16_t AddMesh(const RenderMesh& mesh);
+    uint16_t AddMaterial(const glm::vec4& color);
+
+    // Starts a frame. Depth is the view-space distance, quantized over [nearPlane, farPlane].
+    void Begin(const glm::mat4& view, float nearPlane, float farPlane);
+
+    // model and normalMatrix must stay valid until Upload(); normalMatrix may be null for programs
+    // that don't read it.
+    void Submit(RenderPass pass, uint16_t program, uint16_t mesh, uint16_t material,
+                const glm::mat4* model, const glm::mat3* normalMatrix);
+
+    void Sort();
+
+    // Streams the instance matrices in sorted order. Must come after Sort() and before Execute().
+    void Upload(StreamBuffer& streamBuffer);
+
+    // Issues the draws. profiler may be null.
+    void Execute(StreamBuffer& streamBuffer, Profiler* profiler);
+
+    size_t Size() const { return _keys.size(); }
+    const Statistics& GetStatistics() const { return _statistics; }
+
+    static uint64_t MakeKey(RenderPass pass, uint16_t program, uint16_t mesh, uint16_t material, uint32_t depth);
+
+    // Sorts keys ascending, permuting values alongside; scratchKeys and scratchValues must be at
+    // least as large. Exposed for the benchmark.
+    static void RadixSort(uint64_t* keys, uint32_t* values, uint64_t* scratchKeys, uint32_t* scratchValues, size_t count);
+
+private:
+    struct Item
+    {
+        const glm::mat4* model;
+        const glm::mat3* normalMatrix;
+        uint16_t program;
+        uint16_t mesh;
+        uint16_t material;
+    };
+
+    struct ProgramEntry
+    {
+        GLSLProgram* program;
+        const char* name;
+    };
+
+    std::vector<ProgramEntry> _programs;
+    std::vector<RenderMesh> _meshes;
+    std::vector<glm::vec4> _materials;
+
+    glm::vec4 _viewDepthRow;    // third row of the view matrix, negated: dot with a position gives its depth
+    float _nearPlane;
+    float _depthScale;          // maps [near, far] to the 24-bit depth range
+
+    std::vector<Item> _items;
+    std::vector<uint64_t> _keys;
+    std::vector<uint32_t> _order;       // item indices, sorted along with _keys
+    std::vector<uint64_t> _scratchKeys;
+    std::vector<uint32_t> _scratchOrder;
+
+    GLintptr _modelOffset;      // where Upload() streamed the sorted instance matrices, -1 if it failed
+    GLintptr _normalMatrixOffset;
+
+    Statistics _statistics;
+};
@@ -0,0 +1,244 @@
+#include "ResourceStreamer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "GLStateCache.h"
+#include "ThreadPool.h"
+
+ResourceStreamer::ResourceStreamer(ThreadPool& threadPool, MeshLoader& meshLoader, const ContextBinder& bindUploadContext) :
+        _threadPool(threadPool),
+        _meshLoader(meshLoader),
+        _bindUploadContext(bindUploadContext),
+        _loaderState(LOADER_FAILED),
+        _decoding(0),
+        _inFlight(0),
+        _stopping(false)
+{
+    std::memset(&_statistics, 0, sizeof(_statistics));
+
+    if (_bindUploadContext) {
+        // Wait for the loader to find out whether it can use the context, so the render thread
+        // knows from the start whether it has to upload.
+        _loaderState = LOADER_STARTING;
+        _loaderThread = std::thread(&ResourceStreamer::LoaderLoop, this);
+        std::unique_lock<std::mutex> lock(_mutex);
+        _changed.wait(lock, [this]() { return _loaderState != LOADER_STARTING; });
+    }
+    _statistics.hasLoaderThread = _loaderState == LOADER_RUNNING;
+}
+
+ResourceStreamer::~ResourceStreamer()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _changed.notify_all();
+    if (_loaderThread.joinable()) {
+        _loaderThread.join();
+    }
+
+    // Reads still running on the pool hold on to this.
+    std::unique_lock<std::mutex> lock(_mutex);
+    _changed.wait(lock, [this]() { return _decoding == 0; });
+
+    for (const std::shared_ptr<Request>& request : _uploaded) {
+        if (request->fence != nullptr) {
+            glDeleteSync(request->fence);
+        }
+        if (!request->failed) {
+            GLStateCache::DeleteBuffer(request->mesh.vertexBuffer);
+            GLStateCache::DeleteBuffer(request->mesh.indexBuffer);
+        }
+    }
+}
+
+void ResourceStreamer::RequestMesh(const std::string& path, const MeshLoadOptions& options, const MeshCallback& onLoaded)
+{
+    std::shared_ptr<Request> request = std::make_shared<Request>();
+    request->path = path;
+    request->options = options;
+    request->onLoaded = onLoaded;
+    request->requestTime = std::chrono::steady_clock::now();
+    request->fence = nullptr;
+    request->failed = false;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++_decoding;
+        ++_inFlight;
+        ++_statistics.requested;
+        _statistics.maxQueueDepth = std::max(_statistics.maxQueueDepth, _inFlight);
+    }
+    _threadPool.Submit([this, request]() { Decode(request); });
+}
+
+void ResourceStreamer::Poll()
+{
+    UploadOnRenderThread();
+    Publish(false);
+}
+
+void ResourceStreamer::Finish()
+{
+    while (QueueDepth() > 0) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _changed.wait(lock, [this]() {
+                return !_uploaded.empty() || (_loaderState != LOADER_RUNNING && !_decoded.empty());
+            });
+        }
+        UploadOnRenderThread();
+        Publish(true);
+    }
+}
+
+unsigned int ResourceStreamer::QueueDepth() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _inFlight;
+}
+
+ResourceStreamer::Statistics ResourceStreamer::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _statistics;
+}
+
+void ResourceStreamer::Decode(const std::shared_ptr<Request>& request)
+{
+    request->failed = !_meshLoader.Map(request->path, request->options, request->file);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (request->failed) {
+            _uploaded.push_back(request);
+        }
+        else {
+            _decoded.push_back(request);
+        }
+        --_decoding;
+
+        // Notify before unlocking: once the lock is released the destructor may see no decodes
+        // left and destroy _changed, with this thread still inside notify_all().
+        _changed.notify_all();
+    }
+}
+
+void ResourceStreamer::LoaderLoop()
+{
+    bool hasContext = _bindUploadContext(true);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _loaderState = hasContext ? LOADER_RUNNING : LOADER_FAILED;
+    }
+    _changed.notify_all();
+    if (!hasContext) {
+        return;
+    }
+
+    for (;;) {
+        std::shared_ptr<Request> request;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _changed.wait(lock, [this]() { return _stopping || !_decoded.empty(); });
+            if (_stopping) {
+                break;
+            }
+            request = _decoded.front();
+            _decoded.pop_front();
+        }
+
+        Upload(*request);
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _uploaded.push_back(request);
+        }
+        _changed.notify_all();
+    }
+
+    _bindUploadContext(false);
+}
+
+void ResourceStreamer::Upload(Request& request)
+{
+    request.failed = !_meshLoader.Upload(request.file, request.mesh);
+    request.file.Close();
+    if (request.failed) {
+        return;     // nothing to fence; Publish() counts it and the placeholder stays
+    }
+
+    // Fences are shared between the contexts. Flush so this one reaches the GPU: the render
+    // thread's waits can only flush its own context's commands.
+    request.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+}
+
+void ResourceStreamer::UploadOnRenderThread()
+{
+    std::shared_ptr<Request> request;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_loaderState == LOADER_RUNNING || _decoded.empty()) {
+            return;
+        }
+        request = _decoded.front();
+        _decoded.pop_front();
+    }
+
+    Upload(*request);
+    GLStateCache::Invalidate();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _uploaded.push_back(request);
+}
+
+void ResourceStreamer::Publish(bool wait)
+{
+    // Only this thread takes requests out of the list, so they can be checked without the lock.
+    std::vector<std::shared_ptr<Request>> uploaded;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        uploaded.swap(_uploaded);
+    }
+
+    std::vector<std::shared_ptr<Request>> pending;
+    for (const std::shared_ptr<Request>& request : uploaded) {
+        if (request->fence != nullptr) {
+            GLenum status = glClientWaitSync(request->fence, 0, 0);
+            while (wait && status == GL_TIMEOUT_EXPIRED) {
+                status = glClientWaitSync(request->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            }
+            if (status == GL_TIMEOUT_EXPIRED) {
+                pending.push_back(request);
+                continue;
+            }
+            glDeleteSync(request->fence);
+            request->fence = nullptr;
+
+            // The copies may not have finished: drop the buffers rather than publish them.
+            if (status == GL_WAIT_FAILED) {
+                std::cerr << "ResourceStreamer: can't wait for the upload of " << request->path << std::endl;
+                GLStateCache::DeleteBuffer(request->mesh.vertexBuffer);
+                GLStateCache::DeleteBuffer(request->mesh.indexBuffer);
+                request->failed = true;
+            }
+        }
+
+        if (!request->failed) {
+            request->onLoaded(request->mesh);
+        }
+
+        double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - request->requestTime).count();
+        std::lock_guard<std::mutex> lock(_mutex);
+        --_inFlight;
+        ++(request->failed ? _statistics.failed : _statistics.published);
+        _statistics.maxLatencyMilliseconds = std::max(_statistics.maxLatencyMilliseconds, latency);
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _uploaded.insert(_uploaded.begin(), pending.begin(), pending.end());
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+#include "MeshLoader.h"
+
+class ThreadPool;
+
+// Loads resources without ever making the render thread wait for them. A request goes through
+// three stages:
+// 1. On the thread pool, the file is read and decoded: for a mesh, MeshLoader::Map() builds the
+//    cache file if it has to and maps it.
+// 2. On the loader thread, which has a GL context of its own sharing objects with the render
+//    thread's, the data is copied into new buffers and a fence is placed behind the copies.
+// 3. On the render thread, Poll() checks the fences without waiting and publishes every resource
+//    whose fence has signalled by calling its callback. Until then the renderer draws whatever
+//    stands in for it. Objects that contexts don't share (vertex arrays) are made by the
+//    callbacks, on the render thread.
+//
+// Without a shared context (no ContextBinder, or one that fails) Poll() does the uploads itself,
+// one resource per call: the render thread then pays for the copy, but still never waits for the
+// reading and decoding.
+class ResourceStreamer final
+{
+public:
+    // Makes the upload context current on the calling thread, or with false releases it. Returns
+    // false if it can't.
+    typedef std::function<bool(bool current)> ContextBinder;
+
+    // Called with the mesh's buffers, which the callback then owns.
+    typedef std::function<void(const GpuMesh& mesh)> MeshCallback;
+
+    // Counters since construction.
+    struct Statistics
+    {
+        unsigned int requested;
+        unsigned int published;
+        unsigned int failed;
+        unsigned int maxQueueDepth;         // most requests in flight at once
+        double maxLatencyMilliseconds;      // longest from a request to its publication
+        bool hasLoaderThread;               // false if the uploads happen on the render thread
+    };
+
+    // Starts the loader thread and makes the upload context current on it with
+    // bindUploadContext, which may be null.
+    ResourceStreamer(ThreadPool& threadPool, MeshLoader& meshLoader, const ContextBinder& bindUploadContext);
+
+    ResourceStreamer(const ResourceStreamer& rhs) = delete;
+    ResourceStreamer& operator=(const ResourceStreamer& rhs) = delete;
+
+    // Waits for the reads and uploads in flight and deletes everything that wasn't published.
+    ~ResourceStreamer();
+
+    // Queues the mesh at path. onLoaded runs on the render thread, from Poll() or Finish(), once
+    // the mesh is in GL buffers; if the mesh can't be loaded, it never runs.
+    void RequestMesh(const std::string& path, const MeshLoadOptions& options, const MeshCallback& onLoaded);
+
+    // Publishes every resource whose upload has finished, without waiting. Call once a frame on the
+    // render thread, before drawing.
+    void Poll();
+
+    // Waits for every request and publishes it, for runs that need the finished scene from their
+    // first frame.
+    void Finish();
+
+    // Requests that are neither published nor failed.
+    unsigned int QueueDepth() const;
+    bool IsIdle() const { return QueueDepth() == 0; }
+
+    Statistics GetStatistics() const;
+
+private:
+    struct Request
+    {
+        std::string path;
+        MeshLoadOptions options;
+        MeshCallback onLoaded;
+        std::chrono::steady_clock::time_point requestTime;
+        MappedFile file;        // from the pool until the upload
+        GpuMesh mesh;
+        GLsync fence;           // behind the upload's copies
+        bool failed;
+    };
+
+    void Decode(const std::shared_ptr<Request>& request);
+    void LoaderLoop();
+
+    // Copies a decoded request into buffers and fences it, on the current context. Marks the request
+    // failed if the copy fails.
+    void Upload(Request& request);
+
+    // On the render thread without a loader thread: uploads the oldest decoded request, if any.
+    void UploadOnRenderThread();
+
+    // Publishes the uploaded requests whose fences have signalled, or all of them if wait.
+    void Publish(bool wait);
+
+    ThreadPool& _threadPool;
+    MeshLoader& _meshLoader;
+    ContextBinder _bindUploadContext;
+    std::thread _loaderThread;
+
+    enum LoaderState
+    {
+        LOADER_STARTING,
+        LOADER_RUNNING,
+        LOADER_FAILED   // no shared context: Poll() uploads
+    };
+
+    mutable std::mutex _mutex;
+    std::condition_variable _changed;   // a request moved on, the loader started, or stopping
+    LoaderState _loaderState;
+    std::deque<std::shared_ptr<Request>> _decoded;      // waiting for an upload
+    std::vector<std::shared_ptr<Request>> _uploaded;    // fenced (or failed), waiting for Poll()
+    unsigned int _decoding;                             // on the pool
+    unsigned int _inFlight;
+    bool _stopping;
+
+    Statistics _statistics;
+};
@@ -0,0 +1,172 @@
+#include "Scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "ThreadPool.h"
+#include "Transform.h"
+
+const float Scene::CUBE_BOUNDING_RADIUS = 0.866025404f;
+
+Scene::Scene() :
+    _paused(false)
+{
+    CreateGrid(1);
+    CreateLights(1);
+}
+
+void Scene::CreateGrid(size_t count, float spacing)
+{
+    _objects.clear();
+    _objects.reserve(count);
+    _hasUniformScale.clear();
+
+    if (count == 1) {
+        SceneObject object = { glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 0.0f, 0.0f, glm::vec3(1.0f) };
+        _objects.push_back(object);
+        _hasUniformScale.push_back(1);
+        _store.Resize(1);
+        _store.SetObject(0, object.position, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), object.scale, CUBE_BOUNDING_RADIUS);
+        _boundsMin = glm::vec3(-1.0f);
+        _boundsMax = glm::vec3(1.0f);
+        _maxRadius = CUBE_BOUNDING_RADIUS;
+        return;
+    }
+
+    // Fill a cube of side x side x side cells, centred on the origin and sunk behind it so that
+    // the default camera looks into the grid.
+    size_t side = static_cast<size_t>(std::ceil(std::cbrt(static_cast<double>(count))));
+    float halfExtent = 0.5f * spacing * (side - 1);
+    _maxRadius = 0.0f;
+
+    for (size_t i = 0; i < count; ++i) {
+        size_t x = i % side;
+        size_t y = (i / side) % side;
+        size_t z = i / (side * side);
+
+        SceneObject object;
+        object.position = glm::vec3(x * spacing - halfExtent, y * spacing - halfExtent, -(z * spacing));
+        object.rotationAxis = glm::normalize(glm::vec3(1.0f + (i % 3), 1.0f + (i % 5), 1.0f + (i % 7)));
+        object.rotation = 0.1f * (i % 63);
+        object.spin = 0.25f + 0.05f * (i % 11);
+        object.scale = glm::vec3(0.5f + 0.1f * (i % 6));
+        if (i % 4 == 3) {
+            object.scale.y *= 2.0f;     // stretch every fourth cube so both normal matrix paths get used
+        }
+        _objects.push_back(object);
+        _hasUniformScale.push_back(object.scale.x == object.scale.y && object.scale.y == object.scale.z);
+        _maxRadius = std::max(_maxRadius, 0.5f * glm::length(object.scale));
+    }
+
+    _boundsMin = glm::vec3(-halfExtent, -halfExtent, -(spacing * (side - 1)));
+    _boundsMax = glm::vec3(halfExtent, halfExtent, 0.0f);
+
+    _store.Resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        _store.SetObject(i, _objects[i].position, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), _objects[i].scale, CUBE_BOUNDING_RADIUS);
+        UpdateOrientation(i);
+    }
+}
+
+void Scene::CreateLights(size_t count)
+{
+    count = std::min<size_t>(count, LightGrid::MAX_LIGHTS);
+    _lights.clear();
+    _lightOrbitSpeeds.clear();
+
+    if (count == 1) {
+        PointLight light = { glm::vec3(1.2f, 1.0f, 2.0f), 100.0f, glm::vec3(1.0f), 1.0f };
+        _lights.push_back(light);
+        _lightOrbitSpeeds.push_back(0.0f);
+        return;
+    }
+
+    // Pad the bounds by a cell so the outer cubes are lit too, then size each light's sphere so
+    // that the spheres cover the volume about four times over.
+    glm::vec3 low = _boundsMin - glm::vec3(1.0f);
+    glm::vec3 high = _boundsMax + glm::vec3(1.0f);
+    glm::vec3 extent = high - low;
+    float volume = extent.x * extent.y * extent.z;
+    float radius = std::cbrt(3.0f * 4.0f * volume / (4.0f * 3.14159265f * count));
+
+    // A fixed seed keeps the scene the same from run to run.
+    std::mt19937 random(15);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    for (size_t i = 0; i < count; ++i) {
+        PointLight light;
+        light.position = low + glm::vec3(unit(random), unit(random), unit(random)) * extent;
+        light.radius = radius;
+        light.color = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.2f));
+        light.intensity = 0.6f;
+        _lights.push_back(light);
+        _lightOrbitSpeeds.push_back(0.2f + 0.3f * unit(random));
+    }
+}
+
+void Scene::Update(float deltaTime, ThreadPool* threadPool)
+{
+    if (_paused) {
+        return;
+    }
+
+    auto spin = [this, deltaTime](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            _objects[i].rotation = std::fmod(_objects[i].rotation + _objects[i].spin * deltaTime, 6.28318531f);
+            UpdateOrientation(i);
+        }
+    };
+    if (threadPool != nullptr) {
+        threadPool->ParallelFor(_objects.size(), spin);
+    }
+    else {
+        spin(0, _objects.size());
+    }
+
+    // Orbit the lights about the vertical axis through the centre of the bounds.
+    glm::vec3 center = 0.5f * (_boundsMin + _boundsMax);
+    for (size_t i = 0; i < _lights.size(); ++i) {
+        float angle = _lightOrbitSpeeds[i] * deltaTime;
+        if (angle == 0.0f) {
+            continue;
+        }
+        float c = std::cos(angle), s = std::sin(angle);
+        glm::vec3 offset = _lights[i].position - center;
+        _lights[i].position.x = center.x + c * offset.x + s * offset.z;
+        _lights[i].position.z = center.z - s * offset.x + c * offset.z;
+    }
+}
+
+void Scene::GetBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const
+{
+    boundsMin = _boundsMin - glm::vec3(_maxRadius);
+    boundsMax = _boundsMax + glm::vec3(_maxRadius);
+}
+
+// The quaternion for a rotation by angle about a unit axis is (axis * sin(angle / 2), cos(angle / 2)).
+void Scene::UpdateOrientation(size_t index)
+{
+    const SceneObject& object = _objects[index];
+    float halfAngle = 0.5f * object.rotation;
+    glm::vec3 axis = object.rotationAxis * std::sin(halfAngle);
+    _store.SetOrientation(index, glm::vec4(axis.x, axis.y, axis.z, std::cos(halfAngle)));
+}
+
+void Scene::GetModelMatrices(glm::mat4* models, ThreadPool* threadPool) const
+{
+    if (threadPool != nullptr) {
+        _store.BuildModelMatrices(*threadPool, models);
+    }
+    else {
+        _store.BuildModelMatrices(models, 0, _store.Size());
+    }
+}
+
+void Scene::GetTransforms(glm::mat4* models, glm::mat3* normalMatrices, ThreadPool* threadPool) const
+{
+    GetModelMatrices(models, threadPool);
+    if (!_objects.empty()) {
+        ComputeNormalMatrices(models, &_hasUniformScale[0], normalMatrices, _objects.size());
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+
+#include "LightGrid.h"
+#include "ObjectStore.h"
+
+class ThreadPool;
+
+// A lit cube in the scene.
+struct SceneObject
+{
+    glm::vec3 position;
+    glm::vec3 rotationAxis; // unit length
+    float rotation;         // radians about rotationAxis
+    float spin;             // radians per second
+    glm::vec3 scale;
+};
+
+// The lit objects drawn by Render(). A scene of one object is the original single cube at the
+// origin; larger scenes lay the cubes out on a grid and spin them so every frame has fresh
+// transforms to upload. The animation state is kept per object; the transforms and bounds the
+// batch kernels read are mirrored in an ObjectStore.
+//
+// The scene also holds the point lights. One light is the original white lamp beside the cube;
+// more are scattered through the grid's bounds with random colors and orbit about the vertical
+// axis, with radii chosen so each point is lit by a few of them whatever their number.
+class Scene final
+{
+public:
+    Scene();
+
+    // Replaces the scene's contents with count cubes.
+    void CreateGrid(size_t count, float spacing = 2.0f);
+
+    // Replaces the lights with count lights (at most LightGrid::MAX_LIGHTS) among the cubes.
+    void CreateLights(size_t count);
+
+    // Advances the animation by deltaTime seconds, unless paused. threadPool, if given, splits the
+    // objects across its threads.
+    void Update(float deltaTime, ThreadPool* threadPool = nullptr);
+
+    // A paused scene keeps its cubes and lights still, so cached shadow maps stay valid.
+    void SetPaused(bool paused) { _paused = paused; }
+    bool IsPaused() const { return _paused; }
+
+    // A box holding every cube whatever its rotation.
+    void GetBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const;
+
+    size_t Size() const { return _objects.size(); }
+    const SceneObject& operator[](size_t index) const { return _objects[index]; }
+
+    // Writes the model matrix of every object to models, which must hold Size() matrices.
+    // threadPool, if given, splits the work across its threads.
+    void GetModelMatrices(glm::mat4* models, ThreadPool* threadPool = nullptr) const;
+
+    // Writes the model and normal matrix of every object; see Transform.h.
+    void GetTransforms(glm::mat4* models, glm::mat3* normalMatrices, ThreadPool* threadPool = nullptr) const;
+
+    const std::vector<PointLight>& GetLights() const { return _lights; }
+
+    // Positions, orientations, scales and world-space bounding radii, for culling.
+    const ObjectStore& GetStore() const { return _store; }
+
+    // Bounding radius of the unit cube every object draws: half its diagonal.
+    static const float CUBE_BOUNDING_RADIUS;
+
+private:
+    void UpdateOrientation(size_t index);
+
+    std::vector<SceneObject> _objects;
+    ObjectStore _store;
+    std::vector<unsigned char> _hasUniformScale;    // per object; selects the normal matrix fast path
+
+    std::vector<PointLight> _lights;
+    std::vector<float> _lightOrbitSpeeds;   // radians per second about the y axis
+    glm::vec3 _boundsMin, _boundsMax;       // of the cubes' positions
+    float _maxRadius;                       // largest bounding radius of a cube
+    bool _paused;
+};
@@ -0,0 +1,138 @@
+#include "ShaderCompiler.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "GLSLProgram.h"
+#include "ThreadPool.h"
+
+namespace {
+
+std::string ReadShaderFile(const std::string& filename)
+{
+    std::ifstream inputStream(filename.c_str(), std::ios_base::in);
+    if (!inputStream) {
+        std::cerr << "ShaderCompiler: can't read " << filename << std::endl;
+        return std::string();
+    }
+
+    std::stringstream shaderSource;
+    shaderSource << inputStream.rdbuf();
+    return shaderSource.str();
+}
+
+// The file with its libraries inserted after its #version line, in order.
+std::string ReadShaderFile(const ShaderCompiler::ShaderFile& file)
+{
+    std::string libraries;
+    for (size_t i = 0; i < file.libraries.size(); ++i) {
+        libraries += ReadShaderFile(file.libraries[i]);
+    }
+    return GLSLProgram::InsertAfterVersion(ReadShaderFile(file.filename), libraries);
+}
+
+bool IsReady(const std::future<std::string>& source)
+{
+    return source.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+}
+
+ShaderCompiler::ShaderCompiler(ThreadPool& threadPool) :
+        _threadPool(threadPool)
+{
+#ifdef GL_KHR_parallel_shader_compile
+    if (GLEW_KHR_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);  // let the driver pick the number of threads
+    }
+#endif
+}
+
+void ShaderCompiler::Submit(GLSLProgram& program, const std::vector<ShaderFile>& files,
+                            std::function<void(GLSLProgram&)> onReady)
+{
+    Request request;
+    request.program = &program;
+    request.onReady = onReady;
+    request.isLinking = false;
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        ShaderFile file = files[i];
+        request.types.push_back(files[i].type);
+        request.sources.push_back(_threadPool.Submit([file]() { return ReadShaderFile(file); }));
+    }
+
+    _requests.push_back(std::move(request));
+}
+
+bool ShaderCompiler::Poll()
+{
+    // First kick off every program whose files have been read...
+    for (size_t i = 0; i < _requests.size(); ++i) {
+        Advance(_requests[i], false);
+    }
+
+    // ... and only then collect the ones the driver has finished.
+    // onReady may submit more programs, so take each request out of the list before calling it.
+    for (size_t i = 0; i < _requests.size(); ) {
+        if (_requests[i].isLinking && _requests[i].program->IsLinkComplete()) {
+            Request request = std::move(_requests[i]);
+            _requests.erase(_requests.begin() + i);
+
+            request.program->FinishLink();
+            if (request.onReady) {
+                request.onReady(*request.program);
+            }
+        }
+        else {
+            ++i;
+        }
+    }
+
+    return _requests.empty();
+}
+
+void ShaderCompiler::Finish()
+{
+    while (!_requests.empty()) {
+        std::vector<Request> requests;
+        requests.swap(_requests);
+
+        for (size_t i = 0; i < requests.size(); ++i) {
+            Advance(requests[i], true);
+        }
+
+        for (size_t i = 0; i < requests.size(); ++i) {
+            requests[i].program->FinishLink();
+            if (requests[i].onReady) {
+                requests[i].onReady(*requests[i].program);
+            }
+        }
+    }
+}
+
+// Issues the compile and link once all of the request's sources are available. Returns true if
+// the request is linking.
+bool ShaderCompiler::Advance(Request& request, bool wait)
+{
+    if (request.isLinking) {
+        return true;
+    }
+
+    for (size_t i = 0; i < request.sources.size(); ++i) {
+        if (!wait && !IsReady(request.sources[i])) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < request.sources.size(); ++i) {
+        request.program->AddShader(request.types[i], request.sources[i].get());
+    }
+    request.sources.clear();
+
+    request.program->BeginLink();
+    request.isLinking = true;
+    return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+class GLSLProgram;
+class ThreadPool;
+
+// Builds many GLSL programs concurrently instead of one after the other.
+// Shader files are read on the thread pool. Poll(), called once per frame on the GL thread,
+// issues the compile and link for every program whose sources have arrived before it asks the
+// driver about any of them, so with GL_KHR_parallel_shader_compile the driver builds them all
+// at once and N programs take about as long as the slowest one.
+class ShaderCompiler final
+{
+public:
+    explicit ShaderCompiler(ThreadPool& threadPool);
+
+    ShaderCompiler(const ShaderCompiler& rhs) = delete;
+    ShaderCompiler& operator=(const ShaderCompiler& rhs) = delete;
+
+    // A stage's file, and the files of shared code (GLSL has no #include) inserted after its
+    // #version line, so they come after the program's #defines and can test them.
+    struct ShaderFile
+    {
+        GLenum type;
+        std::string filename;
+        std::vector<std::string> libraries;
+    };
+
+    // Queues program to be built from files. onReady runs on the GL thread (from Poll()) once the
+    // program is linked, whether or not the link succeeded. program must stay alive until then.
+    void Submit(GLSLProgram& program, const std::vector<ShaderFile>& files,
+                std::function<void(GLSLProgram&)> onReady = nullptr);
+
+    // Advances every queued program as far as it can go without blocking. Returns true once
+    // nothing is left in flight.
+    bool Poll();
+
+    // Blocks until every queued program is ready.
+    void Finish();
+
+    bool IsIdle() const { return _requests.empty(); }
+
+private:
+    struct Request
+    {
+        GLSLProgram* program;
+        std::vector<GLenum> types;
+        std::vector<std::future<std::string>> sources;  // being read on the thread pool
+        std::function<void(GLSLProgram&)> onReady;
+        bool isLinking;
+    };
+
+    bool Advance(Request& request, bool wait);
+
+    ThreadPool& _threadPool;
+    std::vector<Request> _requests;
+};
@@ -0,0 +1,120 @@
+#include "ShaderPermutations.h"
+
+#include <cassert>
+#include <iostream>
+
+#include "GLSLProgram.h"
+
+ShaderPermutations::ShaderPermutations(ShaderCompiler& compiler, const std::vector<ShaderCompiler::ShaderFile>& files,
+                                       const std::vector<std::string>& defines,
+                                       std::function<void(GLSLProgram&, uint32_t)> configure,
+                                       std::function<void(GLSLProgram&, uint32_t)> onReady) :
+    _compiler(compiler),
+    _files(files),
+    _defines(defines),
+    _configure(configure),
+    _onReady(onReady)
+{
+    assert(defines.size() < 32);
+
+    _variants.resize(size_t(1) << defines.size());
+    for (size_t i = 0; i < _variants.size(); ++i) {
+        _variants[i].program.reset(new GLSLProgram());
+        _variants[i].state = VARIANT_IDLE;
+    }
+
+    _statistics.builds = 0;
+    _statistics.failures = 0;
+}
+
+ShaderPermutations::~ShaderPermutations()
+{
+    // The compiler holds the addresses of the variants still building.
+    _compiler.Finish();
+}
+
+GLSLProgram& ShaderPermutations::GetProgram(uint32_t mask) const
+{
+    assert(mask < _variants.size());
+    return *_variants[mask].program;
+}
+
+void ShaderPermutations::Request(uint32_t mask)
+{
+    assert(mask < _variants.size());
+    Variant& variant = _variants[mask];
+    if (variant.state != VARIANT_IDLE) {
+        return;
+    }
+
+    GLSLProgram& program = *variant.program;
+    for (size_t i = 0; i < _defines.size(); ++i) {
+        if ((mask & (1u << i)) != 0) {
+            program.AddDefine(_defines[i]);
+        }
+    }
+    if (_configure) {
+        _configure(program, mask);
+    }
+
+    variant.state = VARIANT_BUILDING;
+    ++_statistics.builds;
+    _compiler.Submit(program, _files, [this, mask](GLSLProgram& built) {
+        if (built.IsCreated()) {
+            _variants[mask].state = VARIANT_READY;
+            if (_onReady) {
+                _onReady(built, mask);
+            }
+        }
+        else {
+            _variants[mask].state = VARIANT_FAILED;
+            ++_statistics.failures;
+            std::cerr << "Shader variant " << Describe(mask) << " failed to build" << std::endl;
+        }
+    });
+}
+
+void ShaderPermutations::RequestAll()
+{
+    for (uint32_t mask = 0; mask < Size(); ++mask) {
+        Request(mask);
+    }
+}
+
+bool ShaderPermutations::IsReady(uint32_t mask) const
+{
+    assert(mask < _variants.size());
+    const Variant& variant = _variants[mask];
+
+    // A variant that failed may have been fixed since by a reload.
+    return variant.state >= VARIANT_READY && variant.program->IsCreated();
+}
+
+GLSLProgram* ShaderPermutations::Find(uint32_t mask)
+{
+    if (IsReady(mask)) {
+        return _variants[mask].program.get();
+    }
+    Request(mask);
+    return nullptr;
+}
+
+void ShaderPermutations::ForEachReady(const std::function<void(GLSLProgram&, uint32_t)>& fn) const
+{
+    for (uint32_t mask = 0; mask < Size(); ++mask) {
+        if (IsReady(mask)) {
+            fn(*_variants[mask].program, mask);
+        }
+    }
+}
+
+std::string ShaderPermutations::Describe(uint32_t mask) const
+{
+    std::string description;
+    for (size_t i = 0; i < _defines.size(); ++i) {
+        if ((mask & (1u << i)) != 0) {
+            description += (description.empty() ? "" : "+") + _defines[i];
+        }
+    }
+    return description.empty() ? "base" : description;
+}
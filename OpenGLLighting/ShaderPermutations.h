@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ShaderCompiler.h"
+
+class GLSLProgram;
+
+// The variants of one program built from the same files with different sets of #defines, so
+// that each draw can use a program compiled for exactly the features it needs, with the branches
+// on disabled features and the loops over known counts folded away by the GLSL compiler, instead
+// of one program that tests for everything at run time.
+//
+// A variant is keyed by a bitmask: bit i set means the program is built with the i-th define of
+// the list given to the constructor. Each variant is built at most once, through the
+// ShaderCompiler, either when it is first asked for (Find()) or up front (Request(),
+// RequestAll(), which queues them all so the driver builds them in parallel). With a
+// ProgramBinaryCache the variants are cached like any program, since the defines are part of
+// their source.
+class ShaderPermutations final
+{
+public:
+    struct Statistics
+    {
+        unsigned int builds;    // variants queued for building
+        unsigned int failures;  // variants that didn't link
+    };
+
+    // configure runs on every variant before it is queued, to add the block bindings and the
+    // defines every variant shares. onReady runs once the variant is linked, as with
+    // ShaderCompiler::Submit(), and only if it linked.
+    ShaderPermutations(ShaderCompiler& compiler, const std::vector<ShaderCompiler::ShaderFile>& files,
+                       const std::vector<std::string>& defines,
+                       std::function<void(GLSLProgram&, uint32_t)> configure,
+                       std::function<void(GLSLProgram&, uint32_t)> onReady = nullptr);
+
+    ShaderPermutations(const ShaderPermutations& rhs) = delete;
+    ShaderPermutations& operator=(const ShaderPermutations& rhs) = delete;
+
+    // Waits for the variants still building, since the compiler holds their addresses.
+    ~ShaderPermutations();
+
+    // Number of variants, one per mask below it.
+    uint32_t Size() const { return static_cast<uint32_t>(_variants.size()); }
+
+    // The variant's program object. It exists for every mask, so its address can be registered
+    // up front (with a RenderQueue, say), but it's only built once requested.
+    GLSLProgram& GetProgram(uint32_t mask) const;
+
+    // Queues the variant's build if it hasn't been queued yet.
+    void Request(uint32_t mask);
+    void RequestAll();
+
+    // True once the variant is linked.
+    bool IsReady(uint32_t mask) const;
+
+    // The variant if it is linked; otherwise requests it and returns null.
+    GLSLProgram* Find(uint32_t mask);
+
+    // Calls fn on every linked variant.
+    void ForEachReady(const std::function<void(GLSLProgram&, uint32_t)>& fn) const;
+
+    // The defines of mask, as "SPECULAR+SHADOWS", for logs and reports.
+    std::string Describe(uint32_t mask) const;
+
+    const Statistics& GetStatistics() const { return _statistics; }
+
+private:
+    enum VariantState
+    {
+        VARIANT_IDLE,
+        VARIANT_BUILDING,
+        VARIANT_READY,
+        VARIANT_FAILED
+    };
+
+    struct Variant
+    {
+        std::unique_ptr<GLSLProgram> program;
+        VariantState state;
+    };
+
+    ShaderCompiler& _compiler;
+    std::vector<ShaderCompiler::ShaderFile> _files;
+    std::vector<std::string> _defines;
+    std::function<void(GLSLProgram&, uint32_t)> _configure;
+    std::function<void(GLSLProgram&, uint32_t)> _onReady;
+    std::vector<Variant> _variants;     // indexed by mask
+    Statistics _statistics;
+};
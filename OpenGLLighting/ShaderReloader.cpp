@@ -0,0 +1,101 @@
+#include "ShaderReloader.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "GLSLProgram.h"
+
+ShaderReloader::ShaderReloader(ShaderCompiler& compiler) :
+    _compiler(compiler)
+{
+    _statistics.reloads = 0;
+    _statistics.failures = 0;
+    _statistics.lastBuildMilliseconds = 0.0;
+}
+
+void ShaderReloader::Watch(GLSLProgram& program, const std::vector<ShaderCompiler::ShaderFile>& files,
+                           std::function<void(GLSLProgram&)> onReloaded)
+{
+    Entry entry;
+    entry.program = &program;
+    entry.files = files;
+    entry.onReloaded = onReloaded;
+    entry.changedAgain = false;
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::string::size_type slash = files[i].filename.rfind('/');
+        entry.name += (i > 0 ? "+" : "") + files[i].filename.substr(slash == std::string::npos ? 0 : slash + 1);
+        _watcher.Watch(files[i].filename);
+        for (size_t j = 0; j < files[i].libraries.size(); ++j) {
+            _watcher.Watch(files[i].libraries[j]);
+        }
+    }
+    _entries.push_back(std::move(entry));
+}
+
+void ShaderReloader::Poll()
+{
+    _retired.clear();
+
+    std::vector<std::string> changed;
+    _watcher.Poll(changed);
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        Entry& entry = _entries[i];
+        bool uses = false;
+        for (size_t j = 0; j < entry.files.size() && !uses; ++j) {
+            const ShaderCompiler::ShaderFile& file = entry.files[j];
+            for (size_t k = 0; k < changed.size() && !uses; ++k) {
+                uses = file.filename == changed[k] ||
+                       std::find(file.libraries.begin(), file.libraries.end(), changed[k]) != file.libraries.end();
+            }
+        }
+        if (!uses) {
+            continue;
+        }
+        if (entry.rebuild) {
+            entry.changedAgain = true;  // build the latest sources once this one is done
+        }
+        else {
+            entry.changeTime = std::chrono::steady_clock::now();
+            StartRebuild(i);
+        }
+    }
+
+    _compiler.Poll();
+}
+
+void ShaderReloader::StartRebuild(size_t index)
+{
+    Entry& entry = _entries[index];
+    entry.rebuild.reset(new GLSLProgram());
+    entry.rebuild->CopyBuildSettings(*entry.program);
+    _compiler.Submit(*entry.rebuild, entry.files, [this, index](GLSLProgram& rebuilt) { FinishRebuild(index, rebuilt); });
+}
+
+void ShaderReloader::FinishRebuild(size_t index, GLSLProgram& rebuilt)
+{
+    Entry& entry = _entries[index];
+    double milliseconds =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - entry.changeTime).count();
+
+    if (entry.program->AdoptProgram(rebuilt)) {
+        ++_statistics.reloads;
+        _statistics.lastBuildMilliseconds = milliseconds;
+        std::cout << "Reloaded " << entry.name << " in " << milliseconds << " ms" << std::endl;
+        if (entry.onReloaded) {
+            entry.onReloaded(*entry.program);
+        }
+    }
+    else {
+        ++_statistics.failures;
+        std::cerr << "Reloading " << entry.name << " failed; keeping the previous program" << std::endl;
+    }
+
+    // The compiler still holds rebuilt's address until this returns.
+    _retired.push_back(std::move(entry.rebuild));
+
+    if (entry.changedAgain) {
+        entry.changedAgain = false;
+        entry.changeTime = std::chrono::steady_clock::now();
+        StartRebuild(index);
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ShaderCompiler.h"
+#include "ShaderWatcher.h"
+
+class GLSLProgram;
+
+// Rebuilds programs whose shader files change while the demo runs, so lighting shaders can be
+// iterated on without a restart.
+//
+// A change seen by the ShaderWatcher queues a rebuild of every program using the file into a
+// scratch GLSLProgram with the same #defines and block bindings, through the ShaderCompiler: the
+// files are read on the thread pool and, with GL_KHR_parallel_shader_compile, compiled on the
+// driver's threads, so the frame loop doesn't wait for them. Poll(), called at the start of a
+// frame, swaps each finished rebuild into its program with GLSLProgram::AdoptProgram(), so a
+// frame is drawn entirely with the old code or entirely with the new. A rebuild that fails to
+// compile or link is dropped and the program keeps the code it had.
+class ShaderReloader final
+{
+public:
+    struct Statistics
+    {
+        unsigned int reloads;
+        unsigned int failures;
+        double lastBuildMilliseconds;   // from the change being seen to the swap
+    };
+
+    explicit ShaderReloader(ShaderCompiler& compiler);
+
+    ShaderReloader(const ShaderReloader& rhs) = delete;
+    ShaderReloader& operator=(const ShaderReloader& rhs) = delete;
+
+    // Rebuilds program from files whenever one of them changes. onReloaded runs after each swap,
+    // to set the program's uniforms again and resolve any handles into it. program must outlive
+    // the reloader.
+    void Watch(GLSLProgram& program, const std::vector<ShaderCompiler::ShaderFile>& files,
+               std::function<void(GLSLProgram&)> onReloaded = nullptr);
+
+    // Queues rebuilds for changed files and swaps in the finished ones. Polls the compiler, so it
+    // also advances anything else queued on it. Call on the GL thread, between frames.
+    void Poll();
+
+    const Statistics& GetStatistics() const { return _statistics; }
+
+private:
+    struct Entry
+    {
+        GLSLProgram* program;
+        std::vector<ShaderCompiler::ShaderFile> files;
+        std::function<void(GLSLProgram&)> onReloaded;
+        std::string name;                       // the files' names, for the log
+        std::unique_ptr<GLSLProgram> rebuild;   // in flight, or null
+        bool changedAgain;                      // a file changed while the rebuild was in flight
+        std::chrono::steady_clock::time_point changeTime;
+    };
+
+    void StartRebuild(size_t index);
+    void FinishRebuild(size_t index, GLSLProgram& rebuilt);
+
+    ShaderCompiler& _compiler;
+    ShaderWatcher _watcher;
+    std::vector<Entry> _entries;
+    std::vector<std::unique_ptr<GLSLProgram>> _retired;  // finished rebuilds, freed next Poll()
+    Statistics _statistics;
+};
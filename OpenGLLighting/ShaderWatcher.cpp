@@ -0,0 +1,153 @@
+#include "ShaderWatcher.h"
+
+#include <cerrno>
+#include <iostream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#define SHADER_WATCHER_INOTIFY 1
+#include <sys/inotify.h>
+#endif
+
+namespace {
+
+int64_t ModificationTime(const std::string& path)
+{
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0) {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return static_cast<int64_t>(status.st_mtimespec.tv_sec) * 1000000000 + status.st_mtimespec.tv_nsec;
+#else
+    return static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+#endif
+}
+
+}
+
+const std::chrono::milliseconds ShaderWatcher::STAT_POLL_INTERVAL(250);
+
+ShaderWatcher::ShaderWatcher() :
+    _inotify(-1),
+    _lastStatPoll(std::chrono::steady_clock::now())
+{
+#if defined(SHADER_WATCHER_INOTIFY)
+    _inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotify < 0) {
+        std::cerr << "ShaderWatcher: inotify unavailable (errno " << errno << "); polling modification times" << std::endl;
+    }
+#endif
+}
+
+ShaderWatcher::~ShaderWatcher()
+{
+    if (_inotify >= 0) {
+        close(_inotify);
+    }
+}
+
+void ShaderWatcher::Watch(const std::string& path)
+{
+    for (size_t i = 0; i < _files.size(); ++i) {
+        if (_files[i].path == path) {
+            return;
+        }
+    }
+
+    std::string::size_type slash = path.rfind('/');
+    WatchedFile file;
+    file.path = path;
+    file.directory = slash == std::string::npos ? "." : path.substr(0, slash);
+    file.name = slash == std::string::npos ? path : path.substr(slash + 1);
+    file.modified = ModificationTime(path);
+    file.changed = false;
+    _files.push_back(file);
+
+#if defined(SHADER_WATCHER_INOTIFY)
+    if (_inotify < 0) {
+        return;
+    }
+    for (size_t i = 0; i < _directories.size(); ++i) {
+        if (_directories[i].second == file.directory) {
+            return;
+        }
+    }
+    int descriptor = inotify_add_watch(_inotify, file.directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (descriptor < 0) {
+        std::cerr << "ShaderWatcher: can't watch " << file.directory << " (errno " << errno << ")" << std::endl;
+        return;
+    }
+    _directories.push_back(std::make_pair(descriptor, file.directory));
+#endif
+}
+
+void ShaderWatcher::Poll(std::vector<std::string>& changed)
+{
+    if (_inotify >= 0) {
+        PollInotify();
+    }
+    else {
+        PollModificationTimes();
+    }
+
+    for (size_t i = 0; i < _files.size(); ++i) {
+        if (_files[i].changed) {
+            _files[i].changed = false;
+            changed.push_back(_files[i].path);
+        }
+    }
+}
+
+void ShaderWatcher::PollInotify()
+{
+#if defined(SHADER_WATCHER_INOTIFY)
+    // Events are variable length; the buffer is aligned for the header of the first one.
+    alignas(struct inotify_event) char buffer[4096];
+    for (;;) {
+        ssize_t length = read(_inotify, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;  // EAGAIN: nothing more queued
+        }
+
+        for (char* next = buffer; next < buffer + length; ) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(next);
+            next += sizeof(struct inotify_event) + event->len;
+            if (event->len == 0) {
+                continue;
+            }
+
+            const std::string* directory = nullptr;
+            for (size_t i = 0; i < _directories.size() && directory == nullptr; ++i) {
+                if (_directories[i].first == event->wd) {
+                    directory = &_directories[i].second;
+                }
+            }
+            for (size_t i = 0; directory != nullptr && i < _files.size(); ++i) {
+                if (_files[i].directory == *directory && _files[i].name == event->name) {
+                    _files[i].changed = true;
+                }
+            }
+        }
+    }
+#endif
+}
+
+void ShaderWatcher::PollModificationTimes()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now - _lastStatPoll < STAT_POLL_INTERVAL) {
+        return;
+    }
+    _lastStatPoll = now;
+
+    for (size_t i = 0; i < _files.size(); ++i) {
+        int64_t modified = ModificationTime(_files[i].path);
+        if (modified != 0 && modified != _files[i].modified) {
+            _files[i].modified = modified;
+            _files[i].changed = true;
+        }
+    }
+}
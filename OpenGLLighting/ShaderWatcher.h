@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Notices when shader files change on disk.
+//
+// On Linux the watcher uses inotify on the files' directories rather than on the files, so that
+// editors that save by writing a new file and renaming it over the old one are seen as well;
+// events for other files in those directories are ignored. Elsewhere, or if inotify is
+// unavailable, it compares the files' modification times instead, at most every
+// STAT_POLL_INTERVAL. Either way Poll() never blocks, so it can be called every frame.
+class ShaderWatcher final
+{
+public:
+    static const std::chrono::milliseconds STAT_POLL_INTERVAL;
+
+    ShaderWatcher();
+    ~ShaderWatcher();
+
+    ShaderWatcher(const ShaderWatcher& rhs) = delete;
+    ShaderWatcher& operator=(const ShaderWatcher& rhs) = delete;
+
+    // Starts watching path. Watching a path twice is harmless.
+    void Watch(const std::string& path);
+
+    // Appends to changed every watched path written since the last call, once each.
+    void Poll(std::vector<std::string>& changed);
+
+    bool UsesInotify() const { return _inotify >= 0; }
+
+private:
+    struct WatchedFile
+    {
+        std::string path;
+        std::string directory;
+        std::string name;
+        int64_t modified;       // modification time in nanoseconds, 0 if the file can't be read
+        bool changed;
+    };
+
+    void PollInotify();
+    void PollModificationTimes();
+
+    std::vector<WatchedFile> _files;
+
+    int _inotify;                                       // inotify descriptor, -1 if not in use
+    std::vector<std::pair<int, std::string>> _directories;  // inotify watch descriptor, directory
+
+    std::chrono::steady_clock::time_point _lastStatPoll;
+};
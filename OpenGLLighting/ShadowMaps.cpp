@@ -0,0 +1,366 @@
+#include "ShadowMaps.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// GLM: OpenGL Math
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLSLProgram.h"
+#include "GLStateCache.h"
+#include "LightGrid.h"
+#include "Profiler.h"
+#include "RenderQueue.h"
+#include "StreamBuffer.h"
+
+namespace {
+
+// Blend between logarithmic (1) and uniform (0) cascade splits.
+const float CASCADE_SPLIT_LAMBDA = 0.75f;
+
+// Near plane of the cube map faces.
+const float POINT_NEAR_PLANE = 0.05f;
+
+// Slope-scaled depth bias for the cascades, against shadow acne.
+const float CASCADE_POLYGON_OFFSET_FACTOR = 2.0f;
+const float CASCADE_POLYGON_OFFSET_UNITS = 4.0f;
+
+// The eight corners of the box [low, high] transformed by matrix, bounded again by a box.
+void TransformBox(const glm::mat4& matrix, const glm::vec3& low, const glm::vec3& high,
+                  glm::vec3& outLow, glm::vec3& outHigh)
+{
+    for (int corner = 0; corner < 8; ++corner) {
+        glm::vec3 point((corner & 1) ? high.x : low.x, (corner & 2) ? high.y : low.y, (corner & 4) ? high.z : low.z);
+        glm::vec3 transformed(matrix * glm::vec4(point, 1.0f));
+        outLow = corner == 0 ? transformed : glm::min(outLow, transformed);
+        outHigh = corner == 0 ? transformed : glm::max(outHigh, transformed);
+    }
+}
+
+bool SameMatrix(const glm::mat4& a, const glm::mat4& b)
+{
+    return std::memcmp(&a, &b, sizeof(glm::mat4)) == 0;
+}
+
+}
+
+ShadowMaps::ShadowMaps(GLSLProgram& pointProgram, GLSLProgram& cascadeProgram) :
+    _pointProgram(pointProgram),
+    _cascadeProgram(cascadeProgram),
+    _framebuffer(0),
+    _pointMap(0),
+    _cascadeMaps(0),
+    _hasPointLight(false),
+    _pointLightIndex(-1),
+    _pointLight(0.0f),
+    _renderedPointLight(0.0f),
+    _pointDirty(false),
+    _sunDirection(0.0f, -1.0f, 0.0f),
+    _sunColor(0.0f),
+    _sunShadows(false),
+    _casterMin(-1.0f),
+    _casterMax(1.0f),
+    _hasChangedRegion(false),
+    _changedMin(0.0f),
+    _changedMax(0.0f)
+{
+    std::memset(&_statistics, 0, sizeof(_statistics));
+    for (unsigned int i = 0; i < CASCADE_COUNT; ++i) {
+        _cascadeSplits[i] = 0.0f;
+        _cascadeDirty[i] = false;
+    }
+
+    glGenFramebuffers(1, &_framebuffer);
+
+    // Storage for each map is allocated the first time it is rendered, so a light that never
+    // casts shadows costs nothing.
+    glGenTextures(1, &_pointMap);
+    glGenTextures(1, &_cascadeMaps);
+}
+
+ShadowMaps::~ShadowMaps()
+{
+    glDeleteFramebuffers(1, &_framebuffer);
+    glDeleteTextures(1, &_pointMap);
+    glDeleteTextures(1, &_cascadeMaps);
+}
+
+void ShadowMaps::SetPointLight(const PointLight* light, int index)
+{
+    _hasPointLight = light != nullptr;
+    _pointLightIndex = light != nullptr ? index : -1;
+    if (light != nullptr) {
+        _pointLight = glm::vec4(light->position, light->radius);
+    }
+}
+
+void ShadowMaps::SetSun(const glm::vec3& direction, const glm::vec3& color, bool castsShadows)
+{
+    _sunDirection = glm::normalize(direction);
+    _sunColor = color;
+    _sunShadows = castsShadows && color != glm::vec3(0.0f);
+
+    // Any up vector not parallel to the direction will do; the cascades only need a fixed one.
+    glm::vec3 up = std::abs(_sunDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    _sunView = glm::lookAt(glm::vec3(0.0f), _sunDirection, up);
+}
+
+void ShadowMaps::SetCasterBounds(const glm::vec3& casterMin, const glm::vec3& casterMax)
+{
+    _casterMin = casterMin;
+    _casterMax = casterMax;
+}
+
+void ShadowMaps::MarkCastersChanged(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+    _changedMin = _hasChangedRegion ? glm::min(_changedMin, boundsMin) : boundsMin;
+    _changedMax = _hasChangedRegion ? glm::max(_changedMax, boundsMax) : boundsMax;
+    _hasChangedRegion = true;
+}
+
+void ShadowMaps::Update(const glm::mat4& view, const glm::mat4& projection, float nearPlane, float shadowDistance)
+{
+    ++_statistics.frames;
+
+    // The point light's map covers the sphere it lights.
+    if (_hasPointLight) {
+        bool moved = std::memcmp(&_pointLight, &_renderedPointLight, sizeof(glm::vec4)) != 0;
+        bool castersChanged = false;
+        if (_hasChangedRegion) {
+            glm::vec3 center(_pointLight);
+            glm::vec3 closest = glm::clamp(center, _changedMin, _changedMax);
+            castersChanged = glm::dot(closest - center, closest - center) <= _pointLight.w * _pointLight.w;
+        }
+        _pointDirty = _pointDirty || moved || castersChanged;
+    }
+
+    if (_sunShadows) {
+        const glm::mat4 inverseView = glm::inverse(view);
+        const float tanHalfFovX = 1.0f / projection[0][0];
+        const float tanHalfFovY = 1.0f / projection[1][1];
+
+        float splitNear = nearPlane;
+        for (unsigned int i = 0; i < CASCADE_COUNT; ++i) {
+            float fraction = static_cast<float>(i + 1) / CASCADE_COUNT;
+            float logarithmic = nearPlane * std::pow(shadowDistance / nearPlane, fraction);
+            float uniform = nearPlane + (shadowDistance - nearPlane) * fraction;
+            _cascadeSplits[i] = CASCADE_SPLIT_LAMBDA * logarithmic + (1.0f - CASCADE_SPLIT_LAMBDA) * uniform;
+
+            FitCascade(i, inverseView, splitNear, _cascadeSplits[i], tanHalfFovX, tanHalfFovY);
+            splitNear = _cascadeSplits[i];
+
+            _cascadeDirty[i] = _cascadeDirty[i] || !SameMatrix(_cascadeMatrices[i], _renderedCascadeMatrices[i]) ||
+                               (_hasChangedRegion && ChangedRegionTouches(_sunView, _cascadeMin[i], _cascadeMax[i]));
+        }
+    }
+
+    _hasChangedRegion = false;
+}
+
+// The cascade is an orthographic box in the sun's space around the bounding sphere of the
+// frustum slice [nearDepth, farDepth]. It reaches back towards the sun to the furthest caster.
+void ShadowMaps::FitCascade(unsigned int cascade, const glm::mat4& inverseView, float nearDepth, float farDepth,
+                            float tanHalfFovX, float tanHalfFovY)
+{
+    glm::vec3 corners[8];
+    glm::vec3 center(0.0f);
+    for (int corner = 0; corner < 8; ++corner) {
+        float depth = (corner & 4) ? farDepth : nearDepth;
+        glm::vec4 viewCorner((corner & 1 ? 1.0f : -1.0f) * tanHalfFovX * depth,
+                             (corner & 2 ? 1.0f : -1.0f) * tanHalfFovY * depth, -depth, 1.0f);
+        corners[corner] = glm::vec3(inverseView * viewCorner);
+        center += corners[corner];
+    }
+    center /= 8.0f;
+
+    float radius = 0.0f;
+    for (int corner = 0; corner < 8; ++corner) {
+        radius = std::max(radius, glm::length(corners[corner] - center));
+    }
+    radius = std::ceil(radius * 16.0f) / 16.0f;    // absorb rounding so the size stays put
+
+    // Move the box in whole texels.
+    glm::vec3 sunCenter(_sunView * glm::vec4(center, 1.0f));
+    float texel = 2.0f * radius / CASCADE_MAP_SIZE;
+    sunCenter.x = std::floor(sunCenter.x / texel) * texel;
+    sunCenter.y = std::floor(sunCenter.y / texel) * texel;
+
+    glm::vec3 casterLow, casterHigh;
+    TransformBox(_sunView, _casterMin, _casterMax, casterLow, casterHigh);
+
+    // The sun looks down -z: larger z is closer to the sun.
+    glm::vec3 low(sunCenter.x - radius, sunCenter.y - radius, sunCenter.z - radius);
+    glm::vec3 high(sunCenter.x + radius, sunCenter.y + radius, std::max(sunCenter.z + radius, casterHigh.z));
+    _cascadeMin[cascade] = low;
+    _cascadeMax[cascade] = high;
+    _cascadeMatrices[cascade] = glm::ortho(low.x, high.x, low.y, high.y, -high.z, -low.z) * _sunView;
+}
+
+bool ShadowMaps::ChangedRegionTouches(const glm::mat4& lightView, const glm::vec3& boxMin, const glm::vec3& boxMax) const
+{
+    glm::vec3 low, high;
+    TransformBox(lightView, _changedMin, _changedMax, low, high);
+    return low.x <= boxMax.x && high.x >= boxMin.x && low.y <= boxMax.y && high.y >= boxMin.y &&
+           low.z <= boxMax.z && high.z >= boxMin.z;
+}
+
+void ShadowMaps::Render(StreamBuffer& streamBuffer, GLuint vertexArray, GLsizei indexCount, GLenum indexType,
+                        const glm::mat4* models, size_t count, Profiler* profiler)
+{
+    const bool renderPoint = _hasPointLight && _pointDirty;
+    bool renderCascades = false;
+    for (unsigned int i = 0; i < CASCADE_COUNT; ++i) {
+        renderCascades = renderCascades || (_sunShadows && _cascadeDirty[i]);
+    }
+    if ((!renderPoint && !renderCascades) || count == 0) {
+        return;
+    }
+
+    ProfileZone shadowZone(profiler, "shadows");
+
+    // Every caster, once, for all the passes below.
+    StreamBuffer::Allocation allocation = streamBuffer.Allocate(count * sizeof(glm::mat4));
+    if (allocation.data == nullptr) {
+        return;
+    }
+    std::memcpy(allocation.data, models, count * sizeof(glm::mat4));
+    streamBuffer.Flush();
+
+    GLint previousFramebuffer = 0;
+    GLint previousViewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+
+    GLStateCache::BindVertexArray(vertexArray);
+    GLStateCache::BindBuffer(GL_ARRAY_BUFFER, streamBuffer.GetBufferHandle());
+    for (GLuint column = 0; column < 4; ++column) {
+        glVertexAttribPointer(RenderQueue::INSTANCE_MODEL_LOCATION + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                              (void*)(allocation.offset + column * sizeof(glm::vec4)));
+    }
+
+    if (renderPoint) {
+        ProfileZone pointZone(profiler, "point shadow");
+        glBindTexture(GL_TEXTURE_CUBE_MAP, _pointMap);
+        if (_statistics.pointPasses == 0) {
+            for (GLenum face = 0; face < 6; ++face) {
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT24, POINT_MAP_SIZE, POINT_MAP_SIZE,
+                             0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+            }
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        }
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        // Attached whole, the cube map is a layered target: gl_Layer picks the face.
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _pointMap, 0);
+        glViewport(0, 0, POINT_MAP_SIZE, POINT_MAP_SIZE);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        // The faces in GL_TEXTURE_CUBE_MAP_POSITIVE_X order, each with the up vector that lines
+        // its image up with the cube map's conventions.
+        static const glm::vec3 directions[6] = {
+            glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+            glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+        };
+        static const glm::vec3 ups[6] = {
+            glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+            glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+        };
+        glm::vec3 position(_pointLight);
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, POINT_NEAR_PLANE, _pointLight.w);
+
+        ShadowPassBlock passBlock;
+        for (int face = 0; face < 6; ++face) {
+            passBlock.matrices[face] = projection * glm::lookAt(position, position + directions[face], ups[face]);
+        }
+        passBlock.lightPosition = _pointLight;
+        streamBuffer.BindUniformBlock(SHADOW_PASS_BLOCK_BINDING, passBlock);
+
+        _pointProgram.UseProgram();
+        glDrawElementsInstanced(GL_TRIANGLES, indexCount, indexType, (void*)0, static_cast<GLsizei>(count));
+
+        _renderedPointLight = _pointLight;
+        _pointDirty = false;
+        ++_statistics.pointPasses;
+    }
+
+    if (renderCascades) {
+        ProfileZone cascadeZone(profiler, "cascade shadows");
+        glBindTexture(GL_TEXTURE_2D_ARRAY, _cascadeMaps);
+        if (_statistics.cascadePasses == 0) {
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, CASCADE_MAP_SIZE, CASCADE_MAP_SIZE, CASCADE_COUNT,
+                         0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+
+            // Compare in the sampler, with linear filtering for 2x2 percentage-closer filtering.
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glViewport(0, 0, CASCADE_MAP_SIZE, CASCADE_MAP_SIZE);
+        glPolygonOffset(CASCADE_POLYGON_OFFSET_FACTOR, CASCADE_POLYGON_OFFSET_UNITS);
+        GLStateCache::Enable(GL_POLYGON_OFFSET_FILL);
+        _cascadeProgram.UseProgram();
+
+        // Only the dirty cascades, each through its own layer.
+        for (unsigned int i = 0; i < CASCADE_COUNT; ++i) {
+            if (!_cascadeDirty[i]) {
+                continue;
+            }
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _cascadeMaps, 0, static_cast<GLint>(i));
+            glClear(GL_DEPTH_BUFFER_BIT);
+
+            ShadowPassBlock passBlock;
+            passBlock.matrices[0] = _cascadeMatrices[i];
+            passBlock.lightPosition = glm::vec4(0.0f);
+            streamBuffer.BindUniformBlock(SHADOW_PASS_BLOCK_BINDING, passBlock);
+            glDrawElementsInstanced(GL_TRIANGLES, indexCount, indexType, (void*)0, static_cast<GLsizei>(count));
+
+            _renderedCascadeMatrices[i] = _cascadeMatrices[i];
+            _cascadeDirty[i] = false;
+            ++_statistics.cascadePasses;
+        }
+        GLStateCache::Disable(GL_POLYGON_OFFSET_FILL);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(previousFramebuffer));
+    glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+}
+
+ShadowBlock ShadowMaps::GetShadowBlock() const
+{
+    // From clip space [-1, 1] to the map's [0, 1].
+    glm::mat4 bias = glm::translate(glm::mat4(), glm::vec3(0.5f)) * glm::scale(glm::mat4(), glm::vec3(0.5f));
+
+    ShadowBlock block;
+    for (unsigned int i = 0; i < CASCADE_COUNT; ++i) {
+        block.cascadeMatrices[i] = bias * _cascadeMatrices[i];
+    }
+    block.cascadeSplits = glm::vec4(_cascadeSplits[0], _cascadeSplits[1], _cascadeSplits[2], _cascadeSplits[3]);
+    block.sunDirection = glm::vec4(-_sunDirection, 0.0f);
+    block.sunColor = glm::vec4(_sunColor, _sunColor != glm::vec3(0.0f) ? 1.0f : 0.0f);
+    block.pointShadow = _pointLight;
+    block.shadowLights = glm::ivec4(_hasPointLight ? _pointLightIndex : -1, _sunShadows ? CASCADE_COUNT : 0, 0, 0);
+    return block;
+}
+
+void ShadowMaps::Bind() const
+{
+    glActiveTexture(GL_TEXTURE0 + POINT_SHADOW_UNIT);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, _pointMap);
+    glActiveTexture(GL_TEXTURE0 + CASCADE_SHADOW_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, _cascadeMaps);
+    glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+
+#include "UniformBlocks.h"
+
+class GLSLProgram;
+class Profiler;
+class StreamBuffer;
+struct PointLight;
+
+// Shadow maps for one point light and one directional light (the sun), cached between frames.
+//
+// The point light gets a depth cube map rendered in a single pass: shadow_point.gs sends every
+// triangle to all six faces with gl_Layer, and shadow_point.fs stores the distance to the light
+// over its radius. The sun gets CASCADE_COUNT cascades in the layers of a depth texture array,
+// each fitted to a slice of the view frustum (split between uniform and logarithmic spacing),
+// bounded by the slice's sphere so its size doesn't change as the camera turns, and snapped to
+// whole texels so it doesn't shimmer as the camera moves.
+//
+// A map is only re-rendered when it is dirty: when its light moved, when its cascade's fit
+// changed, or when casters inside its volume changed (MarkCastersChanged()). With a still scene,
+// a still light and a still camera no shadow pass runs at all.
+class ShadowMaps final
+{
+public:
+    static const unsigned int POINT_MAP_SIZE = 512;
+    static const unsigned int CASCADE_MAP_SIZE = 1024;
+    static const unsigned int CASCADE_COUNT = 4;
+
+    // Texture units the lighting shaders read the maps from; after the G-buffer's.
+    enum TextureUnit
+    {
+        POINT_SHADOW_UNIT = 6,
+        CASCADE_SHADOW_UNIT = 7
+    };
+
+    // Passes rendered since creation, to show what the caching saves.
+    struct Statistics
+    {
+        unsigned int frames;
+        unsigned int pointPasses;
+        unsigned int cascadePasses;
+    };
+
+    // pointProgram links shadow.vs, shadow_point.gs and shadow_point.fs; cascadeProgram links
+    // shadow_cascade.vs and shadow.fs.
+    ShadowMaps(GLSLProgram& pointProgram, GLSLProgram& cascadeProgram);
+
+    ShadowMaps(const ShadowMaps& rhs) = delete;
+    ShadowMaps& operator=(const ShadowMaps& rhs) = delete;
+
+    ~ShadowMaps();
+
+    // The light casting point shadows, index being its place in the light grid; light null (the
+    // default) for none.
+    void SetPointLight(const PointLight* light, int index);
+
+    // direction points from the sun towards the scene. A black color turns the sun off; without
+    // castsShadows it lights everything it faces.
+    void SetSun(const glm::vec3& direction, const glm::vec3& color, bool castsShadows);
+
+    // Casters in the box [boundsMin, boundsMax] moved since the last frame. casterMin and
+    // casterMax bound every caster, so cascades reach back to the ones between the sun and the
+    // view.
+    void MarkCastersChanged(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+    void SetCasterBounds(const glm::vec3& casterMin, const glm::vec3& casterMax);
+
+    // Fits the cascades to the view frustum, up to shadowDistance from the camera, and decides
+    // which maps are dirty. Call once per frame before Render() and GetShadowBlock().
+    void Update(const glm::mat4& view, const glm::mat4& projection, float nearPlane, float shadowDistance);
+
+    // Renders the dirty maps, drawing count instances of the caster mesh with models streamed
+    // through streamBuffer. vertexArray must have the position at location 0 and the instance
+    // model matrix at RenderQueue::INSTANCE_MODEL_LOCATION.
+    void Render(StreamBuffer& streamBuffer, GLuint vertexArray, GLsizei indexCount, GLenum indexType,
+                const glm::mat4* models, size_t count, Profiler* profiler);
+
+    ShadowBlock GetShadowBlock() const;
+
+    // Binds the maps to their units. Leaves texture unit 0 active.
+    void Bind() const;
+
+    const Statistics& GetStatistics() const { return _statistics; }
+
+private:
+    void FitCascade(unsigned int cascade, const glm::mat4& inverseView, float nearDepth, float farDepth,
+                    float tanHalfFovX, float tanHalfFovY);
+    bool ChangedRegionTouches(const glm::mat4& lightView, const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+
+    GLSLProgram& _pointProgram;
+    GLSLProgram& _cascadeProgram;
+    GLuint _framebuffer;
+    GLuint _pointMap;           // depth cube map
+    GLuint _cascadeMaps;        // depth 2D array, one layer per cascade
+
+    bool _hasPointLight;
+    int _pointLightIndex;
+    glm::vec4 _pointLight;      // position and radius
+    glm::vec4 _renderedPointLight;
+    bool _pointDirty;
+
+    glm::vec3 _sunDirection;
+    glm::vec3 _sunColor;
+    bool _sunShadows;
+    glm::mat4 _sunView;         // rotation only; cascades are boxes in this space
+    glm::vec3 _casterMin, _casterMax;
+
+    glm::mat4 _cascadeMatrices[CASCADE_COUNT];          // world to clip space of the cascade
+    glm::mat4 _renderedCascadeMatrices[CASCADE_COUNT];
+    float _cascadeSplits[CASCADE_COUNT];
+    bool _cascadeDirty[CASCADE_COUNT];
+    glm::vec3 _cascadeMin[CASCADE_COUNT], _cascadeMax[CASCADE_COUNT];  // in _sunView space
+
+    bool _hasChangedRegion;     // casters moved since the last Update()
+    glm::vec3 _changedMin, _changedMax;
+
+    Statistics _statistics;
+};
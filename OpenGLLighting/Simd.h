@@ -0,0 +1,215 @@
+#pragma once
+
+// Thin wrappers over 4-wide float SIMD: SSE on x86, NEON on ARM, and plain arrays elsewhere.
+// Float8 is the 8-wide equivalent for kernels that are written once for either width: native
+// when the compiler targets AVX (-mavx), a pair of Float4s otherwise, so 8-wide kernels build
+// everywhere and run at the width the target has. Only the operations the batch kernels and the
+// software rasterizer need are provided. Loads and stores are unaligned.
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SIMD_SSE 1
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_AVX 1
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SIMD_NEON 1
+#endif
+
+struct Float4
+{
+    static const int WIDTH = 4;
+
+#if SIMD_SSE
+    __m128 v;
+
+    Float4() { }
+    Float4(__m128 value) : v(value) { }
+
+    static Float4 Load(const float* p) { return _mm_loadu_ps(p); }
+    static Float4 Set1(float value) { return _mm_set1_ps(value); }
+    static Float4 Zero() { return _mm_setzero_ps(); }
+    void Store(float* p) const { _mm_storeu_ps(p, v); }
+#elif SIMD_NEON
+    float32x4_t v;
+
+    Float4() { }
+    Float4(float32x4_t value) : v(value) { }
+
+    static Float4 Load(const float* p) { return vld1q_f32(p); }
+    static Float4 Set1(float value) { return vdupq_n_f32(value); }
+    static Float4 Zero() { return vdupq_n_f32(0.0f); }
+    void Store(float* p) const { vst1q_f32(p, v); }
+#else
+    float v[4];
+
+    static Float4 Load(const float* p) { Float4 r; for (int i = 0; i < 4; ++i) r.v[i] = p[i]; return r; }
+    static Float4 Set1(float value) { Float4 r; for (int i = 0; i < 4; ++i) r.v[i] = value; return r; }
+    static Float4 Zero() { return Set1(0.0f); }
+    void Store(float* p) const { for (int i = 0; i < 4; ++i) p[i] = v[i]; }
+#endif
+};
+
+#if SIMD_SSE
+
+inline Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+inline Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline Float4 operator/(Float4 a, Float4 b) { return _mm_div_ps(a.v, b.v); }
+inline Float4 Min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+inline Float4 Max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+inline Float4 Sqrt(Float4 a) { return _mm_sqrt_ps(a.v); }
+
+// Returns a with its sign flipped in every lane where signSource is negative.
+inline Float4 FlipSign(Float4 a, Float4 signSource)
+{
+    return _mm_xor_ps(a.v, _mm_and_ps(signSource.v, _mm_set1_ps(-0.0f)));
+}
+
+inline void Transpose(Float4& a, Float4& b, Float4& c, Float4& d)
+{
+    _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v);
+}
+
+// Bit i is set when a >= b in lane i.
+inline int GreaterEqualMask(Float4 a, Float4 b)
+{
+    return _mm_movemask_ps(_mm_cmpge_ps(a.v, b.v));
+}
+
+#elif SIMD_NEON
+
+inline Float4 operator+(Float4 a, Float4 b) { return vaddq_f32(a.v, b.v); }
+inline Float4 operator-(Float4 a, Float4 b) { return vsubq_f32(a.v, b.v); }
+inline Float4 operator*(Float4 a, Float4 b) { return vmulq_f32(a.v, b.v); }
+inline Float4 operator/(Float4 a, Float4 b) { return vdivq_f32(a.v, b.v); }     // AArch64
+inline Float4 Min(Float4 a, Float4 b) { return vminq_f32(a.v, b.v); }
+inline Float4 Max(Float4 a, Float4 b) { return vmaxq_f32(a.v, b.v); }
+inline Float4 Sqrt(Float4 a) { return vsqrtq_f32(a.v); }                          // AArch64
+
+inline Float4 FlipSign(Float4 a, Float4 signSource)
+{
+    uint32x4_t signBits = vandq_u32(vreinterpretq_u32_f32(signSource.v), vdupq_n_u32(0x80000000u));
+    return vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(a.v), signBits));
+}
+
+inline void Transpose(Float4& a, Float4& b, Float4& c, Float4& d)
+{
+    float32x4x2_t ab = vtrnq_f32(a.v, b.v);
+    float32x4x2_t cd = vtrnq_f32(c.v, d.v);
+    a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+    b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+    c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+    d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+
+inline int GreaterEqualMask(Float4 a, Float4 b)
+{
+    uint32x4_t mask = vcgeq_f32(a.v, b.v);
+    return static_cast<int>((vgetq_lane_u32(mask, 0) & 1) | (vgetq_lane_u32(mask, 1) & 2) |
+                            (vgetq_lane_u32(mask, 2) & 4) | (vgetq_lane_u32(mask, 3) & 8));
+}
+
+#else
+
+#define SIMD_FLOAT4_BINARY(name, expression) \
+    inline Float4 name(Float4 a, Float4 b) { Float4 r; for (int i = 0; i < 4; ++i) r.v[i] = (expression); return r; }
+SIMD_FLOAT4_BINARY(operator+, a.v[i] + b.v[i])
+SIMD_FLOAT4_BINARY(operator-, a.v[i] - b.v[i])
+SIMD_FLOAT4_BINARY(operator*, a.v[i] * b.v[i])
+SIMD_FLOAT4_BINARY(operator/, a.v[i] / b.v[i])
+SIMD_FLOAT4_BINARY(Min, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+SIMD_FLOAT4_BINARY(Max, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+SIMD_FLOAT4_BINARY(FlipSign, std::signbit(b.v[i]) ? -a.v[i] : a.v[i])
+#undef SIMD_FLOAT4_BINARY
+
+inline Float4 Sqrt(Float4 a) { Float4 r; for (int i = 0; i < 4; ++i) r.v[i] = std::sqrt(a.v[i]); return r; }
+
+inline void Transpose(Float4& a, Float4& b, Float4& c, Float4& d)
+{
+    Float4* rows[4] = { &a, &b, &c, &d };
+    for (int i = 0; i < 4; ++i) {
+        for (int j = i + 1; j < 4; ++j) {
+            float t = rows[i]->v[j];
+            rows[i]->v[j] = rows[j]->v[i];
+            rows[j]->v[i] = t;
+        }
+    }
+}
+
+inline int GreaterEqualMask(Float4 a, Float4 b)
+{
+    int mask = 0;
+    for (int i = 0; i < 4; ++i) {
+        mask |= (a.v[i] >= b.v[i]) << i;
+    }
+    return mask;
+}
+
+#endif
+
+#if SIMD_AVX
+
+struct Float8
+{
+    static const int WIDTH = 8;
+
+    __m256 v;
+
+    Float8() { }
+    Float8(__m256 value) : v(value) { }
+
+    static Float8 Load(const float* p) { return _mm256_loadu_ps(p); }
+    static Float8 Set1(float value) { return _mm256_set1_ps(value); }
+    static Float8 Zero() { return _mm256_setzero_ps(); }
+    void Store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+
+inline Float8 operator+(Float8 a, Float8 b) { return _mm256_add_ps(a.v, b.v); }
+inline Float8 operator-(Float8 a, Float8 b) { return _mm256_sub_ps(a.v, b.v); }
+inline Float8 operator*(Float8 a, Float8 b) { return _mm256_mul_ps(a.v, b.v); }
+inline Float8 operator/(Float8 a, Float8 b) { return _mm256_div_ps(a.v, b.v); }
+inline Float8 Min(Float8 a, Float8 b) { return _mm256_min_ps(a.v, b.v); }
+inline Float8 Max(Float8 a, Float8 b) { return _mm256_max_ps(a.v, b.v); }
+inline Float8 Sqrt(Float8 a) { return _mm256_sqrt_ps(a.v); }
+
+inline int GreaterEqualMask(Float8 a, Float8 b)
+{
+    return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ));
+}
+
+#else
+
+struct Float8
+{
+    static const int WIDTH = 8;
+
+    Float4 low, high;
+
+    Float8() { }
+    Float8(Float4 lowHalf, Float4 highHalf) : low(lowHalf), high(highHalf) { }
+
+    static Float8 Load(const float* p) { return Float8(Float4::Load(p), Float4::Load(p + 4)); }
+    static Float8 Set1(float value) { return Float8(Float4::Set1(value), Float4::Set1(value)); }
+    static Float8 Zero() { return Float8(Float4::Zero(), Float4::Zero()); }
+    void Store(float* p) const { low.Store(p); high.Store(p + 4); }
+};
+
+inline Float8 operator+(Float8 a, Float8 b) { return Float8(a.low + b.low, a.high + b.high); }
+inline Float8 operator-(Float8 a, Float8 b) { return Float8(a.low - b.low, a.high - b.high); }
+inline Float8 operator*(Float8 a, Float8 b) { return Float8(a.low * b.low, a.high * b.high); }
+inline Float8 operator/(Float8 a, Float8 b) { return Float8(a.low / b.low, a.high / b.high); }
+inline Float8 Min(Float8 a, Float8 b) { return Float8(Min(a.low, b.low), Min(a.high, b.high)); }
+inline Float8 Max(Float8 a, Float8 b) { return Float8(Max(a.low, b.low), Max(a.high, b.high)); }
+inline Float8 Sqrt(Float8 a) { return Float8(Sqrt(a.low), Sqrt(a.high)); }
+
+inline int GreaterEqualMask(Float8 a, Float8 b)
+{
+    return GreaterEqualMask(a.low, b.low) | (GreaterEqualMask(a.high, b.high) << 4);
+}
+
+#endif
@@ -0,0 +1,595 @@
+#include "SoftwareRasterizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+
+// GLM: OpenGL Math
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Simd.h"
+#include "ThreadPool.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Triangles set up per batch, about; a batch is a whole number of instances.
+const size_t TRIANGLES_PER_BATCH = 1024;
+
+// Clip-space x and y beyond this multiple of w are clipped, so window coordinates, and with them
+// the edge functions' constants, stay small enough for float precision.
+const float GUARD_BAND = 4.0f;
+
+// The clip-space planes a triangle may be clipped against, as (a, b, c, d) with the inside where
+// a*x + b*y + c*z + d*w >= 0: the near plane first, then the guard band.
+const int CLIP_PLANE_COUNT = 5;
+const glm::vec4 CLIP_PLANES[CLIP_PLANE_COUNT] = {
+    glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+    glm::vec4(1.0f, 0.0f, 0.0f, GUARD_BAND),
+    glm::vec4(-1.0f, 0.0f, 0.0f, GUARD_BAND),
+    glm::vec4(0.0f, 1.0f, 0.0f, GUARD_BAND),
+    glm::vec4(0.0f, -1.0f, 0.0f, GUARD_BAND)
+};
+
+// Largest polygon clipping a triangle against every plane can leave.
+const int MAX_CLIPPED_VERTICES = 3 + CLIP_PLANE_COUNT;
+
+// The pixel centres of a span, relative to its first pixel.
+const float LANE_OFFSETS[SoftwareRasterizer::SPAN_WIDTH] = { 0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f };
+
+// Outside bits: x, y or z beyond -w or w.
+int OutCode(const glm::vec4& clip)
+{
+    return (clip.x < -clip.w ? 1 : 0) | (clip.x > clip.w ? 2 : 0) |
+           (clip.y < -clip.w ? 4 : 0) | (clip.y > clip.w ? 8 : 0) |
+           (clip.z < -clip.w ? 16 : 0) | (clip.z > clip.w ? 32 : 0);
+}
+
+// As glReadPixels converts to GL_UNSIGNED_BYTE.
+uint8_t ToUnorm8(float value)
+{
+    return static_cast<uint8_t>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+int CountBits(int mask)
+{
+    int count = 0;
+    for (; mask != 0; mask &= mask - 1) {
+        ++count;
+    }
+    return count;
+}
+
+}
+
+SoftwareRasterizer::SoftwareRasterizer(int width, int height, ThreadPool* threadPool) :
+    _width(width),
+    _height(height),
+    _stride((width + SPAN_WIDTH - 1) / SPAN_WIDTH * SPAN_WIDTH),
+    _tilesX((width + TILE_SIZE - 1) / TILE_SIZE),
+    _tilesY((height + TILE_SIZE - 1) / TILE_SIZE),
+    _threadPool(threadPool),
+    _depth(static_cast<size_t>(_stride) * height, 1.0f),
+    _color(static_cast<size_t>(width) * height * 3, 0),
+    _specularStrength(0.0f)
+{
+    _statistics = Statistics();
+}
+
+template <typename Body>
+void SoftwareRasterizer::ForEach(size_t count, const Body& body)
+{
+    if (_threadPool == nullptr) {
+        for (size_t i = 0; i < count; ++i) {
+            body(i);
+        }
+        return;
+    }
+
+    // One range per thread; each takes the next index whenever it finishes one, so uneven items
+    // (a crowded tile, a batch of near triangles) don't leave threads idle.
+    std::atomic<size_t> next(0);
+    _threadPool->ParallelFor(_threadPool->ThreadCount() + 1, [&](size_t, size_t) {
+        for (size_t i = next++; i < count; i = next++) {
+            body(i);
+        }
+    });
+}
+
+void SoftwareRasterizer::BeginFrame(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos,
+                                    const glm::vec3& clearColor, const glm::vec3& ambientColor, float specularStrength,
+                                    const PointLight* lights, size_t lightCount)
+{
+    _viewProjection = projection * view;
+    _viewPos = viewPos;
+    _clearColor = clearColor;
+    _ambientColor = ambientColor;
+    _specularStrength = specularStrength;
+    _draws.clear();
+    _statistics = Statistics();
+
+    // Bound each light's sphere on screen by its bounding box's corners; a box reaching behind the
+    // camera may cover anything.
+    _lights.resize(lightCount);
+    _lampModels.resize(lightCount);
+    _lampColors.resize(lightCount);
+    for (size_t i = 0; i < lightCount; ++i) {
+        const PointLight& pointLight = lights[i];
+        Light& light = _lights[i];
+        light.position = pointLight.position;
+        light.inverseRadius = 1.0f / pointLight.radius;
+        light.color = pointLight.color * pointLight.intensity;
+        light.minX = 0;
+        light.minY = 0;
+        light.maxX = _width - 1;
+        light.maxY = _height - 1;
+
+        float minX = 1.0f, minY = 1.0f, maxX = -1.0f, maxY = -1.0f;
+        bool bounded = true;
+        for (int corner = 0; corner < 8 && bounded; ++corner) {
+            glm::vec3 offset((corner & 1) ? pointLight.radius : -pointLight.radius,
+                             (corner & 2) ? pointLight.radius : -pointLight.radius,
+                             (corner & 4) ? pointLight.radius : -pointLight.radius);
+            glm::vec4 clip = _viewProjection * glm::vec4(pointLight.position + offset, 1.0f);
+            bounded = clip.w > 1e-4f;
+            if (bounded) {
+                minX = std::min(minX, clip.x / clip.w);
+                maxX = std::max(maxX, clip.x / clip.w);
+                minY = std::min(minY, clip.y / clip.w);
+                maxY = std::max(maxY, clip.y / clip.w);
+            }
+        }
+        if (bounded) {
+            light.minX = std::max(0, static_cast<int>(std::floor((minX * 0.5f + 0.5f) * _width)));
+            light.maxX = std::min(_width - 1, static_cast<int>(std::ceil((maxX * 0.5f + 0.5f) * _width)));
+            light.minY = std::max(0, static_cast<int>(std::floor((minY * 0.5f + 0.5f) * _height)));
+            light.maxY = std::min(_height - 1, static_cast<int>(std::ceil((maxY * 0.5f + 0.5f) * _height)));
+        }
+
+        // The lamp as lamp.vs places it.
+        _lampModels[i] = glm::scale(glm::translate(glm::mat4(1.0f), pointLight.position), glm::vec3(0.2f));
+        _lampColors[i] = pointLight.color;
+    }
+}
+
+void SoftwareRasterizer::DrawLit(const Mesh& mesh, const glm::mat4* models, const glm::mat3* normalMatrices,
+                                 size_t count, const glm::vec3& color)
+{
+    Draw draw = { &mesh, models, normalMatrices, nullptr, count, color, true };
+    _draws.push_back(draw);
+}
+
+void SoftwareRasterizer::DrawLamps(const Mesh& mesh)
+{
+    Draw draw = { &mesh, _lampModels.data(), nullptr, _lampColors.data(), _lampModels.size(), glm::vec3(1.0f), false };
+    _draws.push_back(draw);
+}
+
+void SoftwareRasterizer::EndFrame()
+{
+    // Split every draw into batches of whole instances.
+    size_t batchCount = 0;
+    for (size_t i = 0; i < _draws.size(); ++i) {
+        size_t triangles = std::max<size_t>(_draws[i].mesh->indices.size() / 3, 1);
+        size_t instancesPerBatch = std::max<size_t>(TRIANGLES_PER_BATCH / triangles, 1);
+        for (size_t first = 0; first < _draws[i].count; first += instancesPerBatch) {
+            if (_batches.size() <= batchCount) {
+                _batches.resize(batchCount + 1);
+            }
+            Batch& batch = _batches[batchCount++];
+            batch.draw = i;
+            batch.first = first;
+            batch.count = std::min(instancesPerBatch, _draws[i].count - first);
+        }
+        _statistics.triangles += _draws[i].count * (_draws[i].mesh->indices.size() / 3);
+    }
+
+    Clock::time_point start = Clock::now();
+    ForEach(batchCount, [this](size_t i) { SetUpBatch(_batches[i]); });
+    Clock::time_point geometryEnd = Clock::now();
+
+    // Count each tile's triangles, then lay the tiles' lists out one after the other.
+    const size_t tileCount = static_cast<size_t>(_tilesX) * _tilesY;
+    _tileOffsets.assign(tileCount + 1, 0);
+    for (size_t i = 0; i < batchCount; ++i) {
+        const Batch& batch = _batches[i];
+        for (size_t entry = 0; entry < batch.binTiles.size(); ++entry) {
+            ++_tileOffsets[batch.binTiles[entry] + 1];
+        }
+        _statistics.trianglesSetUp += batch.triangles.size();
+    }
+    for (size_t tile = 0; tile < tileCount; ++tile) {
+        _tileOffsets[tile + 1] += _tileOffsets[tile];
+    }
+    _statistics.binEntries = _tileOffsets[tileCount];
+    _tileTriangles.resize(_statistics.binEntries);
+    std::vector<uint32_t> cursors(_tileOffsets.begin(), _tileOffsets.end() - 1);
+    for (size_t i = 0; i < batchCount; ++i) {
+        const Batch& batch = _batches[i];
+        for (size_t entry = 0; entry < batch.binTiles.size(); ++entry) {
+            _tileTriangles[cursors[batch.binTiles[entry]]++] = &batch.triangles[batch.binTriangles[entry]];
+        }
+    }
+    Clock::time_point binningEnd = Clock::now();
+
+    _tileFragments.assign(tileCount, 0);
+    ForEach(tileCount, [this](size_t tile) { RasterizeTile(tile); });
+    Clock::time_point rasterEnd = Clock::now();
+    for (size_t tile = 0; tile < tileCount; ++tile) {
+        _statistics.fragmentsShaded += _tileFragments[tile];
+    }
+
+    _statistics.geometryMilliseconds = std::chrono::duration<double, std::milli>(geometryEnd - start).count();
+    _statistics.binningMilliseconds = std::chrono::duration<double, std::milli>(binningEnd - geometryEnd).count();
+    _statistics.rasterMilliseconds = std::chrono::duration<double, std::milli>(rasterEnd - binningEnd).count();
+}
+
+void SoftwareRasterizer::SetUpBatch(Batch& batch)
+{
+    batch.triangles.clear();
+    batch.binTiles.clear();
+    batch.binTriangles.clear();
+
+    const Draw& draw = _draws[batch.draw];
+    const Mesh& mesh = *draw.mesh;
+    batch.vertices.resize(mesh.vertices.size());
+
+    for (size_t instance = batch.first; instance < batch.first + batch.count; ++instance) {
+        const glm::mat4& model = draw.models[instance];
+        const glm::mat3 normalMatrix = draw.normalMatrices != nullptr ? draw.normalMatrices[instance] : glm::mat3(1.0f);
+        const glm::mat4 modelViewProjection = _viewProjection * model;
+        const glm::vec3 color = draw.colors != nullptr ? draw.colors[instance] : draw.color;
+
+        // As cube.vs does.
+        for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+            ClipVertex& vertex = batch.vertices[i];
+            glm::vec4 position(mesh.vertices[i].position, 1.0f);
+            vertex.clip = modelViewProjection * position;
+            vertex.position = glm::vec3(model * position);
+            vertex.normal = normalMatrix * mesh.vertices[i].normal;
+        }
+
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+            const ClipVertex* corners[3] = {
+                &batch.vertices[mesh.indices[i]], &batch.vertices[mesh.indices[i + 1]], &batch.vertices[mesh.indices[i + 2]]
+            };
+
+            // Facing away when every vertex normal points away from the camera. The normals decide
+            // rather than the winding, which the cube's vertices[] doesn't keep consistent.
+            bool facingAway = true;
+            for (int k = 0; k < 3 && facingAway; ++k) {
+                facingAway = glm::dot(corners[k]->normal, _viewPos - corners[k]->position) <= 0.0f;
+            }
+            if (facingAway || (OutCode(corners[0]->clip) & OutCode(corners[1]->clip) & OutCode(corners[2]->clip)) != 0) {
+                continue;
+            }
+
+            // Clip against the near plane, and against the guard band for triangles reaching past
+            // it, then fan the polygon out into triangles.
+            ClipVertex polygon[2][MAX_CLIPPED_VERTICES];
+            int count = 3;
+            for (int k = 0; k < 3; ++k) {
+                polygon[0][k] = *corners[k];
+            }
+            int current = 0;
+            for (int plane = 0; plane < CLIP_PLANE_COUNT && count >= 3; ++plane) {
+                float distances[MAX_CLIPPED_VERTICES];
+                bool allInside = true;
+                for (int k = 0; k < count; ++k) {
+                    distances[k] = glm::dot(CLIP_PLANES[plane], polygon[current][k].clip);
+                    allInside = allInside && distances[k] >= 0.0f;
+                }
+                if (allInside) {
+                    continue;
+                }
+
+                int clippedCount = 0;
+                for (int k = 0; k < count; ++k) {
+                    int next = (k + 1) % count;
+                    const ClipVertex& a = polygon[current][k];
+                    const ClipVertex& b = polygon[current][next];
+                    if (distances[k] >= 0.0f) {
+                        polygon[1 - current][clippedCount++] = a;
+                    }
+                    if ((distances[k] >= 0.0f) != (distances[next] >= 0.0f)) {
+                        float t = distances[k] / (distances[k] - distances[next]);
+                        ClipVertex& crossing = polygon[1 - current][clippedCount++];
+                        crossing.clip = a.clip + (b.clip - a.clip) * t;
+                        crossing.position = a.position + (b.position - a.position) * t;
+                        crossing.normal = a.normal + (b.normal - a.normal) * t;
+                    }
+                }
+                count = clippedCount;
+                current = 1 - current;
+            }
+
+            for (int k = 1; k + 1 < count; ++k) {
+                ClipVertex fan[3] = { polygon[current][0], polygon[current][k], polygon[current][k + 1] };
+                SetUpTriangle(batch, fan, color, draw.lit);
+            }
+        }
+    }
+}
+
+void SoftwareRasterizer::SetUpTriangle(Batch& batch, const ClipVertex* vertices, const glm::vec3& color, bool lit)
+{
+    // To window coordinates, with the depth range [0, 1].
+    float x[3], y[3], z[3], inverseW[3];
+    for (int k = 0; k < 3; ++k) {
+        inverseW[k] = 1.0f / vertices[k].clip.w;
+        x[k] = (vertices[k].clip.x * inverseW[k] * 0.5f + 0.5f) * _width;
+        y[k] = (vertices[k].clip.y * inverseW[k] * 0.5f + 0.5f) * _height;
+        z[k] = vertices[k].clip.z * inverseW[k] * 0.5f + 0.5f;
+    }
+
+    // Twice the signed area; flip the edges of clockwise triangles so inside is always positive.
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (!(area != 0.0f)) {
+        return;     // degenerate, or NaN
+    }
+    const float orientation = area > 0.0f ? 1.0f : -1.0f;
+    area *= orientation;
+
+    Triangle triangle;
+    triangle.minX = std::max(0, static_cast<int>(std::ceil(std::min(std::min(x[0], x[1]), x[2]) - 0.5f)));
+    triangle.maxX = std::min(_width - 1, static_cast<int>(std::floor(std::max(std::max(x[0], x[1]), x[2]) - 0.5f)));
+    triangle.minY = std::max(0, static_cast<int>(std::ceil(std::min(std::min(y[0], y[1]), y[2]) - 0.5f)));
+    triangle.maxY = std::min(_height - 1, static_cast<int>(std::floor(std::max(std::max(y[0], y[1]), y[2]) - 0.5f)));
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) {
+        return;     // covers no pixel centre
+    }
+
+    // Edge k is opposite vertex k: zero on the edge, area at the vertex.
+    for (int k = 0; k < 3; ++k) {
+        int from = (k + 1) % 3, to = (k + 2) % 3;
+        float a = (y[from] - y[to]) * orientation;
+        float b = (x[to] - x[from]) * orientation;
+        triangle.edges[k][0] = a;
+        triangle.edges[k][1] = b;
+        triangle.edges[k][2] = -(a * x[from] + b * y[from]);
+    }
+
+    // Each quantity over the triangle is the barycentric mix of its corner values, and the
+    // barycentric weights are the edge functions over the area, so it is a plane in x and y.
+    float values[PLANE_COUNT][3];
+    for (int k = 0; k < 3; ++k) {
+        values[PLANE_DEPTH][k] = z[k];
+        values[PLANE_INVERSE_W][k] = inverseW[k];
+        values[PLANE_POSITION_X][k] = vertices[k].position.x * inverseW[k];
+        values[PLANE_POSITION_Y][k] = vertices[k].position.y * inverseW[k];
+        values[PLANE_POSITION_Z][k] = vertices[k].position.z * inverseW[k];
+        values[PLANE_NORMAL_X][k] = vertices[k].normal.x * inverseW[k];
+        values[PLANE_NORMAL_Y][k] = vertices[k].normal.y * inverseW[k];
+        values[PLANE_NORMAL_Z][k] = vertices[k].normal.z * inverseW[k];
+    }
+    const float inverseArea = 1.0f / area;
+    for (int plane = 0; plane < PLANE_COUNT; ++plane) {
+        for (int coefficient = 0; coefficient < 3; ++coefficient) {
+            triangle.planes[plane][coefficient] = (values[plane][0] * triangle.edges[0][coefficient] +
+                                                   values[plane][1] * triangle.edges[1][coefficient] +
+                                                   values[plane][2] * triangle.edges[2][coefficient]) * inverseArea;
+        }
+    }
+    triangle.color = color;
+    triangle.lit = lit;
+
+    uint32_t index = static_cast<uint32_t>(batch.triangles.size());
+    batch.triangles.push_back(triangle);
+    for (int tileY = triangle.minY / TILE_SIZE; tileY <= triangle.maxY / TILE_SIZE; ++tileY) {
+        for (int tileX = triangle.minX / TILE_SIZE; tileX <= triangle.maxX / TILE_SIZE; ++tileX) {
+            batch.binTiles.push_back(static_cast<uint32_t>(tileY * _tilesX + tileX));
+            batch.binTriangles.push_back(index);
+        }
+    }
+}
+
+void SoftwareRasterizer::RasterizeTile(size_t tile)
+{
+    const int minX = static_cast<int>(tile % _tilesX) * TILE_SIZE;
+    const int minY = static_cast<int>(tile / _tilesX) * TILE_SIZE;
+    const int maxX = std::min(minX + TILE_SIZE, _width) - 1;
+    const int maxY = std::min(minY + TILE_SIZE, _height) - 1;
+
+    // Clear, including the depth padding the last span of a row reads.
+    const int depthEnd = std::min(minX + TILE_SIZE, _stride);
+    const uint8_t clear[3] = { ToUnorm8(_clearColor.x), ToUnorm8(_clearColor.y), ToUnorm8(_clearColor.z) };
+    for (int y = minY; y <= maxY; ++y) {
+        std::fill(&_depth[static_cast<size_t>(y) * _stride + minX], &_depth[static_cast<size_t>(y) * _stride + depthEnd], 1.0f);
+        uint8_t* row = &_color[(static_cast<size_t>(y) * _width + minX) * 3];
+        for (int x = minX; x <= maxX; ++x, row += 3) {
+            row[0] = clear[0];
+            row[1] = clear[1];
+            row[2] = clear[2];
+        }
+    }
+
+    std::vector<uint32_t> tileLights;
+    for (size_t i = 0; i < _lights.size(); ++i) {
+        const Light& light = _lights[i];
+        if (light.minX <= maxX && light.maxX >= minX && light.minY <= maxY && light.maxY >= minY) {
+            tileLights.push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    size_t fragments = 0;
+    for (uint32_t i = _tileOffsets[tile]; i < _tileOffsets[tile + 1]; ++i) {
+        RasterizeTriangle(*_tileTriangles[i], minX, minY, maxX, maxY, tileLights, fragments);
+    }
+
+    _tileFragments[tile] = fragments;
+}
+
+void SoftwareRasterizer::RasterizeTriangle(const Triangle& triangle, int tileMinX, int tileMinY, int tileMaxX,
+                                           int tileMaxY, const std::vector<uint32_t>& tileLights, size_t& fragments)
+{
+    const int firstX = std::max(triangle.minX, tileMinX);
+    const int lastX = std::min(triangle.maxX, tileMaxX);
+    const int firstY = std::max(triangle.minY, tileMinY);
+    const int lastY = std::min(triangle.maxY, tileMaxY);
+    if (firstX > lastX || firstY > lastY) {
+        return;
+    }
+
+    // Spans start on multiples of SPAN_WIDTH, so the depth rows load whole spans.
+    const int spanStart = firstX / SPAN_WIDTH * SPAN_WIDTH;
+
+    const Float8 zero = Float8::Zero();
+    const Float8 one = Float8::Set1(1.0f);
+    const Float8 two = Float8::Set1(2.0f);
+    const Float8 laneOffsets = Float8::Load(LANE_OFFSETS);
+    Float8 edgeA[3];
+    for (int k = 0; k < 3; ++k) {
+        edgeA[k] = Float8::Set1(triangle.edges[k][0]);
+    }
+    Float8 planeA[PLANE_COUNT];
+    for (int plane = 0; plane < PLANE_COUNT; ++plane) {
+        planeA[plane] = Float8::Set1(triangle.planes[plane][0]);
+    }
+    const Float8 viewX = Float8::Set1(_viewPos.x), viewY = Float8::Set1(_viewPos.y), viewZ = Float8::Set1(_viewPos.z);
+    const Float8 specularStrength = Float8::Set1(_specularStrength);
+
+    float depths[SPAN_WIDTH], red[SPAN_WIDTH], green[SPAN_WIDTH], blue[SPAN_WIDTH];
+
+    for (int y = firstY; y <= lastY; ++y) {
+        // The b*y + c part of every plane is the same along the row.
+        const float centreY = y + 0.5f;
+        Float8 edgeRow[3];
+        for (int k = 0; k < 3; ++k) {
+            edgeRow[k] = Float8::Set1(triangle.edges[k][1] * centreY + triangle.edges[k][2]);
+        }
+        Float8 planeRow[PLANE_COUNT];
+        for (int plane = 0; plane < PLANE_COUNT; ++plane) {
+            planeRow[plane] = Float8::Set1(triangle.planes[plane][1] * centreY + triangle.planes[plane][2]);
+        }
+        float* depthRow = &_depth[static_cast<size_t>(y) * _stride];
+        uint8_t* colorRow = &_color[static_cast<size_t>(y) * _width * 3];
+
+        for (int spanX = spanStart; spanX <= lastX; spanX += SPAN_WIDTH) {
+            // Lanes inside the triangle's bounds and the tile.
+            int first = std::max(firstX - spanX, 0);
+            int last = std::min(lastX - spanX, SPAN_WIDTH - 1);
+            int mask = ((2 << last) - 1) & ~((1 << first) - 1);
+
+            Float8 centreX = Float8::Set1(static_cast<float>(spanX)) + laneOffsets;
+            for (int k = 0; k < 3 && mask != 0; ++k) {
+                mask &= GreaterEqualMask(edgeA[k] * centreX + edgeRow[k], zero);
+            }
+            if (mask == 0) {
+                continue;
+            }
+
+            // Depth test: less than what is there.
+            Float8 depth = planeA[PLANE_DEPTH] * centreX + planeRow[PLANE_DEPTH];
+            mask &= ~GreaterEqualMask(depth, Float8::Load(depthRow + spanX));
+            if (mask == 0) {
+                continue;
+            }
+            depth.Store(depths);
+
+            if (triangle.lit) {
+                // Undo the division by w to get the world position and normal at each centre.
+                Float8 w = one / (planeA[PLANE_INVERSE_W] * centreX + planeRow[PLANE_INVERSE_W]);
+                Float8 fragX = (planeA[PLANE_POSITION_X] * centreX + planeRow[PLANE_POSITION_X]) * w;
+                Float8 fragY = (planeA[PLANE_POSITION_Y] * centreX + planeRow[PLANE_POSITION_Y]) * w;
+                Float8 fragZ = (planeA[PLANE_POSITION_Z] * centreX + planeRow[PLANE_POSITION_Z]) * w;
+                Float8 normX = (planeA[PLANE_NORMAL_X] * centreX + planeRow[PLANE_NORMAL_X]) * w;
+                Float8 normY = (planeA[PLANE_NORMAL_Y] * centreX + planeRow[PLANE_NORMAL_Y]) * w;
+                Float8 normZ = (planeA[PLANE_NORMAL_Z] * centreX + planeRow[PLANE_NORMAL_Z]) * w;
+                Float8 inverseLength = one / Sqrt(normX * normX + normY * normY + normZ * normZ);
+                normX = normX * inverseLength;
+                normY = normY * inverseLength;
+                normZ = normZ * inverseLength;
+
+                Float8 viewDirX = viewX - fragX, viewDirY = viewY - fragY, viewDirZ = viewZ - fragZ;
+                inverseLength = one / Sqrt(viewDirX * viewDirX + viewDirY * viewDirY + viewDirZ * viewDirZ);
+                viewDirX = viewDirX * inverseLength;
+                viewDirY = viewDirY * inverseLength;
+                viewDirZ = viewDirZ * inverseLength;
+
+                // cube.fs, one light at a time, every lane at once.
+                Float8 lightR = Float8::Set1(_ambientColor.x);
+                Float8 lightG = Float8::Set1(_ambientColor.y);
+                Float8 lightB = Float8::Set1(_ambientColor.z);
+                for (size_t i = 0; i < tileLights.size(); ++i) {
+                    const Light& light = _lights[tileLights[i]];
+                    Float8 toLightX = Float8::Set1(light.position.x) - fragX;
+                    Float8 toLightY = Float8::Set1(light.position.y) - fragY;
+                    Float8 toLightZ = Float8::Set1(light.position.z) - fragZ;
+                    Float8 distance = Max(Sqrt(toLightX * toLightX + toLightY * toLightY + toLightZ * toLightZ),
+                                          Float8::Set1(1e-6f));
+
+                    // Zero at the radius and beyond.
+                    Float8 ratio = distance * Float8::Set1(light.inverseRadius);
+                    Float8 ratioSquared = ratio * ratio;
+                    Float8 falloff = Max(one - ratioSquared * ratioSquared, zero);
+                    falloff = falloff * falloff;
+
+                    Float8 inverseDistance = one / distance;
+                    Float8 lightDirX = toLightX * inverseDistance;
+                    Float8 lightDirY = toLightY * inverseDistance;
+                    Float8 lightDirZ = toLightZ * inverseDistance;
+                    Float8 normalDotLight = normX * lightDirX + normY * lightDirY + normZ * lightDirZ;
+                    Float8 diffuse = Max(normalDotLight, zero);
+
+                    // reflect(-lightDir, norm), then the power of 32 as five squarings.
+                    Float8 twiceDot = two * normalDotLight;
+                    Float8 reflectX = twiceDot * normX - lightDirX;
+                    Float8 reflectY = twiceDot * normY - lightDirY;
+                    Float8 reflectZ = twiceDot * normZ - lightDirZ;
+                    Float8 specular = Max(viewDirX * reflectX + viewDirY * reflectY + viewDirZ * reflectZ, zero);
+                    specular = specular * specular;
+                    specular = specular * specular;
+                    specular = specular * specular;
+                    specular = specular * specular;
+                    specular = specular * specular;
+
+                    Float8 amount = (diffuse + specularStrength * specular) * falloff;
+                    lightR = lightR + amount * Float8::Set1(light.color.x);
+                    lightG = lightG + amount * Float8::Set1(light.color.y);
+                    lightB = lightB + amount * Float8::Set1(light.color.z);
+                }
+                (lightR * Float8::Set1(triangle.color.x)).Store(red);
+                (lightG * Float8::Set1(triangle.color.y)).Store(green);
+                (lightB * Float8::Set1(triangle.color.z)).Store(blue);
+            }
+            else {
+                Float8::Set1(triangle.color.x).Store(red);
+                Float8::Set1(triangle.color.y).Store(green);
+                Float8::Set1(triangle.color.z).Store(blue);
+            }
+
+            for (int lane = 0; lane < SPAN_WIDTH; ++lane) {
+                if ((mask & (1 << lane)) != 0) {
+                    depthRow[spanX + lane] = depths[lane];
+                    uint8_t* pixel = colorRow + (spanX + lane) * 3;
+                    pixel[0] = ToUnorm8(red[lane]);
+                    pixel[1] = ToUnorm8(green[lane]);
+                    pixel[2] = ToUnorm8(blue[lane]);
+                }
+            }
+            fragments += CountBits(mask);
+        }
+    }
+}
+
+uint64_t SoftwareRasterizer::Checksum() const
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < _color.size(); ++i) {
+        hash = (hash ^ _color[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+bool SoftwareRasterizer::WritePpm(const std::string& path) const
+{
+    std::ofstream file(path.c_str(), std::ios::binary);
+    file << "P6\n" << _width << " " << _height << "\n255\n";
+    for (int y = _height - 1; y >= 0; --y) {
+        file.write(reinterpret_cast<const char*>(&_color[static_cast<size_t>(y) * _width * 3]), _width * 3);
+    }
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+
+#include "LightGrid.h"
+#include "MeshBuilder.h"
+
+class ThreadPool;
+
+// Renders the demo's scene on the CPU, for machines without a GPU: a reference image that is the
+// same bit for bit on every run and every thread count, and a measure of what the scene costs
+// without one.
+//
+// It draws what Render() draws with forward shading: the lit cubes with cube.fs's Phong model
+// (ambient, then for every point light a diffuse and a specular term with the same falloff) and
+// the unlit lamps of lamp.vs. There are no shadows and no sun.
+//
+// A frame runs in three phases, the first and last spread over the thread pool:
+// 1. Geometry: instances are split into fixed batches. Each batch transforms its vertices, drops
+//    triangles facing away from the camera or outside the frustum, clips the rest against the
+//    near plane (and a guard band well outside the screen, to keep window coordinates small),
+//    sets up their edge functions and the screen-space planes of their depth and
+//    perspective-divided attributes, and lists the TILE_SIZE x TILE_SIZE screen tiles their
+//    bounds touch.
+// 2. Binning: the lists are gathered into one list of triangles per tile, in batch order.
+// 3. Rasterization: threads take tiles one at a time. A tile is cleared, picks the lights whose
+//    spheres can reach it, then walks its triangles in 8 x 1 pixel spans: the edge functions,
+//    the depth test and the shading run in Float8 lanes, and only covered, visible lanes are
+//    written. Tiles don't share pixels, so no locks are needed, and every tile sees its
+//    triangles in submission order, so the result doesn't depend on the thread count.
+//
+// Pixel centres are at half-integer window coordinates, as in GL; a pixel exactly on an edge
+// belongs to both triangles, which the depth test makes harmless for the opaque scene. The
+// buffers are bottom row first, like glReadPixels.
+class SoftwareRasterizer final
+{
+public:
+    static const int TILE_SIZE = 64;
+    static const int SPAN_WIDTH = 8;        // pixels per Float8
+
+    struct Statistics
+    {
+        size_t triangles;           // submitted
+        size_t trianglesSetUp;      // left after culling and near-plane clipping
+        size_t binEntries;          // triangle-tile pairs
+        size_t fragmentsShaded;     // covered pixels that passed the depth test
+        double geometryMilliseconds;
+        double binningMilliseconds;
+        double rasterMilliseconds;
+    };
+
+    // threadPool, if given, runs the geometry and rasterization phases on its threads and the
+    // calling one; otherwise everything runs on the calling thread.
+    SoftwareRasterizer(int width, int height, ThreadPool* threadPool = nullptr);
+
+    SoftwareRasterizer(const SoftwareRasterizer& rhs) = delete;
+    SoftwareRasterizer& operator=(const SoftwareRasterizer& rhs) = delete;
+
+    // Starts a frame with the camera and lights of Render(). The lights' intensity and falloff
+    // are as in LightGrid; the specular exponent is cube.fs's 32.
+    void BeginFrame(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos,
+                    const glm::vec3& clearColor, const glm::vec3& ambientColor, float specularStrength,
+                    const PointLight* lights, size_t lightCount);
+
+    // Queues count instances of mesh, lit, in color. The matrices must stay valid until
+    // EndFrame().
+    void DrawLit(const Mesh& mesh, const glm::mat4* models, const glm::mat3* normalMatrices, size_t count,
+                 const glm::vec3& color);
+
+    // Queues a lamp at every light of the frame: mesh scaled by 0.2, unlit, in the light's color.
+    // At most once per frame.
+    void DrawLamps(const Mesh& mesh);
+
+    // Renders everything queued since BeginFrame().
+    void EndFrame();
+
+    int GetWidth() const { return _width; }
+    int GetHeight() const { return _height; }
+
+    // RGB, 8 bits per channel, bottom row first.
+    const std::vector<uint8_t>& GetPixels() const { return _color; }
+
+    // FNV-1a of the pixels, to compare frames at a glance.
+    uint64_t Checksum() const;
+
+    // Writes the frame as a binary PPM, top row first.
+    bool WritePpm(const std::string& path) const;
+
+    const Statistics& GetStatistics() const { return _statistics; }
+
+private:
+    // Depth, 1/w, then world position and normal, each over w: the quantities interpolated
+    // across a triangle, as screen-space planes.
+    enum Plane
+    {
+        PLANE_DEPTH,
+        PLANE_INVERSE_W,
+        PLANE_POSITION_X,
+        PLANE_POSITION_Y,
+        PLANE_POSITION_Z,
+        PLANE_NORMAL_X,
+        PLANE_NORMAL_Y,
+        PLANE_NORMAL_Z,
+        PLANE_COUNT
+    };
+
+    struct Triangle
+    {
+        float edges[3][3];          // a, b, c of a*x + b*y + c, positive inside
+        float planes[PLANE_COUNT][3];
+        int minX, minY, maxX, maxY; // pixels whose centres the bounds cover, inclusive
+        glm::vec3 color;
+        bool lit;
+    };
+
+    struct Draw
+    {
+        const Mesh* mesh;
+        const glm::mat4* models;
+        const glm::mat3* normalMatrices;    // null for the lamps
+        const glm::vec3* colors;            // per instance, or null for color
+        size_t count;
+        glm::vec3 color;
+        bool lit;
+    };
+
+    // A vertex in clip space, with what the lit shading needs in world space.
+    struct ClipVertex
+    {
+        glm::vec4 clip;
+        glm::vec3 position;
+        glm::vec3 normal;
+    };
+
+    // A run of instances of one draw, set up by one thread.
+    struct Batch
+    {
+        size_t draw;
+        size_t first, count;
+        std::vector<ClipVertex> vertices;   // of the instance being set up
+        std::vector<Triangle> triangles;
+        std::vector<uint32_t> binTiles;     // per entry: the tile
+        std::vector<uint32_t> binTriangles; // per entry: the triangle in triangles
+    };
+
+    // A light with its falloff and color folded in, and the pixels its sphere can reach.
+    struct Light
+    {
+        glm::vec3 position;
+        float inverseRadius;
+        glm::vec3 color;                    // times the intensity
+        int minX, minY, maxX, maxY;
+    };
+
+    void SetUpBatch(Batch& batch);
+    void SetUpTriangle(Batch& batch, const ClipVertex* vertices, const glm::vec3& color, bool lit);
+    void RasterizeTile(size_t tile);
+    void RasterizeTriangle(const Triangle& triangle, int tileMinX, int tileMinY, int tileMaxX, int tileMaxY,
+                           const std::vector<uint32_t>& tileLights, size_t& fragments);
+
+    // Runs body(index) for every index below count, spread over the pool, taking indices in
+    // order as threads come free.
+    template <typename Body>
+    void ForEach(size_t count, const Body& body);
+
+    int _width, _height;
+    int _stride;                    // depth buffer row length, padded to whole spans
+    int _tilesX, _tilesY;
+    ThreadPool* _threadPool;
+
+    std::vector<float> _depth;
+    std::vector<uint8_t> _color;
+
+    glm::mat4 _viewProjection;
+    glm::vec3 _viewPos;
+    glm::vec3 _clearColor;
+    glm::vec3 _ambientColor;
+    float _specularStrength;
+    std::vector<Light> _lights;
+    std::vector<glm::mat4> _lampModels;
+    std::vector<glm::vec3> _lampColors;
+
+    std::vector<Draw> _draws;
+    std::vector<Batch> _batches;
+    std::vector<uint32_t> _tileOffsets;     // per tile, the start of its run in _tileTriangles
+    std::vector<const Triangle*> _tileTriangles;
+    std::vector<size_t> _tileFragments;     // per tile, fragments shaded
+
+    Statistics _statistics;
+};
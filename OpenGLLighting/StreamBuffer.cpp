@@ -0,0 +1,143 @@
+#include "StreamBuffer.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+StreamBuffer::StreamBuffer(size_t frameSize) :
+        _buffer(0),
+        _frameSize(frameSize),
+        _uniformAlignment(256),
+        _isPersistent(false),
+        _persistentData(nullptr),
+        _frameData(nullptr),
+        _frameIndex(FRAMES_IN_FLIGHT - 1),
+        _frameOffset(0),
+        _flushedOffset(0)
+{
+    for (unsigned int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+        _fences[i] = nullptr;
+    }
+    ResetStatistics();
+
+    GLint uniformAlignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    if (uniformAlignment > 0) {
+        _uniformAlignment = uniformAlignment;
+    }
+
+    // Round the regions up so that every region starts on an aligned offset.
+    _frameSize = (_frameSize + _uniformAlignment - 1) / _uniformAlignment * _uniformAlignment;
+    GLsizeiptr totalSize = static_cast<GLsizeiptr>(_frameSize * FRAMES_IN_FLIGHT);
+
+    glGenBuffers(1, &_buffer);
+    GLStateCache::BindBuffer(GL_COPY_WRITE_BUFFER, _buffer);
+
+    if (GLEW_ARB_buffer_storage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, totalSize, nullptr, flags);
+        _persistentData = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, totalSize, flags));
+        _isPersistent = _persistentData != nullptr;
+    }
+    if (!_isPersistent) {
+        glBufferData(GL_COPY_WRITE_BUFFER, totalSize, nullptr, GL_STREAM_DRAW);
+        _shadow.resize(_frameSize);
+    }
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    for (unsigned int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+        glDeleteSync(_fences[i]);
+    }
+
+    if (_isPersistent) {
+        GLStateCache::BindBuffer(GL_COPY_WRITE_BUFFER, _buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    }
+    GLStateCache::DeleteBuffer(_buffer);
+}
+
+void StreamBuffer::BeginFrame()
+{
+    _frameIndex = (_frameIndex + 1) % FRAMES_IN_FLIGHT;
+    _frameOffset = 0;
+    _flushedOffset = 0;
+    ++_statistics.frames;
+
+    // Wait for the GPU to finish the frame that last used this region. The first check doesn't
+    // flush or block; only if it fails do we count a stall and wait for real.
+    GLsync& fence = _fences[_frameIndex];
+    if (fence != nullptr) {
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+            }
+            ++_statistics.stalls;
+            _statistics.stallMilliseconds +=
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    _frameData = _isPersistent ? _persistentData + _frameIndex * _frameSize : &_shadow[0];
+}
+
+StreamBuffer::Allocation StreamBuffer::Allocate(size_t size, size_t alignment)
+{
+    Allocation allocation = { nullptr, 0 };
+
+    size_t offset = (_frameOffset + alignment - 1) & ~(alignment - 1);
+    if (_frameData == nullptr || offset + size > _frameSize) {
+        ++_statistics.overflows;
+        return allocation;
+    }
+
+    _frameOffset = offset + size;
+    _statistics.bytesStreamed += size;
+
+    allocation.data = _frameData + offset;
+    allocation.offset = static_cast<GLintptr>(_frameIndex * _frameSize + offset);
+    return allocation;
+}
+
+void StreamBuffer::Flush()
+{
+    if (_isPersistent || _flushedOffset == _frameOffset) {
+        return;
+    }
+
+    // The fence already guarantees the GPU is done with this part of the region, so skip the
+    // driver's own synchronization.
+    GLintptr offset = static_cast<GLintptr>(_frameIndex * _frameSize + _flushedOffset);
+    GLsizeiptr size = static_cast<GLsizeiptr>(_frameOffset - _flushedOffset);
+
+    // The copy target is left bound; the state cache skips rebinding it on the next flush.
+    GLStateCache::BindBuffer(GL_COPY_WRITE_BUFFER, _buffer);
+    void* destination = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size,
+                                         GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    if (destination != nullptr) {
+        std::memcpy(destination, &_shadow[_flushedOffset], size);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    }
+
+    _flushedOffset = _frameOffset;
+}
+
+void StreamBuffer::EndFrame()
+{
+    Flush();
+    _frameData = nullptr;
+
+    _fences[_frameIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void StreamBuffer::ResetStatistics()
+{
+    _statistics.bytesStreamed = 0;
+    _statistics.frames = 0;
+    _statistics.stalls = 0;
+    _statistics.stallMilliseconds = 0.0;
+    _statistics.overflows = 0;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+#include "GLStateCache.h"
+
+// A ring buffer for data written by the CPU every frame (uniform blocks, per-object and per-instance
+// data, dynamic vertices). The buffer is split into one region per frame in flight. Allocate()
+// hands out aligned ranges of the current frame's region. The region is reused three frames
+// later, once the fence placed by EndFrame() has signalled, so the CPU never writes memory the
+// GPU is still reading and never allocates anything per frame.
+//
+// With GL_ARB_buffer_storage (GL 4.4) the buffer is mapped once, persistently and coherently, and
+// writes are visible to the GPU immediately. Without it (macOS stops at GL 4.1) a buffer can't be
+// read by draws while it is mapped, so allocations come from a CPU-side copy of the region and
+// Flush() copies the newly written bytes with an unsynchronized map; the fences still provide the
+// synchronization.
+class StreamBuffer final
+{
+public:
+    static const unsigned int FRAMES_IN_FLIGHT = 3;
+
+    // A range of the buffer for the current frame.
+    struct Allocation
+    {
+        void* data;         // where the CPU writes; nullptr if the region is exhausted
+        GLintptr offset;    // byte offset for glBindBufferRange, glVertexAttribPointer, etc.
+    };
+
+    // Counters since the last ResetStatistics().
+    struct Statistics
+    {
+        uint64_t bytesStreamed;     // bytes handed out by Allocate()
+        unsigned int frames;
+        unsigned int stalls;        // frames where the CPU had to wait for the GPU
+        double stallMilliseconds;
+        unsigned int overflows;     // allocations that didn't fit in a region
+    };
+
+    // frameSize is the capacity of each region in bytes.
+    explicit StreamBuffer(size_t frameSize);
+
+    StreamBuffer(const StreamBuffer& rhs) = delete;
+    StreamBuffer& operator=(const StreamBuffer& rhs) = delete;
+
+    ~StreamBuffer();
+
+    GLuint GetBufferHandle() const { return _buffer; }
+    size_t GetFrameSize() const { return _frameSize; }
+
+    // Waits (if needed) until the GPU is done with the next region and makes it current.
+    void BeginFrame();
+
+    // Returns size bytes aligned to alignment (a power of two). Allocations don't survive the frame.
+    Allocation Allocate(size_t size, size_t alignment = 16);
+
+    // Convenience for a single uniform block: copies value into the frame and binds the range.
+    template <typename T>
+    GLintptr BindUniformBlock(GLuint bindingPoint, const T& value)
+    {
+        Allocation allocation = Allocate(sizeof(T), _uniformAlignment);
+        if (allocation.data == nullptr) {
+            return -1;
+        }
+        *static_cast<T*>(allocation.data) = value;
+        Flush();
+        GLStateCache::BindBufferRange(GL_UNIFORM_BUFFER, bindingPoint, _buffer, allocation.offset, sizeof(T));
+        return allocation.offset;
+    }
+
+    // Makes everything allocated so far visible to the GPU. Call before the draws that read it.
+    // Free with a persistent mapping.
+    void Flush();
+
+    // Fences the current region. Call after the frame's last draw that reads from it.
+    void EndFrame();
+
+    size_t GetUniformAlignment() const { return _uniformAlignment; }
+
+    const Statistics& GetStatistics() const { return _statistics; }
+    void ResetStatistics();
+
+private:
+    GLuint _buffer;
+    size_t _frameSize;
+    size_t _uniformAlignment;   // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    bool _isPersistent;         // mapped once with GL_MAP_PERSISTENT_BIT
+
+    unsigned char* _persistentData;     // the whole buffer when persistent
+    std::vector<unsigned char> _shadow; // CPU copy of one region when not persistent
+    unsigned char* _frameData;          // where the current region is written
+    unsigned int _frameIndex;
+    size_t _frameOffset;                // next free byte in the current region
+    size_t _flushedOffset;              // bytes of the region already copied to the GPU
+    GLsync _fences[FRAMES_IN_FLIGHT];
+
+    Statistics _statistics;
+};
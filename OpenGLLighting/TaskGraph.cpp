@@ -0,0 +1,85 @@
+#include "TaskGraph.h"
+
+#include "ThreadPool.h"
+
+TaskGraph::TaskGraph() :
+        _threadPool(nullptr),
+        _running(false),
+        _unfinished(0),
+        _finished(true)
+{
+    _statistics.milliseconds = 0.0;
+}
+
+TaskGraph::TaskId TaskGraph::Add(const char* name, std::function<void()> task, const std::vector<TaskId>& dependencies)
+{
+    TaskId id = _tasks.size();
+    std::unique_ptr<Task> entry(new Task());
+    entry->name = name;
+    entry->body = std::move(task);
+    entry->dependencyCount = dependencies.size();
+    entry->waitingFor = 0;
+    for (TaskId dependency : dependencies) {
+        _tasks[dependency]->dependents.push_back(id);
+    }
+    _tasks.push_back(std::move(entry));
+    _statistics.taskMilliseconds.push_back(0.0);
+    return id;
+}
+
+void TaskGraph::Run(ThreadPool& threadPool)
+{
+    _threadPool = &threadPool;
+    _running = true;
+    _start = Clock::now();
+    if (_tasks.empty()) {
+        _statistics.milliseconds = 0.0;
+        return;
+    }
+
+    // Every count is set before the first task can finish and decrement one.
+    for (const std::unique_ptr<Task>& task : _tasks) {
+        task->waitingFor = task->dependencyCount;
+    }
+    _unfinished = _tasks.size();
+    _finished = false;
+    for (TaskId task = 0; task < _tasks.size(); ++task) {
+        if (_tasks[task]->dependencyCount == 0) {
+            _threadPool->Enqueue([this, task]() { Execute(task); });
+        }
+    }
+}
+
+void TaskGraph::Wait()
+{
+    if (!_running) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(_mutex);
+    _allFinished.wait(lock, [this]() { return _finished; });
+    _running = false;
+}
+
+void TaskGraph::Execute(TaskId id)
+{
+    Task& task = *_tasks[id];
+    Clock::time_point start = Clock::now();
+    task.body();
+    Clock::time_point end = Clock::now();
+    _statistics.taskMilliseconds[id] = std::chrono::duration<double, std::milli>(end - start).count();
+
+    for (TaskId dependent : task.dependents) {
+        if (--_tasks[dependent]->waitingFor == 0) {
+            _threadPool->Enqueue([this, dependent]() { Execute(dependent); });
+        }
+    }
+
+    // The waiter can't return, and the graph can't be run again, until the lock is released; the
+    // task touches nothing after that.
+    if (--_unfinished == 0) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _statistics.milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - _start).count();
+        _finished = true;
+        _allFinished.notify_all();
+    }
+}
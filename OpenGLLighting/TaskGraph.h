@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class ThreadPool;
+
+// Tasks and the order they have to run in, built once and run on a ThreadPool as often as needed:
+// FramePipeline runs the same graph every frame.
+//
+// Each task is added with the tasks it depends on, which must already be in the graph, so there
+// can be no cycles. Run() queues the tasks that depend on nothing. When a task finishes, each of
+// its dependents whose last dependency that was is queued from the worker that ran it, so it goes
+// on that worker's own deque: a chain of tasks tends to stay on one core, with its data in that
+// core's cache, while independent branches are stolen by the idle workers. A task may use the
+// pool itself, for a ParallelFor() over its objects.
+//
+// A graph runs once at a time: Run() again only after Wait().
+class TaskGraph final
+{
+public:
+    typedef size_t TaskId;
+
+    // For the last run.
+    struct Statistics
+    {
+        double milliseconds;                    // from Run() to the last task finishing
+        std::vector<double> taskMilliseconds;   // by task id
+    };
+
+    TaskGraph();
+
+    TaskGraph(const TaskGraph& rhs) = delete;
+    TaskGraph& operator=(const TaskGraph& rhs) = delete;
+
+    // Adds task, to run after every task in dependencies. name labels it in reports and must
+    // outlive the graph.
+    TaskId Add(const char* name, std::function<void()> task, const std::vector<TaskId>& dependencies = {});
+
+    size_t Size() const { return _tasks.size(); }
+    const char* GetName(TaskId task) const { return _tasks[task]->name; }
+
+    // Starts running every task on threadPool and returns at once.
+    void Run(ThreadPool& threadPool);
+
+    // Blocks until every task of the run has finished. Not from a task of the pool running it.
+    void Wait();
+
+    // From Run() to the Wait() after it.
+    bool IsRunning() const { return _running; }
+
+    // Valid after Wait().
+    const Statistics& GetStatistics() const { return _statistics; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Task
+    {
+        const char* name;
+        std::function<void()> body;
+        size_t dependencyCount;
+        std::vector<TaskId> dependents;
+        std::atomic<size_t> waitingFor;     // dependencies unfinished in this run
+    };
+
+    // Runs a task, then queues the dependents it was the last dependency of.
+    void Execute(TaskId task);
+
+    std::vector<std::unique_ptr<Task>> _tasks;
+    ThreadPool* _threadPool;
+    bool _running;
+
+    std::atomic<size_t> _unfinished;
+    Clock::time_point _start;
+    std::mutex _mutex;
+    std::condition_variable _allFinished;
+    bool _finished;     // guarded by _mutex; set once the last task no longer touches the graph
+
+    Statistics _statistics;
+};
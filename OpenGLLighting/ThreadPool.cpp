@@ -0,0 +1,173 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace {
+
+// The pool the current thread works for, and its index there; null on threads outside any pool.
+thread_local ThreadPool* currentPool = nullptr;
+thread_local size_t currentWorker = 0;
+
+}   // namespace
+
+ThreadPool::ThreadPool(unsigned int threadCount) :
+        _nextQueue(0),
+        _steals(0),
+        _queuedTasks(0),
+        _sleepingWorkers(0),
+        _stopping(false)
+{
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Every deque exists before any worker starts stealing from them.
+    for (unsigned int i = 0; i < threadCount; ++i) {
+        _queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+    }
+    _workers.reserve(threadCount);
+    for (unsigned int i = 0; i < threadCount; ++i) {
+        _workers.push_back(std::thread(&ThreadPool::WorkerLoop, this, static_cast<size_t>(i)));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _taskAvailable.notify_all();
+
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        _workers[i].join();
+    }
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t begin, size_t end)>& body)
+{
+    if (count == 0) {
+        return;
+    }
+
+    size_t rangeCount = std::min<size_t>(count, _workers.size() + 1);
+    size_t rangeSize = (count + rangeCount - 1) / rangeCount;
+    rangeCount = (count + rangeSize - 1) / rangeSize;
+
+    // The caller and the helpers all claim ranges from the same counter, and the caller waits for
+    // the ranges to be finished rather than for the helpers to run. When this is called from a
+    // task and every worker is busy, the caller ends up running all the ranges itself instead of
+    // waiting for workers that never come; a helper that starts after the last range was claimed
+    // returns without touching body. The first exception body throws, on whichever thread, is
+    // rethrown here once every range has finished.
+    struct Ranges
+    {
+        std::atomic<size_t> next;
+        std::atomic<size_t> finished;
+        std::mutex mutex;
+        std::condition_variable allFinished;
+        std::exception_ptr error;       // guarded by mutex
+    };
+    std::shared_ptr<Ranges> ranges = std::make_shared<Ranges>();
+    ranges->next = 0;
+    ranges->finished = 0;
+
+    const std::function<void(size_t begin, size_t end)>* bodyPointer = &body;
+    std::function<void()> runRanges = [ranges, bodyPointer, rangeCount, rangeSize, count]() {
+        for (size_t range = ranges->next++; range < rangeCount; range = ranges->next++) {
+            try {
+                (*bodyPointer)(range * rangeSize, std::min(range * rangeSize + rangeSize, count));
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(ranges->mutex);
+                if (!ranges->error) {
+                    ranges->error = std::current_exception();
+                }
+            }
+            if (++ranges->finished == rangeCount) {
+                std::lock_guard<std::mutex> lock(ranges->mutex);
+                ranges->allFinished.notify_all();
+            }
+        }
+    };
+
+    for (size_t helper = 1; helper < rangeCount; ++helper) {
+        Enqueue(runRanges);
+    }
+    runRanges();
+
+    std::unique_lock<std::mutex> lock(ranges->mutex);
+    ranges->allFinished.wait(lock, [&ranges, rangeCount]() { return ranges->finished == rangeCount; });
+    if (ranges->error) {
+        std::rethrow_exception(ranges->error);
+    }
+}
+
+void ThreadPool::Enqueue(std::function<void()> task)
+{
+    // A worker keeps its own tasks; anyone else's are spread over the deques. The task is counted
+    // before it's pushed, so the count never drops below the tasks in the deques.
+    size_t index = currentPool == this ? currentWorker : _nextQueue++ % _queues.size();
+    ++_queuedTasks;
+    {
+        std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+        _queues[index]->tasks.push_back(std::move(task));
+    }
+
+    // A worker counts itself asleep before it checks the task count, and the task was counted
+    // before this check, so either the worker sees the task or this sees the worker. Notifying
+    // under the lock means the worker is either still awake or already waiting.
+    if (_sleepingWorkers > 0) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _taskAvailable.notify_one();
+    }
+}
+
+bool ThreadPool::TakeTask(size_t index, std::function<void()>& task)
+{
+    {
+        WorkerQueue& own = *_queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t offset = 1; offset < _queues.size(); ++offset) {
+        WorkerQueue& victim = *_queues[(index + offset) % _queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            ++_steals;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::WorkerLoop(size_t index)
+{
+    currentPool = this;
+    currentWorker = index;
+
+    for (;;) {
+        std::function<void()> task;
+        if (TakeTask(index, task)) {
+            --_queuedTasks;
+            task();
+            continue;
+        }
+
+        // A task counted but not pushed yet, or taken but not uncounted yet, only costs another
+        // look round the deques.
+        std::unique_lock<std::mutex> lock(_mutex);
+        ++_sleepingWorkers;
+        _taskAvailable.wait(lock, [this]() { return _stopping || _queuedTasks > 0; });
+        --_sleepingWorkers;
+        if (_queuedTasks == 0) {
+            return;     // stopping and drained
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed-size pool of worker threads that share their work by stealing it.
+//
+// Every worker has a deque of its own. A task queued by a worker, like the ranges of a
+// ParallelFor() inside a task or the tasks a finished TaskGraph task releases, goes on the back of
+// that worker's deque, and the worker takes its next task from the back: the newest, whose data is
+// most likely still in its cache. A worker with an empty deque steals from the front of the others',
+// taking the oldest task, which is usually the biggest piece of work left, and only sleeps when
+// every deque is empty. Tasks queued from other threads are dealt round the deques in turn.
+//
+// Each deque has its own lock, held only to push or pop, so workers running their own tasks never
+// contend. The count of queued tasks is atomic; the one lock they share is only taken by a worker
+// going to sleep and by a thread queueing a task while one is asleep.
+class ThreadPool final
+{
+public:
+    // threadCount 0 means one thread per hardware thread.
+    explicit ThreadPool(unsigned int threadCount = 0);
+
+    ThreadPool(const ThreadPool& rhs) = delete;
+    ThreadPool& operator=(const ThreadPool& rhs) = delete;
+
+    // Finishes the queued tasks, then joins the workers.
+    ~ThreadPool();
+
+    unsigned int ThreadCount() const { return static_cast<unsigned int>(_workers.size()); }
+
+    // Queues task and returns a future for its result.
+    template <typename F>
+    std::future<typename std::result_of<F()>::type> Submit(F task)
+    {
+        typedef typename std::result_of<F()>::type Result;
+        std::shared_ptr<std::packaged_task<Result()>> packagedTask =
+                std::make_shared<std::packaged_task<Result()>>(task);
+        std::future<Result> result = packagedTask->get_future();
+        Enqueue([packagedTask]() { (*packagedTask)(); });
+        return result;
+    }
+
+    // Queues task with no result to wait for; see TaskGraph.
+    void Enqueue(std::function<void()> task);
+
+    // Splits [0, count) into roughly equal ranges, runs body(begin, end) on each in parallel and
+    // waits for all of them. The calling thread runs ranges itself, so it may be a task of this
+    // pool. An exception thrown by body is rethrown here after the other ranges have finished.
+    void ParallelFor(size_t count, const std::function<void(size_t begin, size_t end)>& body);
+
+    // Tasks taken from another worker's deque since the pool started.
+    size_t Steals() const { return _steals; }
+
+private:
+    struct WorkerQueue
+    {
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+    };
+
+    void WorkerLoop(size_t index);
+
+    // Takes a task for worker index: its own newest, or failing that the oldest of another's.
+    bool TakeTask(size_t index, std::function<void()>& task);
+
+    std::vector<std::thread> _workers;
+    std::vector<std::unique_ptr<WorkerQueue>> _queues;     // one per worker
+    std::atomic<size_t> _nextQueue;         // where the next task from outside the pool goes
+    std::atomic<size_t> _steals;
+
+    std::atomic<size_t> _queuedTasks;       // in every deque
+    std::atomic<size_t> _sleepingWorkers;   // changed under _mutex
+
+    std::mutex _mutex;
+    std::condition_variable _taskAvailable;
+    bool _stopping;                         // guarded by _mutex
+};
@@ -0,0 +1,84 @@
+#include "Transform.h"
+
+#include <cstring>
+
+#include "Simd.h"
+
+namespace {
+
+// Cofactor matrices of four transforms at once. The upper 3x3 of each matrix is loaded column
+// by column and transposed so that each Float4 holds one component of one column for all four
+// transforms (structure of arrays); the cross products then run on four transforms per
+// instruction, and the results are transposed back. Lanes whose uniform flag is set take the
+// upper 3x3 of their model instead; uniform may be nullptr.
+void ComputeFourCofactors(const glm::mat4* models, const unsigned char* uniform, glm::mat3* normalMatrices)
+{
+    Float4 x[3], y[3], z[3];
+    for (int column = 0; column < 3; ++column) {
+        Float4 a = Float4::Load(&models[0][column][0]);
+        Float4 b = Float4::Load(&models[1][column][0]);
+        Float4 c = Float4::Load(&models[2][column][0]);
+        Float4 d = Float4::Load(&models[3][column][0]);
+        Transpose(a, b, c, d);
+        x[column] = a;
+        y[column] = b;
+        z[column] = c;
+    }
+
+    // n[i] = cross(c[i+1], c[i+2])
+    Float4 nx[3], ny[3], nz[3];
+    for (int column = 0; column < 3; ++column) {
+        int j = (column + 1) % 3;
+        int k = (column + 2) % 3;
+        nx[column] = y[j] * z[k] - z[j] * y[k];
+        ny[column] = z[j] * x[k] - x[j] * z[k];
+        nz[column] = x[j] * y[k] - y[j] * x[k];
+    }
+
+    Float4 determinant = x[0] * nx[0] + y[0] * ny[0] + z[0] * nz[0];
+
+    for (int column = 0; column < 3; ++column) {
+        Float4 a = FlipSign(nx[column], determinant);
+        Float4 b = FlipSign(ny[column], determinant);
+        Float4 c = FlipSign(nz[column], determinant);
+        Float4 d = Float4::Zero();
+        Transpose(a, b, c, d);
+
+        // Each result is a vec3; store through a temporary so the fourth lane can't run past the
+        // end of the matrix.
+        float lanes[4][4];
+        a.Store(lanes[0]);
+        b.Store(lanes[1]);
+        c.Store(lanes[2]);
+        d.Store(lanes[3]);
+        for (int i = 0; i < 4; ++i) {
+            const float* source = uniform != nullptr && uniform[i] ? &models[i][column][0] : lanes[i];
+            std::memcpy(&normalMatrices[i][column][0], source, 3 * sizeof(float));
+        }
+    }
+}
+
+}
+
+void ComputeNormalMatrices(const glm::mat4* models, const unsigned char* hasUniformScale,
+                           glm::mat3* normalMatrices, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        // The cross products are skipped when no lane needs them; a mixed group computes all four
+        // and keeps them for the lanes that aren't uniform.
+        const unsigned char* uniform = hasUniformScale != nullptr ? &hasUniformScale[i] : nullptr;
+        if (uniform != nullptr && uniform[0] && uniform[1] && uniform[2] && uniform[3]) {
+            for (size_t j = i; j < i + 4; ++j) {
+                normalMatrices[j] = NormalMatrix(models[j], true);
+            }
+        }
+        else {
+            ComputeFourCofactors(&models[i], uniform, &normalMatrices[i]);
+        }
+    }
+
+    for (; i < count; ++i) {
+        normalMatrices[i] = NormalMatrix(models[i], hasUniformScale != nullptr && hasUniformScale[i]);
+    }
+}
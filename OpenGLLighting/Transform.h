@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+
+// Normal matrices for lighting, computed on the CPU once per object instead of once per vertex.
+//
+// The exact normal matrix is transpose(inverse(mat3(model))). The shaders normalize the normal
+// after transforming it, so any positive multiple of it works just as well:
+// - for rotations, translations and uniform scales, mat3(model) itself is such a multiple, so no
+//   inverse is needed at all;
+// - otherwise the cofactor matrix, det(M) * transpose(inverse(M)), is three cross products. Its
+//   sign is corrected for mirroring transforms (det < 0) so normals keep pointing outwards.
+
+// Normal matrix for a single transform.
+inline glm::mat3 NormalMatrix(const glm::mat4& model, bool hasUniformScale = false)
+{
+    glm::vec3 c0(model[0]), c1(model[1]), c2(model[2]);
+    if (hasUniformScale) {
+        return glm::mat3(c0, c1, c2);
+    }
+
+    glm::mat3 cofactor(glm::cross(c1, c2), glm::cross(c2, c0), glm::cross(c0, c1));
+    return glm::dot(c0, cofactor[0]) < 0.0f ? cofactor * -1.0f : cofactor;
+}
+
+// Batch version for every object in a frame. hasUniformScale may be nullptr, in which case every
+// transform takes the general path. Four transforms are processed per SIMD iteration.
+void ComputeNormalMatrices(const glm::mat4* models, const unsigned char* hasUniformScale,
+                           glm::mat3* normalMatrices, size_t count);
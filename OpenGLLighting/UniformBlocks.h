@@ -0,0 +1,86 @@
+#pragma once
+
+// GLEW: OpenGL Extension Wrangler
+#include <GL/glew.h>
+
+// GLM: OpenGL Math
+#include <glm/glm.hpp>
+
+// C++ mirrors of the std140 uniform blocks declared in the shaders. Their contents are streamed
+// through the StreamBuffer: the per-frame blocks are written and bound once per frame, no matter
+// how many programs read them, and each material binds its own ObjectBlock range. Model matrices
+// are per-instance vertex attributes (see RenderQueue). Under std140 a vec3 takes the space of a
+// vec4, so vectors are stored as vec4 here and the shaders use .xyz.
+
+// Binding points shared by every program.
+enum UniformBlockBinding {
+    FRAME_BLOCK_BINDING = 0,
+    LIGHT_BLOCK_BINDING = 1,
+    OBJECT_BLOCK_BINDING = 2,
+    CULL_BLOCK_BINDING = 3,
+    DEFERRED_BLOCK_BINDING = 4,
+    SHADOW_BLOCK_BINDING = 5,
+    SHADOW_PASS_BLOCK_BINDING = 6
+};
+
+// Per-frame camera data: "FrameBlock" in cube.vs, cube.fs and lamp.vs.
+struct FrameBlock
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 viewPos;      // camera position, w unused
+};
+
+// How cube.fs finds a fragment's lights in the LightGrid: "LightBlock" in lighting.glsl. The lights
+// themselves are in buffer textures.
+struct LightBlock
+{
+    glm::vec4 ambientColor;     // w unused
+    glm::uvec4 clusterCounts;   // clusters along x, y and z, then the number of lights
+    glm::vec4 clusterScale;     // tiles per pixel along x and y, then the slice scale and bias
+};
+
+// Per-draw data: "ObjectBlock" in cube.fs.
+struct ObjectBlock
+{
+    glm::vec4 objectColor;  // w unused
+};
+
+// Per-frame frustum culling data: "CullBlock" in cull.comp.
+struct CullBlock
+{
+    glm::vec4 planes[6];        // see Frustum.h
+    glm::uvec4 objectCount;     // x: objects to test, yzw unused
+};
+
+// Per-frame data of the deferred lighting pass: "DeferredBlock" in deferred.fs.
+struct DeferredBlock
+{
+    glm::mat4 inverseViewProjection;    // from normalized device coordinates back to world space
+};
+
+// Per-frame shadow and sun data (see ShadowMaps): "ShadowBlock" in lighting.glsl.
+struct ShadowBlock
+{
+    glm::mat4 cascadeMatrices[4];   // world space to the [0, 1] coordinates of each cascade's map
+    glm::vec4 cascadeSplits;        // view depth at which each cascade ends
+    glm::vec4 sunDirection;         // towards the sun, w unused
+    glm::vec4 sunColor;             // times its intensity; w 1 with a sun, 0 without
+    glm::vec4 pointShadow;          // position of the light casting point shadows, and its radius
+    glm::ivec4 shadowLights;        // x: that light's index or -1, y: cascades in use, zw unused
+};
+
+// Per-pass data of the shadow map passes: "ShadowPassBlock" in the shadow shaders.
+struct ShadowPassBlock
+{
+    glm::mat4 matrices[6];          // the cube faces' view projections, or the cascade's in [0]
+    glm::vec4 lightPosition;        // point light position and radius, w unused for cascades
+};
+
+static_assert(sizeof(FrameBlock) == 144, "FrameBlock must match the std140 layout in the shaders");
+static_assert(sizeof(LightBlock) == 48, "LightBlock must match the std140 layout in the shaders");
+static_assert(sizeof(ObjectBlock) == 16, "ObjectBlock must match the std140 layout in the shaders");
+static_assert(sizeof(CullBlock) == 112, "CullBlock must match the std140 layout in the shaders");
+static_assert(sizeof(DeferredBlock) == 64, "DeferredBlock must match the std140 layout in the shaders");
+static_assert(sizeof(ShadowBlock) == 336, "ShadowBlock must match the std140 layout in the shaders");
+static_assert(sizeof(ShadowPassBlock) == 400, "ShadowPassBlock must match the std140 layout in the shaders");
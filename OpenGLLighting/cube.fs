@@ -1,37 +1,45 @@
 #version 330 core
 
+// Built as permutations (see ShaderPermutations.h) of the defines listed in lighting.glsl, which
+// is inserted above and does the lighting, and of the material constants below, so each variant
+// only contains the code it runs.
+#ifndef SPECULAR_STRENGTH
+#define SPECULAR_STRENGTH 0.5
+#endif
+
 out vec4 FragColor;
 
 in vec3 Normal;
 in vec3 FragPos;
 
-uniform vec3 lightPos;
-uniform vec3 viewPos;
-uniform vec3 lightColor;
-uniform vec3 objectColor;
+// Per-frame camera data, shared by every program (see UniformBlocks.h).
+layout (std140) uniform FrameBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
+// Per-draw data.
+layout (std140) uniform ObjectBlock
+{
+    vec4 objectColor;
+};
 
 void main()
 {
     // Calculate ambient lighting (indirect light source(s)).
-    float ambientStrength = 0.1;
-    vec3 ambient = ambientStrength * lightColor;
+    vec3 ambient = ambientColor.rgb;
 
-    // Calulate diffuse lighting (direct light source).
     vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(lightPos - FragPos);
-    float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * lightColor;
-
-    // Calculate specular lighting (the spot of light that appears on a shiny object; usually the
-    // color of the light rather than the color of the object).
-    float specularStrength = 0.5;
-    vec3 viewDir = normalize(viewPos - FragPos);
-    vec3 reflectDir = reflect(-lightDir, norm);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
-    vec3 specular = specularStrength * spec * lightColor;
+    vec3 viewDir = normalize(viewPos.xyz - FragPos);
+    vec3 diffuse = vec3(0.0);
+    vec3 specular = vec3(0.0);
+    float depth = -(view * vec4(FragPos, 1.0)).z;
+    AddLights(FragPos, norm, viewDir, depth, SPECULAR_STRENGTH, diffuse, specular);
 
     // Calculate the Phong reflection model.
-    vec3 result = (ambient + diffuse + specular) * objectColor;
+    vec3 result = (ambient + diffuse + specular) * objectColor.rgb;
 
     // Set the fragment's color.
     FragColor = vec4(result, 1.0);
@@ -2,22 +2,30 @@
 
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
+layout (location = 2) in mat4 aModel;          // per instance; occupies locations 2-5
+layout (location = 6) in mat3 aNormalMatrix;   // per instance; occupies locations 6-8
 
 out vec3 FragPos;
 out vec3 Normal;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Per-frame camera data, shared by every program (see UniformBlocks.h).
+layout (std140) uniform FrameBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
 
 void main()
 {
     // Calculate the normal's position.
-    FragPos = vec3(model * vec4(aPos, 1.0));
+    FragPos = vec3(aModel * vec4(aPos, 1.0));
 
     // Calculate the normal vector. Apply a normal matrix to avoid distortion caused by non-uniform
     // scaling. See "One last thing" at https://learnopengl.com/#!Lighting/Basic-Lighting
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    // The normal matrix is computed once per instance on the CPU (see Transform.h) rather than
+    // inverting the model matrix for every vertex.
+    Normal = aNormalMatrix * aNormal;
 
     // Set the position of the current vertex using gl_Position, a GLSL built-in variable.
     gl_Position = projection * view * vec4(FragPos, 1.0);
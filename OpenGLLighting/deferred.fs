@@ -0,0 +1,72 @@
+#version 330 core
+
+// The lighting pass of the deferred path: one fragment per pixel, reading the surface from the
+// G-buffer (see GBuffer.h) and applying the lights of its cluster with lighting.glsl, inserted
+// above, as cube.fs does.
+//
+// Built as permutations of the same defines as cube.fs; the specular strength comes from the
+// G-buffer instead of SPECULAR_STRENGTH.
+
+out vec4 FragColor;
+
+// Per-frame camera data, shared by every program (see UniformBlocks.h).
+layout (std140) uniform FrameBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
+// To reconstruct positions from depth.
+layout (std140) uniform DeferredBlock
+{
+    mat4 inverseViewProjection;
+};
+
+// The G-buffer.
+uniform sampler2D gNormal;
+uniform sampler2D gAlbedo;
+uniform sampler2D gDepth;
+
+// Inverse of EncodeNormal() in gbuffer.fs.
+vec3 DecodeNormal(vec2 encoded)
+{
+    vec2 f = encoded * 2.0 - 1.0;
+    vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    if (depth == 1.0) {
+        discard;    // background; keep the clear color
+    }
+
+    // Unproject the pixel's window coordinates to get back the world position cube.vs had.
+    vec4 ndc = vec4(gl_FragCoord.xy / vec2(textureSize(gDepth, 0)), depth, 1.0) * 2.0 - 1.0;
+    vec4 world = inverseViewProjection * ndc;
+    vec3 FragPos = world.xyz / world.w;
+
+    vec3 norm = DecodeNormal(texelFetch(gNormal, pixel, 0).xy);
+    vec4 albedo = texelFetch(gAlbedo, pixel, 0);
+    float specularStrength = albedo.a;
+
+    // Calculate ambient lighting (indirect light source(s)).
+    vec3 ambient = ambientColor.rgb;
+
+    vec3 viewDir = normalize(viewPos.xyz - FragPos);
+    vec3 diffuse = vec3(0.0);
+    vec3 specular = vec3(0.0);
+    float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+    AddLights(FragPos, norm, viewDir, viewDepth, specularStrength, diffuse, specular);
+
+    // Calculate the Phong reflection model.
+    vec3 result = (ambient + diffuse + specular) * albedo.rgb;
+
+    // Set the fragment's color.
+    FragColor = vec4(result, 1.0);
+}
@@ -0,0 +1,37 @@
+#version 330 core
+
+#ifndef SPECULAR_STRENGTH
+#define SPECULAR_STRENGTH 0.5
+#endif
+
+// The geometry pass of the deferred path: writes the surface into the G-buffer (see GBuffer.h)
+// instead of lighting it. Runs after cube.vs.
+layout (location = 0) out vec2 GNormal;
+layout (location = 1) out vec4 GAlbedo;
+
+in vec3 Normal;
+in vec3 FragPos;
+
+// Per-draw data.
+layout (std140) uniform ObjectBlock
+{
+    vec4 objectColor;
+};
+
+// Octahedral encoding: project the unit normal onto the octahedron |x| + |y| + |z| = 1, fold the
+// lower half over the upper one, and keep x and y. Two 16-bit channels then hold a normal about
+// as precisely as three 16-bit floats. deferred.fs has the decoder.
+vec2 EncodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return n.z >= 0.0 ? n.xy : folded;
+}
+
+void main()
+{
+    GNormal = EncodeNormal(normalize(Normal)) * 0.5 + 0.5;
+
+    // The specular strength of cube.fs goes in alpha.
+    GAlbedo = vec4(objectColor.rgb, SPECULAR_STRENGTH);
+}
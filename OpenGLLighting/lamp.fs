@@ -2,7 +2,9 @@
 
 out vec4 FragColor;
 
+flat in vec3 LampColor;
+
 void main()
 {
-    FragColor = vec4(1.0);  // set all 4 vector values to 1.0 (white)
+    FragColor = vec4(LampColor, 1.0);  // the light's color (white for the original lamp)
 }
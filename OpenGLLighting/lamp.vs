@@ -2,11 +2,31 @@
 
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Per-frame camera data, shared by every program (see UniformBlocks.h).
+layout (std140) uniform FrameBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
+// The lights, two texels each: position and radius, color and intensity (see LightGrid.h). One
+// instance is drawn per light.
+uniform samplerBuffer lightData;
+
+// The lights sorted by level of detail; each level's draw starts at firstLamp (see DrawLamps() in
+// main.cpp).
+uniform usamplerBuffer lampLights;
+uniform int firstLamp;
+
+flat out vec3 LampColor;
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(aPos, 1.0);
+    int light = int(texelFetch(lampLights, firstLamp + gl_InstanceID).r);
+    vec3 lightPos = texelFetch(lightData, 2 * light).xyz;
+    LampColor = texelFetch(lightData, 2 * light + 1).rgb;
+
+    // The lamp's cube is smaller than the lit cubes.
+	gl_Position = projection * view * vec4(lightPos + 0.2 * aPos, 1.0);
 }
@@ -0,0 +1,147 @@
+// The lighting shared by the forward path (cube.fs) and the deferred lighting pass (deferred.fs):
+// the light and shadow data, and the functions that light a fragment with them. ShaderCompiler
+// inserts it after each of those files' #version line and #defines (see ShaderFile::libraries), so
+// it sees the same permutation defines:
+//   SINGLE_LIGHT    the scene has one light, light 0; no cluster lookup
+//   SPECULAR        add the specular term
+//   SHADOWS         the point light and the sun cast shadows (see ShadowMaps.h)
+//   SUN             add the directional light
+#ifndef SHININESS
+#define SHININESS 32.0
+#endif
+
+// Cascades of the sun's shadow map; ShadowMaps::CASCADE_COUNT.
+#define CASCADE_COUNT 4
+
+// Where to find a fragment's lights in the cluster grid (see LightGrid.h).
+layout (std140) uniform LightBlock
+{
+    vec4 ambientColor;
+    uvec4 clusterCounts;    // clusters along x, y and z, then the number of lights
+    vec4 clusterScale;      // tiles per pixel along x and y, then the slice scale and bias
+};
+
+// Shadows of the point light and of the sun (see ShadowMaps.h).
+layout (std140) uniform ShadowBlock
+{
+    mat4 cascadeMatrices[CASCADE_COUNT];    // world to shadow map coordinates
+    vec4 cascadeSplits;         // far view depth of each cascade
+    vec4 sunDirection;          // towards the sun
+    vec4 sunColor;              // alpha 1 if there is a sun
+    vec4 pointShadow;           // shadowing light's position and radius
+    ivec4 shadowLights;         // shadowing light's index or -1, then the cascades in use
+};
+
+// The lights, two texels each: position and radius, color and intensity.
+uniform samplerBuffer lightData;
+
+// Per cluster, the offset of its lights in lightIndices and their count.
+uniform usamplerBuffer clusters;
+uniform usamplerBuffer lightIndices;
+
+#ifdef SHADOWS
+// Distance to the point light over its radius, and the sun's cascades.
+uniform samplerCube pointShadowMap;
+uniform sampler2DArrayShadow cascadeShadowMap;
+
+// 0 where the shadowing point light is hidden from the fragment, 1 where it is not.
+float PointShadow(vec3 fragPos)
+{
+    vec3 fromLight = fragPos - pointShadow.xyz;
+    float stored = textureLod(pointShadowMap, fromLight, 0.0).r;
+    return length(fromLight) / pointShadow.w - 0.02 > stored ? 0.0 : 1.0;
+}
+
+// 0 where the sun is hidden from the fragment, 1 where it is not, from the first cascade that
+// covers the fragment's view depth. Past the last cascade nothing is shadowed.
+float SunShadow(vec3 fragPos, vec3 norm, float viewDepth)
+{
+    int cascade = 0;
+    while (cascade < CASCADE_COUNT && viewDepth > cascadeSplits[cascade]) {
+        ++cascade;
+    }
+    if (cascade >= CASCADE_COUNT) {
+        return 1.0;
+    }
+
+    // Push the sample point off the surface a little against acne on surfaces facing away.
+    vec4 coords = cascadeMatrices[cascade] * vec4(fragPos + norm * 0.02 * float(cascade + 1), 1.0);
+    return texture(cascadeShadowMap, vec4(coords.xy, float(cascade), coords.z));
+}
+#endif
+
+// Adds one point light's diffuse and specular contributions.
+void AddLight(int light, vec3 fragPos, vec3 norm, vec3 viewDir, float specularStrength,
+              inout vec3 diffuse, inout vec3 specular)
+{
+    vec4 positionRadius = texelFetch(lightData, 2 * light);
+    vec4 colorIntensity = texelFetch(lightData, 2 * light + 1);
+
+    // Fade the light out smoothly, reaching zero at its radius, so it can be left out of the
+    // clusters beyond it. Clusters are boxes, so some of their lights miss the fragment.
+    vec3 toLight = positionRadius.xyz - fragPos;
+    float distanceRatio = length(toLight) / positionRadius.w;
+    if (distanceRatio >= 1.0) {
+        return;
+    }
+    float falloff = clamp(1.0 - distanceRatio * distanceRatio * distanceRatio * distanceRatio, 0.0, 1.0);
+    vec3 lightColor = colorIntensity.rgb * (colorIntensity.a * falloff * falloff);
+#ifdef SHADOWS
+    if (light == shadowLights.x) {
+        lightColor *= PointShadow(fragPos);
+    }
+#endif
+
+    // Calculate diffuse lighting (direct light source).
+    vec3 lightDir = normalize(toLight);
+    float diff = max(dot(norm, lightDir), 0.0);
+    diffuse += diff * lightColor;
+
+#ifdef SPECULAR
+    // Calculate specular lighting (the spot of light that appears on a shiny object; usually the
+    // color of the light rather than the color of the object).
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), SHININESS);
+    specular += specularStrength * spec * lightColor;
+#endif
+}
+
+// Adds the diffuse and specular light reaching a fragment: light 0 alone with SINGLE_LIGHT, else
+// the lights of its cluster, then the sun with SUN. viewDepth is the fragment's distance in front
+// of the camera.
+void AddLights(vec3 fragPos, vec3 norm, vec3 viewDir, float viewDepth, float specularStrength,
+               inout vec3 diffuse, inout vec3 specular)
+{
+#ifdef SINGLE_LIGHT
+    AddLight(0, fragPos, norm, viewDir, specularStrength, diffuse, specular);
+#else
+    // Find the fragment's cluster: its screen tile, and the depth slice of its view-space depth.
+    uvec2 tile = min(uvec2(gl_FragCoord.xy * clusterScale.xy), clusterCounts.xy - 1u);
+    uint slice = uint(clamp(log(viewDepth) * clusterScale.z + clusterScale.w, 0.0, float(clusterCounts.z - 1u)));
+    uint cluster = (slice * clusterCounts.y + tile.y) * clusterCounts.x + tile.x;
+    uvec2 range = texelFetch(clusters, int(cluster)).xy;
+
+    for (uint i = 0u; i < range.y; ++i) {
+        AddLight(int(texelFetch(lightIndices, int(range.x + i)).r), fragPos, norm, viewDir, specularStrength,
+                 diffuse, specular);
+    }
+#endif
+
+#ifdef SUN
+    // The sun: a directional light.
+    float sunDiff = max(dot(norm, sunDirection.xyz), 0.0);
+    if (sunDiff > 0.0) {
+#ifdef SHADOWS
+        float shadow = SunShadow(fragPos, norm, viewDepth);
+#else
+        float shadow = 1.0;
+#endif
+        diffuse += shadow * sunDiff * sunColor.rgb;
+#ifdef SPECULAR
+        vec3 reflectDir = reflect(-sunDirection.xyz, norm);
+        float spec = pow(max(dot(viewDir, reflectDir), 0.0), SHININESS);
+        specular += shadow * specularStrength * spec * sunColor.rgb;
+#endif
+    }
+#endif
+}
@@ -26,7 +26,19 @@
  * Created 8/6/17.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 // GLEW: OpenGL Extension Wrangler
 //#define GLEW_STATIC
@@ -41,11 +53,91 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "GLSLProgram.h"
+#include "GLStateCache.h"
 #include "Camera.h"
+#include "Benchmark.h"
+#include "FrameCapture.h"
+#include "FramePipeline.h"
+#include "FrameReport.h"
+#include "Frustum.h"
+#include "GBuffer.h"
+#include "GpuCuller.h"
+#include "HeadlessContext.h"
+#include "LightGrid.h"
+#include "LodSelector.h"
+#include "MeshBuilder.h"
+#include "MeshLoader.h"
+#include "Profiler.h"
+#include "ProgramBinaryCache.h"
+#include "Regression.h"
+#include "RenderQueue.h"
+#include "ResourceStreamer.h"
+#include "Scene.h"
+#include "ShadowMaps.h"
+#include "ShaderCompiler.h"
+#include "ShaderPermutations.h"
+#include "ShaderReloader.h"
+#include "SoftwareRasterizer.h"
+#include "StreamBuffer.h"
+#include "ThreadPool.h"
+#include "UniformBlocks.h"
+
+// Options given on the command line.
+struct Options
+{
+    int uniformBenchmarkFrames = 0;     // --bench-uniforms [frames]: run the uniform benchmark and exit
+    std::string shaderCacheDirectory = "shader-cache";  // --shader-cache DIR, or --no-shader-cache
+    size_t instances = 0;               // --instances N: draw N cubes without vsync and report frame times
+    bool packVertices = true;           // --no-pack-vertices: keep float positions and normals
+    std::string meshPath;               // --mesh FILE: draw an OBJ or glTF mesh instead of the cube
+    std::string meshCacheDirectory = "mesh-cache";      // --mesh-cache DIR: where --mesh keeps its built meshes
+    float lodPixelError = LodSelector::DEFAULT_PIXEL_ERROR;  // --lod-error PIXELS: level of detail error allowed, 0 for full detail
+    int headlessFrames = 0;             // --headless [frames]: render offscreen, write a frame report and exit
+    std::string reportPath = "frame-report.json";       // --report FILE, or - for stdout
+    bool profile = false;               // --profile: print CPU and GPU time per zone once a second
+    std::string tracePath;              // --trace FILE: write the first TRACE_FRAMES frames as a Chrome trace
+    bool gpuCulling = false;            // --gpu-cull: cull and draw the cubes on the GPU (GL 4.3)
+    bool cpuCulling = false;            // --cpu-cull: cull the cubes on the CPU before queueing them
+    size_t cullingBenchmarkObjects = 0; // --bench-culling [objects]: run the culling benchmark and exit
+    unsigned int threads = 0;           // --threads N: worker threads, 0 for one per hardware thread
+    size_t pipelineBenchmarkObjects = 0;    // --bench-pipeline [objects]: time frame preparation per thread count and exit
+    size_t lights = 1;                  // --lights N: scatter N point lights (up to 4096) among the cubes
+    bool deferred = false;              // --deferred: start with deferred shading; G switches at runtime
+    bool shadows = false;               // --shadows: shadow maps for the first light and the sun
+    bool sun = false;                   // --sun: add a directional light
+    bool paused = false;                // --paused: start with the animation paused; P switches at runtime
+    bool watchShaders = true;           // --no-watch-shaders: don't rebuild programs when their files change
+    bool specular = true;               // --no-specular: start without specular highlights; H switches at runtime
+    bool allPermutations = false;       // --all-permutations: build every lighting variant at startup
+    std::string rasterPath;             // --raster FILE: render the first frame on the CPU to a PPM and exit
+    int rasterBenchmarkFrames = 0;      // --bench-raster [frames]: time the CPU rasterizer per thread count and exit
+    std::string regressionDirectory;    // --regress DIR: run --scenario headless against DIR's golden frames and exit
+    std::string scenario;               // --scenario NAME: the regression scenario
+    std::string baselineDirectory;      // --regress-baselines DIR: also check the frame time against DIR's baseline
+    bool regressionUpdate = false;      // --regress-update: record the golden frames (and baseline) instead
+    double regressionThreshold = REGRESSION_DEFAULT_THRESHOLD;  // --regress-threshold FRACTION: slowdown allowed
+};
 
+Options ParseCommandLine(int argc, const char* argv[]);
 GLFWwindow* InitGlfw();
-void InitShaders();
-void Render(GLFWwindow* window);
+void InitShaders(const Options& options);
+void WatchProgram(GLSLProgram& program, const std::vector<ShaderCompiler::ShaderFile>& files);
+void OnShadersReady();
+void OnMeshLoaded(const GpuMesh& mesh);
+void SetCulledObjects(const std::vector<uint8_t>& objectLods);
+uint16_t AddToRenderQueues(const std::function<uint16_t(RenderQueue& queue)>& add);
+void ReportFramePresented();
+void SetSamplerUnits();
+uint32_t LightingFeatures();
+void ReportFrameRate(double cpuMilliseconds);
+void ReportStateCache();
+void RunHeadless(const Options& options);
+bool RunRegression(const Options& options, const RegressionScenario& scenario, GLuint framebuffer);
+void RunSoftwareRasterizer(const Options& options);
+void Render(float currentFrame);
+void PrepareFrame(float deltaTime);
+void RenderPlaceholder(const FrameBlock& frameBlock, const FramePipeline::Frame& frame);
+void DrawLamps(const FrameBlock& frameBlock, const FramePipeline::Frame& frame);
 void HandleDirectionalKeys(GLFWwindow *window);
 void GlfwErrorCallback(int error, const char* description);
 void GlfwFramebufferResizeCallback(GLFWwindow *window, int width, int height);
@@ -58,25 +150,182 @@ void GlfwWindowRefreshCallback(GLFWwindow* window);
 static const GLuint WIDTH = 1280;
 static const GLuint HEIGHT = 960;
 
-static const char* LIGHTING_VERTEX_SHADER_PATH =
-        "/Users/john/Dev/OpenGL/LearnOpenGL/OpenGLLighting/OpenGLLighting/cube.vs";
-static const char* LIGHTING_FRAGMENT_SHADER_PATH =
-        "/Users/john/Dev/OpenGL/LearnOpenGL/OpenGLLighting/OpenGLLighting/cube.fs";
-static const char* LAMP_VERTEX_SHADER_PATH =
-        "/Users/john/Dev/OpenGL/LearnOpenGL/OpenGLLighting/OpenGLLighting/lamp.vs";
-static const char* LAMP_FRAGMENT_SHADER_PATH =
-        "/Users/john/Dev/OpenGL/LearnOpenGL/OpenGLLighting/OpenGLLighting/lamp.fs";
+// Where the shaders are read from at run time; the CMake build points it at the source tree.
+#ifndef SHADER_DIRECTORY
+#define SHADER_DIRECTORY "/Users/john/Dev/OpenGL/LearnOpenGL/OpenGLLighting/OpenGLLighting/"
+#endif
+
+static const char* LIGHTING_VERTEX_SHADER_PATH = SHADER_DIRECTORY "cube.vs";
+static const char* LIGHTING_FRAGMENT_SHADER_PATH = SHADER_DIRECTORY "cube.fs";
+static const char* LAMP_VERTEX_SHADER_PATH = SHADER_DIRECTORY "lamp.vs";
+static const char* LAMP_FRAGMENT_SHADER_PATH = SHADER_DIRECTORY "lamp.fs";
+static const char* CULL_COMPUTE_SHADER_PATH = SHADER_DIRECTORY "cull.comp";
+static const char* GBUFFER_FRAGMENT_SHADER_PATH = SHADER_DIRECTORY "gbuffer.fs";
+static const char* DEFERRED_VERTEX_SHADER_PATH = SHADER_DIRECTORY "deferred.vs";
+static const char* DEFERRED_FRAGMENT_SHADER_PATH = SHADER_DIRECTORY "deferred.fs";
+static const char* LIGHTING_LIBRARY_PATH = SHADER_DIRECTORY "lighting.glsl";
+static const char* SHADOW_VERTEX_SHADER_PATH = SHADER_DIRECTORY "shadow.vs";
+static const char* SHADOW_POINT_GEOMETRY_SHADER_PATH = SHADER_DIRECTORY "shadow_point.gs";
+static const char* SHADOW_POINT_FRAGMENT_SHADER_PATH = SHADER_DIRECTORY "shadow_point.fs";
+static const char* SHADOW_CASCADE_VERTEX_SHADER_PATH = SHADER_DIRECTORY "shadow_cascade.vs";
+static const char* SHADOW_FRAGMENT_SHADER_PATH = SHADER_DIRECTORY "shadow.fs";
+static const char* PLACEHOLDER_FRAGMENT_SHADER_PATH = SHADER_DIRECTORY "placeholder.fs";
 
-GLSLProgram lightingShader;
 GLSLProgram lampShader;
+GLSLProgram cullShader;
+GLSLProgram gBufferShader;
+GLSLProgram pointShadowShader;
+GLSLProgram cascadeShadowShader;
+
+// Worker threads for file I/O and frame preparation, and the scheduler that builds the programs in
+// the background.
+ThreadPool* threadPool = nullptr;
+ShaderCompiler* shaderCompiler = nullptr;
+ProgramBinaryCache* binaryCache = nullptr;
+ShaderReloader* shaderReloader = nullptr;   // rebuilds programs whose files are edited; null with --no-watch-shaders
+std::chrono::steady_clock::time_point shaderStart;
+bool shadersReady = false;  // Render() draws a placeholder frame until the programs are linked
+
+// Linked at startup, before anything else, to draw the placeholder frames with: the cubes in a
+// flat color, shaded by the angle to the camera.
+GLSLProgram placeholderShader;
+uint16_t placeholderProgramId;
+
+// The forward lighting program (cube.vs and cube.fs) and the deferred lighting pass (deferred.vs
+// and deferred.fs), which share their lighting code through lighting.glsl, are built in variants,
+// one per combination of the features below, each compiled with only the code its features need. A
+// frame uses the variant of its features; one that isn't built yet is stood in for by the last
+// variant used until it is.
+enum LightingFeature
+{
+    LIGHTING_SINGLE_LIGHT = 1 << 0,     // exactly one light: no cluster lookup
+    LIGHTING_SPECULAR = 1 << 1,
+    LIGHTING_SHADOWS = 1 << 2,
+    LIGHTING_SUN = 1 << 3
+};
+ShaderPermutations* lightingPermutations = nullptr;
+ShaderPermutations* deferredPermutations = nullptr;
+uint32_t forwardFeatures = 0;   // the variants in use
+uint32_t deferredFeatures = 0;
+
+// The cubes' material, compiled into the lighting programs.
+static const float SPECULAR_STRENGTH = 0.5f;
+static const float SHININESS = 32.0f;
+bool specularEnabled = true;
 
 GLuint cubeVAO;
 GLuint lightVAO;
 GLuint VBO;
+GLuint EBO;
+
+// The cube mesh after MeshBuilder: welded, reordered and (by default) packed. Both VAOs share it.
+// With --mesh the cube stands in until resourceStreamer has loaded the mesh in the background,
+// fitted into the cube's bounds, then OnMeshLoaded() swaps it in.
+GLenum meshIndexType = GL_UNSIGNED_SHORT;
+GLsizei meshIndexCount = 0;     // of level 0
+std::vector<MeshLod> meshLods;
+
+// Picks each cube's level of detail every frame, by the error it would show on screen.
+LodSelector* lodSelector = nullptr;
+MeshLoader* meshLoader = nullptr;
+ResourceStreamer* resourceStreamer = nullptr;
+GLFWwindow* uploadWindow = nullptr;     // hidden; its context shares the window's, for the loader thread
+
+// From the start of main() to the first frame presented, and to the first with every program and
+// resource loaded; negative until then.
+std::chrono::steady_clock::time_point startTime;
+double firstFrameMilliseconds = -1.0;
+double completeFrameMilliseconds = -1.0;
+
+// Per-frame data (the uniform blocks in UniformBlocks.h and the per-instance model matrices) is
+// written into this ring buffer.
+StreamBuffer* streamBuffer = nullptr;
+static const size_t STREAM_BUFFER_FRAME_SIZE = 1024 * 1024;
+
+// The lit cubes, submitted to the render queue every frame.
+Scene scene;
+
+// Sorts and batches the frame's draw items; one per frame the pipeline holds. The ids are the
+// program, mesh and material registered with each in InitShaders(), the same in both; the forward
+// lighting program has one per variant.
+RenderQueue* renderQueues[FramePipeline::FRAME_COUNT] = {};
+std::vector<uint16_t> cubeProgramIds;
+uint16_t gBufferProgramId;
+std::vector<uint16_t> cubeMeshIds;  // one per level of detail
+uint16_t cubeMaterialId;
+
+// The scene's point lights, binned into clusters every frame for cube.fs. The lamps are drawn
+// from the same data, one instance per light.
+LightGrid* lightGrid = nullptr;
+static const glm::vec3 AMBIENT_COLOR(0.1f);
+
+// Each lamp's level of detail, picked by lodSelector like the cubes', and the lights listed level
+// by level for lamp.vs, which reads them from the buffer texture on LAMP_LIGHTS_UNIT.
+static const float LAMP_SCALE = 0.2f;   // lamp.vs's, of the cube
+static const GLuint LAMP_LIGHTS_UNIT = 8;
+std::vector<uint8_t> lampLods;
+std::vector<glm::vec3> lampCenters;
+std::vector<uint16_t> lampLights;
+GLuint lampLightsBuffer;
+GLuint lampLightsTexture;
+
+// With deferred shading the cubes are drawn into the G-buffer by gBufferShader instead of being
+// lit by the forward lighting program, then the deferred one lights every pixel in one full-screen
+// pass. Toggled with G; the lamps stay forward either way.
+bool deferredShading = false;
+GBuffer* gBuffer = nullptr;
+GLuint fullScreenVAO;   // no attributes; deferred.vs makes the triangle from gl_VertexID
+
+// Shadow maps for the first light and the sun, re-rendered only when they go stale; with
+// --shadows. The sun lights the scene from SUN_DIRECTION with --sun, shadowed or not.
+bool shadowsEnabled = false;
+bool sunEnabled = false;
+ShadowMaps* shadowMaps = nullptr;
+GLuint shadowVAO;       // positions and instance model matrices only
+static const glm::vec3 SUN_DIRECTION(-0.4f, -1.0f, -0.3f);
+static const glm::vec3 SUN_COLOR(0.5f);
+static const float SHADOW_DISTANCE = 40.0f;     // the cascades cover the view up to this depth
+
+// Size of the default framebuffer in pixels, for finding a fragment's cluster from gl_FragCoord.
+int framebufferWidth = WIDTH;
+int framebufferHeight = HEIGHT;
+
+// With --gpu-cull, the cubes bypass the render queue: they are culled by a compute shader and
+// drawn with one multi-draw indirect call. Null otherwise, or if the GL is older than 4.3.
+GpuCuller* gpuCuller = nullptr;
+std::vector<uint32_t> cullMeshIds;  // one per level of detail
+
+// With --cpu-cull, or --gpu-cull on an older GL, the cubes' bounding spheres are tested on the
+// CPU and only the visible ones are queued.
+bool cpuCulling = false;
+size_t visibleObjectCount = 0;     // of the last frame drawn
+
+// Render() draws each frame while the workers prepare the next one: its animation, transforms,
+// levels of detail, culling and sorted render queue (see FramePipeline.h). The next frame is
+// started from the camera and settings as they are when the last one is drawn, so input shows a
+// frame later, and the animation advances by the last frame's time step. drawnFrame is the frame
+// Render() last drew.
+FramePipeline* framePipeline = nullptr;
+const FramePipeline::Frame* drawnFrame = nullptr;
+
+// The render thread's settings a frame is drawn with, fixed when its preparation starts, so a key
+// pressed in between can't draw it with a program its queue wasn't built for.
+struct FrameState
+{
+    bool placeholder;       // drawn before the programs were linked
+    bool deferred;
+    uint32_t features;      // of the lighting variant
+};
+FrameState preparedState;
 
-Camera camera(glm::vec3(0.0f, 0.0f, 6.0f));
+// P pauses the animation at the start of the next frame, while nothing is being prepared.
+bool pauseToggled = false;
 
-glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
+static const glm::vec4 CUBE_COLOR(1.0f, 0.5f, 0.31f, 1.0f);
+static const float NEAR_PLANE = 0.1f;
+static const float FAR_PLANE = 100.0f;
+
+Camera camera(glm::vec3(0.0f, 0.0f, 6.0f));
 
 float lastX = std::numeric_limits<int>::min();
 float lastY = std::numeric_limits<int>::min();
@@ -85,6 +334,16 @@ uint mouseCallbackNbr = 0;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
+// CPU time per frame and per stage, recorded in headless mode.
+FrameReport frameReport;
+static const int HEADLESS_WARMUP_FRAMES = 10;     // rendered before recording starts
+static const float HEADLESS_TIME_STEP = 1.0f / 60.0f;   // fixed, so every run animates the same frames
+
+// CPU and GPU zones around the clear, the update, the light binning, the sort, the cube and lamp
+// passes and the swap; null unless --profile or --trace is given.
+Profiler* profiler = nullptr;
+static const size_t TRACE_FRAMES = 600;
+
 // Position and normal data
 float vertices[] = {
     -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
@@ -132,85 +391,1105 @@ float vertices[] = {
 
 int main(int argc, const char * argv[])
 {
-    GLFWwindow* window = InitGlfw();
+    startTime = std::chrono::steady_clock::now();
+    Options options = ParseCommandLine(argc, argv);
+
+    // The culling benchmark is CPU only.
+    if (options.cullingBenchmarkObjects > 0) {
+        RunCullingBenchmark(options.cullingBenchmarkObjects);
+        return EXIT_SUCCESS;
+    }
+    if (options.pipelineBenchmarkObjects > 0) {
+        RunFramePipelineBenchmark(options.pipelineBenchmarkObjects, options.threads);
+        return EXIT_SUCCESS;
+    }
+
+    // So is the software rasterizer.
+    if (!options.rasterPath.empty() || options.rasterBenchmarkFrames > 0) {
+        RunSoftwareRasterizer(options);
+        return EXIT_SUCCESS;
+    }
+
+    // A regression scenario sets up its own scene and always renders headless.
+    const RegressionScenario* scenario = nullptr;
+    if (!options.regressionDirectory.empty()) {
+        scenario = FindRegressionScenario(options.scenario);
+        if (scenario == nullptr) {
+            std::cerr << "Unknown regression scenario \"" << options.scenario << "\"; the scenarios are:";
+            for (const RegressionScenario& known : GetRegressionScenarios()) {
+                std::cerr << " " << known.name;
+            }
+            std::cerr << std::endl;
+            return EXIT_FAILURE;
+        }
+        options.instances = scenario->instances;
+        options.lights = scenario->lights;
+        options.deferred = scenario->deferred;
+        options.shadows = scenario->shadows;
+        options.sun = scenario->sun;
+        options.headlessFrames = scenario->frames;
+    }
+
+    // Either a window, or an offscreen framebuffer in a context without one.
+    GLFWwindow* window = nullptr;
+    HeadlessContext* headlessContext = nullptr;
+    if (options.headlessFrames > 0) {
+        headlessContext = new HeadlessContext(WIDTH, HEIGHT);
+        if (!headlessContext->IsValid()) {
+            std::cerr << "Headless context error: " << headlessContext->GetError() << std::endl;
+            delete headlessContext;
+            return EXIT_FAILURE;
+        }
+        GLStateCache::Enable(GL_DEPTH_TEST);
+    }
+    else {
+        window = InitGlfw();
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    }
 
-    InitShaders();
+    // In benchmark mode, don't let vsync cap the frame rate.
+    if (options.instances > 0) {
+        scene.CreateGrid(options.instances);
+        if (window != nullptr) {
+            glfwSwapInterval(0);
+        }
+    }
+    if (options.lights != 1) {
+        scene.CreateLights(options.lights);
+    }
+    deferredShading = options.deferred;
+    shadowsEnabled = options.shadows;
+    sunEnabled = options.sun;
+    specularEnabled = options.specular;
+    scene.SetPaused(options.paused);
+
+    threadPool = new ThreadPool(options.threads);
+    shaderCompiler = new ShaderCompiler(*threadPool);
+    if (!options.meshPath.empty()) {
+        // The loader thread uploads through a context of its own that shares the render context's
+        // objects: the hidden window's, or a second headless one. Without either the render thread
+        // uploads.
+        ResourceStreamer::ContextBinder bindUploadContext;
+        if (window != nullptr) {
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+            uploadWindow = glfwCreateWindow(1, 1, "", nullptr, window);
+            if (uploadWindow != nullptr) {
+                bindUploadContext = [](bool current) {
+                    glfwMakeContextCurrent(current ? uploadWindow : nullptr);
+                    return true;
+                };
+            }
+        }
+        else if (headlessContext->CreateSharedContext()) {
+            bindUploadContext = [headlessContext](bool current) {
+                return headlessContext->MakeSharedContextCurrent(current);
+            };
+        }
+        meshLoader = new MeshLoader(*threadPool, options.meshCacheDirectory);
+        resourceStreamer = new ResourceStreamer(*threadPool, *meshLoader, bindUploadContext);
+        if (!resourceStreamer->GetStatistics().hasLoaderThread) {
+            std::cerr << "No shared context to upload from; uploading on the render thread" << std::endl;
+        }
+    }
+    if (options.watchShaders) {
+        shaderReloader = new ShaderReloader(*shaderCompiler);
+    }
+
+    // Cache linked program binaries between runs; a cold start compiles from source, a warm start
+    // loads the driver's binaries.
+    if (!options.shaderCacheDirectory.empty()) {
+        binaryCache = new ProgramBinaryCache(options.shaderCacheDirectory);
+        GLSLProgram::SetBinaryCache(binaryCache);
+    }
+
+    if (options.profile || !options.tracePath.empty()) {
+        profiler = new Profiler();
+        profiler->SetSummaryInterval(options.profile ? 1.0 : 0.0);
+        if (!options.tracePath.empty()) {
+            profiler->StartTrace(TRACE_FRAMES);
+        }
+    }
+
+    InitShaders(options);
+
+    int exitCode = EXIT_SUCCESS;
+    if (options.uniformBenchmarkFrames > 0) {
+        shaderCompiler->Finish();
+        OnShadersReady();
+        if (resourceStreamer != nullptr) {
+            resourceStreamer->Finish();
+        }
+        RunUniformBenchmark(options.uniformBenchmarkFrames);
+        if (window != nullptr) {
+            glfwSetWindowShouldClose(window, GL_TRUE);
+        }
+    }
+    else if (scenario != nullptr) {
+        if (!RunRegression(options, *scenario, headlessContext->GetFramebuffer())) {
+            exitCode = EXIT_FAILURE;
+        }
+    }
+    else if (headlessContext != nullptr) {
+        RunHeadless(options);
+    }
 
     // Render the window's contents, then poll for events  (key pressed, mouse moved, etc.).
-    while (!glfwWindowShouldClose(window)) {
-        Render(window);
+    while (window != nullptr && !glfwWindowShouldClose(window)) {
+        if (!shadersReady && shaderCompiler->Poll()) {
+            OnShadersReady();
+        }
+        if (profiler != nullptr) {
+            profiler->BeginFrame();
+        }
+        std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+        Render(static_cast<float>(glfwGetTime()));
+        if (options.instances > 0) {
+            ReportFrameRate(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+        }
+        {
+            ProfileZone swapZone(profiler, "swap");
+            glfwSwapBuffers(window);
+        }
+        ReportFramePresented();
+        if (profiler != nullptr) {
+            profiler->EndFrame();
+        }
         HandleDirectionalKeys(window);
         glfwPollEvents();
     }
 
-    // Deallocate all resources once they've outlived their purpose.
-    glUseProgram(0);
-    glDeleteVertexArrays(1, &cubeVAO);
-    glDeleteVertexArrays(1, &lightVAO);
-    glDeleteBuffers(1, &VBO);
+    if (profiler != nullptr) {
+        profiler->Flush();
+        if (!options.tracePath.empty()) {
+            if (profiler->WriteTrace(options.tracePath)) {
+                std::cout << "Wrote trace to " << options.tracePath << std::endl;
+            }
+            else {
+                std::cerr << "Unable to write trace to " << options.tracePath << std::endl;
+            }
+        }
+        delete profiler;
+        profiler = nullptr;
+    }
+
+    // Deallocate all resources once they've outlived their purpose, starting with the frame the
+    // workers are still preparing.
+    framePipeline->Finish();
+    GLStateCache::UseProgram(0);
+    GLStateCache::DeleteVertexArray(cubeVAO);
+    GLStateCache::DeleteVertexArray(lightVAO);
+    GLStateCache::DeleteVertexArray(fullScreenVAO);
+    GLStateCache::DeleteVertexArray(shadowVAO);
+    GLStateCache::DeleteBuffer(VBO);
+    GLStateCache::DeleteBuffer(EBO);
+
+    // Before the shared context goes: the loader thread still has it current.
+    if (resourceStreamer != nullptr) {
+        const ResourceStreamer::Statistics& resourceStatistics = resourceStreamer->GetStatistics();
+        std::cout << "Resources: " << resourceStatistics.published << " of " << resourceStatistics.requested
+                  << " loaded, " << resourceStatistics.failed << " failed, max queue depth "
+                  << resourceStatistics.maxQueueDepth << ", max latency " << resourceStatistics.maxLatencyMilliseconds
+                  << " ms" << std::endl;
+    }
+    delete resourceStreamer;
+
+    ReportStateCache();
+
+    const StreamBuffer::Statistics& streamStatistics = streamBuffer->GetStatistics();
+    std::cout << "Stream buffer: " << streamStatistics.bytesStreamed << " bytes in " << streamStatistics.frames
+              << " frames, " << streamStatistics.stalls << " stalls (" << streamStatistics.stallMilliseconds
+              << " ms), " << streamStatistics.overflows << " overflows" << std::endl;
+    delete gpuCuller;
+    delete framePipeline;
+    delete lodSelector;
+    delete lightGrid;
+    glDeleteTextures(1, &lampLightsTexture);
+    GLStateCache::DeleteBuffer(lampLightsBuffer);
+    delete gBuffer;
+    delete shadowMaps;
+    for (RenderQueue* renderQueue : renderQueues) {
+        delete renderQueue;
+    }
+    delete streamBuffer;
+
+    delete meshLoader;
+    delete lightingPermutations;
+    delete deferredPermutations;
+    delete shaderReloader;
+    delete shaderCompiler;
+    delete threadPool;
+
+    GLSLProgram::SetBinaryCache(nullptr);
+    delete binaryCache;
 
-    // Terminate GLFW and clear its resources.
-    glfwTerminate();
+    // Terminate GLFW and clear its resources, or destroy the offscreen context.
+    if (window != nullptr) {
+        glfwTerminate();
+    }
+    delete headlessContext;
 
-    return EXIT_SUCCESS;
+    return exitCode;
 }
 
-void Render(GLFWwindow* window)
+void Render(float currentFrame)
 {
-    float currentFrame = static_cast<float>(glfwGetTime()); // per-frame time logic
-    deltaTime = currentFrame - lastFrame;
+    deltaTime = currentFrame - lastFrame;   // per-frame time logic
     lastFrame = currentFrame;
 
-    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    // Swap in the programs rebuilt since the last frame and collect the variants built in the
+    // background, before anything is drawn with them.
+    ProfileZone shaderZone(profiler, "shaders");
+    if (shaderReloader != nullptr) {
+        shaderReloader->Poll();
+    }
+    else {
+        shaderCompiler->Poll();
+    }
+    shaderZone.End();
+
+    // Take the frame the workers prepared while the last one was drawn; the first frame has to be
+    // prepared now.
+    ProfileZone waitZone(profiler, "wait");
+    if (!framePipeline->IsPreparing()) {
+        PrepareFrame(deltaTime);
+    }
+    const FramePipeline::Frame* frame = &framePipeline->Wait();
+    waitZone.End();
+
+    // Nothing is being prepared until the next frame is started, so this is where the scene and
+    // the meshes can change. A mesh swapped in leaves the frame's queue pointing at the old one's
+    // levels: prepare it again, without advancing the animation.
+    if (pauseToggled) {
+        scene.SetPaused(!scene.IsPaused());
+        std::cout << (scene.IsPaused() ? "Paused" : "Running") << std::endl;
+        pauseToggled = false;
+    }
+    if (resourceStreamer != nullptr) {
+        ProfileZone resourceZone(profiler, "resources");
+        const size_t published = resourceStreamer->GetStatistics().published;
+        resourceStreamer->Poll();
+        if (profiler != nullptr) {
+            profiler->SetCounter("resource queue", resourceStreamer->QueueDepth());
+        }
+        if (resourceStreamer->GetStatistics().published != published) {
+            PrepareFrame(0.0f);
+            frame = &framePipeline->Wait();
+        }
+    }
+    const FrameState state = preparedState;
+    if (frame->lodsChanged && gpuCuller != nullptr) {
+        SetCulledObjects(frame->objectLods);
+    }
+    if (profiler != nullptr) {
+        profiler->SetCounter("prepare ms", framePipeline->GetGraph().GetStatistics().milliseconds);
+        profiler->SetCounter("triangles K", frame->lodStatistics.triangles * 1e-3);
+    }
+    frameReport.Mark(STAGE_WAIT);
+
+    // Start on the next frame; the workers prepare it while this one is drawn.
+    PrepareFrame(deltaTime);
+    drawnFrame = frame;
+    visibleObjectCount = frame->visibleCount;
+
+    ProfileZone clearZone(profiler, "clear");
+    GLStateCache::ClearColor(0.1f, 0.1f, 0.1f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    clearZone.End();
+    frameReport.Mark(STAGE_DRAW);
+
+    FrameBlock frameBlock;
+    frameBlock.projection = frame->settings.projection;
+    frameBlock.view = frame->settings.view;
+    frameBlock.viewPos = glm::vec4(frame->settings.cameraPosition, 1.0f);
+
+    // Until the programs are linked, draw the cubes with the placeholder program.
+    if (state.placeholder) {
+        RenderPlaceholder(frameBlock, *frame);
+        return;
+    }
+
+    // Bin the lights into the clusters of this frame's view.
+    ProfileZone lightZone(profiler, "lights");
+    const std::vector<PointLight>& lights = frame->lights;
+    lightGrid->Build(lights.data(), lights.size(), frameBlock.view, frameBlock.projection, NEAR_PLANE, FAR_PLANE, *threadPool);
+    lightZone.End();
+
+    // Work out which shadow maps went stale: a moving light, a moving camera for the cascades,
+    // and anything in a map's volume when the cubes spin.
+    if (shadowsEnabled) {
+        shadowMaps->SetPointLight(lights.empty() ? nullptr : &lights[0], 0);
+        if (!scene.IsPaused()) {
+            glm::vec3 boundsMin, boundsMax;
+            scene.GetBounds(boundsMin, boundsMax);
+            shadowMaps->MarkCastersChanged(boundsMin, boundsMax);
+        }
+    }
+    shadowMaps->Update(frameBlock.view, frameBlock.projection, NEAR_PLANE, SHADOW_DISTANCE);
+    frameReport.Mark(STAGE_UPDATE);
+
+    streamBuffer->BeginFrame();
+
+    // Write the camera and light data once; every program reads them from the uniform blocks.
+    streamBuffer->BindUniformBlock(FRAME_BLOCK_BINDING, frameBlock);
+
+    LightBlock lightBlock = lightGrid->GetLightBlock(framebufferWidth, framebufferHeight, AMBIENT_COLOR);
+    streamBuffer->BindUniformBlock(LIGHT_BLOCK_BINDING, lightBlock);
+    lightGrid->Upload();
+    lightGrid->Bind();
+
+    ShadowBlock shadowBlock = shadowMaps->GetShadowBlock();
+    streamBuffer->BindUniformBlock(SHADOW_BLOCK_BINDING, shadowBlock);
+    shadowMaps->Bind();
+
+    if (state.deferred) {
+        DeferredBlock deferredBlock;
+        deferredBlock.inverseViewProjection = glm::inverse(frameBlock.projection * frameBlock.view);
+        streamBuffer->BindUniformBlock(DEFERRED_BLOCK_BINDING, deferredBlock);
+    }
+
+    frame->queue->Upload(*streamBuffer);
+
+    if (gpuCuller != nullptr) {
+        gpuCuller->Upload(*streamBuffer, &frame->models[0], &frame->normalMatrices[0], frameBlock.projection * frameBlock.view);
+    }
+    frameReport.Mark(STAGE_UPLOAD);
+
+    // Bring the stale shadow maps up to date; nothing at all when none is.
+    shadowMaps->Render(*streamBuffer, shadowVAO, meshIndexCount, meshIndexType, &frame->models[0], scene.Size(), profiler);
+
+    // With deferred shading the cubes only fill the G-buffer here.
+    ProfileZone geometryZone(state.deferred ? profiler : nullptr, "geometry pass");
+    if (state.deferred) {
+        gBuffer->Resize(framebufferWidth, framebufferHeight);
+        gBuffer->BeginGeometryPass();
+    }
+
+    // Cull the cubes on the GPU and draw the survivors with one call.
+    if (gpuCuller != nullptr) {
+        ProfileZone cullZone(profiler, "cull");
+        gpuCuller->Cull(*streamBuffer);
+        cullZone.End();
+
+        ProfileZone cubeZone(profiler, "cubes");
+        (state.deferred ? gBufferShader : lightingPermutations->GetProgram(state.features)).UseProgram();
+        ObjectBlock objectBlock;
+        objectBlock.objectColor = CUBE_COLOR;
+        streamBuffer->BindUniformBlock(OBJECT_BLOCK_BINDING, objectBlock);
+        gpuCuller->Draw(cubeVAO, meshIndexType);
+    }
+
+    // Draw the cubes; the queue opens a profiler zone per program.
+    frame->queue->Execute(*streamBuffer, profiler);
+
+    if (state.deferred) {
+        gBuffer->EndGeometryPass();
+        geometryZone.End();
+
+        // Light every covered pixel once, whatever the overdraw was, then hand the depth to the
+        // lamps.
+        ProfileZone lightingZone(profiler, "lighting pass");
+        GLStateCache::Disable(GL_DEPTH_TEST);
+        deferredPermutations->GetProgram(state.features).UseProgram();
+        gBuffer->BindTextures();
+        GLStateCache::BindVertexArray(fullScreenVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        GLStateCache::Enable(GL_DEPTH_TEST);
+        gBuffer->BlitDepth();
+        lightingZone.End();
+
+        // The geometry pass writes every fragment that passes the depth test, the lighting pass
+        // reads every pixel.
+        if (profiler != nullptr) {
+            profiler->SetCounter("gbuffer write MB", gBuffer->GetFragmentsWritten() * GBuffer::BYTES_PER_PIXEL * 1e-6);
+            profiler->SetCounter("gbuffer read MB",
+                                 static_cast<double>(gBuffer->GetWidth()) * gBuffer->GetHeight() * GBuffer::BYTES_PER_PIXEL * 1e-6);
+        }
+    }
+    geometryZone.End();
+
+    ProfileZone lampZone(profiler, "lamps");
+    DrawLamps(frameBlock, *frame);
+    lampZone.End();
+
+    streamBuffer->EndFrame();
+    frameReport.Mark(STAGE_DRAW);
+}
+
+/**
+ * Starts preparing the next frame on the worker threads, from the camera and settings as they are
+ * now, with the animation advanced by deltaTime seconds.
+ */
+void PrepareFrame(float deltaTime)
+{
+    // Use the lighting variant of the frame's features if it's built; otherwise ask for it and
+    // keep the last one.
+    uint32_t features = LightingFeatures();
+    if (deferredShading ? deferredPermutations->Find(features) != nullptr : lightingPermutations->Find(features) != nullptr) {
+        (deferredShading ? deferredFeatures : forwardFeatures) = features;
+    }
+    preparedState.placeholder = !shadersReady;
+    preparedState.deferred = deferredShading;
+    preparedState.features = deferredShading ? deferredFeatures : forwardFeatures;
+
+    FramePipeline::Settings settings;
+    settings.deltaTime = deltaTime;
+    settings.view = camera.GetViewMatrix();
+    settings.projection = glm::perspective(glm::radians(camera.Zoom), (float)WIDTH / (float)HEIGHT, NEAR_PLANE, FAR_PLANE);
+    settings.cameraPosition = camera.Position;
+    settings.viewportHeight = framebufferHeight;
+    settings.nearPlane = NEAR_PLANE;
+    settings.farPlane = FAR_PLANE;
+
+    // GPU-culled cubes skip the queue, except for the placeholder frames; with CPU culling only
+    // the visible ones are queued.
+    settings.cull = cpuCulling;
+    settings.queue = gpuCuller == nullptr || preparedState.placeholder;
+    if (preparedState.placeholder) {
+        settings.program = placeholderProgramId;
+    }
+    else {
+        settings.program = preparedState.deferred ? gBufferProgramId : cubeProgramIds[preparedState.features];
+    }
+    settings.material = cubeMaterialId;
+    settings.meshes = cubeMeshIds;
+    framePipeline->Prepare(settings);
+}
+
+/**
+ * Draws the cubes queued with the placeholder program, without lights or shadows: a frame that only
+ * needs the program linked at startup.
+ */
+void RenderPlaceholder(const FrameBlock& frameBlock, const FramePipeline::Frame& frame)
+{
+    streamBuffer->BeginFrame();
+    streamBuffer->BindUniformBlock(FRAME_BLOCK_BINDING, frameBlock);
+    frame.queue->Upload(*streamBuffer);
+    frame.queue->Execute(*streamBuffer, profiler);
+    streamBuffer->EndFrame();
+    frameReport.Mark(STAGE_DRAW);
+}
+
+/**
+ * Draws a lamp at every light, in its color. Each lamp gets the level of detail its size on screen
+ * needs, as the cubes do; the lights are sorted by level into lampLights and every level in use is
+ * one instanced draw.
+ */
+void DrawLamps(const FrameBlock& frameBlock, const FramePipeline::Frame& frame)
+{
+    const size_t lampCount = lightGrid->LightCount();
+    lampCenters.resize(lampCount);
+    for (size_t i = 0; i < lampCount; ++i) {
+        lampCenters[i] = frame.lights[i].position;
+    }
+    lodSelector->SelectSpheres(lampCenters, LAMP_SCALE * Scene::CUBE_BOUNDING_RADIUS, LAMP_SCALE,
+                               frame.settings.cameraPosition, frameBlock.projection, framebufferHeight, lampLods);
+
+    // Count the lamps at each level, then list them level by level. Lights fit in 16 bits (see
+    // LightGrid::MAX_LIGHTS).
+    size_t firstLamp[MESH_MAX_LODS + 1] = {};
+    for (uint8_t lod : lampLods) {
+        ++firstLamp[lod + 1];
+    }
+    for (size_t lod = 0; lod < MESH_MAX_LODS; ++lod) {
+        firstLamp[lod + 1] += firstLamp[lod];
+    }
+    size_t nextLamp[MESH_MAX_LODS];
+    std::copy(firstLamp, firstLamp + MESH_MAX_LODS, nextLamp);
+    lampLights.resize(lampCount);
+    for (size_t i = 0; i < lampCount; ++i) {
+        lampLights[nextLamp[lampLods[i]]++] = static_cast<uint16_t>(i);
+    }
+
+    // Orphaned like the light grid's buffers. Buffer textures cannot be empty, hence the padding.
+    GLStateCache::BindBuffer(GL_COPY_WRITE_BUFFER, lampLightsBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, std::max<size_t>(lampCount * sizeof(uint16_t), 16), nullptr, GL_STREAM_DRAW);
+    if (lampCount > 0) {
+        glBufferSubData(GL_COPY_WRITE_BUFFER, 0, lampCount * sizeof(uint16_t), &lampLights[0]);
+    }
+    glActiveTexture(GL_TEXTURE0 + LAMP_LIGHTS_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, lampLightsTexture);
+    glActiveTexture(GL_TEXTURE0);
 
-    // Make the cube's shader part of the current rendering state.
-    lightingShader.UseProgram();
-
-    // Set the cube's color, the color and position of the light, and the camera's position.
-    lightingShader.setVec3("objectColor", 1.0f, 0.5f, 0.31f);
-    lightingShader.setVec3("lightColor",  1.0f, 1.0f, 1.0f);
-    lightingShader.setVec3("lightPos", lightPos);
-    lightingShader.setVec3("viewPos", camera.Position);
-
-    // View/Projection transformations.
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)WIDTH / (float)HEIGHT, 0.1f, 100.0f);
-    glm::mat4 view = camera.GetViewMatrix();
-    lightingShader.setMat4("projection", projection);
-    lightingShader.setMat4("view", view);
-
-    // World transformation.
-    glm::mat4 model;
-    lightingShader.setMat4("model", model);
-
-    // Render the cube. For glDrawArrays(...):
-    // - first argument specifies what kind of primitives to render.
-    // - second argument specifies the start index
-    // - third argument specifies the number of indices
-    glBindVertexArray(cubeVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-
-    // Make the lamp's shader part of the current rendering state.
     lampShader.UseProgram();
+    GLStateCache::BindVertexArray(lightVAO);
+    const size_t indexSize = meshIndexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+    for (size_t lod = 0; lod < meshLods.size() && lod < MESH_MAX_LODS; ++lod) {
+        GLsizei count = static_cast<GLsizei>(firstLamp[lod + 1] - firstLamp[lod]);
+        if (count == 0) {
+            continue;
+        }
+        lampShader.setInt("firstLamp", static_cast<int>(firstLamp[lod]));
+        GLintptr indexOffset = meshLods[lod].firstIndex * indexSize;
+        glDrawElementsInstanced(GL_TRIANGLES, static_cast<GLsizei>(meshLods[lod].indexCount), meshIndexType,
+                                (void*)indexOffset, count);
+    }
+}
+
+/**
+ * Renders a fixed number of frames into the headless context's framebuffer as fast as possible,
+ * then writes the frame report. Shaders are built up front and the animation advances by a fixed
+ * step, so runs are comparable.
+ */
+void RunHeadless(const Options& options)
+{
+    shaderCompiler->Finish();
+    OnShadersReady();
+    if (resourceStreamer != nullptr) {
+        resourceStreamer->Finish();
+    }
+
+    float time = 0.0f;
+    for (int frame = 0; frame < HEADLESS_WARMUP_FRAMES; ++frame) {
+        Render(time += HEADLESS_TIME_STEP);
+        if (frame == 0) {
+            glFinish();
+            ReportFramePresented();
+        }
+    }
+    glFinish();
+
+    // glFinish() stands in for the buffer swap: it charges the GL's work for the frame to the frame.
+    frameReport.Start(options.headlessFrames);
+    GLStateCache::ResetStatistics();
+    framePipeline->ResetStatistics();
+    for (int frame = 0; frame < options.headlessFrames; ++frame) {
+        if (profiler != nullptr) {
+            profiler->BeginFrame();
+        }
+        frameReport.BeginFrame();
+        Render(time += HEADLESS_TIME_STEP);
+        {
+            ProfileZone swapZone(profiler, "swap");
+            glFinish();
+        }
+        frameReport.Mark(STAGE_FINISH);
+        frameReport.EndFrame();
+        if (profiler != nullptr) {
+            profiler->EndFrame();
+        }
+    }
+    frameReport.Stop();
+    framePipeline->Finish();
+
+    const GLStateCache::Statistics& stateStatistics = GLStateCache::GetStatistics();
+    unsigned int stateCalls = 0, stateCallsSkipped = 0;
+    for (int kind = 0; kind < GLStateCache::STATE_KIND_COUNT; ++kind) {
+        stateCalls += stateStatistics.issued[kind] + stateStatistics.skipped[kind];
+        stateCallsSkipped += stateStatistics.skipped[kind];
+    }
+
+    size_t visibleInstances = scene.Size();
+    if (gpuCuller != nullptr) {
+        visibleInstances = gpuCuller->ReadVisibleCount();
+    }
+    else if (cpuCulling) {
+        visibleInstances = visibleObjectCount;
+    }
+
+    const RenderQueue::Statistics& queueStatistics = drawnFrame->queue->GetStatistics();
+    unsigned int drawCalls = queueStatistics.drawCalls + 1;     // and the lamps
+    if (gpuCuller != nullptr) {
+        drawCalls += gpuCuller->GetDrawCalls();
+    }
+
+    std::vector<std::pair<std::string, std::string>> properties = {
+        { "renderer", reinterpret_cast<const char*>(glGetString(GL_RENDERER)) },
+        { "version", reinterpret_cast<const char*>(glGetString(GL_VERSION)) },
+        { "resolution", std::to_string(WIDTH) + "x" + std::to_string(HEIGHT) },
+        { "instances", std::to_string(scene.Size()) },
+        { "state_calls", std::to_string(stateCalls) },
+        { "state_calls_skipped", std::to_string(stateCallsSkipped) },
+        { "draw_calls", std::to_string(drawCalls) },
+        { "program_changes", std::to_string(queueStatistics.programChanges) },
+        { "culling", gpuCuller != nullptr ? "gpu" : (cpuCulling ? "cpu" : "off") },
+        { "visible_instances", std::to_string(visibleInstances) },
+        { "lights", std::to_string(lightGrid->LightCount()) },
+        { "light_indices", std::to_string(lightGrid->GetStatistics().indices) },
+        { "max_lights_per_cluster", std::to_string(lightGrid->GetStatistics().maxLightsPerCluster) },
+        { "clusters", std::to_string(lightGrid->GetStatistics().clustersX) + "x" +
+                      std::to_string(lightGrid->GetStatistics().clustersY) + "x" +
+                      std::to_string(lightGrid->GetStatistics().clustersZ) },
+        { "shading", deferredShading ? "deferred" : "forward" },
+        { "shadows", shadowsEnabled ? "on" : "off" },
+        { "lighting_variant", deferredShading ? deferredPermutations->Describe(deferredFeatures)
+                                              : lightingPermutations->Describe(forwardFeatures) },
+        { "lighting_variants_built", std::to_string(lightingPermutations->GetStatistics().builds +
+                                                    deferredPermutations->GetStatistics().builds) },
+        { "shadow_frames", std::to_string(shadowMaps->GetStatistics().frames) },
+        { "shadow_point_passes", std::to_string(shadowMaps->GetStatistics().pointPasses) },
+        { "shadow_cascade_passes", std::to_string(shadowMaps->GetStatistics().cascadePasses) }
+    };
+    // Objects per level of detail, finest first, and the triangles of the levels they drew.
+    const LodSelector::Statistics& lodStatistics = drawnFrame->lodStatistics;
+    std::string lodObjects;
+    for (size_t lod = 0; lod < lodSelector->LodCount(); ++lod) {
+        lodObjects += (lod > 0 ? "/" : "") + std::to_string(lodStatistics.objects[lod]);
+    }
+    properties.push_back({ "lod_pixel_error", std::to_string(lodSelector->GetPixelError()) });
+    properties.push_back({ "lod_objects", lodObjects });
+    properties.push_back({ "lod_triangles", std::to_string(lodStatistics.triangles) });
+    std::string lampLodCounts;
+    for (size_t lod = 0; lod < lodSelector->LodCount(); ++lod) {
+        lampLodCounts += (lod > 0 ? "/" : "") + std::to_string(std::count(lampLods.begin(), lampLods.end(), lod));
+    }
+    properties.push_back({ "lamp_lods", lampLodCounts });
+    // Mean milliseconds to prepare a frame on the workers, from start to ready, and per task.
+    const FramePipeline::Statistics& pipelineStatistics = framePipeline->GetStatistics();
+    const double preparedFrames = static_cast<double>(std::max<size_t>(1, pipelineStatistics.frames));
+    properties.push_back({ "worker_threads", std::to_string(threadPool->ThreadCount()) });
+    properties.push_back({ "prepare_ms", std::to_string(pipelineStatistics.prepareMilliseconds / preparedFrames) });
+    for (size_t task = 0; task < framePipeline->GetGraph().Size(); ++task) {
+        properties.push_back({ std::string("prepare_") + framePipeline->GetGraph().GetName(task) + "_ms",
+                               std::to_string(pipelineStatistics.taskMilliseconds[task] / preparedFrames) });
+    }
+    properties.push_back({ "first_frame_ms", std::to_string(firstFrameMilliseconds) });
+    properties.push_back({ "complete_frame_ms", std::to_string(completeFrameMilliseconds) });
+    if (resourceStreamer != nullptr) {
+        const ResourceStreamer::Statistics& resourceStatistics = resourceStreamer->GetStatistics();
+        properties.push_back({ "resource_uploads", resourceStatistics.hasLoaderThread ? "loader thread" : "render thread" });
+        properties.push_back({ "resources_loaded", std::to_string(resourceStatistics.published) });
+        properties.push_back({ "resource_max_queue_depth", std::to_string(resourceStatistics.maxQueueDepth) });
+        properties.push_back({ "resource_max_latency_ms", std::to_string(resourceStatistics.maxLatencyMilliseconds) });
+    }
+    if (shaderReloader != nullptr) {
+        properties.push_back({ "shader_reloads", std::to_string(shaderReloader->GetStatistics().reloads) });
+        properties.push_back({ "shader_reload_failures", std::to_string(shaderReloader->GetStatistics().failures) });
+    }
+    if (deferredShading) {
+        // Bytes per frame: the fragments that reached the G-buffer, and every pixel read back.
+        size_t pixels = static_cast<size_t>(gBuffer->GetWidth()) * gBuffer->GetHeight();
+        properties.push_back({ "gbuffer_bytes_per_pixel", std::to_string(GBuffer::BYTES_PER_PIXEL) });
+        properties.push_back({ "gbuffer_write_bytes", std::to_string(gBuffer->GetFragmentsWritten() * GBuffer::BYTES_PER_PIXEL) });
+        properties.push_back({ "gbuffer_read_bytes", std::to_string(pixels * GBuffer::BYTES_PER_PIXEL) });
+    }
+
+    if (options.reportPath == "-") {
+        frameReport.WriteJson(std::cout, properties);
+    }
+    else {
+        std::ofstream report(options.reportPath.c_str());
+        frameReport.WriteJson(report, properties);
+        if (report) {
+            std::cout << "Wrote " << frameReport.FrameCount() << " frames to " << options.reportPath << std::endl;
+        }
+        else {
+            std::cerr << "Unable to write frame report to " << options.reportPath << std::endl;
+        }
+    }
+}
+
+/**
+ * Puts the scene, the clock and the camera back where a regression scenario starts, with no frame
+ * being prepared, and renders the warm-up frames, so every run of the path draws the same frames.
+ */
+void RewindRegression(const Options& options, const RegressionScenario& scenario, float& time)
+{
+    framePipeline->Finish();
+    scene.CreateGrid(std::max<size_t>(options.instances, 1));
+    scene.CreateLights(options.lights);
+
+    const CameraKey start = SampleCameraPath(scenario, 0);
+    camera.SetPose(start.position, start.yaw, start.pitch);
+    time = 0.0f;
+    lastFrame = 0.0f;
+    for (int frame = 0; frame < HEADLESS_WARMUP_FRAMES; ++frame) {
+        Render(time += HEADLESS_TIME_STEP);
+    }
+    glFinish();
+}
+
+/**
+ * Renders a regression scenario like RunHeadless(), with the camera following the scenario's path,
+ * and checks its checkpoint frames, read back through a FrameCapture while the run goes on, against
+ * the golden images in the regression directory. With --regress-baselines the path is replayed
+ * from the start REGRESSION_TIMING_RUNS times and the median of the runs' p50 frame times is checked
+ * against the baseline there too. With --regress-update it records the images, and the baseline if
+ * there is a baseline directory, instead. Writes a frame report with the results and returns true
+ * if everything passed.
+ */
+bool RunRegression(const Options& options, const RegressionScenario& scenario, GLuint framebuffer)
+{
+    shaderCompiler->Finish();
+    OnShadersReady();
+    if (resourceStreamer != nullptr) {
+        resourceStreamer->Finish();
+    }
+
+    const std::string& directory = options.regressionDirectory;
+    const bool timing = !options.baselineDirectory.empty();
+    const std::string baselinePath = timing ? BaselinePath(options.baselineDirectory, scenario) : std::string();
+    FrameTimeBaseline baseline = { 0.0, 0.0 };
+    const bool hasBaseline = timing && !options.regressionUpdate && ReadBaseline(baselinePath, baseline);
+    const double limit = baseline.p50 * (1.0 + options.regressionThreshold);
+
+    // Every run captures the checkpoints, so every run does the same work, but only the first run's
+    // frames are kept; comparing them waits until the runs are over.
+    FrameCapture capture(WIDTH, HEIGHT);
+    std::vector<std::pair<int, std::vector<uint8_t>>> capturedFrames;
+    bool collecting = true;
+    FrameCapture::FrameCallback collect = [&](int frame, const uint8_t* pixels) {
+        if (collecting) {
+            capturedFrames.push_back(std::make_pair(frame, std::vector<uint8_t>(pixels, pixels + WIDTH * HEIGHT * 4)));
+        }
+    };
+
+    // glFlush() stands in for the buffer swap: it hands the frame to the GL without waiting for it,
+    // so the GL can fall behind by as much as the stream buffer and the capture ring allow.
+    const int timingRuns = timing ? REGRESSION_TIMING_RUNS : 1;
+    std::vector<double> p50s, p99s;
+    float time = 0.0f;
+    for (int run = 0; run < timingRuns; ++run) {
+        RewindRegression(options, scenario, time);
+        collecting = run == 0;
+        frameReport.Start(scenario.frames);
+        for (int frame = 0; frame < scenario.frames; ++frame) {
+            // Render() draws the frame prepared during the call before and starts on the next one
+            // from the camera as it is now, so the camera runs a frame ahead.
+            const CameraKey pose = SampleCameraPath(scenario, frame + 1);
+            camera.SetPose(pose.position, pose.yaw, pose.pitch);
+
+            frameReport.BeginFrame();
+            capture.Poll(collect);
+            Render(time += HEADLESS_TIME_STEP);
+            if (std::find(scenario.checkpoints.begin(), scenario.checkpoints.end(), frame) != scenario.checkpoints.end()) {
+                capture.Capture(framebuffer, frame, collect);
+            }
+            glFlush();
+            frameReport.Mark(STAGE_FINISH);
+            frameReport.EndFrame();
+        }
+        frameReport.Stop();
+        capture.Flush(collect);
+
+        p50s.push_back(frameReport.FramePercentile(50));
+        p99s.push_back(frameReport.FramePercentile(99));
+        if (timing) {
+            std::cout << scenario.name << ": run " << run + 1 << " of " << timingRuns << ", p50 " << p50s.back()
+                      << " ms" << std::endl;
+        }
+    }
+    std::sort(p50s.begin(), p50s.end());
+    std::sort(p99s.begin(), p99s.end());
+    FrameTimeBaseline measured = { p50s[p50s.size() / 2], p99s[p99s.size() / 2] };
+
+    std::vector<std::pair<std::string, std::string>> properties = {
+        { "scenario", scenario.name },
+        { "renderer", reinterpret_cast<const char*>(glGetString(GL_RENDERER)) },
+        { "resolution", std::to_string(WIDTH) + "x" + std::to_string(HEIGHT) },
+        { "capture_stalls", std::to_string(capture.GetStatistics().stalls) },
+        { "timing_runs", std::to_string(timingRuns) }
+    };
+    bool passed = true;
+
+    for (size_t i = 0; i < capturedFrames.size(); ++i) {
+        const int frame = capturedFrames[i].first;
+        const RgbImage image = DownsampleFrame(capturedFrames[i].second.data(), WIDTH, HEIGHT, REGRESSION_DOWNSAMPLE);
+        const std::string goldenPath = GoldenImagePath(directory, scenario, frame);
+        const std::string prefix = "frame_" + std::to_string(frame);
+
+        if (options.regressionUpdate) {
+            if (WritePpm(goldenPath, image)) {
+                std::cout << "Wrote " << goldenPath << std::endl;
+            }
+            else {
+                std::cerr << "Unable to write " << goldenPath << std::endl;
+                passed = false;
+            }
+            continue;
+        }
+
+        RgbImage golden;
+        if (!ReadPpm(goldenPath, golden)) {
+            std::cerr << scenario.name << " frame " << frame << ": no golden image " << goldenPath
+                      << "; record it with --regress-update" << std::endl;
+            properties.push_back({ prefix, "missing golden image" });
+            passed = false;
+            continue;
+        }
+
+        const ImageDifference difference = CompareImages(image, golden, REGRESSION_DELTA_E);
+        const bool matches = difference.differing <= REGRESSION_MAX_DIFFERING;
+        std::cout << scenario.name << " frame " << frame << ": mean delta E " << difference.meanDeltaE << ", max "
+                  << difference.maxDeltaE << ", " << difference.differing * 100.0 << "% of pixels over "
+                  << REGRESSION_DELTA_E << (matches ? ": ok" : ": FAILED") << std::endl;
+        properties.push_back({ prefix + "_delta_e_mean", std::to_string(difference.meanDeltaE) });
+        properties.push_back({ prefix + "_delta_e_max", std::to_string(difference.maxDeltaE) });
+        properties.push_back({ prefix + "_differing", std::to_string(difference.differing) });
+        if (!matches) {
+            // Keep the frame that failed, next to the report, to look at.
+            std::string actualPath = std::string(scenario.name) + "." + std::to_string(frame) + ".actual.ppm";
+            if (WritePpm(actualPath, image)) {
+                std::cout << "Wrote " << actualPath << std::endl;
+            }
+            passed = false;
+        }
+    }
+    if (capturedFrames.size() != scenario.checkpoints.size()) {
+        std::cerr << scenario.name << ": only " << capturedFrames.size() << " of " << scenario.checkpoints.size()
+                  << " frames were read back" << std::endl;
+        passed = false;
+    }
+
+    if (!timing) {
+        properties.push_back({ "frame_time", "not checked" });
+    }
+    else if (options.regressionUpdate) {
+        if (WriteBaseline(baselinePath, measured)) {
+            std::cout << "Wrote " << baselinePath << std::endl;
+        }
+        else {
+            std::cerr << "Unable to write " << baselinePath << std::endl;
+            passed = false;
+        }
+    }
+    else if (!hasBaseline) {
+        // Baselines belong to the machine that gates; a new machine records its own.
+        std::cout << scenario.name << ": no baseline " << baselinePath << ", frame time not checked" << std::endl;
+    }
+    else {
+        const bool fastEnough = measured.p50 <= limit;
+        std::cout << scenario.name << ": median p50 " << measured.p50 << " ms against a baseline of " << baseline.p50
+                  << " ms, limit " << limit << (fastEnough ? " ms: ok" : " ms: FAILED") << std::endl;
+        properties.push_back({ "baseline_p50_ms", std::to_string(baseline.p50) });
+        properties.push_back({ "limit_p50_ms", std::to_string(limit) });
+        passed = passed && fastEnough;
+    }
+    properties.push_back({ "result", passed ? "pass" : "fail" });
 
-    // View/Projection transformations.
-    lampShader.setMat4("projection", projection);
-    lampShader.setMat4("view", view);
+    if (options.reportPath == "-") {
+        frameReport.WriteJson(std::cout, properties);
+    }
+    else {
+        std::ofstream report(options.reportPath.c_str());
+        frameReport.WriteJson(report, properties);
+        if (!report) {
+            std::cerr << "Unable to write frame report to " << options.reportPath << std::endl;
+        }
+    }
+    return passed;
+}
 
-    // World transformations. Note that the lamp's cube is smaller than the main cube.
-    model = glm::mat4();
-    model = glm::translate(model, lightPos);
-    model = glm::scale(model, glm::vec3(0.2f));
-    lampShader.setMat4("model", model);
+/**
+ * Renders the scene's first frame with SoftwareRasterizer instead of the GL: with --raster, once,
+ * to a PPM; with --bench-raster, again and again on 1, 2, 4... threads up to one per hardware
+ * thread, printing the best time of each count and the triangles and pixels per second per core.
+ * The image must be the same on every thread count. Needs no GL context.
+ */
+void RunSoftwareRasterizer(const Options& options)
+{
+    if (options.instances > 0) {
+        scene.CreateGrid(options.instances);
+    }
+    if (options.lights != 1) {
+        scene.CreateLights(options.lights);
+    }
 
-    // Render the lamp. For glDrawArrays(...):
-    // - first argument specifies what kind of primitives to render.
-    // - second argument specifies the start index
-    // - third argument specifies the number of indices
-    glBindVertexArray(lightVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
+    const glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)WIDTH / (float)HEIGHT, NEAR_PLANE, FAR_PLANE);
+    const glm::mat4 view = camera.GetViewMatrix();
+    std::vector<glm::mat4> instanceModels(scene.Size());
+    std::vector<glm::mat3> instanceNormalMatrices(scene.Size());
+    scene.GetTransforms(&instanceModels[0], &instanceNormalMatrices[0]);
+    const std::vector<PointLight>& lights = scene.GetLights();
+    const Mesh cubeMesh = WeldVertices(reinterpret_cast<const MeshVertex*>(vertices), sizeof(vertices) / (6 * sizeof(float)));
+
+    auto renderFrame = [&](SoftwareRasterizer& rasterizer) {
+        rasterizer.BeginFrame(view, projection, camera.Position, glm::vec3(0.1f), AMBIENT_COLOR,
+                              options.specular ? SPECULAR_STRENGTH : 0.0f, lights.data(), lights.size());
+        rasterizer.DrawLit(cubeMesh, &instanceModels[0], &instanceNormalMatrices[0], scene.Size(), glm::vec3(CUBE_COLOR));
+        rasterizer.DrawLamps(cubeMesh);
+        rasterizer.EndFrame();
+    };
+
+    if (!options.rasterPath.empty()) {
+        ThreadPool pool;
+        SoftwareRasterizer rasterizer(WIDTH, HEIGHT, &pool);
+        renderFrame(rasterizer);
+
+        const SoftwareRasterizer::Statistics& statistics = rasterizer.GetStatistics();
+        if (rasterizer.WritePpm(options.rasterPath)) {
+            std::cout << "Wrote " << options.rasterPath << std::endl;
+        }
+        else {
+            std::cerr << "Unable to write " << options.rasterPath << std::endl;
+        }
+        std::cout << "checksum " << std::hex << rasterizer.Checksum() << std::dec << ", "
+                  << statistics.triangles << " triangles, " << statistics.trianglesSetUp << " set up, "
+                  << statistics.binEntries << " bin entries, " << statistics.fragmentsShaded << " fragments" << std::endl;
+    }
 
-    glfwSwapBuffers(window);
+    if (options.rasterBenchmarkFrames > 0) {
+        const unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<unsigned int> threadCounts;
+        for (unsigned int threads = 1; threads < hardwareThreads; threads *= 2) {
+            threadCounts.push_back(threads);
+        }
+        threadCounts.push_back(hardwareThreads);
+
+        std::cout << "Software rasterizer benchmark, " << WIDTH << "x" << HEIGHT << ", " << scene.Size() << " cubes, "
+                  << lights.size() << " lights, best of " << options.rasterBenchmarkFrames << " frames" << std::endl;
+        std::cout << "threads  frame ms  geometry  binning  raster  speedup  Mtri/s/core  Mpix/s/core" << std::endl;
+
+        uint64_t firstChecksum = 0;
+        double oneThreadMilliseconds = 0.0;
+        bool identical = true;
+        for (size_t i = 0; i < threadCounts.size(); ++i) {
+            // The calling thread works too, so a pool of n - 1 makes n.
+            std::unique_ptr<ThreadPool> pool(threadCounts[i] > 1 ? new ThreadPool(threadCounts[i] - 1) : nullptr);
+            SoftwareRasterizer rasterizer(WIDTH, HEIGHT, pool.get());
+            renderFrame(rasterizer);
+
+            SoftwareRasterizer::Statistics best = rasterizer.GetStatistics();
+            double bestMilliseconds = std::numeric_limits<double>::max();
+            for (int frame = 0; frame < options.rasterBenchmarkFrames; ++frame) {
+                auto start = std::chrono::steady_clock::now();
+                renderFrame(rasterizer);
+                double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                if (milliseconds < bestMilliseconds) {
+                    bestMilliseconds = milliseconds;
+                    best = rasterizer.GetStatistics();
+                }
+            }
+
+            if (i == 0) {
+                firstChecksum = rasterizer.Checksum();
+                oneThreadMilliseconds = bestMilliseconds;
+            }
+            identical = identical && rasterizer.Checksum() == firstChecksum;
+
+            double coreSeconds = bestMilliseconds * 1e-3 * threadCounts[i];
+            std::printf("%7u  %8.2f  %8.2f  %7.2f  %6.2f  %6.2fx  %11.2f  %11.2f\n", threadCounts[i], bestMilliseconds,
+                        best.geometryMilliseconds, best.binningMilliseconds, best.rasterMilliseconds,
+                        oneThreadMilliseconds / bestMilliseconds, best.triangles / coreSeconds * 1e-6,
+                        best.fragmentsShaded / coreSeconds * 1e-6);
+        }
+        std::cout << "checksum " << std::hex << firstChecksum << std::dec
+                  << (identical ? ", identical on every thread count" : ", DIFFERS between thread counts") << std::endl;
+    }
+}
+
+/**
+ * Parses the command line. Unknown arguments are reported and ignored.
+ */
+Options ParseCommandLine(int argc, const char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--bench-uniforms") == 0) {
+            options.uniformBenchmarkFrames = 100000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                options.uniformBenchmarkFrames = std::atoi(argv[++i]);
+            }
+        }
+        else if (std::strcmp(argv[i], "--shader-cache") == 0 && i + 1 < argc) {
+            options.shaderCacheDirectory = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+            options.instances = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--no-shader-cache") == 0) {
+            options.shaderCacheDirectory.clear();
+        }
+        else if (std::strcmp(argv[i], "--no-pack-vertices") == 0) {
+            options.packVertices = false;
+        }
+        else if (std::strcmp(argv[i], "--mesh") == 0 && i + 1 < argc) {
+            options.meshPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--mesh-cache") == 0 && i + 1 < argc) {
+            options.meshCacheDirectory = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc) {
+            options.lodPixelError = static_cast<float>(std::atof(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--headless") == 0) {
+            options.headlessFrames = 1000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                options.headlessFrames = std::atoi(argv[++i]);
+            }
+        }
+        else if (std::strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            options.reportPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--profile") == 0) {
+            options.profile = true;
+        }
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            options.tracePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--gpu-cull") == 0) {
+            options.gpuCulling = true;
+        }
+        else if (std::strcmp(argv[i], "--cpu-cull") == 0) {
+            options.cpuCulling = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-culling") == 0) {
+            options.cullingBenchmarkObjects = 1000000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                options.cullingBenchmarkObjects = std::strtoul(argv[++i], nullptr, 10);
+            }
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.threads = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--bench-pipeline") == 0) {
+            options.pipelineBenchmarkObjects = 100000;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                options.pipelineBenchmarkObjects = std::strtoul(argv[++i], nullptr, 10);
+            }
+        }
+        else if (std::strcmp(argv[i], "--deferred") == 0) {
+            options.deferred = true;
+        }
+        else if (std::strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+            options.lights = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--shadows") == 0) {
+            options.shadows = true;
+        }
+        else if (std::strcmp(argv[i], "--sun") == 0) {
+            options.sun = true;
+        }
+        else if (std::strcmp(argv[i], "--paused") == 0) {
+            options.paused = true;
+        }
+        else if (std::strcmp(argv[i], "--no-watch-shaders") == 0) {
+            options.watchShaders = false;
+        }
+        else if (std::strcmp(argv[i], "--no-specular") == 0) {
+            options.specular = false;
+        }
+        else if (std::strcmp(argv[i], "--all-permutations") == 0) {
+            options.allPermutations = true;
+        }
+        else if (std::strcmp(argv[i], "--raster") == 0 && i + 1 < argc) {
+            options.rasterPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--regress") == 0 && i + 1 < argc) {
+            options.regressionDirectory = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--scenario") == 0 && i + 1 < argc) {
+            options.scenario = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--regress-baselines") == 0 && i + 1 < argc) {
+            options.baselineDirectory = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--regress-update") == 0) {
+            options.regressionUpdate = true;
+        }
+        else if (std::strcmp(argv[i], "--regress-threshold") == 0 && i + 1 < argc) {
+            options.regressionThreshold = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--bench-raster") == 0) {
+            options.rasterBenchmarkFrames = 20;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                options.rasterBenchmarkFrames = std::atoi(argv[++i]);
+            }
+        }
+        else {
+            std::cerr << "Unknown argument: " << argv[i] << std::endl;
+        }
+    }
+    return options;
 }
 
 /**
@@ -258,7 +1537,7 @@ GLFWwindow* InitGlfw()
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
     // Tell OpenGL to do depth comparisons and update the depth buffer.
-    glEnable(GL_DEPTH_TEST);
+    GLStateCache::Enable(GL_DEPTH_TEST);
 
     // Set this to true so GLEW knows to use a modern approach to retrieving function pointers and extensions.
     glewExperimental = GL_TRUE;
@@ -272,61 +1551,474 @@ GLFWwindow* InitGlfw()
     return window;
 }
 
-void InitShaders()
+/**
+ * Has the reloader rebuild program when one of its files changes. A rebuilt program starts with
+ * every uniform at its default, so the sampler units are set again after the swap.
+ */
+void WatchProgram(GLSLProgram& program, const std::vector<ShaderCompiler::ShaderFile>& files)
+{
+    if (shaderReloader != nullptr) {
+        shaderReloader->Watch(program, files, [](GLSLProgram&) { SetSamplerUnits(); });
+    }
+}
+
+void InitShaders(const Options& options)
 {
-    // Load shaders and create the GLSL programs for the cube.
-    lightingShader.AddShaderFromFile(GL_VERTEX_SHADER, LIGHTING_VERTEX_SHADER_PATH);
-    lightingShader.AddShaderFromFile(GL_FRAGMENT_SHADER, LIGHTING_FRAGMENT_SHADER_PATH);
-    lightingShader.CreateAndLinkProgram();
+    // Queue the GLSL programs for the cubes and the lamps. Both are read, compiled and linked in the
+    // background.
+    shaderStart = std::chrono::steady_clock::now();
+
+    // The placeholder program is small enough to link here, so there is something to draw with
+    // from the first frame.
+    placeholderShader.AddShaderFromFile(GL_VERTEX_SHADER, LIGHTING_VERTEX_SHADER_PATH);
+    placeholderShader.AddShaderFromFile(GL_FRAGMENT_SHADER, PLACEHOLDER_FRAGMENT_SHADER_PATH);
+    placeholderShader.SetUniformBlockBinding("FrameBlock", FRAME_BLOCK_BINDING);
+    placeholderShader.SetUniformBlockBinding("ObjectBlock", OBJECT_BLOCK_BINDING);
+    placeholderShader.CreateAndLinkProgram();
+
+    // The lighting programs' variants; the defines are in the order of the LightingFeature bits.
+    // Only the variants of the startup features are built now, the others when they are first
+    // needed, or all of them at once with --all-permutations.
+    const std::vector<std::string> lightingDefines = { "SINGLE_LIGHT", "SPECULAR", "SHADOWS", "SUN" };
+    std::vector<ShaderCompiler::ShaderFile> lightingFiles = {
+        { GL_VERTEX_SHADER, LIGHTING_VERTEX_SHADER_PATH },
+        { GL_FRAGMENT_SHADER, LIGHTING_FRAGMENT_SHADER_PATH, { LIGHTING_LIBRARY_PATH } }
+    };
+    lightingPermutations = new ShaderPermutations(*shaderCompiler, lightingFiles, lightingDefines,
+        [lightingFiles](GLSLProgram& program, uint32_t) {
+            program.AddDefine("SPECULAR_STRENGTH", std::to_string(SPECULAR_STRENGTH));
+            program.AddDefine("SHININESS", std::to_string(SHININESS));
+            program.SetUniformBlockBinding("FrameBlock", FRAME_BLOCK_BINDING);
+            program.SetUniformBlockBinding("LightBlock", LIGHT_BLOCK_BINDING);
+            program.SetUniformBlockBinding("ObjectBlock", OBJECT_BLOCK_BINDING);
+            program.SetUniformBlockBinding("ShadowBlock", SHADOW_BLOCK_BINDING);
+            WatchProgram(program, lightingFiles);
+        },
+        [](GLSLProgram&, uint32_t) { SetSamplerUnits(); });
+
+    std::vector<ShaderCompiler::ShaderFile> lampFiles = {
+        { GL_VERTEX_SHADER, LAMP_VERTEX_SHADER_PATH },
+        { GL_FRAGMENT_SHADER, LAMP_FRAGMENT_SHADER_PATH }
+    };
+    lampShader.SetUniformBlockBinding("FrameBlock", FRAME_BLOCK_BINDING);
+    shaderCompiler->Submit(lampShader, lampFiles);
+    WatchProgram(lampShader, lampFiles);
+
+    // The deferred path's programs: the geometry pass shares cube.vs with the forward path.
+    std::vector<ShaderCompiler::ShaderFile> gBufferFiles = {
+        { GL_VERTEX_SHADER, LIGHTING_VERTEX_SHADER_PATH },
+        { GL_FRAGMENT_SHADER, GBUFFER_FRAGMENT_SHADER_PATH }
+    };
+    gBufferShader.AddDefine("SPECULAR_STRENGTH", std::to_string(SPECULAR_STRENGTH));
+    gBufferShader.SetUniformBlockBinding("FrameBlock", FRAME_BLOCK_BINDING);
+    gBufferShader.SetUniformBlockBinding("ObjectBlock", OBJECT_BLOCK_BINDING);
+    shaderCompiler->Submit(gBufferShader, gBufferFiles);
+    WatchProgram(gBufferShader, gBufferFiles);
+
+    std::vector<ShaderCompiler::ShaderFile> deferredFiles = {
+        { GL_VERTEX_SHADER, DEFERRED_VERTEX_SHADER_PATH },
+        { GL_FRAGMENT_SHADER, DEFERRED_FRAGMENT_SHADER_PATH, { LIGHTING_LIBRARY_PATH } }
+    };
+    deferredPermutations = new ShaderPermutations(*shaderCompiler, deferredFiles, lightingDefines,
+        [deferredFiles](GLSLProgram& program, uint32_t) {
+            program.AddDefine("SHININESS", std::to_string(SHININESS));
+            program.SetUniformBlockBinding("FrameBlock", FRAME_BLOCK_BINDING);
+            program.SetUniformBlockBinding("LightBlock", LIGHT_BLOCK_BINDING);
+            program.SetUniformBlockBinding("DeferredBlock", DEFERRED_BLOCK_BINDING);
+            program.SetUniformBlockBinding("ShadowBlock", SHADOW_BLOCK_BINDING);
+            WatchProgram(program, deferredFiles);
+        },
+        [](GLSLProgram&, uint32_t) { SetSamplerUnits(); });
+
+    forwardFeatures = deferredFeatures = LightingFeatures();
+    lightingPermutations->Request(forwardFeatures);
+    deferredPermutations->Request(deferredFeatures);
+    if (options.allPermutations) {
+        lightingPermutations->RequestAll();
+        deferredPermutations->RequestAll();
+    }
 
-    // Load shaders and create the GLSL programs for the lamp.
-    lampShader.AddShaderFromFile(GL_VERTEX_SHADER, LAMP_VERTEX_SHADER_PATH);
-    lampShader.AddShaderFromFile(GL_FRAGMENT_SHADER, LAMP_FRAGMENT_SHADER_PATH);
-    lampShader.CreateAndLinkProgram();
+    // The shadow passes: all six faces of the point light's cube map at once through the geometry
+    // shader, and one cascade at a time.
+    if (options.shadows) {
+        std::vector<ShaderCompiler::ShaderFile> pointShadowFiles = {
+            { GL_VERTEX_SHADER, SHADOW_VERTEX_SHADER_PATH },
+            { GL_GEOMETRY_SHADER, SHADOW_POINT_GEOMETRY_SHADER_PATH },
+            { GL_FRAGMENT_SHADER, SHADOW_POINT_FRAGMENT_SHADER_PATH }
+        };
+        pointShadowShader.SetUniformBlockBinding("ShadowPassBlock", SHADOW_PASS_BLOCK_BINDING);
+        shaderCompiler->Submit(pointShadowShader, pointShadowFiles);
+        WatchProgram(pointShadowShader, pointShadowFiles);
+
+        std::vector<ShaderCompiler::ShaderFile> cascadeShadowFiles = {
+            { GL_VERTEX_SHADER, SHADOW_CASCADE_VERTEX_SHADER_PATH },
+            { GL_FRAGMENT_SHADER, SHADOW_FRAGMENT_SHADER_PATH }
+        };
+        cascadeShadowShader.SetUniformBlockBinding("ShadowPassBlock", SHADOW_PASS_BLOCK_BINDING);
+        shaderCompiler->Submit(cascadeShadowShader, cascadeShadowFiles);
+        WatchProgram(cascadeShadowShader, cascadeShadowFiles);
+    }
 
-    // Create cube's Vertex Array Object and bind to it.
-    glGenVertexArrays(1, &cubeVAO);
-    glBindVertexArray(cubeVAO);
+    const bool gpuCulling = options.gpuCulling && !options.cpuCulling && GpuCuller::IsSupported();
+    if (options.gpuCulling && !options.cpuCulling && !gpuCulling) {
+        std::cerr << "GPU culling needs OpenGL 4.3; culling the cubes on the CPU instead" << std::endl;
+    }
+    cpuCulling = (options.gpuCulling || options.cpuCulling) && !gpuCulling;
+    if (gpuCulling) {
+        std::vector<ShaderCompiler::ShaderFile> cullFiles = {
+            { GL_COMPUTE_SHADER, CULL_COMPUTE_SHADER_PATH }
+        };
+        cullShader.SetUniformBlockBinding("CullBlock", CULL_BLOCK_BINDING);
+        shaderCompiler->Submit(cullShader, cullFiles);
+        WatchProgram(cullShader, cullFiles);
+    }
+
+    // Everything the shaders read per frame is streamed through this ring buffer; leave room for
+    // the instance matrices of every cube on top of the uniform blocks, and for the model matrices
+    // again for the shadow passes.
+    size_t shadowInstanceSize = options.shadows ? scene.Size() * sizeof(glm::mat4) : 0;
+    streamBuffer = new StreamBuffer(STREAM_BUFFER_FRAME_SIZE + scene.Size() * (sizeof(glm::mat4) + sizeof(glm::mat3)) +
+                                    shadowInstanceSize);
+
+    // Weld the cube's triangle soup into an indexed mesh, reorder it for the vertex cache and
+    // pack it.
+    MeshBuildOptions meshOptions;
+    meshOptions.packPositions = options.packVertices;
+    meshOptions.packNormals = options.packVertices;
+    static_assert(sizeof(MeshVertex) == 6 * sizeof(float), "vertices[] is read as an array of MeshVertex");
+    const size_t vertexCount = sizeof(vertices) / (6 * sizeof(float));
+    MeshBuildStatistics meshStatistics;
+    PackedMesh cubeMesh = BuildMesh(reinterpret_cast<const MeshVertex*>(vertices), vertexCount, meshOptions, &meshStatistics);
+    meshIndexType = cubeMesh.indexType;
+    meshIndexCount = cubeMesh.indexCount;
+    VertexFormat meshFormat = cubeMesh.format;
+    float meshRadius = 0.0f;    // of the bounding sphere around the origin
+    for (size_t i = 0; i < vertexCount; ++i) {
+        meshRadius = glm::max(meshRadius, glm::length(glm::make_vec3(&vertices[i * 6])));
+    }
 
-    // Create the Vertex Buffer Object and bind to it.
+    std::cout << "Cube mesh: " << meshStatistics.verticesBefore << " -> " << meshStatistics.verticesAfter
+              << " vertices, " << meshStatistics.vertexBytesBefore << " -> " << meshStatistics.vertexBytesAfter
+              << " vertex bytes (+" << meshStatistics.indexBytesAfter << " index bytes), ACMR "
+              << meshStatistics.acmrBefore << " -> " << meshStatistics.acmrAfter << std::endl;
+
+    // Create the Vertex Buffer Object and the Element Buffer Object.
     glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-    // Position attribute
-    glVertexAttribPointer(
-            0,                      // vertex attribute to configure
-            3,                      // size of the vertex attribute (vec3 has 3 values)
-            GL_FLOAT,               // data is GL_FLOAT
-            GL_FALSE,               // don't normalize data
-            6 * sizeof(float),      // stride between consecutive attributes: XYZ for position and normals
-            (void*)0);              // position data offset is 0
-    glEnableVertexAttribArray(0);
-
-    // Normal attribute
-    glVertexAttribPointer(
-            1,                      // vertex attribute to configure
-            3,                      // size of the vertex attribute (vec3 has 3 values)
-            GL_FLOAT,               // data is GL_FLOAT
-            GL_FALSE,               // don't normalize data
-            6 * sizeof(float),      // stride between consecutive attributes: XYZ for position and normals
-            (void*)(3 * sizeof(float)));    // normal data offset is 3
-    glEnableVertexAttribArray(1);
+    GLStateCache::BindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, cubeMesh.vertexData.size(), &cubeMesh.vertexData[0], GL_STATIC_DRAW);
+    glGenBuffers(1, &EBO);
+    GLStateCache::BindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+    glBufferData(GL_COPY_WRITE_BUFFER, cubeMesh.indexData.size(), &cubeMesh.indexData[0], GL_STATIC_DRAW);
+
+    // Create cube's Vertex Array Object and bind to it. The element buffer binding is part of the
+    // VAO's state.
+    glGenVertexArrays(1, &cubeVAO);
+    GLStateCache::BindVertexArray(cubeVAO);
+    GLStateCache::BindBuffer(GL_ARRAY_BUFFER, VBO);
+    GLStateCache::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
+    // Position and normal attributes
+    meshFormat.Apply();
+
+    // Per-instance model and normal matrices, one column per location. The buffer and offsets are
+    // set by the render queue for every batch, once the matrices have been streamed.
+    for (GLuint column = 0; column < 4; ++column) {
+        glEnableVertexAttribArray(RenderQueue::INSTANCE_MODEL_LOCATION + column);
+        glVertexAttribDivisor(RenderQueue::INSTANCE_MODEL_LOCATION + column, 1);
+    }
+    for (GLuint column = 0; column < 3; ++column) {
+        glEnableVertexAttribArray(RenderQueue::INSTANCE_NORMAL_MATRIX_LOCATION + column);
+        glVertexAttribDivisor(RenderQueue::INSTANCE_NORMAL_MATRIX_LOCATION + column, 1);
+    }
 
     // Create the lamp's Vertex Array Object for the lamp and bind to it.
     // Note we're still bound to the VBO from above -- the vertices are the same.
     glGenVertexArrays(1, &lightVAO);
-    glBindVertexArray(lightVAO);
-
-    // Position attribute
-    glVertexAttribPointer(
-            0,                      // vertex attribute to configure
-            3,                      // size of the vertex attribute (vec3 has 3 values)
-            GL_FLOAT,               // data is GL_FLOAT
-            GL_FALSE,               // don't normalize data
-            6 * sizeof(float),      // stride between consecutive attributes: XYZ for position and (unused) normals
-            (void*)0);              // position data offset is 0
-    glEnableVertexAttribArray(0);
+    GLStateCache::BindVertexArray(lightVAO);
+    GLStateCache::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
+    // Position attribute only; the lamp doesn't use normals. Each instance reads its position and
+    // color from the light grid's buffer texture.
+    meshFormat.Apply(false);
+
+    // The shadow passes draw the cubes from the same buffers, with nothing but the positions and
+    // the model matrices, which ShadowMaps streams itself.
+    glGenVertexArrays(1, &shadowVAO);
+    GLStateCache::BindVertexArray(shadowVAO);
+    GLStateCache::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    meshFormat.Apply(false);
+    for (GLuint column = 0; column < 4; ++column) {
+        glEnableVertexAttribArray(RenderQueue::INSTANCE_MODEL_LOCATION + column);
+        glVertexAttribDivisor(RenderQueue::INSTANCE_MODEL_LOCATION + column, 1);
+    }
+
+    // The cubes go through the render queues, one per frame in the pipeline; the lamps are one
+    // instanced draw of their own.
+    for (RenderQueue*& renderQueue : renderQueues) {
+        renderQueue = new RenderQueue(scene.Size());
+    }
+    for (uint32_t mask = 0; mask < lightingPermutations->Size(); ++mask) {
+        cubeProgramIds.push_back(AddToRenderQueues([mask](RenderQueue& queue) {
+            return queue.AddProgram(lightingPermutations->GetProgram(mask), "cubes");
+        }));
+    }
+    gBufferProgramId = AddToRenderQueues([](RenderQueue& queue) { return queue.AddProgram(gBufferShader, "gbuffer"); });
+    placeholderProgramId = AddToRenderQueues([](RenderQueue& queue) { return queue.AddProgram(placeholderShader, "placeholder"); });
+    meshLods = cubeMesh.lods;
+    cubeMeshIds.push_back(AddToRenderQueues([](RenderQueue& queue) {
+        return queue.AddMesh({cubeVAO, meshIndexCount, meshIndexType, 0});
+    }));
+    cubeMaterialId = AddToRenderQueues([](RenderQueue& queue) { return queue.AddMaterial(CUBE_COLOR); });
+
+    lightGrid = new LightGrid();
+    glGenBuffers(1, &lampLightsBuffer);
+    glGenTextures(1, &lampLightsTexture);
+    GLStateCache::BindBuffer(GL_COPY_WRITE_BUFFER, lampLightsBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, lampLightsTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, lampLightsBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    gBuffer = new GBuffer();
+    glGenVertexArrays(1, &fullScreenVAO);
+
+    shadowMaps = new ShadowMaps(pointShadowShader, cascadeShadowShader);
+    glm::vec3 casterMin, casterMax;
+    scene.GetBounds(casterMin, casterMax);
+    shadowMaps->SetCasterBounds(casterMin, casterMax);
+    if (options.sun) {
+        shadowMaps->SetSun(SUN_DIRECTION, SUN_COLOR, options.shadows);
+    }
+
+    lodSelector = new LodSelector();
+    lodSelector->SetPixelError(options.lodPixelError);
+    lodSelector->SetLods(meshLods);
+    framePipeline = new FramePipeline(*threadPool, scene, *lodSelector, renderQueues);
+
+    if (gpuCulling) {
+        // Every cube draws the one mesh, at its level of detail.
+        gpuCuller = new GpuCuller(cullShader, scene.Size());
+        cullMeshIds.push_back(gpuCuller->AddMesh(meshIndexCount, 0, 0, meshRadius));
+        SetCulledObjects(lodSelector->GetObjectLods());
+    }
+
+    // With --mesh, the cube stands in for the mesh until it's loaded. A mesh is built once and
+    // cached; every later run maps the cache file and copies it into the buffers.
+    if (resourceStreamer != nullptr) {
+        MeshLoadOptions loadOptions;
+        loadOptions.build = meshOptions;
+        loadOptions.fitToUnitCube = true;
+        resourceStreamer->RequestMesh(options.meshPath, loadOptions, OnMeshLoaded);
+    }
+}
+
+/**
+ * Replaces the cube with a mesh loaded by the resource streamer: points every VAO at its buffers
+ * and gives the render queue, the level of detail selector and the GPU culler its levels and
+ * bounds.
+ */
+void OnMeshLoaded(const GpuMesh& mesh)
+{
+    GLStateCache::DeleteBuffer(VBO);
+    GLStateCache::DeleteBuffer(EBO);
+    VBO = mesh.vertexBuffer;
+    EBO = mesh.indexBuffer;
+    meshIndexType = mesh.indexType;
+    meshIndexCount = mesh.indexCount;
+    meshLods = mesh.lods;
+
+    GLStateCache::BindBuffer(GL_ARRAY_BUFFER, VBO);
+    GLStateCache::BindVertexArray(cubeVAO);
+    GLStateCache::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    mesh.format.Apply();
+    GLStateCache::BindVertexArray(lightVAO);
+    GLStateCache::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    mesh.format.Apply(false);
+    GLStateCache::BindVertexArray(shadowVAO);
+    GLStateCache::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    mesh.format.Apply(false);
+
+    cubeMeshIds.clear();
+    cullMeshIds.clear();
+    for (const MeshLod& lod : meshLods) {
+        const RenderMesh lodMesh = {cubeVAO, static_cast<GLsizei>(lod.indexCount), meshIndexType, lod.firstIndex};
+        cubeMeshIds.push_back(AddToRenderQueues([&lodMesh](RenderQueue& queue) { return queue.AddMesh(lodMesh); }));
+        if (gpuCuller != nullptr) {
+            cullMeshIds.push_back(gpuCuller->AddMesh(static_cast<GLsizei>(lod.indexCount), lod.firstIndex, 0, mesh.radius));
+        }
+    }
+    lodSelector->SetLods(meshLods);
+    if (gpuCuller != nullptr) {
+        SetCulledObjects(lodSelector->GetObjectLods());
+    }
+
+    const MeshLoader::Statistics& loadStatistics = meshLoader->GetStatistics();
+    std::cout << "Mesh loaded: " << meshIndexCount / 3 << " triangles in " << meshLods.size() << " levels of detail (coarsest "
+              << meshLods.back().indexCount / 3 << "), "
+              << (loadStatistics.hits > 0 ? "cached" : "built") << "; parse " << loadStatistics.parseMilliseconds
+              << " ms, build " << loadStatistics.buildMilliseconds << " ms, map " << loadStatistics.mapMilliseconds
+              << " ms, upload " << loadStatistics.bytesUploaded << " bytes in " << loadStatistics.uploadMilliseconds
+              << " ms" << std::endl;
+}
+
+/**
+ * Called once every program queued by InitShaders() is linked. Reports how long the build took
+ * and how much of it came from the binary cache.
+ */
+void OnShadersReady()
+{
+    shadersReady = true;
+    SetSamplerUnits();
+
+    double shaderMilliseconds =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - shaderStart).count();
+
+    std::cout << "Shaders ready in " << shaderMilliseconds << " ms";
+    if (binaryCache != nullptr) {
+        std::cout << (binaryCache->IsSupported() ? "" : " (binary cache unsupported by driver)")
+                  << " binary cache hits: " << binaryCache->Hits()
+                  << " misses: " << binaryCache->Misses()
+                  << " rejected: " << binaryCache->Rejects();
+    }
+    std::cout << std::endl;
+}
+
+/**
+ * Assigns every cube the GPU culler's mesh of its level of detail in objectLods.
+ */
+void SetCulledObjects(const std::vector<uint8_t>& objectLods)
+{
+    std::vector<uint32_t> objectMeshes(scene.Size(), cullMeshIds[0]);
+    for (size_t i = 0; i < objectLods.size() && i < objectMeshes.size(); ++i) {
+        objectMeshes[i] = cullMeshIds[objectLods[i]];
+    }
+    gpuCuller->SetObjects(objectMeshes.data(), objectMeshes.size());
+}
+
+/**
+ * Registers a program, mesh or material with every frame's render queue through add, and returns
+ * its id, which is the same in all of them.
+ */
+uint16_t AddToRenderQueues(const std::function<uint16_t(RenderQueue& queue)>& add)
+{
+    uint16_t id = 0;
+    for (RenderQueue* renderQueue : renderQueues) {
+        id = add(*renderQueue);
+    }
+    return id;
+}
+
+/**
+ * Called after every frame is presented. The first time, and the first time the frame had every
+ * program linked and every requested resource loaded, prints how long it took from startup.
+ */
+void ReportFramePresented()
+{
+    if (completeFrameMilliseconds >= 0.0) {
+        return;
+    }
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    if (firstFrameMilliseconds < 0.0) {
+        firstFrameMilliseconds = milliseconds;
+        std::cout << "First frame in " << milliseconds << " ms" << std::endl;
+    }
+    if (shadersReady && (resourceStreamer == nullptr || resourceStreamer->IsIdle())) {
+        completeFrameMilliseconds = milliseconds;
+        std::cout << "Complete frame in " << milliseconds << " ms" << std::endl;
+    }
+}
+
+/**
+ * Points the samplers of every program at the texture units their data is bound to. Sampler
+ * uniforms are program state, so this runs again whenever a program is rebuilt.
+ */
+void SetSamplerUnits()
+{
+    lightingPermutations->ForEachReady([](GLSLProgram& lightingShader, uint32_t) {
+        lightingShader.UseProgram();
+        lightingShader.setInt("lightData", LightGrid::LIGHT_DATA_UNIT);
+        lightingShader.setInt("clusters", LightGrid::CLUSTER_UNIT);
+        lightingShader.setInt("lightIndices", LightGrid::LIGHT_INDEX_UNIT);
+        lightingShader.setInt("pointShadowMap", ShadowMaps::POINT_SHADOW_UNIT);
+        lightingShader.setInt("cascadeShadowMap", ShadowMaps::CASCADE_SHADOW_UNIT);
+    });
+    lampShader.UseProgram();
+    lampShader.setInt("lightData", LightGrid::LIGHT_DATA_UNIT);
+    lampShader.setInt("lampLights", LAMP_LIGHTS_UNIT);
+    deferredPermutations->ForEachReady([](GLSLProgram& deferredShader, uint32_t) {
+        deferredShader.UseProgram();
+        deferredShader.setInt("lightData", LightGrid::LIGHT_DATA_UNIT);
+        deferredShader.setInt("clusters", LightGrid::CLUSTER_UNIT);
+        deferredShader.setInt("lightIndices", LightGrid::LIGHT_INDEX_UNIT);
+        deferredShader.setInt("gNormal", GBuffer::NORMAL_UNIT);
+        deferredShader.setInt("gAlbedo", GBuffer::ALBEDO_UNIT);
+        deferredShader.setInt("gDepth", GBuffer::DEPTH_UNIT);
+        deferredShader.setInt("pointShadowMap", ShadowMaps::POINT_SHADOW_UNIT);
+        deferredShader.setInt("cascadeShadowMap", ShadowMaps::CASCADE_SHADOW_UNIT);
+    });
+}
+
+/**
+ * The lighting features of the current settings; the bits of the lighting variant to draw with.
+ */
+uint32_t LightingFeatures()
+{
+    uint32_t features = 0;
+    if (scene.GetLights().size() == 1) {
+        features |= LIGHTING_SINGLE_LIGHT;
+    }
+    if (specularEnabled) {
+        features |= LIGHTING_SPECULAR;
+    }
+    if (shadowsEnabled) {
+        features |= LIGHTING_SHADOWS;
+    }
+    if (sunEnabled) {
+        features |= LIGHTING_SUN;
+    }
+    return features;
+}
+
+/**
+ * Accumulates the CPU time spent in Render() and prints the frame rate once a second.
+ */
+void ReportFrameRate(double cpuMilliseconds)
+{
+    static std::chrono::steady_clock::time_point periodStart = std::chrono::steady_clock::now();
+    static unsigned int frames = 0;
+    static double totalCpuMilliseconds = 0.0;
+
+    ++frames;
+    totalCpuMilliseconds += cpuMilliseconds;
+
+    double elapsedSeconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - periodStart).count();
+    if (elapsedSeconds >= 1.0) {
+        std::cout << scene.Size() << " instances: " << frames / elapsedSeconds << " fps, "
+                  << totalCpuMilliseconds / frames << " ms CPU per frame" << std::endl;
+
+        periodStart = std::chrono::steady_clock::now();
+        frames = 0;
+        totalCpuMilliseconds = 0.0;
+    }
+}
+
+/**
+ * Prints how many state changes and uniform uploads went to the driver and how many the state
+ * cache dropped as redundant.
+ */
+void ReportStateCache()
+{
+    const GLStateCache::Statistics& statistics = GLStateCache::GetStatistics();
+    unsigned int issued = 0, skipped = 0;
+    std::cout << "GL state cache:";
+    for (int kind = 0; kind < GLStateCache::STATE_KIND_COUNT; ++kind) {
+        issued += statistics.issued[kind];
+        skipped += statistics.skipped[kind];
+        std::cout << " " << GLStateCache::StateKindName(static_cast<GLStateCache::StateKind>(kind)) << " "
+                  << statistics.skipped[kind] << "/" << statistics.issued[kind] + statistics.skipped[kind];
+    }
+    std::cout << " skipped; " << skipped << " of " << issued + skipped << " calls in total" << std::endl;
 }
 
 /**
@@ -351,6 +2043,8 @@ void GlfwFramebufferResizeCallback(GLFWwindow* window, int width, int height)
 {
     std::cout << "Resize" << std::endl;
     glViewport(0, 0, width, height);
+    framebufferWidth = width;
+    framebufferHeight = height;
 }
 
 void GlfwWindowRefreshCallback(GLFWwindow* window)
@@ -371,6 +2065,17 @@ void GlfwKeyCallback(GLFWwindow* window, int key, int scancode, int action, int
     else if (key == GLFW_KEY_X && action == GLFW_PRESS) {
         camera.ResetToPosition(glm::vec3(0.0f, 0.0f, 6.0f));
     }
+    else if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+        deferredShading = !deferredShading;
+        std::cout << (deferredShading ? "Deferred" : "Forward") << " shading" << std::endl;
+    }
+    else if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+        specularEnabled = !specularEnabled;
+        std::cout << "Specular highlights " << (specularEnabled ? "on" : "off") << std::endl;
+    }
+    else if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        pauseToggled = !pauseToggled;   // the workers may be animating the scene right now
+    }
 }
 
 /**
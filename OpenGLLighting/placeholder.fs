@@ -0,0 +1,28 @@
+#version 330 core
+
+// Draws the objects while the lighting programs are still being built: the object's color, darker
+// where the surface turns away from the camera, with no lights to look up. Runs after cube.vs.
+out vec4 FragColor;
+
+in vec3 Normal;
+in vec3 FragPos;
+
+// Per-frame camera data, shared by every program (see UniformBlocks.h).
+layout (std140) uniform FrameBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
+// Per-draw data.
+layout (std140) uniform ObjectBlock
+{
+    vec4 objectColor;
+};
+
+void main()
+{
+    float facing = max(dot(normalize(Normal), normalize(viewPos.xyz - FragPos)), 0.0);
+    FragColor = vec4(objectColor.rgb * (0.3 + 0.7 * facing), 1.0);
+}
@@ -0,0 +1,10 @@
+#version 330 core
+
+// Caster vertices for the point light's shadow pass; shadow_point.gs projects them to each face.
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in mat4 aModel;          // per instance; occupies locations 2-5
+
+void main()
+{
+    gl_Position = aModel * vec4(aPos, 1.0);
+}
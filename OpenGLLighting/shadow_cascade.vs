@@ -0,0 +1,17 @@
+#version 330 core
+
+// Caster vertices for one cascade of the sun's shadow map.
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in mat4 aModel;          // per instance; occupies locations 2-5
+
+// The cascade's view-projection is the first matrix (see ShadowMaps.cpp).
+layout (std140) uniform ShadowPassBlock
+{
+    mat4 matrices[6];
+    vec4 lightPosition;
+};
+
+void main()
+{
+    gl_Position = matrices[0] * aModel * vec4(aPos, 1.0);
+}
@@ -0,0 +1,16 @@
+#version 330 core
+
+in vec3 WorldPos;
+
+layout (std140) uniform ShadowPassBlock
+{
+    mat4 matrices[6];
+    vec4 lightPosition;     // position and radius
+};
+
+void main()
+{
+    // Store the distance to the light over its radius rather than the face's projected depth, so
+    // the lighting shaders can compare it without knowing which face they sampled.
+    gl_FragDepth = length(WorldPos - lightPosition.xyz) / lightPosition.w;
+}
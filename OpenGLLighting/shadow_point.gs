@@ -0,0 +1,27 @@
+#version 330 core
+
+// Renders each caster triangle into all six faces of the point light's cube map in one pass.
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 18) out;
+
+// Face view-projections in GL_TEXTURE_CUBE_MAP_POSITIVE_X order (see ShadowMaps.cpp).
+layout (std140) uniform ShadowPassBlock
+{
+    mat4 matrices[6];
+    vec4 lightPosition;     // position and radius
+};
+
+out vec3 WorldPos;
+
+void main()
+{
+    for (int face = 0; face < 6; ++face) {
+        gl_Layer = face;
+        for (int i = 0; i < 3; ++i) {
+            WorldPos = gl_in[i].gl_Position.xyz;
+            gl_Position = matrices[face] * gl_in[i].gl_Position;
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}